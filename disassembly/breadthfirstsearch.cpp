@@ -0,0 +1,35 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "disassembly/breadthfirstsearch.hpp"
+
+BreadthFirstSearch& BreadthFirstSearch::ForThisThread() {
+  static thread_local BreadthFirstSearch search;
+  return search;
+}
+
+void BreadthFirstSearch::Prepare(uint32_t size) {
+  if (nodes_.size() < size) {
+    nodes_.resize(size, NodeState{ 0, 0, 0 });
+    queue_.resize(size);
+  }
+  found_ = 0;
+  if (++epoch_ == 0) {
+    // After 2^32 searches, stale states could match again.
+    for (NodeState& state : nodes_) {
+      state.epoch = 0;
+    }
+    epoch_ = 1;
+  }
+}
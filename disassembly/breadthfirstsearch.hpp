@@ -0,0 +1,142 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BREADTHFIRSTSEARCH_HPP
+#define BREADTHFIRSTSEARCH_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "disassembly/compactflowgraph.hpp"
+#include "disassembly/flowgraph.hpp"
+
+// Breadth-first search over graphs with dense node indices, i.e. anything
+// with GetSize(), GetOutEdges(node) and GetInEdges(node) like CompactFlowgraph
+// and GraphletView. Neighbors with indices >= GetSize() are skipped, so views
+// of the first few nodes of a larger graph work as expected.
+//
+// The state of each node carries the number of the search that wrote it, so
+// starting a new search does not have to clear anything, and the queue holds
+// every node at most once, so it is a flat array that doubles as the list of
+// nodes found. Once the arrays have grown to the largest graph searched, no
+// search allocates. Results stay valid until the next search on the same
+// object.
+class BreadthFirstSearch {
+public:
+  static constexpr uint32_t kUnreached = 0xFFFFFFFF;
+
+  BreadthFirstSearch() : epoch_(0), found_(0) {}
+
+  // An instance for the calling thread, for code that does not keep its own.
+  // Callers must not hold on to its results across calls into code that might
+  // search, too.
+  static BreadthFirstSearch& ForThisThread();
+
+  // Finds all nodes within 'max_distance' edges of 'start', following edges
+  // in 'direction' (direction_down follows successors, direction_up
+  // predecessors, direction_bidirectional both, predecessors first). Returns
+  // false, with only part of the nodes found, as soon as a neighbor makes
+  // more than 'max_nodes' of them.
+  template <typename Graph>
+  bool Search(const Graph& graph, uint32_t start, Direction direction,
+    uint32_t max_distance = kUnreached, uint32_t max_nodes = kUnreached);
+
+  // The nodes found, in breadth-first order (and hence by distance).
+  NodeRange GetFound() const {
+    return NodeRange(queue_.data(), queue_.data() + found_);
+  }
+  bool WasFound(uint32_t node) const { return nodes_[node].epoch == epoch_; }
+  // The distance from the start node, or kUnreached.
+  uint32_t GetDistance(uint32_t node) const {
+    return WasFound(node) ? nodes_[node].distance : kUnreached;
+  }
+  // The index of the node in GetFound(), or kUnreached.
+  uint32_t GetPosition(uint32_t node) const {
+    return WasFound(node) ? nodes_[node].position : kUnreached;
+  }
+private:
+  struct NodeState {
+    uint32_t epoch;
+    uint32_t distance;
+    uint32_t position;
+  };
+
+  // Makes room for 'size' nodes and invalidates the previous results.
+  void Prepare(uint32_t size);
+
+  std::vector<NodeState> nodes_;
+  std::vector<uint32_t> queue_;
+  uint32_t epoch_;
+  uint32_t found_;
+};
+
+template <typename Graph>
+bool BreadthFirstSearch::Search(const Graph& graph, uint32_t start,
+  Direction direction, uint32_t max_distance, uint32_t max_nodes) {
+  uint32_t size = graph.GetSize();
+  Prepare(size);
+  // Work on local copies, as the stores into the queue could otherwise alias
+  // the members and force reloads after every node.
+  NodeState* nodes = nodes_.data();
+  uint32_t* queue = queue_.data();
+  uint32_t epoch = epoch_;
+  uint32_t found = 0;
+  auto visit = [&](uint32_t node, uint32_t distance) {
+    NodeState& state = nodes[node];
+    if (state.epoch != epoch) {
+      state = NodeState{ epoch, distance, found };
+      queue[found++] = node;
+    }
+  };
+
+  // Like Flowgraph::GetSubgraph, only neighbors count against 'max_nodes'.
+  visit(start, 0);
+  bool backward = (direction != direction_down);
+  bool forward = (direction != direction_up);
+  bool complete = true;
+  for (uint32_t head = 0; (head < found) && complete; ++head) {
+    uint32_t current = queue[head];
+    uint32_t distance = nodes[current].distance;
+    if (distance >= max_distance) {
+      // Breadth-first order: All remaining nodes are this far away, too.
+      break;
+    }
+    if (backward) {
+      for (uint32_t source : graph.GetInEdges(current)) {
+        if (source < size) {
+          visit(source, distance + 1);
+          if (found > max_nodes) {
+            complete = false;
+            break;
+          }
+        }
+      }
+    }
+    if (forward && complete) {
+      for (uint32_t target : graph.GetOutEdges(current)) {
+        if (target < size) {
+          visit(target, distance + 1);
+          if (found > max_nodes) {
+            complete = false;
+            break;
+          }
+        }
+      }
+    }
+  }
+  found_ = found;
+  return complete;
+}
+
+#endif // BREADTHFIRSTSEARCH_HPP
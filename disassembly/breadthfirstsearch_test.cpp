@@ -0,0 +1,128 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "disassembly/breadthfirstsearch.hpp"
+#include "disassembly/compactflowgraph.hpp"
+
+namespace {
+
+// 0x10 -> 0x20 -> 0x30 -> 0x40, 0x50 -> 0x30, and an isolated node 0x60.
+Flowgraph MakeGraph() {
+  Flowgraph graph;
+  graph.AddEdge(0x10, 0x20);
+  graph.AddEdge(0x20, 0x30);
+  graph.AddEdge(0x30, 0x40);
+  graph.AddEdge(0x50, 0x30);
+  graph.AddNode(0x60);
+  return graph;
+}
+
+std::vector<uint32_t> GetDistances(const BreadthFirstSearch& search,
+  uint32_t size) {
+  std::vector<uint32_t> distances;
+  for (uint32_t node = 0; node < size; ++node) {
+    distances.push_back(search.GetDistance(node));
+  }
+  return distances;
+}
+
+constexpr uint32_t kUnreached = BreadthFirstSearch::kUnreached;
+
+} // namespace
+
+TEST(breadthfirstsearch, directions) {
+  CompactFlowgraph graph(MakeGraph());
+  BreadthFirstSearch search;
+  EXPECT_TRUE(search.Search(graph, 1, direction_down));
+  EXPECT_EQ(GetDistances(search, 6), std::vector<uint32_t>({ kUnreached, 0, 1,
+    2, kUnreached, kUnreached }));
+  EXPECT_TRUE(search.Search(graph, 2, direction_up));
+  EXPECT_EQ(GetDistances(search, 6), std::vector<uint32_t>({ 2, 1, 0,
+    kUnreached, 1, kUnreached }));
+  EXPECT_TRUE(search.Search(graph, 0, direction_bidirectional));
+  EXPECT_EQ(GetDistances(search, 6), std::vector<uint32_t>({ 0, 1, 2, 3, 3,
+    kUnreached }));
+
+  // Found in breadth-first order, predecessors before successors.
+  std::vector<uint32_t> found(search.GetFound().begin(),
+    search.GetFound().end());
+  EXPECT_EQ(found, std::vector<uint32_t>({ 0, 1, 2, 4, 3 }));
+  for (uint32_t position = 0; position < found.size(); ++position) {
+    EXPECT_EQ(search.GetPosition(found[position]), position);
+  }
+  EXPECT_FALSE(search.WasFound(5));
+  EXPECT_EQ(search.GetPosition(5), kUnreached);
+}
+
+TEST(breadthfirstsearch, limits) {
+  CompactFlowgraph graph(MakeGraph());
+  BreadthFirstSearch search;
+  EXPECT_TRUE(search.Search(graph, 0, direction_bidirectional, 2));
+  EXPECT_EQ(search.GetFound().size(), 3);
+  EXPECT_FALSE(search.WasFound(3));
+
+  EXPECT_TRUE(search.Search(graph, 0, direction_bidirectional,
+    kUnreached, 5));
+  EXPECT_FALSE(search.Search(graph, 0, direction_bidirectional,
+    kUnreached, 4));
+  // The start node alone never exceeds the limit.
+  EXPECT_TRUE(search.Search(graph, 5, direction_bidirectional, kUnreached, 0));
+  EXPECT_FALSE(search.Search(graph, 0, direction_bidirectional, kUnreached,
+    0));
+}
+
+TEST(breadthfirstsearch, reuse) {
+  CompactFlowgraph graph(MakeGraph());
+  BreadthFirstSearch search;
+  EXPECT_TRUE(search.Search(graph, 0, direction_bidirectional));
+  // Nothing of the previous, larger search shows.
+  Flowgraph small;
+  small.AddEdge(0x10, 0x20);
+  small.AddNode(0x30);
+  EXPECT_TRUE(search.Search(CompactFlowgraph(small), 1,
+    direction_bidirectional));
+  EXPECT_EQ(GetDistances(search, 3), std::vector<uint32_t>({ 1, 0,
+    kUnreached }));
+  EXPECT_EQ(search.GetFound().size(), 2);
+}
+
+TEST(breadthfirstsearch, views) {
+  // Three nodes 0 -> 1 -> 2, viewed as a graphlet of the first two: The edge
+  // to node 2 leads outside the view.
+  std::vector<address> addresses = { 0x10, 0x20, 0x30 };
+  std::vector<uint32_t> out_offsets = { 0, 1, 2, 2 };
+  std::vector<uint32_t> out_targets = { 1, 2 };
+  std::vector<uint32_t> in_offsets = { 0, 0, 1, 2 };
+  std::vector<uint32_t> in_sources = { 0, 1 };
+  GraphletView view(addresses.data(), out_offsets.data(), out_targets.data(),
+    in_offsets.data(), in_sources.data(), 2, 0);
+  BreadthFirstSearch search;
+  EXPECT_TRUE(search.Search(view, 0, direction_down));
+  EXPECT_EQ(GetDistances(search, 2), std::vector<uint32_t>({ 0, 1 }));
+  EXPECT_EQ(search.GetFound().size(), 2);
+}
+
+TEST(breadthfirstsearch, flowgraph_topological_order) {
+  Flowgraph graph = MakeGraph();
+  std::vector<int32_t> order;
+  graph.GetTopologicalOrder(0x20, direction_down, &order);
+  EXPECT_EQ(order, std::vector<int32_t>({ -1, 0, 1, 2, -1, -1 }));
+  graph.GetTopologicalOrder(0x30, direction_up, &order);
+  EXPECT_EQ(order, std::vector<int32_t>({ 2, 1, 0, -1, 1, -1 }));
+  graph.GetTopologicalOrder(0x70, direction_bidirectional, &order);
+  EXPECT_EQ(order, std::vector<int32_t>(6, -1));
+}
@@ -0,0 +1,141 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "disassembly/breadthfirstsearch.hpp"
+#include "disassembly/compactflowgraph.hpp"
+#include "disassembly/graphletsignature.hpp"
+
+CompactFlowgraph::CompactFlowgraph() {
+  Clear();
+}
+
+CompactFlowgraph::CompactFlowgraph(const Flowgraph& graph) {
+  Clear();
+  graph.GetNodes(&addresses_);
+  for (address source : addresses_) {
+    for (address target : *graph.GetOutEdges(source)) {
+      out_targets_.push_back(GetNode(target));
+    }
+    out_offsets_.push_back(out_targets_.size());
+  }
+  BuildInEdges();
+}
+
+void CompactFlowgraph::Clear() {
+  addresses_.clear();
+  out_offsets_.assign(1, 0);
+  out_targets_.clear();
+  in_offsets_.assign(1, 0);
+  in_sources_.clear();
+}
+
+uint32_t CompactFlowgraph::GetNode(address node_address) const {
+  auto iter = std::lower_bound(addresses_.begin(), addresses_.end(),
+    node_address);
+  if ((iter == addresses_.end()) || (*iter != node_address)) {
+    return kInvalidNode;
+  }
+  return iter - addresses_.begin();
+}
+
+// A counting sort of the edges by target. Counts are stored two slots ahead,
+// so after the prefix sum slot t + 1 holds the start of the predecessors of
+// node t and serves as the insertion cursor for them; once all edges are
+// placed, it holds the start of node t + 1, which is the final layout.
+void CompactFlowgraph::BuildInEdges() {
+  in_offsets_.assign(GetSize() + 2, 0);
+  for (uint32_t target : out_targets_) {
+    ++in_offsets_[target + 2];
+  }
+  for (uint32_t node = 2; node < in_offsets_.size(); ++node) {
+    in_offsets_[node] += in_offsets_[node - 1];
+  }
+  in_sources_.resize(out_targets_.size());
+  for (uint32_t source = 0; source < GetSize(); ++source) {
+    for (uint32_t target : GetOutEdges(source)) {
+      in_sources_[in_offsets_[target + 1]++] = source;
+    }
+  }
+  in_offsets_.pop_back();
+}
+
+bool CompactFlowgraph::GetSubgraph(uint32_t node, uint32_t distance,
+  uint32_t max_size, CompactFlowgraph* subgraph) const {
+  BreadthFirstSearch& search = BreadthFirstSearch::ForThisThread();
+  if (!search.Search(*this, node, direction_bidirectional, distance,
+    max_size)) {
+    return false;
+  }
+  static thread_local std::vector<uint32_t> found;
+  found.assign(search.GetFound().begin(), search.GetFound().end());
+
+  // Node indices ascend with addresses, so sorting the parent indices numbers
+  // the subgraph nodes in address order, too.
+  std::sort(found.begin(), found.end());
+  subgraph->Clear();
+  for (uint32_t parent_node : found) {
+    subgraph->addresses_.push_back(addresses_[parent_node]);
+    for (uint32_t target : GetOutEdges(parent_node)) {
+      if (search.WasFound(target)) {
+        subgraph->out_targets_.push_back(std::lower_bound(found.begin(),
+          found.end(), target) - found.begin());
+      }
+    }
+    subgraph->out_offsets_.push_back(subgraph->out_targets_.size());
+  }
+  subgraph->BuildInEdges();
+  return true;
+}
+
+uint64_t GraphletView::CalculateHash(uint64_t k0, uint64_t k1, uint64_t k2)
+  const {
+  static thread_local GraphletSignature signature;
+  signature.Reset(*this);
+  return signature.CalculateHash(k0, k1, k2);
+}
+
+void GraphletView::GetEncoding(std::vector<uint32_t>* encoding) const {
+  encoding->clear();
+  encoding->push_back(size_);
+  encoding->push_back(start_);
+  for (uint32_t source = 0; source < size_; ++source) {
+    uint32_t count_index = encoding->size();
+    encoding->push_back(0);
+    for (uint32_t target : GetOutEdges(source)) {
+      if (target < size_) {
+        encoding->push_back(target);
+        ++(*encoding)[count_index];
+      }
+    }
+  }
+}
+
+Flowgraph* GraphletView::ToFlowgraph() const {
+  Flowgraph* graph = new Flowgraph();
+  for (uint32_t node = 0; node < size_; ++node) {
+    graph->AddNode(addresses_[node]);
+  }
+  // Flowgraph sorts the nodes by address itself; the successors of each node
+  // keep their order.
+  for (uint32_t source = 0; source < size_; ++source) {
+    for (uint32_t target : GetOutEdges(source)) {
+      if (target < size_) {
+        graph->AddEdge(addresses_[source], addresses_[target]);
+      }
+    }
+  }
+  return graph;
+}
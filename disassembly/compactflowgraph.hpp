@@ -0,0 +1,177 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMPACTFLOWGRAPH_HPP
+#define COMPACTFLOWGRAPH_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "disassembly/flowgraph.hpp"
+
+// A range of node indices, as returned for the neighbors of a node.
+class NodeRange {
+public:
+  NodeRange(const uint32_t* begin, const uint32_t* end) : begin_(begin),
+    end_(end) {}
+  const uint32_t* begin() const { return begin_; }
+  const uint32_t* end() const { return end_; }
+  uint32_t size() const { return end_ - begin_; }
+private:
+  const uint32_t* begin_;
+  const uint32_t* end_;
+};
+
+// A graphlet as a view into compressed-sparse-row arrays owned by somebody
+// else (a CompactFlowgraph or a GraphletEnumerator). The graphlet consists of
+// the nodes 0..GetSize()-1 and the edges between them; edges that lead
+// outside this range are ignored. With the nodes in breadth-first order around
+// the start node, views of the first few nodes are therefore the graphlets of
+// smaller radius, all sharing the same arrays. A view is only valid as long
+// as the arrays it points to are.
+class GraphletView {
+public:
+  GraphletView() : addresses_(nullptr), out_offsets_(nullptr),
+    out_targets_(nullptr), in_offsets_(nullptr), in_sources_(nullptr),
+    size_(0), start_(0) {}
+  GraphletView(const address* addresses, const uint32_t* out_offsets,
+    const uint32_t* out_targets, const uint32_t* in_offsets,
+    const uint32_t* in_sources, uint32_t size, uint32_t start) :
+    addresses_(addresses), out_offsets_(out_offsets),
+    out_targets_(out_targets), in_offsets_(in_offsets),
+    in_sources_(in_sources), size_(size), start_(start) {}
+
+  uint32_t GetSize() const { return size_; }
+  uint32_t GetStart() const { return start_; }
+  address GetAddress(uint32_t node) const { return addresses_[node]; }
+  address GetStartAddress() const { return addresses_[start_]; }
+  // Whether this view consists of the first GetSize() nodes of 'other' and
+  // shares its storage, like the views of a GraphletEnumerator of growing
+  // radius around the same node.
+  bool IsPrefixOf(const GraphletView& other) const {
+    return (addresses_ == other.addresses_) &&
+      (out_offsets_ == other.out_offsets_) &&
+      (out_targets_ == other.out_targets_) &&
+      (in_offsets_ == other.in_offsets_) &&
+      (in_sources_ == other.in_sources_) && (start_ == other.start_) &&
+      (size_ <= other.size_);
+  }
+
+  // Successors and predecessors of a node. These include nodes outside the
+  // view (with indices >= GetSize()), which callers have to skip.
+  NodeRange GetOutEdges(uint32_t node) const {
+    return NodeRange(out_targets_ + out_offsets_[node],
+      out_targets_ + out_offsets_[node + 1]);
+  }
+  NodeRange GetInEdges(uint32_t node) const {
+    return NodeRange(in_sources_ + in_offsets_[node],
+      in_sources_ + in_offsets_[node + 1]);
+  }
+
+  // Identical to Flowgraph::CalculateHash of the graphlet as a Flowgraph,
+  // starting at the start node. To calculate several hashes of the same
+  // graphlet, use a GraphletSignature.
+  uint64_t CalculateHash(uint64_t k0 = 0xc3a5c85c97cb3127ULL,
+    uint64_t k1 = 0xb492b66fbe98f273ULL,
+    uint64_t k2 = 0x9ae16a3b2f90404fULL) const;
+
+  // Replaces the contents of 'encoding' with the size of the graphlet, its
+  // start node and the successors of each node in edge order. This describes
+  // the graphlet as numbered in the view completely, so views with the same
+  // encoding have the same hashes. The views of a GraphletEnumerator number
+  // the nodes in breadth-first order from the start node, so the same small
+  // graphlet usually has the same encoding wherever it occurs.
+  void GetEncoding(std::vector<uint32_t>* encoding) const;
+
+  // Builds the graphlet as a Flowgraph, for diagnostics and for code that
+  // has not been converted to views.
+  Flowgraph* ToFlowgraph() const;
+private:
+  const address* addresses_;
+  const uint32_t* out_offsets_;
+  const uint32_t* out_targets_;
+  const uint32_t* in_offsets_;
+  const uint32_t* in_sources_;
+  uint32_t size_;
+  uint32_t start_;
+};
+
+// An immutable flowgraph in compressed sparse row form, built once per
+// function from a Flowgraph. Nodes are numbered 0..GetSize()-1 in ascending
+// address order, and the successors (or predecessors) of all nodes are stored
+// back to back in a single array, so walking the graph touches a few flat
+// arrays instead of chasing tree nodes of three std::maps.
+//
+// Successors are kept in the order in which the edges were added to the
+// Flowgraph, duplicates included, so that GetSubgraph and CalculateHash
+// produce exactly the same graphlets and hashes as their Flowgraph
+// counterparts.
+class CompactFlowgraph {
+public:
+  static constexpr uint32_t kInvalidNode = 0xFFFFFFFF;
+
+  CompactFlowgraph();
+  explicit CompactFlowgraph(const Flowgraph& graph);
+
+  uint32_t GetSize() const { return addresses_.size(); }
+  uint64_t GetNumberOfEdges() const { return out_targets_.size(); }
+  address GetAddress(uint32_t node) const { return addresses_[node]; }
+  // Returns kInvalidNode if there is no node at the address.
+  uint32_t GetNode(address node_address) const;
+
+  NodeRange GetOutEdges(uint32_t node) const {
+    return NodeRange(out_targets_.data() + out_offsets_[node],
+      out_targets_.data() + out_offsets_[node + 1]);
+  }
+  NodeRange GetInEdges(uint32_t node) const {
+    return NodeRange(in_sources_.data() + in_offsets_[node],
+      in_sources_.data() + in_offsets_[node + 1]);
+  }
+
+  // Replaces the contents of 'subgraph' with all nodes within 'distance'
+  // edges of 'node' (in either direction) and the edges between them. Returns
+  // false, leaving 'subgraph' unspecified, if there are more than 'max_size'
+  // such nodes. 'subgraph' keeps its memory, so reusing it for many graphlets
+  // avoids allocations.
+  bool GetSubgraph(uint32_t node, uint32_t distance, uint32_t max_size,
+    CompactFlowgraph* subgraph) const;
+
+  // The whole graph as a graphlet around 'node'.
+  GraphletView GetView(uint32_t node) const {
+    return GraphletView(addresses_.data(), out_offsets_.data(),
+      out_targets_.data(), in_offsets_.data(), in_sources_.data(), GetSize(),
+      node);
+  }
+
+  // Identical to Flowgraph::CalculateHash for the same graph and start node.
+  uint64_t CalculateHash(uint32_t node, uint64_t k0 = 0xc3a5c85c97cb3127ULL,
+    uint64_t k1 = 0xb492b66fbe98f273ULL,
+    uint64_t k2 = 0x9ae16a3b2f90404fULL) const {
+    return GetView(node).CalculateHash(k0, k1, k2);
+  }
+private:
+  void Clear();
+  // Fills in_offsets_ and in_sources_ from the out-edges.
+  void BuildInEdges();
+
+  std::vector<address> addresses_;
+  // The successors of node i are out_targets_[out_offsets_[i]] up to (but not
+  // including) out_targets_[out_offsets_[i + 1]]; likewise for predecessors.
+  std::vector<uint32_t> out_offsets_;
+  std::vector<uint32_t> out_targets_;
+  std::vector<uint32_t> in_offsets_;
+  std::vector<uint32_t> in_sources_;
+};
+
+#endif // COMPACTFLOWGRAPH_HPP
@@ -0,0 +1,274 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <tuple>
+
+#include "gtest/gtest.h"
+#include "disassembly/compactflowgraph.hpp"
+#include "disassembly/flowgraphutil.hpp"
+#include "disassembly/flowgraphwithinstructions.hpp"
+#include "disassembly/graphletenumerator.hpp"
+
+namespace {
+
+// The map-based implementation of Flowgraph::CalculateHash from before it
+// used GraphletSignature, as the reference the hashes must not deviate from.
+void LegacyTopologicalOrder(std::map<address, std::vector<address>>* edges,
+  address startnode, std::map<address, int32_t>* order) {
+  std::queue<std::pair<address, uint32_t>> worklist;
+
+  worklist.push(std::make_pair(startnode, 0));
+  (*order)[startnode] = 0;
+
+  address current_node;
+  uint32_t current_order;
+  while (!worklist.empty()) {
+    std::tie(current_node, current_order) = worklist.front();
+    worklist.pop();
+    std::vector<address>& targets = (*edges)[current_node];
+    for (const address& target : targets) {
+      if (order->find(target) != order->end()) {
+        uint32_t target_order = (*order)[target];
+        if (target_order <= current_order + 1) {
+          continue;
+        }
+      }
+      worklist.push(std::make_pair(target, current_order + 1));
+      (*order)[target] = current_order + 1;
+    }
+  }
+  for (const auto& entry : (*edges)) {
+    if (order->find(entry.first) == order->end()) {
+      (*order)[entry.first] = -1;
+    }
+  }
+}
+
+uint64_t LegacyCalculateHash(const Flowgraph& graph, address startnode,
+  uint64_t k0 = 0xc3a5c85c97cb3127ULL, uint64_t k1 = 0xb492b66fbe98f273ULL,
+  uint64_t k2 = 0x9ae16a3b2f90404fULL) {
+  // The edge maps as Flowgraph::AddEdge fills them.
+  std::map<address, std::vector<address>> out_edges, in_edges,
+    bidirectional_edges;
+  std::vector<address> nodes;
+  graph.GetNodes(&nodes);
+  for (address source : nodes) {
+    out_edges[source];
+    for (address target : *graph.GetOutEdges(source)) {
+      out_edges[source].push_back(target);
+      in_edges[target].push_back(source);
+      bidirectional_edges[source].push_back(target);
+      bidirectional_edges[target].push_back(source);
+    }
+  }
+
+  std::map<address, int32_t> order_forward, order_backward, order_both;
+  LegacyTopologicalOrder(&out_edges, startnode, &order_forward);
+  LegacyTopologicalOrder(&in_edges, startnode, &order_backward);
+  LegacyTopologicalOrder(&bidirectional_edges, startnode, &order_both);
+
+  std::map<address, uint32_t> indegrees, outdegrees;
+  for (const auto& element : out_edges) {
+    outdegrees[element.first] = element.second.size();
+    for (const address target : element.second) {
+      indegrees[target]++;
+    }
+  }
+
+  uint64_t hash_result = 0x0BADDEED600DDEEDL;
+  for (const auto& element : out_edges) {
+    address source = element.first;
+    uint64_t per_edge_hash = 0x600DDEED0BADDEEDL;
+    for (const address target : element.second) {
+      for (uint64_t value : {
+        k0 * order_forward[source], k1 * order_backward[source],
+        k2 * order_both[source], k0 * indegrees[source],
+        k1 * outdegrees[source], k2 * order_forward[target],
+        k0 * order_backward[target], k1 * order_both[target],
+        k2 * indegrees[target], k0 * outdegrees[target] }) {
+        per_edge_hash += value;
+        per_edge_hash = rotl64(per_edge_hash, 7);
+      }
+    }
+    hash_result += per_edge_hash;
+  }
+  return hash_result;
+}
+
+// Checks that every graphlet the CompactFlowgraph extracts has the same nodes,
+// edges and hashes as the one extracted by the Flowgraph, and that both hash
+// like the legacy implementation.
+void ExpectSameGraphlets(const Flowgraph& original, uint32_t max_size) {
+  CompactFlowgraph compact(original);
+  const Flowgraph* graph = &original;
+  std::vector<address> nodes;
+  original.GetNodes(&nodes);
+  ASSERT_EQ(compact.GetSize(), nodes.size());
+  CompactFlowgraph compact_subgraph;
+  for (address node : nodes) {
+    uint32_t compact_node = compact.GetNode(node);
+    ASSERT_EQ(compact.GetAddress(compact_node), node);
+    EXPECT_EQ(compact.CalculateHash(compact_node),
+      LegacyCalculateHash(original, node));
+    EXPECT_EQ(original.CalculateHash(node), LegacyCalculateHash(original,
+      node));
+    for (uint32_t distance = 1; distance <= 3; ++distance) {
+      std::unique_ptr<Flowgraph> subgraph(graph->GetSubgraph(node, distance,
+        max_size));
+      bool found = compact.GetSubgraph(compact_node, distance, max_size,
+        &compact_subgraph);
+      ASSERT_EQ(found, subgraph != nullptr);
+      if (!found) {
+        continue;
+      }
+      std::vector<address> subgraph_nodes;
+      subgraph->GetNodes(&subgraph_nodes);
+      ASSERT_EQ(compact_subgraph.GetSize(), subgraph_nodes.size());
+      for (uint32_t index = 0; index < subgraph_nodes.size(); ++index) {
+        EXPECT_EQ(compact_subgraph.GetAddress(index), subgraph_nodes[index]);
+        std::vector<address> targets;
+        for (uint32_t target : compact_subgraph.GetOutEdges(index)) {
+          targets.push_back(compact_subgraph.GetAddress(target));
+        }
+        EXPECT_EQ(targets, *subgraph->GetOutEdges(subgraph_nodes[index]));
+      }
+      uint32_t start = compact_subgraph.GetNode(node);
+      EXPECT_EQ(compact_subgraph.CalculateHash(start),
+        LegacyCalculateHash(*subgraph, node));
+      EXPECT_EQ(compact_subgraph.CalculateHash(start, 1, 2, 3),
+        LegacyCalculateHash(*subgraph, node, 1, 2, 3));
+      EXPECT_EQ(subgraph->CalculateHash(node, 1, 2, 3),
+        LegacyCalculateHash(*subgraph, node, 1, 2, 3));
+    }
+  }
+}
+
+} // namespace
+
+TEST(compactflowgraph, edges) {
+  Flowgraph graph;
+  graph.AddEdge(0x30, 0x10);
+  graph.AddEdge(0x10, 0x20);
+  graph.AddEdge(0x10, 0x30);
+  graph.AddEdge(0x10, 0x20);
+  graph.AddNode(0x40);
+  CompactFlowgraph compact(graph);
+  ASSERT_EQ(compact.GetSize(), 4);
+  EXPECT_EQ(compact.GetNumberOfEdges(), 4);
+  EXPECT_EQ(compact.GetNode(0x10), 0);
+  EXPECT_EQ(compact.GetNode(0x40), 3);
+  EXPECT_EQ(compact.GetNode(0x15), CompactFlowgraph::kInvalidNode);
+
+  // Successors keep their order and duplicates.
+  std::vector<uint32_t> targets(compact.GetOutEdges(0).begin(),
+    compact.GetOutEdges(0).end());
+  EXPECT_EQ(targets, std::vector<uint32_t>({ 1, 2, 1 }));
+  EXPECT_EQ(compact.GetInEdges(1).size(), 2);
+  EXPECT_EQ(compact.GetInEdges(0).size(), 1);
+  EXPECT_EQ(compact.GetOutEdges(3).size(), 0);
+  EXPECT_EQ(compact.GetInEdges(3).size(), 0);
+}
+
+TEST(compactflowgraph, matches_flowgraph_on_vp9) {
+  for (const char* filename : {
+    "../testdata/vp9_set_target_rate.clang.nothumb.json",
+    "../testdata/vp9_set_target_rate.clang.with.thumb.json" }) {
+    FlowgraphWithInstructions graph;
+    ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(filename, &graph));
+    ExpectSameGraphlets(graph, 30);
+    ExpectSameGraphlets(graph, 5);
+    ExpectSameGraphlets(graph, 1000);
+  }
+}
+
+TEST(compactflowgraph, matches_flowgraph_on_random_graphs) {
+  std::mt19937_64 random(1);
+  for (uint32_t round = 0; round < 20; ++round) {
+    // Sparse graphs with self-loops, duplicate edges and isolated nodes, which
+    // are the corner cases of CalculateHash.
+    Flowgraph graph;
+    uint32_t size = 1 + random() % 40;
+    for (uint32_t node = 0; node < size; ++node) {
+      graph.AddNode(0x1000 + 0x10 * node);
+    }
+    for (uint32_t edge = 0; edge < size + random() % size; ++edge) {
+      graph.AddEdge(0x1000 + 0x10 * (random() % size),
+        0x1000 + 0x10 * (random() % size));
+    }
+    ExpectSameGraphlets(graph, 30);
+    ExpectSameGraphlets(graph, 100);
+  }
+}
+
+TEST(compactflowgraph, flowgraph_lookups_have_no_side_effects) {
+  Flowgraph graph;
+  graph.AddEdge(0x10, 0x20);
+  graph.AddEdge(0x20, 0x30);
+  graph.AddEdge(0x40, 0x30);
+  graph.AddNode(0x50);
+  std::vector<uint64_t> hashes;
+  for (address node : { 0x10, 0x20, 0x30, 0x40, 0x50 }) {
+    hashes.push_back(graph.CalculateHash(node));
+  }
+  for (address node : { 0x10, 0x20, 0x30, 0x40, 0x50 }) {
+    std::unique_ptr<Flowgraph> subgraph(graph.GetSubgraph(node, 2, 30));
+    ASSERT_NE(subgraph, nullptr);
+  }
+  uint32_t index = 0;
+  for (address node : { 0x10, 0x20, 0x30, 0x40, 0x50 }) {
+    EXPECT_EQ(graph.CalculateHash(node), hashes[index++]);
+    EXPECT_EQ(graph.CalculateHash(node), LegacyCalculateHash(graph, node));
+  }
+}
+
+// The same graphlets in different places of a function have the same encoding,
+// and graphlets with the same encoding have the same hashes.
+TEST(compactflowgraph, graphlet_encodings) {
+  Flowgraph graph;
+  for (address base : { 0x100, 0x200 }) {
+    graph.AddEdge(base, base + 0x10);
+    graph.AddEdge(base, base + 0x20);
+    graph.AddEdge(base + 0x10, base + 0x30);
+    graph.AddEdge(base + 0x20, base + 0x30);
+  }
+  graph.AddEdge(0x230, 0x300);
+  GraphletEnumerator graphlets(CompactFlowgraph(graph), 3, 30);
+  std::map<address, GraphletView> views;
+  address node;
+  GraphletView graphlet;
+  while (graphlets.HasMore()) {
+    if (graphlets.GetNext(&graphlet, &node) && (views.count(node) == 0)) {
+      views[node] = graphlet;
+    }
+  }
+  std::vector<uint32_t> encoding, other_encoding;
+  views[0x100].GetEncoding(&encoding);
+  views[0x200].GetEncoding(&other_encoding);
+  EXPECT_EQ(encoding, std::vector<uint32_t>({ 3, 0, 2, 1, 2, 0, 0 }));
+  EXPECT_EQ(encoding, other_encoding);
+  views[0x230].GetEncoding(&other_encoding);
+  EXPECT_NE(encoding, other_encoding);
+
+  std::map<std::vector<uint32_t>, uint64_t> hashes;
+  for (const auto& entry : views) {
+    entry.second.GetEncoding(&encoding);
+    uint64_t hash = entry.second.CalculateHash(1, 2, 3);
+    auto inserted = hashes.emplace(encoding, hash);
+    EXPECT_EQ(inserted.first->second, hash);
+  }
+}
@@ -28,7 +28,8 @@
 using namespace std;
 
 Disassembly::Disassembly(const std::string& filetype,
-  const std::string& inputfile) : type_(filetype), inputfile_(inputfile) {
+  const std::string& inputfile) : type_(filetype), inputfile_(inputfile),
+  decode_immediates_(false) {
   code_object_ = nullptr;
   code_source_ = nullptr;
   if ((type_ == "ELF") || (type_ == "PE")) {
@@ -57,8 +58,10 @@ void Disassembly::LoadFromJSONStream(std::istream& jsondata) {
   for (const auto& flowgraph : incoming_data["flowgraphs"]) {
     json_functions_.emplace_back(new FlowgraphWithInstructions());
     json_functions_.back()->ParseJSON(flowgraph);
-    for (const auto& instruction : json_functions_.back()->GetInstructions()) {
-      uint64_t address = instruction.first;
+    const FlowgraphWithInstructions& function = *json_functions_.back();
+    for (uint32_t index = 0; index < function.GetNumberOfBasicBlocks();
+      ++index) {
+      uint64_t address = function.GetBasicBlock(index).GetAddress();
       blocks_to_flowgraph_[address] = json_functions_.size()-1;
     }
   }
@@ -199,7 +202,7 @@ uint64_t Disassembly::GetAddressOfFunction(uint32_t function_index) const {
     // In a rather inelegant move, the node with the lowest address is declared
     // to be the address of the function.
     // TODO(thomasdullien): Find a performant better variant of this.
-    return json_functions_[function_index]->GetInstructions().begin()->first;
+    return json_functions_[function_index]->GetBasicBlock(0).GetAddress();
   }
 }
 
@@ -264,7 +267,7 @@ bool Disassembly::ContainsSharedBasicBlocks(uint32_t index) const {
 
 InstructionGetter Disassembly::GetInstructionGetter() const {
   if (uses_dyninst_) {
-    return MakeDyninstInstructionGetter(code_object_);
+    return MakeDyninstInstructionGetter(code_object_, decode_immediates_);
   } else {
     InstructionGetter getter = [this](uint64_t address,
       std::vector<Instruction>* results) -> bool {
@@ -272,7 +275,9 @@ InstructionGetter Disassembly::GetInstructionGetter() const {
       if (entry == this->blocks_to_flowgraph_.end()) {
         return false;
       }
-      *(results) = json_functions_[entry->second]->GetInstructions().at(address);
+      BasicBlockView block;
+      json_functions_[entry->second]->GetBasicBlock(address, &block);
+      block.GetInstructions(results);
       return true;
     };
     return getter;
@@ -34,6 +34,12 @@ public:
   virtual ~Disassembly();
 
   bool Load(bool perform_parsing = true);
+  // Whether instructions disassembled with Dyninst carry the immediates of
+  // their decoded operands. Only HasherVersion::kDecodedImmediates hashes
+  // them, so collecting them is off by default.
+  void SetDecodeImmediates(bool decode_immediates) {
+    decode_immediates_ = decode_immediates;
+  }
   void DisassembleFromAddress(uint64_t address, bool recursive);
 
   // Allow users of this class to iterate through all functions in the binary.
@@ -61,6 +67,7 @@ private:
   const std::string inputfile_;
   // Dyninst-specific data members.
   bool uses_dyninst_;
+  bool decode_immediates_;
   mutable std::mutex dyninst_api_mutex_;
   std::vector<Dyninst::ParseAPI::Function*> dyninst_functions_;
   Dyninst::ParseAPI::CodeObject* code_object_;
@@ -1,6 +1,9 @@
 #include <algorithm>
 #include <regex>
 #include <string>
+#include <vector>
+
+#include "disassembly/extractimmediate.hpp"
 
 // this regex was provided courtesy of mark brand.
 constexpr char extraction_regex[] =
@@ -8,14 +11,15 @@ constexpr char extraction_regex[] =
 
 // The following code is the ugliest-imaginable solution to extracting operands,
 // but I fear I do not know any better.
-size_t ExtractImmediateFromString(const std::string& operand,
+size_t ExtractImmediateFromString(std::string_view operand,
   std::vector<uint64_t>* results) {
   static std::regex re(extraction_regex, std::regex_constants::ECMAScript);
   size_t count = 0;
-  std::sregex_iterator next(operand.begin(), operand.end(), re);
-  std::sregex_iterator end;
+  std::cregex_iterator next(operand.data(), operand.data() + operand.size(),
+    re);
+  std::cregex_iterator end;
   while (next != end) {
-    std::smatch match = *next;
+    std::cmatch match = *next;
     for (size_t i = 0; i < match.size(); ++i) {
       std::string immediate = match[i].str();
       uint64_t val = strtoull(immediate.c_str(), nullptr, 16);
@@ -1,8 +1,12 @@
 #ifndef EXTRACTIMMEDIATE_HPP
 #define EXTRACTIMMEDIATE_HPP
 
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
 bool isNotHexCharacter(char c);
-size_t ExtractImmediateFromString(const std::string& operand,
+size_t ExtractImmediateFromString(std::string_view operand,
   std::vector<uint64_t>* results);
  
 #endif // EXTRACTIMMEDIATE_HPP
@@ -21,8 +21,10 @@
 
 #include "third_party/json/src/json.hpp"
 
-#include "disassembly/flowgraphutil.hpp"
+#include "disassembly/breadthfirstsearch.hpp"
+#include "disassembly/compactflowgraph.hpp"
 #include "disassembly/flowgraph.hpp"
+#include "disassembly/mnemonictable.hpp"
 
 using json = nlohmann::json;
 
@@ -36,7 +38,14 @@ Flowgraph::Flowgraph(const Flowgraph& other) {
 
 Instruction::Instruction(const std::string& mnemonic,
   const std::vector<std::string>& operands) : mnemonic_(mnemonic),
-  operands_(operands) {};
+  mnemonic_id_(MnemonicTable::Intern(mnemonic)), operands_(operands),
+  has_decoded_immediates_(false) {};
+
+Instruction::Instruction(const std::string& mnemonic,
+  const std::vector<std::string>& operands,
+  const std::vector<uint64_t>& immediates) : mnemonic_(mnemonic),
+  mnemonic_id_(MnemonicTable::Intern(mnemonic)), operands_(operands),
+  has_decoded_immediates_(true), immediates_(immediates) {};
 
 // Automatically default-constructs the target vector.
 bool Flowgraph::AddNode(address node_address) {
@@ -89,9 +98,15 @@ void Flowgraph::WriteJSON(std::ostream* output, InstructionGetter block_getter)
     std::vector<Instruction> instructions;
     block_getter(block_address, &instructions);
     for (const Instruction& instruction : instructions) {
-      node["instructions"].push_back(
-        {{"mnemonic", instruction.GetMnemonic()},
-        {"operands", instruction.GetOperands() }});
+      json json_instruction = {
+        {"mnemonic", instruction.GetMnemonic()},
+        {"operands", instruction.GetOperands() }};
+      // Decoded immediates are kept, so that reading the JSON back yields
+      // the same features as the disassembly it was written from.
+      if (instruction.HasDecodedImmediates()) {
+        json_instruction["immediates"] = instruction.GetImmediates();
+      }
+      node["instructions"].push_back(json_instruction);
     }
     out_graph["nodes"].emplace_back(node);
   }
@@ -114,40 +129,22 @@ void Flowgraph::WriteJSON(const std::string& output_file,
   WriteJSON(&jsonfile, block_getter);
 }
 
-bool Flowgraph::HasNode(address node) {
+bool Flowgraph::HasNode(address node) const {
   return (out_edges_.find(node) != out_edges_.end());
 }
 
-void Flowgraph::GetTopologicalOrder(std::map<address, std::vector<address>>*
-  edges, address startnode, std::map<address, int32_t>* order) {
-  // Begin by calculating the topological order of each node.
-  std::queue<std::pair<address, uint32_t>> worklist;
-
-  worklist.push(std::make_pair(startnode, 0));
-  (*order)[startnode] = 0;
-
-  address current_node;
-  uint32_t current_order;
-  while (!worklist.empty()) {
-    std::tie(current_node, current_order) = worklist.front();
-    worklist.pop();
-    std::vector<address>& targets = (*edges)[current_node];
-    for (const address& target : targets) {
-      if (order->find(target) != order->end()) {
-        uint32_t target_order = (*order)[target];
-        if (target_order <= current_order + 1) {
-          continue;
-        }
-      }
-      // Found a shorter path to this node, reprocess it.
-      worklist.push(std::make_pair(target, current_order + 1));
-      (*order)[target] = current_order + 1;
-    }
+void Flowgraph::GetTopologicalOrder(address startnode, Direction direction,
+  std::vector<int32_t>* order) const {
+  CompactFlowgraph graph(*this);
+  order->assign(graph.GetSize(), -1);
+  uint32_t start = graph.GetNode(startnode);
+  if (start == CompactFlowgraph::kInvalidNode) {
+    return;
   }
-  for (const auto& entry : (*edges)) {
-    if (order->find(entry.first) == order->end()) {
-      (*order)[entry.first] = -1;
-    }
+  BreadthFirstSearch& search = BreadthFirstSearch::ForThisThread();
+  search.Search(graph, start, direction);
+  for (uint32_t node : search.GetFound()) {
+    (*order)[node] = search.GetDistance(node);
   }
 }
 
@@ -162,57 +159,24 @@ void Flowgraph::GetTopologicalOrder(std::map<address, std::vector<address>>*
 // The result is a set of ten-tuples. Each element in the tuple is multiplied
 // with a constant and added into the hash value, which is then rotated.
 //
+// The calculation itself is GraphletSignature's. It keeps two quirks of the
+// original map-based implementation: Nodes that cannot be reached backward
+// (in both directions) get order 0 instead of -1 if they have no predecessors
+// (no edges at all), and a start node that is not in the graph is hashed as
+// an additional node without edges.
 uint64_t Flowgraph::CalculateHash(address startnode,
-  uint64_t k0, uint64_t k1, uint64_t k2) {
-  std::map<address, int32_t> order_forward, order_backward, order_both;
-  GetTopologicalOrder(&out_edges_, startnode, &order_forward);
-  GetTopologicalOrder(&in_edges_, startnode, &order_backward);
-  GetTopologicalOrder(&bidirectional_edges_, startnode, &order_both);
-
-  std::map<address, uint32_t> indegrees, outdegrees;
-  for (const auto& element : out_edges_) {
-    outdegrees[element.first] = element.second.size();
-    for (const address target : element.second) {
-      indegrees[target]++;
-    }
+  uint64_t k0, uint64_t k1, uint64_t k2) const {
+  if (!HasNode(startnode)) {
+    Flowgraph graph(*this);
+    graph.AddNode(startnode);
+    return graph.CalculateHash(startnode, k0, k1, k2);
   }
-
-  // Arbitrarily chosen seed value;
-  uint64_t hash_result = 0x0BADDEED600DDEEDL;
-  for (const auto& element : out_edges_) {
-    address source = element.first;
-    uint64_t per_edge_hash = 0x600DDEED0BADDEEDL;
-    for (const address target : element.second) {
-      per_edge_hash += k0 * order_forward[source];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k1 * order_backward[source];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k2 * order_both[source];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k0 * indegrees[source];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k1 * outdegrees[source];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-
-      per_edge_hash += k2 * order_forward[target];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k0 * order_backward[target];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k1 * order_both[target];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k2 * indegrees[target];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-      per_edge_hash += k0 * outdegrees[target];
-      per_edge_hash = rotl64( per_edge_hash, 7 );
-    }
-    // Combine the per-edge-hashes with a commutative operation.
-    hash_result += per_edge_hash;
-  }
-  return hash_result;
+  CompactFlowgraph graph(*this);
+  return graph.CalculateHash(graph.GetNode(startnode), k0, k1, k2);
 }
 
 Flowgraph* Flowgraph::GetSubgraph(address node, uint32_t distance, uint32_t
-  max_size = 0xFFFFFFFF) {
+  max_size = 0xFFFFFFFF) const {
   Flowgraph* subgraph = new Flowgraph();
 
   // This code proceeds in two iterations: It first identifies all nodes within
@@ -234,12 +198,16 @@ Flowgraph* Flowgraph::GetSubgraph(address node, uint32_t distance, uint32_t
     worklist.pop();
 
     if (current_distance < distance) {
-      std::vector<address>* in = &(in_edges_[current_node]);
-      std::vector<address>* out = &(out_edges_[current_node]);
+      // Nodes without predecessors have no entry in in_edges_.
+      const std::vector<address>* in = GetInEdges(current_node);
+      const std::vector<address>* out = GetOutEdges(current_node);
 
-      std::vector<std::vector<address>*> in_and_out = { in, out };
+      std::vector<const std::vector<address>*> in_and_out = { in, out };
 
-      for (std::vector<address>* edges : in_and_out) {
+      for (const std::vector<address>* edges : in_and_out) {
+        if (edges == nullptr) {
+          continue;
+        }
         for (const address& target : *edges) {
           if (visited.find(target) == visited.end()) {
             visited.insert(target);
@@ -268,7 +236,7 @@ Flowgraph* Flowgraph::GetSubgraph(address node, uint32_t distance, uint32_t
   return subgraph;
 }
 
-const std::vector<address>* Flowgraph::GetOutEdges(address node) {
+const std::vector<address>* Flowgraph::GetOutEdges(address node) const {
   auto iter = out_edges_.find(node);
   if (iter != out_edges_.end()) {
     return &(iter->second);
@@ -276,7 +244,7 @@ const std::vector<address>* Flowgraph::GetOutEdges(address node) {
   return nullptr;
 }
 
-const std::vector<address>* Flowgraph::GetInEdges(address node) {
+const std::vector<address>* Flowgraph::GetInEdges(address node) const {
   auto iter = in_edges_.find(node);
   if (iter != in_edges_.end()) {
     return &(iter->second);
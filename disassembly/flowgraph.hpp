@@ -17,6 +17,8 @@
 
 #include <functional>
 #include <map>
+#include <ostream>
+#include <string>
 #include <vector>
 
 /* A Flowgraph class designed to allow fast extraction of small subgraphs
@@ -38,12 +40,25 @@ class Instruction {
 public:
   Instruction(const std::string& mnemonic, const std::vector<std::string>&
     operands);
+  // With the immediate values in the operands as decoded by the disassembler,
+  // so that nobody has to parse them from the operand strings again.
+  Instruction(const std::string& mnemonic, const std::vector<std::string>&
+    operands, const std::vector<uint64_t>& immediates);
   const std::string& GetMnemonic() const { return mnemonic_; };
+  // The ID of the mnemonic in the MnemonicTable.
+  uint32_t GetMnemonicId() const { return mnemonic_id_; };
   const std::vector<std::string>& GetOperands() const { return operands_; };
+  // Only meaningful if HasDecodedImmediates(); otherwise the immediates have
+  // to be extracted from the operand strings.
+  bool HasDecodedImmediates() const { return has_decoded_immediates_; };
+  const std::vector<uint64_t>& GetImmediates() const { return immediates_; };
   std::string AsString() const;
 private:
   std::string mnemonic_;
+  uint32_t mnemonic_id_;
   std::vector<std::string> operands_;
+  bool has_decoded_immediates_;
+  std::vector<uint64_t> immediates_;
 };
 
 // A callback to get the instructions for a basic block at a given address.
@@ -62,23 +77,25 @@ public:
   virtual ~Flowgraph() {};
   bool AddNode(address node_adress);
   bool AddEdge(address source_address, address target_address);
-  bool HasNode(address node);
-  const std::vector<address>* GetOutEdges(address node);
-  const std::vector<address>* GetInEdges(address node);
+  bool HasNode(address node) const;
+  const std::vector<address>* GetOutEdges(address node) const;
+  const std::vector<address>* GetInEdges(address node) const;
 
   uint64_t GetSize() const { return out_edges_.size(); };
   uint64_t GetNumberOfBranchingNodes() const;
 
-  Flowgraph* GetSubgraph(address node, uint32_t distance, uint32_t max_size);
+  Flowgraph* GetSubgraph(address node, uint32_t distance,
+    uint32_t max_size) const;
   void GetNodes(std::vector<address>* nodes) const;
-  // Fills a map with topological distance from the startnode, or -1 for no
-  // path found.
-  void GetTopologicalOrder(std::map<address, std::vector<address>>* edges,
-    address startnode, std::map<address, int32_t>* order);
+  // Fills a vector with the topological distance of each node (in the order
+  // of GetNodes) from the startnode along edges in the given direction, or -1
+  // for no path found.
+  void GetTopologicalOrder(address startnode, Direction direction,
+    std::vector<int32_t>* order) const;
 
   uint64_t CalculateHash(address node, uint64_t k0 = 0xc3a5c85c97cb3127ULL,
     uint64_t k1 = 0xb492b66fbe98f273ULL,
-    uint64_t k2 = 0x9ae16a3b2f90404fULL);
+    uint64_t k2 = 0x9ae16a3b2f90404fULL) const;
 
   void WriteDot(const std::string& output_file) const;
   void WriteJSON(const std::string& output_file,
@@ -23,11 +23,11 @@ InstructionGetter FlowgraphWithInstructionInstructionGetter(
   FlowgraphWithInstructions* flowgraph) {
   InstructionGetter getter = [flowgraph](uint64_t address,
     std::vector<Instruction>* results) -> bool {
-    const auto& iter = flowgraph->GetInstructions().find(address);
-    if (iter == flowgraph->GetInstructions().end()) {
+    BasicBlockView block;
+    if (!flowgraph->GetBasicBlock(address, &block)) {
       return false;
     }
-    *(results) = iter->second;
+    block.GetInstructions(results);
     return true;
   };
   return getter;
@@ -13,7 +13,9 @@
 // limitations under the License.
 
 #include "CodeObject.h"
+#include "Immediate.h"
 #include "InstructionDecoder.h"
+#include "Visitor.h"
 
 #include "disassembly/disassembly.hpp"
 #include "disassembly/flowgraph.hpp"
@@ -41,12 +43,40 @@ uint64_t BuildFlowgraph(Dyninst::ParseAPI::Function* function,
   return count;
 }
 
+namespace {
+
+// Collects the non-zero immediate values (constants and displacements) in the
+// expression tree of an operand, sign-extended to 64 bits. These are not the
+// numbers ExtractImmediateFromString finds in the formatted operand, so they
+// are only hashed under HasherVersion::kDecodedImmediates.
+class ImmediateCollector : public Dyninst::InstructionAPI::Visitor {
+public:
+  explicit ImmediateCollector(std::vector<uint64_t>* immediates) :
+    immediates_(immediates) {}
+  void visit(Dyninst::InstructionAPI::BinaryFunction*) override {}
+  void visit(Dyninst::InstructionAPI::Immediate* immediate) override {
+    uint64_t value = immediate->eval().convert<int64_t>();
+    if (value != 0) {
+      immediates_->push_back(value);
+    }
+  }
+  void visit(Dyninst::InstructionAPI::RegisterAST*) override {}
+  void visit(Dyninst::InstructionAPI::Dereference*) override {}
+private:
+  std::vector<uint64_t>* immediates_;
+};
+
+} // namespace
+
 // A helper function to provide an InstructionGetter that abstracts away the
-// DynInst API.
+// DynInst API. If asked for, the immediates of the decoded operands are kept
+// next to the formatted operand strings for HasherVersion::kDecodedImmediates;
+// the other hasher versions parse the strings and do not pay for the walk over
+// the operand trees.
 InstructionGetter MakeDyninstInstructionGetter(
-  Dyninst::ParseAPI::CodeObject* codeobject) {
-  InstructionGetter getter =
-    [codeobject](uint64_t address, std::vector<Instruction>* results) -> bool {
+  Dyninst::ParseAPI::CodeObject* codeobject, bool decode_immediates) {
+  InstructionGetter getter = [codeobject, decode_immediates](uint64_t address,
+    std::vector<Instruction>* results) -> bool {
     Dyninst::ParseAPI::CodeSource* codesource = codeobject->cs();
     for (Dyninst::ParseAPI::CodeRegion* region : codesource->regions()) {
       Dyninst::ParseAPI::Block* block = codeobject->findBlockByEntry(
@@ -59,6 +89,8 @@ InstructionGetter MakeDyninstInstructionGetter(
       block->getInsns(block_instructions);
       for (const auto& instruction : block_instructions) {
         std::vector<std::string> operand_strings;
+        std::vector<uint64_t> immediates;
+        ImmediateCollector collector(&immediates);
         std::vector<Dyninst::InstructionAPI::Operand> operands;
         instruction.second->getOperands(operands);
         for (const auto& operand : operands) {
@@ -66,9 +98,18 @@ InstructionGetter MakeDyninstInstructionGetter(
             operand.format(
               instruction.second->getArch(),
               instruction.first));
+          if (decode_immediates) {
+            operand.getValue()->apply(&collector);
+          }
+        }
+        if (decode_immediates) {
+          results->emplace_back(Instruction(
+            instruction.second->getOperation().format(), operand_strings,
+            immediates));
+        } else {
+          results->emplace_back(Instruction(
+            instruction.second->getOperation().format(), operand_strings));
         }
-        results->emplace_back(Instruction(
-          instruction.second->getOperation().format(), operand_strings));
       }
       if (!results->empty()) {
         return true;
@@ -111,9 +152,10 @@ bool GetCFGFromBinaryAsJSON(const std::string& format, const std::string
 
 std::unique_ptr<FlowgraphWithInstructions> GetCFGWithInstructionsFromBinary(
   const std::string& format, const std::string &inputfile,
-  uint64_t func_address) {
+  uint64_t func_address, bool decode_immediates) {
 
   Disassembly disassembly(format, inputfile);
+  disassembly.SetDecodeImmediates(decode_immediates);
   if (!disassembly.Load(false)) {
     return nullptr;
   }
@@ -12,9 +12,11 @@
 uint64_t BuildFlowgraph(Dyninst::ParseAPI::Function* function,
   Flowgraph* graph);
 
-// Return a std::function that retrieves instruction strings from DynInst.
+// Return a std::function that retrieves instruction strings from DynInst. With
+// 'decode_immediates', the instructions also carry the immediates of their
+// decoded operands (see Disassembly::SetDecodeImmediates).
 InstructionGetter MakeDyninstInstructionGetter(
-  Dyninst::ParseAPI::CodeObject* codeobject);
+  Dyninst::ParseAPI::CodeObject* codeobject, bool decode_immediates = false);
 
 // Get a single CFG as JSON.
 bool GetCFGFromBinaryAsJSON(const std::string& format, const std::string
@@ -22,7 +24,7 @@ bool GetCFGFromBinaryAsJSON(const std::string& format, const std::string
 
 std::unique_ptr<FlowgraphWithInstructions> GetCFGWithInstructionsFromBinary(
   const std::string& format, const std::string &inputfile,
-  uint64_t func_address);
+  uint64_t func_address, bool decode_immediates = false);
 
 #endif // FLOWGRAPHUTIL_DYNINST_HPP
 
@@ -1,24 +1,108 @@
-#include <map>
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "disassembly/flowgraph.hpp"
 #include "disassembly/flowgraphwithinstructions.hpp"
+#include "disassembly/mnemonictable.hpp"
 #include "third_party/json/src/json.hpp"
 
-// Copy constructor. Somewhat hideously expensive.
+const std::string& InstructionView::GetMnemonic() const {
+  return MnemonicTable::GetMnemonic(GetMnemonicId());
+}
+
+std::string InstructionView::AsString() const {
+  std::string result = GetMnemonic() + " ";
+  for (uint32_t operand = 0; operand < GetNumberOfOperands(); ++operand) {
+    result.append(GetOperand(operand));
+    if (operand != GetNumberOfOperands() - 1) {
+      result.append(", ");
+    }
+  }
+  return result;
+}
+
+Instruction InstructionView::ToInstruction() const {
+  std::vector<std::string> operands;
+  for (uint32_t operand = 0; operand < GetNumberOfOperands(); ++operand) {
+    operands.emplace_back(GetOperand(operand));
+  }
+  if (!HasDecodedImmediates()) {
+    return Instruction(GetMnemonic(), operands);
+  }
+  ImmediateRange immediates = GetImmediates();
+  return Instruction(GetMnemonic(), operands,
+    std::vector<uint64_t>(immediates.begin(), immediates.end()));
+}
+
+void BasicBlockView::GetInstructions(std::vector<Instruction>* instructions)
+  const {
+  instructions->clear();
+  for (InstructionView instruction : *this) {
+    instructions->push_back(instruction.ToInstruction());
+  }
+}
+
+// Copying the flat arrays takes a few allocations, not one per instruction
+// and operand.
 FlowgraphWithInstructions::FlowgraphWithInstructions(
-  const FlowgraphWithInstructions& original) : Flowgraph(original) {
-  instructions_ = original.instructions_;
+  const FlowgraphWithInstructions& original) : Flowgraph(original),
+  blocks_(original.blocks_), mnemonic_ids_(original.mnemonic_ids_),
+  has_decoded_immediates_(original.has_decoded_immediates_),
+  operand_offsets_(original.operand_offsets_),
+  immediate_offsets_(original.immediate_offsets_),
+  operand_bounds_(original.operand_bounds_),
+  operand_characters_(original.operand_characters_),
+  immediates_(original.immediates_) {
 }
 
-FlowgraphWithInstructions::FlowgraphWithInstructions() {
+FlowgraphWithInstructions::FlowgraphWithInstructions() :
+  operand_offsets_(1, 0), immediate_offsets_(1, 0), operand_bounds_(1, 0) {
 }
 
 bool FlowgraphWithInstructions::AddInstructions(address node_address,
   const std::vector<Instruction>& instructions) {
-  instructions_[node_address] = instructions;
+  StoredBlock block = { node_address,
+    static_cast<uint32_t>(mnemonic_ids_.size()), 0 };
+  for (const Instruction& instruction : instructions) {
+    mnemonic_ids_.push_back(instruction.GetMnemonicId());
+    has_decoded_immediates_.push_back(instruction.HasDecodedImmediates());
+    for (const std::string& operand : instruction.GetOperands()) {
+      operand_characters_.append(operand);
+      operand_bounds_.push_back(operand_characters_.size());
+    }
+    operand_offsets_.push_back(operand_bounds_.size() - 1);
+    immediates_.insert(immediates_.end(), instruction.GetImmediates().begin(),
+      instruction.GetImmediates().end());
+    immediate_offsets_.push_back(immediates_.size());
+  }
+  block.end = mnemonic_ids_.size();
+
+  // Blocks usually arrive by ascending address, so this mostly appends.
+  auto iter = std::lower_bound(blocks_.begin(), blocks_.end(), node_address,
+    [](const StoredBlock& block, address block_address) {
+      return block.block_address < block_address;
+    });
+  if ((iter != blocks_.end()) && (iter->block_address == node_address)) {
+    *iter = block;
+  } else {
+    blocks_.insert(iter, block);
+  }
+  return true;
+}
+
+bool FlowgraphWithInstructions::GetBasicBlock(address block_address,
+  BasicBlockView* block) const {
+  auto iter = std::lower_bound(blocks_.begin(), blocks_.end(), block_address,
+    [](const StoredBlock& block, address block_address) {
+      return block.block_address < block_address;
+    });
+  if ((iter == blocks_.end()) || (iter->block_address != block_address)) {
+    return false;
+  }
+  *block = BasicBlockView(this, iter->block_address, iter->begin, iter->end);
   return true;
 }
 
@@ -39,7 +123,13 @@ bool FlowgraphWithInstructions::ParseNodeJSON(const nlohmann::json& node) {
     for (const auto& operand : instruction["operands"]) {
       operands.push_back(operand.get<std::string>());
     }
-    instructions.emplace_back(mnemonic, operands);
+    // Only JSON written from a disassembler that decodes immediates has them.
+    if (instruction.find("immediates") != instruction.end()) {
+      instructions.emplace_back(mnemonic, operands,
+        instruction["immediates"].get<std::vector<uint64_t>>());
+    } else {
+      instructions.emplace_back(mnemonic, operands);
+    }
   }
   AddNode(address);
   AddInstructions(address, instructions);
@@ -99,13 +189,14 @@ std::string FlowgraphWithInstructions::GetDisassembly() const {
   std::stringstream output;
   // TODO(thomasdullien): The code takes the lowest address in a function as the
   // beginning address here. There has to be a better way?
-  output << "\n[!] Function at " << std::hex << instructions_.begin()->first;
+  output << "\n[!] Function at " << std::hex << blocks_.front().block_address;
 
-  for (const auto& block : instructions_) {
-    output << "\t\tBlock at " << std::hex << block.first;
-    output << " (" << std::dec << static_cast<size_t>(block.second.size()) 
+  for (uint32_t index = 0; index < GetNumberOfBasicBlocks(); ++index) {
+    BasicBlockView block = GetBasicBlock(index);
+    output << "\t\tBlock at " << std::hex << block.GetAddress();
+    output << " (" << std::dec << static_cast<size_t>(block.size()) 
       << ")\n";
-    for (const auto& instruction : block.second) {
+    for (InstructionView instruction : block) {
       output << "\t\t\t " << instruction.AsString() << "\n";
     }
   }
@@ -1,32 +1,182 @@
 #ifndef FLOWGRAPHWITHINSTRUCTIONS_HPP
 #define FLOWGRAPHWITHINSTRUCTIONS_HPP
 
-#include <map>
-#include <queue>
+#include <cstdint>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "disassembly/flowgraph.hpp"
 #include "third_party/json/src/json.hpp"
 
+class FlowgraphWithInstructions;
+
+// A range of immediates, as returned for an instruction.
+class ImmediateRange {
+public:
+  ImmediateRange(const uint64_t* begin, const uint64_t* end) : begin_(begin),
+    end_(end) {}
+  const uint64_t* begin() const { return begin_; }
+  const uint64_t* end() const { return end_; }
+  uint32_t size() const { return end_ - begin_; }
+private:
+  const uint64_t* begin_;
+  const uint64_t* end_;
+};
+
+// A view of an instruction in the instruction store of a
+// FlowgraphWithInstructions. Only valid as long as the graph is not modified.
+class InstructionView {
+public:
+  InstructionView(const FlowgraphWithInstructions* graph, uint32_t index) :
+    graph_(graph), index_(index) {}
+
+  // The ID of the mnemonic in the MnemonicTable.
+  uint32_t GetMnemonicId() const;
+  const std::string& GetMnemonic() const;
+  uint32_t GetNumberOfOperands() const;
+  std::string_view GetOperand(uint32_t operand) const;
+  // Only meaningful if HasDecodedImmediates(); otherwise the immediates have
+  // to be extracted from the operand strings.
+  bool HasDecodedImmediates() const;
+  ImmediateRange GetImmediates() const;
+
+  std::string AsString() const;
+  // A copy that does not depend on the graph.
+  Instruction ToInstruction() const;
+private:
+  const FlowgraphWithInstructions* graph_;
+  uint32_t index_;
+};
+
+// A view of the instructions of a basic block, with the same lifetime as an
+// InstructionView.
+class BasicBlockView {
+public:
+  class Iterator {
+  public:
+    Iterator(const FlowgraphWithInstructions* graph, uint32_t index) :
+      graph_(graph), index_(index) {}
+    InstructionView operator*() const {
+      return InstructionView(graph_, index_);
+    }
+    Iterator& operator++() { ++index_; return *this; }
+    bool operator!=(const Iterator& other) const {
+      return index_ != other.index_;
+    }
+  private:
+    const FlowgraphWithInstructions* graph_;
+    uint32_t index_;
+  };
+
+  BasicBlockView() : graph_(nullptr), address_(0), begin_(0), end_(0) {}
+  BasicBlockView(const FlowgraphWithInstructions* graph, address block_address,
+    uint32_t begin, uint32_t end) : graph_(graph), address_(block_address),
+    begin_(begin), end_(end) {}
+
+  address GetAddress() const { return address_; }
+  uint32_t size() const { return end_ - begin_; }
+  bool empty() const { return begin_ == end_; }
+  InstructionView operator[](uint32_t index) const {
+    return InstructionView(graph_, begin_ + index);
+  }
+  Iterator begin() const { return Iterator(graph_, begin_); }
+  Iterator end() const { return Iterator(graph_, end_); }
+  // Copies of the instructions that do not depend on the graph.
+  void GetInstructions(std::vector<Instruction>* instructions) const;
+private:
+  const FlowgraphWithInstructions* graph_;
+  address address_;
+  uint32_t begin_;
+  uint32_t end_;
+};
+
 // A class that keeps both the CFG and associated vectors of mnemonics for the
 // instructions. This is not used much internally, but gets exposed through the
 // external Python bindings to make interactions from other tools easier.
+//
+// The instructions live in a few flat arrays per function instead of a
+// std::string and a std::vector of std::strings per instruction: Each
+// instruction is its interned mnemonic ID plus offsets into one pool of
+// operand characters and one array of decoded immediates, and the basic
+// blocks are ranges of instructions, sorted by address. Large functions thus
+// take a handful of allocations instead of millions, and copying a graph is
+// cheap. The accessors return views into these arrays.
 class FlowgraphWithInstructions : public Flowgraph {
-private:
-  std::map<address, std::vector<Instruction>> instructions_;
-  bool ParseNodeJSON(const nlohmann::json& node);
-  bool ParseEdgeJSON(const nlohmann::json& edge);
 public:
   bool ParseJSON(const nlohmann::json& json_graph);
+  // Replaces the instructions of the block at 'node_address', if any.
   bool AddInstructions(address node_address,
     const std::vector<Instruction>& instructions);
-  const std::map<address, std::vector<Instruction>>& GetInstructions() const {
-    return instructions_; };
-  FlowgraphWithInstructions(const FlowgraphWithInstructions& original);\
+
+  // The basic blocks with instructions, by ascending address.
+  uint32_t GetNumberOfBasicBlocks() const { return blocks_.size(); }
+  BasicBlockView GetBasicBlock(uint32_t index) const {
+    const StoredBlock& block = blocks_[index];
+    return BasicBlockView(this, block.block_address, block.begin, block.end);
+  }
+  // Returns false if there are no instructions for the block at the address.
+  bool GetBasicBlock(address block_address, BasicBlockView* block) const;
+  uint64_t GetNumberOfInstructions() const { return mnemonic_ids_.size(); }
+
+  FlowgraphWithInstructions(const FlowgraphWithInstructions& original);
   FlowgraphWithInstructions();
   std::string GetDisassembly() const;
+private:
+  friend class InstructionView;
+
+  struct StoredBlock {
+    address block_address;
+    // The instructions are begin..end-1.
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  bool ParseNodeJSON(const nlohmann::json& node);
+  bool ParseEdgeJSON(const nlohmann::json& edge);
+
+  // Sorted by address. Replacing the instructions of a block appends new ones
+  // and leaves the old ones unused.
+  std::vector<StoredBlock> blocks_;
+  // Per instruction. The operands of instruction i are operand_offsets_[i]
+  // up to (but not including) operand_offsets_[i + 1], likewise for the
+  // immediates. The characters of operand o are operand_characters_[
+  // operand_bounds_[o]] up to operand_characters_[operand_bounds_[o + 1]].
+  std::vector<uint32_t> mnemonic_ids_;
+  std::vector<bool> has_decoded_immediates_;
+  std::vector<uint32_t> operand_offsets_;
+  std::vector<uint32_t> immediate_offsets_;
+  std::vector<uint32_t> operand_bounds_;
+  std::string operand_characters_;
+  std::vector<uint64_t> immediates_;
 };
 
+inline uint32_t InstructionView::GetMnemonicId() const {
+  return graph_->mnemonic_ids_[index_];
+}
+
+inline uint32_t InstructionView::GetNumberOfOperands() const {
+  return graph_->operand_offsets_[index_ + 1] -
+    graph_->operand_offsets_[index_];
+}
+
+inline std::string_view InstructionView::GetOperand(uint32_t operand) const {
+  uint32_t index = graph_->operand_offsets_[index_] + operand;
+  uint32_t begin = graph_->operand_bounds_[index];
+  return std::string_view(graph_->operand_characters_.data() + begin,
+    graph_->operand_bounds_[index + 1] - begin);
+}
+
+inline bool InstructionView::HasDecodedImmediates() const {
+  return graph_->has_decoded_immediates_[index_];
+}
+
+inline ImmediateRange InstructionView::GetImmediates() const {
+  const uint64_t* immediates = graph_->immediates_.data();
+  return ImmediateRange(immediates + graph_->immediate_offsets_[index_],
+    immediates + graph_->immediate_offsets_[index_ + 1]);
+}
+
 bool FlowgraphWithInstructionsFromJSON(const char* json,
   FlowgraphWithInstructions* graph);
 
@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <memory>
+#include <sstream>
 #include "gtest/gtest.h"
 #include "third_party/json/src/json.hpp"
 
+#include "disassembly/flowgraphutil.hpp"
 #include "disassembly/flowgraphutil_dyninst.hpp"
 #include "searchbackend/functionsimhash.hpp"
 #include "disassembly/flowgraphwithinstructions.hpp"
@@ -90,6 +93,56 @@ TEST(flowgraphwithinstructions, creategraph) {
   }
 }
 
+// Dyninst decodes the immediates of the operands only if asked to, and only
+// HasherVersion::kDecodedImmediates hashes them: Under the other versions, a
+// function hashes exactly like the same function with nothing but operand
+// strings.
+TEST(flowgraphwithinstructions, dyninst_decoded_immediates) {
+  std::unique_ptr<FlowgraphWithInstructions> graph(
+    GetCFGWithInstructionsFromBinary(
+        "ELF", "../testdata/ELF/unrar.5.5.3.builds/unrar.x86.Os.ELF",
+        0x806C811, true));
+  ASSERT_FALSE(graph == nullptr);
+  std::unique_ptr<FlowgraphWithInstructions> strings_only(
+    GetCFGWithInstructionsFromBinary(
+        "ELF", "../testdata/ELF/unrar.5.5.3.builds/unrar.x86.Os.ELF",
+        0x806C811));
+  ASSERT_FALSE(strings_only == nullptr);
+
+  uint64_t decoded = 0;
+  for (uint32_t index = 0; index < graph->GetNumberOfBasicBlocks(); ++index) {
+    for (InstructionView instruction : graph->GetBasicBlock(index)) {
+      ASSERT_TRUE(instruction.HasDecodedImmediates());
+      decoded += instruction.GetImmediates().size();
+    }
+  }
+  // The function has stack adjustments and displacements.
+  EXPECT_GT(decoded, 0);
+  for (uint32_t index = 0; index < strings_only->GetNumberOfBasicBlocks();
+    ++index) {
+    for (InstructionView instruction : strings_only->GetBasicBlock(index)) {
+      EXPECT_FALSE(instruction.HasDecodedImmediates());
+    }
+  }
+
+  for (HasherVersion version :
+    { HasherVersion::kLegacy, HasherVersion::kPortable }) {
+    FunctionSimHasher hasher("", default_features, default_logging,
+      FunctionSimHasher::kMnemonicDefaultWeight,
+      FunctionSimHasher::kGraphletDefaultWeight,
+      FunctionSimHasher::kImmediateDefaultWeight, version);
+    FlowgraphWithInstructionsFeatureGenerator with_decoded(*graph);
+    FlowgraphWithInstructionsFeatureGenerator without_decoded(*strings_only);
+    std::vector<FeatureHash> expected, features;
+    FunctionSimHasher::SimHash<128> expected_simhash, simhash;
+    hasher.CalculateFunctionSimHash<128>(&without_decoded, &expected_simhash,
+      &expected);
+    hasher.CalculateFunctionSimHash<128>(&with_decoded, &simhash, &features);
+    EXPECT_EQ(simhash, expected_simhash) << HasherVersionName(version);
+    EXPECT_EQ(features, expected) << HasherVersionName(version);
+  }
+}
+
 TEST(flowgraphwithinstructions, parsejson) {
   const char* json_string =
   R"json({"edges":[{"destination":1518838580,"source":1518838565},{"destination":1518838572,"source":1518838565},{"destination":1518838578,"source":1518838572},{"destination":1518838574,"source":1518838572},{"destination":1518838580,"source":1518838574},{"destination":1518838578,"source":1518838574},{"destination":1518838580,"source":1518838578}],"name":"CFG","nodes":[{"address":1518838565,"instructions":[{"mnemonic":"xor","operands":["EAX","EAX"]},{"mnemonic":"cmp","operands":["[ECX + 4]","EAX"]},{"mnemonic":"jnle","operands":["5a87a334"]}]},{"address":1518838572,"instructions":[{"mnemonic":"jl","operands":["5a87a332"]}]},{"address":1518838574,"instructions":[{"mnemonic":"cmp","operands":["[ECX]","EAX"]},{"mnemonic":"jnb","operands":["5a87a334"]}]},{"address":1518838578,"instructions":[{"mnemonic":"mov","operands":["AL","1"]}]},{"address":1518838580,"instructions":[{"mnemonic":"ret near","operands":["[ESP]"]}]}]})json";
@@ -119,3 +172,204 @@ TEST(flowgraphwithinstructions, parsejson) {
   std::string disasm = temp->GetDisassembly();
   EXPECT_EQ(disasm, expected_disassembly);
 }
+
+namespace {
+
+// Collects the immediates a generator pushes, decoded or parsed.
+class ImmediateVisitor : public FeatureVisitor {
+public:
+  explicit ImmediateVisitor(bool decoded) : decoded_(decoded) {}
+  bool WantsGraphlets() const override { return false; }
+  bool WantsMnemonics() const override { return false; }
+  bool WantsDecodedImmediates() const override { return decoded_; }
+  void GetGraphletHashKeys(uint64_t* /* keys */) const override {}
+  void VisitGraphlets(const GraphletView* /* graphlets */,
+    const uint64_t* /* hashes */, uint64_t /* count */) override {}
+  void VisitMnemTuples(const MnemTuple* /* tuples */,
+    uint64_t /* count */) override {}
+  void VisitImmediates(const uint64_t* immediates, uint64_t count) override {
+    immediates_.insert(immediates_.end(), immediates, immediates + count);
+  }
+  const std::vector<uint64_t>& GetImmediates() const { return immediates_; }
+private:
+  bool decoded_;
+  std::vector<uint64_t> immediates_;
+};
+
+} // namespace
+
+// Immediates decoded by the disassembler take precedence over the operand
+// strings if the visitor asks for them, and survive a round trip through JSON.
+TEST(flowgraphwithinstructions, decoded_immediates) {
+  FlowgraphWithInstructions graph;
+  graph.AddEdge(0x10, 0x20);
+  graph.AddInstructions(0x10, {
+    Instruction("mov", { "EAX", "0x1235" }, { 0x4321, 0x10, 0x12345 }),
+    Instruction("add", { "EAX", "0x5555" }),
+    Instruction("jmp", { "20" }) });
+  graph.AddInstructions(0x20, { Instruction("ret", {}, {}) });
+
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  ImmediateVisitor decoded(true);
+  generator.VisitFeatures(&decoded);
+  // 0x10 looks like a stack offset and is skipped.
+  EXPECT_EQ(decoded.GetImmediates(),
+    std::vector<uint64_t>({ 0x4321, 0x12345, 0x5555 }));
+
+  // Otherwise, and through the pull interface, the operand strings count.
+  generator.reinit();
+  ImmediateVisitor parsed_from_strings(false);
+  generator.VisitFeatures(&parsed_from_strings);
+  EXPECT_EQ(parsed_from_strings.GetImmediates(),
+    std::vector<uint64_t>({ 0x1235, 0x5555 }));
+  generator.reinit();
+  std::vector<uint64_t> immediates;
+  while (generator.HasMoreImmediates()) {
+    immediates.push_back(generator.GetNextImmediate());
+  }
+  EXPECT_EQ(immediates, parsed_from_strings.GetImmediates());
+
+  std::stringstream json;
+  graph.WriteJSON(&json, FlowgraphWithInstructionInstructionGetter(&graph));
+  FlowgraphWithInstructions parsed;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSON(json.str().c_str(), &parsed));
+  BasicBlockView block;
+  ASSERT_TRUE(parsed.GetBasicBlock(0x10, &block));
+  ASSERT_EQ(block.size(), 3);
+  EXPECT_TRUE(block[0].HasDecodedImmediates());
+  EXPECT_EQ(std::vector<uint64_t>(block[0].GetImmediates().begin(),
+    block[0].GetImmediates().end()),
+    std::vector<uint64_t>({ 0x4321, 0x10, 0x12345 }));
+  EXPECT_FALSE(block[1].HasDecodedImmediates());
+  ASSERT_EQ(block[1].GetNumberOfOperands(), 2);
+  EXPECT_EQ(block[1].GetOperand(1), "0x5555");
+  ASSERT_TRUE(parsed.GetBasicBlock(0x20, &block));
+  EXPECT_TRUE(block[0].HasDecodedImmediates());
+}
+
+// Blocks are kept sorted by address no matter in which order they are added,
+// replacing a block replaces its instructions, and copies do not depend on
+// the original.
+TEST(flowgraphwithinstructions, instruction_store) {
+  std::unique_ptr<FlowgraphWithInstructions> graph(
+    new FlowgraphWithInstructions());
+  graph->AddInstructions(0x30, { Instruction("ret", {}) });
+  graph->AddInstructions(0x10, { Instruction("mov", { "EAX", "[EBX + 4]" }),
+    Instruction("jmp", { "30" }) });
+  graph->AddInstructions(0x20, { Instruction("nop", {}) });
+  graph->AddInstructions(0x20, { Instruction("add", { "EAX", "1" }) });
+
+  FlowgraphWithInstructions copy(*graph);
+  graph.reset();
+  ASSERT_EQ(copy.GetNumberOfBasicBlocks(), 3);
+  EXPECT_EQ(copy.GetBasicBlock(0).GetAddress(), 0x10);
+  EXPECT_EQ(copy.GetBasicBlock(1).GetAddress(), 0x20);
+  EXPECT_EQ(copy.GetBasicBlock(2).GetAddress(), 0x30);
+
+  BasicBlockView block;
+  EXPECT_FALSE(copy.GetBasicBlock(0x18, &block));
+  ASSERT_TRUE(copy.GetBasicBlock(0x20, &block));
+  ASSERT_EQ(block.size(), 1);
+  EXPECT_EQ(block[0].AsString(), "add EAX, 1");
+
+  ASSERT_TRUE(copy.GetBasicBlock(0x10, &block));
+  std::vector<std::string> rendered;
+  for (InstructionView instruction : block) {
+    rendered.push_back(instruction.AsString());
+  }
+  EXPECT_EQ(rendered, std::vector<std::string>({ "mov EAX, [EBX + 4]",
+    "jmp 30" }));
+  EXPECT_EQ(block[0].GetMnemonic(), "mov");
+  EXPECT_EQ(block[0].GetOperand(1), "[EBX + 4]");
+  EXPECT_EQ(block[0].GetImmediates().size(), 0);
+
+  std::vector<Instruction> instructions;
+  block.GetInstructions(&instructions);
+  ASSERT_EQ(instructions.size(), 2);
+  EXPECT_EQ(instructions[0].GetOperands(), std::vector<std::string>({ "EAX",
+    "[EBX + 4]" }));
+  EXPECT_FALSE(instructions[0].HasDecodedImmediates());
+}
+
+// Feature classes are only extracted when they are asked for, and starting
+// over yields the same features again.
+TEST(flowgraphwithinstructions, lazy_feature_extraction) {
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  FunctionSimHasher mnemonics_only("", disable_graphs | disable_immediates);
+  std::vector<uint64_t> mnemonic_hashes;
+  mnemonics_only.CalculateFunctionSimHash(&generator, 128, &mnemonic_hashes);
+  EXPECT_TRUE(generator.HasExtractedMnemonics());
+  EXPECT_FALSE(generator.HasExtractedGraphlets());
+  EXPECT_FALSE(generator.HasExtractedImmediates());
+
+  FunctionSimHasher hasher("");
+  FunctionSimHasher::SimHash<128> first, second;
+  std::vector<FeatureHash> first_features, second_features;
+  generator.reinit();
+  hasher.CalculateFunctionSimHash<128>(&generator, &first, &first_features);
+  EXPECT_TRUE(generator.HasExtractedGraphlets());
+  EXPECT_TRUE(generator.HasExtractedImmediates());
+  generator.reinit();
+  hasher.CalculateFunctionSimHash<128>(&generator, &second, &second_features);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(first_features, second_features);
+
+  // The same as for a generator that extracts everything on the first pass.
+  FlowgraphWithInstructionsFeatureGenerator fresh(graph);
+  FunctionSimHasher::SimHash<128> expected;
+  std::vector<FeatureHash> expected_features;
+  hasher.CalculateFunctionSimHash<128>(&fresh, &expected, &expected_features);
+  EXPECT_EQ(first, expected);
+  EXPECT_EQ(first_features, expected_features);
+  EXPECT_GT(expected_features.size(), 0);
+
+  generator.reinit();
+  std::vector<uint64_t> mnemonic_hashes_again;
+  mnemonics_only.CalculateFunctionSimHash(&generator, 128,
+    &mnemonic_hashes_again);
+  EXPECT_EQ(mnemonic_hashes, mnemonic_hashes_again);
+}
+
+// A feature class that the hasher disables is never extracted, and the other
+// classes yield the same features as in a hash with all of them enabled.
+TEST(flowgraphwithinstructions, disabled_feature_classes) {
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+
+  FunctionSimHasher hasher("");
+  FlowgraphWithInstructionsFeatureGenerator full(graph);
+  FunctionSimHasher::SimHash<128> simhash;
+  std::vector<FeatureHash> all_features;
+  hasher.CalculateFunctionSimHash<128>(&full, &simhash, &all_features);
+  std::sort(all_features.begin(), all_features.end());
+
+  for (FeatureOptions options : { disable_mnemonics, disable_immediates,
+    disable_mnemonics | disable_immediates }) {
+    FunctionSimHasher restricted("", options);
+    FlowgraphWithInstructionsFeatureGenerator generator(graph);
+    std::vector<FeatureHash> features;
+    restricted.CalculateFunctionSimHash<128>(&generator, &simhash, &features);
+    EXPECT_TRUE(generator.HasExtractedGraphlets());
+    EXPECT_EQ(generator.HasExtractedMnemonics(),
+      !(options & disable_mnemonics));
+    EXPECT_EQ(generator.HasExtractedImmediates(),
+      !(options & disable_immediates));
+
+    // The same features as the hash of a generator that has extracted all
+    // classes.
+    full.reinit();
+    std::vector<FeatureHash> expected;
+    restricted.CalculateFunctionSimHash<128>(&full, &simhash, &expected);
+    EXPECT_EQ(features, expected);
+
+    std::sort(features.begin(), features.end());
+    EXPECT_LT(features.size(), all_features.size());
+    EXPECT_TRUE(std::includes(all_features.begin(), all_features.end(),
+      features.begin(), features.end()));
+  }
+}
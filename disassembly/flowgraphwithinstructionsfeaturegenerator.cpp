@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 
+#include "disassembly/compactflowgraph.hpp"
 #include "disassembly/flowgraph.hpp"
 #include "disassembly/flowgraphwithinstructions.hpp"
 #include "disassembly/extractimmediate.hpp"
@@ -10,122 +11,219 @@
 
 FlowgraphWithInstructionsFeatureGenerator::FlowgraphWithInstructionsFeatureGenerator(
   const FlowgraphWithInstructions& flowgraph) :
-  flowgraph_(new FlowgraphWithInstructions(flowgraph)) {
-  init();
-}
+  flowgraph_(new FlowgraphWithInstructions(flowgraph)),
+  mnem_tuples_built_(false), next_mnem_tuple_(0), immediates_built_(false),
+  immediates_decoded_(false), next_immediate_(0) {}
 
 // Takes ownership of the passed-in unique_ptr<FlowgraphWithInstructions>.
 FlowgraphWithInstructionsFeatureGenerator::FlowgraphWithInstructionsFeatureGenerator(
   std::unique_ptr<FlowgraphWithInstructions> flowgraph) :
-    flowgraph_(std::move(flowgraph)) {
-  init();
-}
+    flowgraph_(std::move(flowgraph)), mnem_tuples_built_(false),
+    next_mnem_tuple_(0), immediates_built_(false), immediates_decoded_(false),
+    next_immediate_(0) {}
 
 void FlowgraphWithInstructionsFeatureGenerator::reinit() {
-  // Fill the internal queues with the features again.
-  init();
+  if (graphlets_) {
+    graphlets_->Reset();
+  }
+  next_mnem_tuple_ = 0;
+  next_immediate_ = 0;
 }
 
-void FlowgraphWithInstructionsFeatureGenerator::init() {
-  std::vector<address> nodes;
-  flowgraph_->GetNodes(&nodes);
-  for (const auto& node : nodes) {
-    nodes_and_distance_.push(std::make_pair(node, 1));
+namespace {
+
+// Graphlets are the subgraphs within distance 1, 2 and 3 of every node, unless
+// they have more than 30 nodes.
+constexpr uint32_t kGraphletMaxDistance = 3;
+constexpr uint32_t kGraphletMaxSize = 30;
+
+void AddImmediateIfUseful(uint64_t immediate,
+  std::vector<uint64_t>* immediates) {
+  // Only consider immediates as useful that are either greater than
+  // 0x4000 or (not divisible by 4 and greater 10). This should remove
+  // most stack offsets.
+  //
+  // These are precisely the heuristics that should be removed by the
+  // machine-learning step, but since the baseline is supposed to work
+  // reasonably well even without the learning step, we need such stuff
+  // here.
+  //
+  // Also removes data structure offsets, though.
+  if ((abs(static_cast<int64_t>(immediate)) > 0x4000) ||
+    ((immediate % 4) && (immediate > 10))) {
+    immediates->push_back(immediate);
   }
-  for (const auto& node : nodes) {
-    nodes_and_distance_.push(std::make_pair(node, 2));
+}
+
+} // namespace
+
+void FlowgraphWithInstructionsFeatureGenerator::EnsureGraphlets() const {
+  if (!graphlets_) {
+    graphlets_.reset(new GraphletEnumerator(CompactFlowgraph(*flowgraph_),
+      kGraphletMaxDistance, kGraphletMaxSize));
   }
-  for (const auto& node : nodes) {
-    nodes_and_distance_.push(std::make_pair(node, 3));
+}
+
+void FlowgraphWithInstructionsFeatureGenerator::EnsureMnemonicNgrams() const {
+  if (!mnem_tuples_built_) {
+    BuildMnemonicNgrams();
+    mnem_tuples_built_ = true;
   }
+}
 
-  BuildMnemonicNgrams();
-  FindImmediateValues();
+void FlowgraphWithInstructionsFeatureGenerator::EnsureImmediateValues(
+  bool decoded) const {
+  if (!immediates_built_ || (immediates_decoded_ != decoded)) {
+    immediates_.clear();
+    FindImmediateValues(decoded);
+    immediates_built_ = true;
+    immediates_decoded_ = decoded;
+  }
 }
 
-void FlowgraphWithInstructionsFeatureGenerator::FindImmediateValues() {
+void FlowgraphWithInstructionsFeatureGenerator::FindImmediateValues(
+  bool decoded) const {
+  std::vector<uint64_t> immediates;
   // Run through all the instructions again.
-  for (const auto& pair : flowgraph_->GetInstructions()) {
+  for (uint32_t block_index = 0;
+    block_index < flowgraph_->GetNumberOfBasicBlocks(); ++block_index) {
+    BasicBlockView block = flowgraph_->GetBasicBlock(block_index);
     // Some disassemblers give us basic blocks with no instructions (DynInst).
-    if (pair.second.size() == 0) {
+    if (block.empty()) {
       continue;
     }
     // Always skip the last instruction in a basic block, as it is a branch
     // and hence does not contain a useful operand.
-    for (uint64_t index = 0; index < pair.second.size()-1; ++index) {
-      const Instruction& instruction = pair.second[index];
-      for (const std::string& operand : instruction.GetOperands()) {
-        std::vector<uint64_t> immediates;
-        ExtractImmediateFromString(operand, &immediates);
+    for (uint32_t index = 0; index < block.size() - 1; ++index) {
+      InstructionView instruction = block[index];
+      // If asked for, immediates decoded by the disassembler are used as they
+      // are; only instructions that have nothing but operand strings (from
+      // JSON or the Python bindings) need to be parsed then.
+      if (decoded && instruction.HasDecodedImmediates()) {
+        for (uint64_t immediate : instruction.GetImmediates()) {
+          AddImmediateIfUseful(immediate, &immediates_);
+        }
+        continue;
+      }
+      for (uint32_t operand = 0; operand < instruction.GetNumberOfOperands();
+        ++operand) {
+        immediates.clear();
+        ExtractImmediateFromString(instruction.GetOperand(operand),
+          &immediates);
         for (uint64_t immediate : immediates) {
-          // Only consider immediates as useful that are either greater than
-          // 0x4000 or (not divisible by 4 and greater 10). This should remove
-          // most stack offsets.
-          //
-          // These are precisely the heuristics that should be removed by the
-          // machine-learning step, but since the baseline is supposed to work
-          // reasonably well even without the learning step, we need such stuff
-          // here.
-          //
-          // Also removes data structure offsets, though.
-          if ((abs(static_cast<int64_t>(immediate)) > 0x4000) ||
-            ((immediate % 4) && (immediate > 10))) {
-            immediates_.push(immediate);
-          }
+          AddImmediateIfUseful(immediate, &immediates_);
         }
       }
     }
   }
 }
 
-void FlowgraphWithInstructionsFeatureGenerator::BuildMnemonicNgrams() {
-  std::vector<std::string> sequence;
-
-  // The map returned from GetInstructions is already sorted by address, so
-  // the instructions will be sorted by address, too.
-  for (const auto& pair : flowgraph_->GetInstructions()) {
-    for (const Instruction& instruction : pair.second) {
-      sequence.push_back(instruction.GetMnemonic());
+void FlowgraphWithInstructionsFeatureGenerator::BuildMnemonicNgrams() const {
+  // The basic blocks are sorted by address, so the instructions will be
+  // sorted by address, too. The tuples are built from a sliding window
+  // instead of a copy of the whole mnemonic sequence.
+  mnem_tuples_.reserve(flowgraph_->GetNumberOfInstructions());
+  uint32_t previous[2] = { 0, 0 };
+  uint64_t count = 0;
+  for (uint32_t block_index = 0;
+    block_index < flowgraph_->GetNumberOfBasicBlocks(); ++block_index) {
+    for (InstructionView instruction :
+      flowgraph_->GetBasicBlock(block_index)) {
+      uint32_t mnemonic = instruction.GetMnemonicId();
+      if (count >= 2) {
+        mnem_tuples_.push_back(std::make_tuple(previous[0], previous[1],
+          mnemonic));
+      }
+      previous[0] = previous[1];
+      previous[1] = mnemonic;
+      ++count;
     }
   }
-
-  // Construct the 3-tuples.
-  for (uint64_t index = 0; index + 2 < sequence.size(); ++index) {
-    mnem_tuples_.push(std::make_tuple(
-      sequence[index],
-      sequence[index+1],
-      sequence[index+2]));
-  }
 }
 
 bool FlowgraphWithInstructionsFeatureGenerator::HasMoreSubgraphs() const {
-  return !nodes_and_distance_.empty();
+  EnsureGraphlets();
+  return graphlets_->HasMore();
 }
 
 std::pair<Flowgraph*, address> FlowgraphWithInstructionsFeatureGenerator
   ::GetNextSubgraph() {
-  address node = nodes_and_distance_.front().first;
-  uint32_t distance = nodes_and_distance_.front().second;
-  nodes_and_distance_.pop();
-  return std::make_pair(flowgraph_->GetSubgraph(node, distance, 30), node);
+  EnsureGraphlets();
+  GraphletView graphlet;
+  address node;
+  if (!graphlets_->GetNext(&graphlet, &node)) {
+    return std::make_pair(nullptr, node);
+  }
+  return std::make_pair(graphlet.ToFlowgraph(), node);
+}
+
+bool FlowgraphWithInstructionsFeatureGenerator::GetNextGraphlet(
+  GraphletView* graphlet) {
+  EnsureGraphlets();
+  while (graphlets_->HasMore()) {
+    if (graphlets_->GetNext(graphlet)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FlowgraphWithInstructionsFeatureGenerator::GetGraphletHashes(
+  uint64_t k0, uint64_t k1, uint64_t k2, std::vector<uint64_t>* hashes) {
+  EnsureGraphlets();
+  graphlets_->CalculateHashes(k0, k1, k2, hashes);
 }
 
 bool FlowgraphWithInstructionsFeatureGenerator::HasMoreMnemonics() const {
-  return !mnem_tuples_.empty();
+  EnsureMnemonicNgrams();
+  return next_mnem_tuple_ < mnem_tuples_.size();
 }
 
 MnemTuple FlowgraphWithInstructionsFeatureGenerator::GetNextMnemTuple() {
-  MnemTuple tuple = mnem_tuples_.front();
-  mnem_tuples_.pop();
-  return tuple;
+  EnsureMnemonicNgrams();
+  return mnem_tuples_[next_mnem_tuple_++];
 }
 
 bool FlowgraphWithInstructionsFeatureGenerator::HasMoreImmediates() const {
-  return !immediates_.empty();
+  EnsureImmediateValues();
+  return next_immediate_ < immediates_.size();
 }
 
 uint64_t FlowgraphWithInstructionsFeatureGenerator::GetNextImmediate() {
-  uint64_t val = immediates_.front();
-  immediates_.pop();
-  return val;
+  EnsureImmediateValues();
+  return immediates_[next_immediate_++];
+}
+
+void FlowgraphWithInstructionsFeatureGenerator::VisitFeatures(
+  FeatureVisitor* visitor) {
+  if (visitor->WantsGraphlets()) {
+    uint64_t keys[3];
+    visitor->GetGraphletHashKeys(keys);
+    EnsureGraphlets();
+    graphlets_->CalculateHashes(keys[0], keys[1], keys[2], &graphlet_hashes_);
+    graphlet_views_.clear();
+    GraphletView graphlet;
+    while (GetNextGraphlet(&graphlet)) {
+      graphlet_views_.push_back(graphlet);
+    }
+    // The hashes cover all graphlets, including those already consumed.
+    if (!graphlet_views_.empty()) {
+      visitor->VisitGraphlets(graphlet_views_.data(), graphlet_hashes_.data() +
+        graphlet_hashes_.size() - graphlet_views_.size(),
+        graphlet_views_.size());
+    }
+  }
+  if (visitor->WantsMnemonics() && HasMoreMnemonics()) {
+    visitor->VisitMnemTuples(mnem_tuples_.data() + next_mnem_tuple_,
+      mnem_tuples_.size() - next_mnem_tuple_);
+    next_mnem_tuple_ = mnem_tuples_.size();
+  }
+  if (visitor->WantsImmediates()) {
+    EnsureImmediateValues(visitor->WantsDecodedImmediates());
+    if (next_immediate_ < immediates_.size()) {
+      visitor->VisitImmediates(immediates_.data() + next_immediate_,
+        immediates_.size() - next_immediate_);
+      next_immediate_ = immediates_.size();
+    }
+  }
 }
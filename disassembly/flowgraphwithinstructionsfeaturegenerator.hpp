@@ -2,11 +2,11 @@
 #define FLOWGRAPHWITHINSTRUCTIONSFEATUREGENERATOR_HPP
 
 #include <map>
-#include <queue>
 #include <vector>
 
 #include "disassembly/flowgraph.hpp"
 #include "disassembly/functionfeaturegenerator.hpp"
+#include "disassembly/graphletenumerator.hpp"
 
 class FlowgraphWithInstructionsFeatureGenerator :
   public FunctionFeatureGenerator {
@@ -17,8 +17,15 @@ public:
   FlowgraphWithInstructionsFeatureGenerator(const FlowgraphWithInstructions&
     flowgraph); 
 
+  // Passes the graphlets, mnemonic tuples and immediates as whole arrays.
+  void VisitFeatures(FeatureVisitor* visitor);
+
   bool HasMoreSubgraphs() const;
   std::pair<Flowgraph*, address> GetNextSubgraph();
+  bool SupportsGraphletViews() const { return true; }
+  bool GetNextGraphlet(GraphletView* graphlet);
+  void GetGraphletHashes(uint64_t k0, uint64_t k1, uint64_t k2,
+    std::vector<uint64_t>* hashes);
 
   bool HasMoreMnemonics() const;
   MnemTuple GetNextMnemTuple();
@@ -26,16 +33,41 @@ public:
   bool HasMoreImmediates() const;
   uint64_t GetNextImmediate();
 
+  // Starts over with the first feature of every class. Features that have
+  // been extracted already are kept.
   void reinit(); 
+
+  // Whether a feature class has been extracted yet.
+  bool HasExtractedGraphlets() const { return graphlets_ != nullptr; }
+  bool HasExtractedMnemonics() const { return mnem_tuples_built_; }
+  bool HasExtractedImmediates() const { return immediates_built_; }
 private:
-  void init();
-  void BuildMnemonicNgrams();
-  void FindImmediateValues();
+  // Each feature class is extracted when it is first asked for, so classes
+  // that the hasher disables are never extracted at all. These are const
+  // because HasMore... are.
+  void EnsureGraphlets() const;
+  void EnsureMnemonicNgrams() const;
+  // Parsed from the operand strings, or - if 'decoded' is set - as decoded
+  // by the disassembler where the instructions have them. Switching between
+  // the two extracts the immediates again.
+  void EnsureImmediateValues(bool decoded = false) const;
+  void BuildMnemonicNgrams() const;
+  void FindImmediateValues(bool decoded) const;
 
   std::unique_ptr<FlowgraphWithInstructions> flowgraph_;
-  std::queue<std::pair<address, uint32_t>> nodes_and_distance_;
-  std::queue<MnemTuple> mnem_tuples_;
-  std::queue<uint64_t> immediates_;
+  mutable std::unique_ptr<GraphletEnumerator> graphlets_;
+  // The features in order; the pull interface hands them out from the
+  // cursors on.
+  mutable bool mnem_tuples_built_;
+  mutable std::vector<MnemTuple> mnem_tuples_;
+  uint64_t next_mnem_tuple_;
+  mutable bool immediates_built_;
+  mutable bool immediates_decoded_;
+  mutable std::vector<uint64_t> immediates_;
+  uint64_t next_immediate_;
+  // The remaining graphlets, collected for VisitFeatures.
+  std::vector<GraphletView> graphlet_views_;
+  std::vector<uint64_t> graphlet_hashes_;
 };
 
 #endif // FLOWGRAPHWITHINSTRUCTIONSFEATUREGENERATOR_HPP
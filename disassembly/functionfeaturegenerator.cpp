@@ -0,0 +1,110 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <vector>
+
+#include "disassembly/compactflowgraph.hpp"
+#include "disassembly/flowgraph.hpp"
+#include "disassembly/functionfeaturegenerator.hpp"
+
+namespace {
+
+// The number of mnemonics and immediates handed over per batch by the default
+// VisitFeatures.
+// The buffers live on the stack, so that visiting does not allocate.
+constexpr uint64_t kBatchSize = 256;
+
+} // namespace
+
+void FunctionFeatureGenerator::VisitFeatures(FeatureVisitor* visitor) {
+  if (visitor->WantsGraphlets()) {
+    uint64_t keys[3];
+    visitor->GetGraphletHashKeys(keys);
+    if (SupportsGraphletViews()) {
+      // The hashes cover all graphlets of the function, the views only those
+      // that have not been consumed yet - the last ones.
+      static thread_local std::vector<GraphletView> graphlets;
+      static thread_local std::vector<uint64_t> hashes;
+      graphlets.clear();
+      GraphletView graphlet;
+      while (GetNextGraphlet(&graphlet)) {
+        graphlets.push_back(graphlet);
+      }
+      GetGraphletHashes(keys[0], keys[1], keys[2], &hashes);
+      uint64_t first_hash = 0;
+      if (hashes.size() >= graphlets.size()) {
+        first_hash = hashes.size() - graphlets.size();
+      } else {
+        // The generator does not provide the hashes.
+        hashes.resize(graphlets.size());
+        for (uint64_t index = 0; index < graphlets.size(); ++index) {
+          hashes[index] = graphlets[index].CalculateHash(keys[0], keys[1],
+            keys[2]);
+        }
+      }
+      if (!graphlets.empty()) {
+        visitor->VisitGraphlets(graphlets.data(), hashes.data() + first_hash,
+          graphlets.size());
+      }
+    } else {
+      // Generators that only provide Flowgraphs: Each graphlet needs a
+      // CompactFlowgraph of its own for the view, so they go one at a time.
+      while (HasMoreSubgraphs()) {
+        std::pair<Flowgraph*, address> graphlet_and_node = GetNextSubgraph();
+        std::unique_ptr<Flowgraph> graphlet(graphlet_and_node.first);
+        if (graphlet) {
+          // Like Flowgraph::CalculateHash, treat a start node that is missing
+          // from the graphlet as an isolated node of it.
+          address node = graphlet_and_node.second;
+          if (!graphlet->HasNode(node)) {
+            graphlet->AddNode(node);
+          }
+          CompactFlowgraph compact(*graphlet);
+          GraphletView view = compact.GetView(compact.GetNode(node));
+          uint64_t hash = view.CalculateHash(keys[0], keys[1], keys[2]);
+          visitor->VisitGraphlets(&view, &hash, 1);
+        }
+      }
+    }
+  }
+  if (visitor->WantsMnemonics()) {
+    MnemTuple tuples[kBatchSize];
+    uint64_t count = 0;
+    while (HasMoreMnemonics()) {
+      tuples[count] = GetNextMnemTuple();
+      if (++count == kBatchSize) {
+        visitor->VisitMnemTuples(tuples, count);
+        count = 0;
+      }
+    }
+    if (count > 0) {
+      visitor->VisitMnemTuples(tuples, count);
+    }
+  }
+  if (visitor->WantsImmediates()) {
+    uint64_t immediates[kBatchSize];
+    uint64_t count = 0;
+    while (HasMoreImmediates()) {
+      immediates[count] = GetNextImmediate();
+      if (++count == kBatchSize) {
+        visitor->VisitImmediates(immediates, count);
+        count = 0;
+      }
+    }
+    if (count > 0) {
+      visitor->VisitImmediates(immediates, count);
+    }
+  }
+}
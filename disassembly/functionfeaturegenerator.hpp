@@ -1,9 +1,15 @@
 #ifndef FUNCTIONFEATUREGENERATOR_HPP
 #define FUNCTIONFEATUREGENERATOR_HPP
 
-typedef std::tuple<std::string, std::string, std::string> MnemTuple;
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+// A mnemonic 3-gram, as IDs from the MnemonicTable.
+typedef std::tuple<uint32_t, uint32_t, uint32_t> MnemTuple;
 typedef uint64_t address;
 class Flowgraph;
+class GraphletView;
 
 // In order to calculate a per-function SimHash, we need something that provides
 // graphlets and mnemonic-3-grams to the calculation. This file defines a simple
@@ -11,11 +17,59 @@ class Flowgraph;
 // infrastructure you are operating on allows de-coupling the disassembler from
 // the hash calculation.
 
+// The receiving end of FunctionFeatureGenerator::VisitFeatures: The generator
+// pushes the features into it in batches of contiguous arrays, with one
+// virtual call per batch instead of several per feature. The arrays are only
+// valid during the call. A feature class may arrive in several batches, but
+// always in the order of the pull interface below, and all graphlets come
+// before all mnemonic tuples, which come before all immediates.
+class FeatureVisitor {
+public:
+  // The feature classes the visitor wants. Generators skip the others.
+  virtual bool WantsGraphlets() const { return true; }
+  virtual bool WantsMnemonics() const { return true; }
+  virtual bool WantsImmediates() const { return true; }
+  // Whether immediates that the disassembler decoded replace the ones parsed
+  // from the operand strings, for generators that have both. The pull
+  // interface below always returns the parsed ones.
+  virtual bool WantsDecodedImmediates() const { return false; }
+  // The keys k0, k1 and k2 of the graphlet hashes passed to VisitGraphlets.
+  virtual void GetGraphletHashKeys(uint64_t* keys) const = 0;
+
+  // 'hashes[i]' is graphlets[i].CalculateHash(k0, k1, k2).
+  virtual void VisitGraphlets(const GraphletView* graphlets,
+    const uint64_t* hashes, uint64_t count) = 0;
+  virtual void VisitMnemTuples(const MnemTuple* tuples, uint64_t count) = 0;
+  virtual void VisitImmediates(const uint64_t* immediates, uint64_t count) = 0;
+  virtual ~FeatureVisitor() {};
+};
+
 class FunctionFeatureGenerator {
 public:
+  // Pushes all remaining features of the wanted classes into 'visitor', and
+  // consumes them as the pull functions below would. The default
+  // implementation is built on the pull functions and hands the mnemonics and
+  // immediates over in batches from fixed-size buffers; generators that keep
+  // their features in arrays anyway can pass those directly.
+  virtual void VisitFeatures(FeatureVisitor* visitor);
+
   // Subgraph-extraction functions.
   virtual bool HasMoreSubgraphs() const = 0;
   virtual std::pair<Flowgraph*, address> GetNextSubgraph() = 0;
+  // The same graphlets as views into the graph of the function, which saves
+  // building a Flowgraph for each one. Generators that support this return
+  // true from SupportsGraphletViews; GetNextGraphlet then skips the graphlets
+  // that GetNextSubgraph returns as nullptr and returns false once there are
+  // no more. Both functions advance through the same sequence.
+  virtual bool SupportsGraphletViews() const { return false; }
+  virtual bool GetNextGraphlet(GraphletView* /*graphlet*/) { return false; }
+  // With graphlet views, also the hashes GraphletView::CalculateHash(k0, k1,
+  // k2) of all graphlets GetNextGraphlet returns, in the same order, no
+  // matter how far it has advanced. This can be cheaper than hashing each
+  // graphlet on its own. Generators that do not provide them leave 'hashes'
+  // empty.
+  virtual void GetGraphletHashes(uint64_t /*k0*/, uint64_t /*k1*/,
+    uint64_t /*k2*/, std::vector<uint64_t>* hashes) { hashes->clear(); }
   // Mnemonics-extraction functions.
   virtual bool HasMoreMnemonics() const = 0;
   virtual MnemTuple GetNextMnemTuple() = 0;
@@ -0,0 +1,153 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "disassembly/graphletenumerator.hpp"
+#include "disassembly/graphletsignature.hpp"
+
+GraphletEnumerator::GraphletEnumerator(const CompactFlowgraph& graph,
+  uint32_t max_distance, uint32_t max_size) : max_distance_(max_distance),
+  max_size_(max_size), number_of_nodes_(graph.GetSize()) {
+  BreadthFirstSearch& search = BreadthFirstSearch::ForThisThread();
+  sizes_.assign(static_cast<uint64_t>(graph.GetSize()) * max_distance_, 0);
+  first_node_.reserve(graph.GetSize() + 1);
+  first_offset_.reserve(graph.GetSize() + 1);
+  node_addresses_.reserve(graph.GetSize());
+  for (uint32_t node = 0; node < graph.GetSize(); ++node) {
+    node_addresses_.push_back(graph.GetAddress(node));
+    EnumerateNode(graph, node, &search);
+  }
+  first_node_.push_back(addresses_.size());
+  first_offset_.push_back(out_offsets_.size());
+  Reset();
+}
+
+void GraphletEnumerator::EnumerateNode(const CompactFlowgraph& graph,
+  uint32_t node, BreadthFirstSearch* search) {
+  // Like Flowgraph::GetSubgraph, give up as soon as there are too many nodes.
+  bool too_large = !search->Search(graph, node, direction_bidirectional,
+    max_distance_, max_size_);
+  NodeRange found = search->GetFound();
+
+  // If the search gave up while looking for the nodes at some distance, the
+  // graphlets of that distance and beyond are too large, and all others are
+  // complete.
+  uint32_t last_distance = search->GetDistance(found.end()[-1]);
+  uint32_t stored = 0;
+  for (uint32_t distance = 1; distance <= max_distance_; ++distance) {
+    if (too_large && (distance >= last_distance)) {
+      break;
+    }
+    while ((stored < found.size()) &&
+      (search->GetDistance(found.begin()[stored]) <= distance)) {
+      ++stored;
+    }
+    sizes_[static_cast<uint64_t>(node) * max_distance_ + distance - 1] = stored;
+  }
+
+  // Store the largest graphlet; the smaller ones are its first few nodes.
+  first_node_.push_back(addresses_.size());
+  first_offset_.push_back(out_offsets_.size());
+  out_offsets_.push_back(out_targets_.size());
+  in_offsets_.push_back(in_sources_.size());
+  for (uint32_t index = 0; index < stored; ++index) {
+    uint32_t parent_node = found.begin()[index];
+    addresses_.push_back(graph.GetAddress(parent_node));
+    // Nodes not found have position kUnreached.
+    for (uint32_t target : graph.GetOutEdges(parent_node)) {
+      if (search->GetPosition(target) < stored) {
+        out_targets_.push_back(search->GetPosition(target));
+      }
+    }
+    for (uint32_t source : graph.GetInEdges(parent_node)) {
+      if (search->GetPosition(source) < stored) {
+        in_sources_.push_back(search->GetPosition(source));
+      }
+    }
+    out_offsets_.push_back(out_targets_.size());
+    in_offsets_.push_back(in_sources_.size());
+  }
+}
+
+bool GraphletEnumerator::GetGraphlet(uint32_t node, uint32_t distance,
+  GraphletView* graphlet) const {
+  uint32_t size = sizes_[static_cast<uint64_t>(node) * max_distance_ +
+    distance - 1];
+  if (size == 0) {
+    return false;
+  }
+  *graphlet = GraphletView(&addresses_[first_node_[node]],
+    &out_offsets_[first_offset_[node]], out_targets_.data(),
+    &in_offsets_[first_offset_[node]], in_sources_.data(), size, 0);
+  return true;
+}
+
+bool GraphletEnumerator::GetNext(GraphletView* graphlet, address* node) {
+  if (node != nullptr) {
+    *node = node_addresses_[node_];
+  }
+  bool found = GetGraphlet(node_, distance_, graphlet);
+  if (++node_ == number_of_nodes_) {
+    node_ = 0;
+    ++distance_;
+  }
+  return found;
+}
+
+void GraphletEnumerator::Reset() {
+  node_ = 0;
+  // A graph without nodes has no graphlets.
+  distance_ = (number_of_nodes_ == 0) ? max_distance_ + 1 : 1;
+}
+
+uint64_t GraphletEnumerator::GetNumberOfGraphlets() const {
+  return sizes_.size() - std::count(sizes_.begin(), sizes_.end(), 0);
+}
+
+void GraphletEnumerator::CalculateHashes(uint64_t k0, uint64_t k1,
+  uint64_t k2, std::vector<uint64_t>* hashes) const {
+  // The index of each graphlet in 'hashes', in the layout of sizes_.
+  static thread_local std::vector<uint32_t> indices;
+  indices.resize(sizes_.size());
+  uint32_t number_of_graphlets = 0;
+  for (uint32_t distance = 1; distance <= max_distance_; ++distance) {
+    for (uint32_t node = 0; node < number_of_nodes_; ++node) {
+      uint64_t index = static_cast<uint64_t>(node) * max_distance_ +
+        distance - 1;
+      if (sizes_[index] != 0) {
+        indices[index] = number_of_graphlets++;
+      }
+    }
+  }
+  hashes->resize(number_of_graphlets);
+
+  static thread_local GraphletSignature signature;
+  signature.TrackHash(k0, k1, k2);
+  GraphletView graphlet;
+  for (uint32_t node = 0; node < number_of_nodes_; ++node) {
+    // Graphlets only get larger with the distance, so the first one that is
+    // too large ends the sequence.
+    for (uint32_t distance = 1; (distance <= max_distance_) &&
+      GetGraphlet(node, distance, &graphlet); ++distance) {
+      if (distance == 1) {
+        signature.Reset(graphlet);
+      } else {
+        signature.Extend(graphlet);
+      }
+      (*hashes)[indices[static_cast<uint64_t>(node) * max_distance_ +
+        distance - 1]] = signature.GetTrackedHash();
+    }
+  }
+}
@@ -0,0 +1,95 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GRAPHLETENUMERATOR_HPP
+#define GRAPHLETENUMERATOR_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "disassembly/breadthfirstsearch.hpp"
+#include "disassembly/compactflowgraph.hpp"
+
+// Enumerates the graphlets of a function: For every distance from 1 to
+// 'max_distance' and every node (by ascending address), the subgraph of all
+// nodes within that distance of the node, in either direction. This is the
+// order in which the feature generator has always produced them, so the
+// SimHashes do not change.
+//
+// Instead of extracting each graphlet separately, the constructor runs one
+// breadth-first search per node up to 'max_distance' and stores the nodes it
+// finds in breadth-first order, along with the edges between them. The
+// graphlet of distance d is then a GraphletView of the nodes found up to
+// distance d. Graphlets with more than 'max_size' nodes are skipped, and the
+// search around a node ends as soon as it gets that large.
+class GraphletEnumerator {
+public:
+  GraphletEnumerator(const CompactFlowgraph& graph, uint32_t max_distance,
+    uint32_t max_size);
+
+  // Whether there are more graphlets, including ones that are too large.
+  bool HasMore() const { return distance_ <= max_distance_; }
+  // Advances to the next graphlet. Returns false if it has more than
+  // 'max_size' nodes, and a view of it otherwise. The view stays valid for
+  // the lifetime of the enumerator. If 'node' is given, it receives the
+  // address of the node the graphlet is centered on in either case.
+  bool GetNext(GraphletView* graphlet, address* node = nullptr);
+  // Starts over with the first graphlet.
+  void Reset();
+
+  // The number of graphlets (of all distances) within the size limit.
+  uint64_t GetNumberOfGraphlets() const;
+
+  // Fills 'hashes' with CalculateHash(k0, k1, k2) of every graphlet within the
+  // size limit, in the order GetNext returns them, independent of how far the
+  // enumeration has advanced. The graphlets around each node are hashed from
+  // the smallest to the largest, each one by extending the signature of the
+  // previous one, so this takes about as long as hashing the largest ones.
+  void CalculateHashes(uint64_t k0, uint64_t k1, uint64_t k2,
+    std::vector<uint64_t>* hashes) const;
+private:
+  // Returns false if the graphlet is too large.
+  bool GetGraphlet(uint32_t node, uint32_t distance, GraphletView* graphlet)
+    const;
+  void EnumerateNode(const CompactFlowgraph& graph, uint32_t node,
+    BreadthFirstSearch* search);
+
+  uint32_t max_distance_;
+  uint32_t max_size_;
+  uint32_t number_of_nodes_;
+  std::vector<address> node_addresses_;
+
+  // The nodes around each node, in breadth-first order, as a compressed
+  // sparse row graph of their own: The nodes around node i start at
+  // addresses_[first_node_[i]], their successor offsets (indices into
+  // out_targets_) at out_offsets_[first_offset_[i]], and the same for their
+  // predecessors. Node indices in out_targets_ and in_sources_ are local to
+  // the graphlet.
+  std::vector<uint32_t> first_node_;
+  std::vector<uint32_t> first_offset_;
+  std::vector<address> addresses_;
+  std::vector<uint32_t> out_offsets_;
+  std::vector<uint32_t> out_targets_;
+  std::vector<uint32_t> in_offsets_;
+  std::vector<uint32_t> in_sources_;
+  // sizes_[i * max_distance_ + d - 1] is the number of nodes within distance
+  // d of node i, or 0 if there are more than max_size_.
+  std::vector<uint32_t> sizes_;
+
+  // The next graphlet.
+  uint32_t distance_;
+  uint32_t node_;
+};
+
+#endif // GRAPHLETENUMERATOR_HPP
@@ -0,0 +1,121 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "disassembly/flowgraphwithinstructions.hpp"
+#include "disassembly/graphletenumerator.hpp"
+
+namespace {
+
+// Checks that the enumerator produces the graphlets of Flowgraph::GetSubgraph
+// for distances 1 to 3, in the same order and with the same hashes.
+void ExpectSameGraphlets(const Flowgraph& original, uint32_t max_size) {
+  Flowgraph graph(original);
+  std::vector<address> nodes;
+  original.GetNodes(&nodes);
+  GraphletEnumerator graphlets(CompactFlowgraph(original), 3, max_size);
+  // Calculated incrementally, in a different order.
+  std::vector<uint64_t> hashes;
+  graphlets.CalculateHashes(5, 7, 11, &hashes);
+  uint64_t number_of_graphlets = 0;
+  for (uint32_t distance = 1; distance <= 3; ++distance) {
+    for (address node : nodes) {
+      ASSERT_TRUE(graphlets.HasMore());
+      std::unique_ptr<Flowgraph> subgraph(graph.GetSubgraph(node, distance,
+        max_size));
+      GraphletView view;
+      address view_node;
+      ASSERT_EQ(graphlets.GetNext(&view, &view_node), subgraph != nullptr);
+      EXPECT_EQ(view_node, node);
+      if (!subgraph) {
+        continue;
+      }
+      ++number_of_graphlets;
+      EXPECT_EQ(view.GetStartAddress(), node);
+      EXPECT_EQ(view.GetSize(), subgraph->GetSize());
+      EXPECT_EQ(view.CalculateHash(), subgraph->CalculateHash(node));
+      EXPECT_EQ(view.CalculateHash(5, 7, 11),
+        subgraph->CalculateHash(node, 5, 7, 11));
+      ASSERT_LT(number_of_graphlets - 1, hashes.size());
+      EXPECT_EQ(hashes[number_of_graphlets - 1],
+        subgraph->CalculateHash(node, 5, 7, 11));
+
+      // The materialized graphlet has the same nodes and edges.
+      std::unique_ptr<Flowgraph> materialized(view.ToFlowgraph());
+      std::vector<address> subgraph_nodes, materialized_nodes;
+      subgraph->GetNodes(&subgraph_nodes);
+      materialized->GetNodes(&materialized_nodes);
+      ASSERT_EQ(materialized_nodes, subgraph_nodes);
+      for (address subgraph_node : subgraph_nodes) {
+        EXPECT_EQ(*materialized->GetOutEdges(subgraph_node),
+          *subgraph->GetOutEdges(subgraph_node));
+      }
+    }
+  }
+  EXPECT_FALSE(graphlets.HasMore());
+  EXPECT_EQ(graphlets.GetNumberOfGraphlets(), number_of_graphlets);
+  EXPECT_EQ(hashes.size(), number_of_graphlets);
+}
+
+} // namespace
+
+TEST(graphletenumerator, matches_flowgraph_on_vp9) {
+  for (const char* filename : {
+    "../testdata/vp9_set_target_rate.clang.nothumb.json",
+    "../testdata/vp9_set_target_rate.clang.with.thumb.json" }) {
+    FlowgraphWithInstructions graph;
+    ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(filename, &graph));
+    ExpectSameGraphlets(graph, 30);
+    ExpectSameGraphlets(graph, 5);
+    ExpectSameGraphlets(graph, 1000);
+  }
+}
+
+TEST(graphletenumerator, matches_flowgraph_on_random_graphs) {
+  std::mt19937_64 random(1);
+  for (uint32_t round = 0; round < 20; ++round) {
+    Flowgraph graph;
+    uint32_t size = 1 + random() % 60;
+    for (uint32_t node = 0; node < size; ++node) {
+      graph.AddNode(0x1000 + 0x10 * node);
+    }
+    for (uint32_t edge = 0; edge < size + random() % size; ++edge) {
+      graph.AddEdge(0x1000 + 0x10 * (random() % size),
+        0x1000 + 0x10 * (random() % size));
+    }
+    ExpectSameGraphlets(graph, 30);
+    ExpectSameGraphlets(graph, 8);
+  }
+}
+
+TEST(graphletenumerator, reset) {
+  Flowgraph graph;
+  graph.AddEdge(0x10, 0x20);
+  GraphletEnumerator graphlets(CompactFlowgraph(graph), 3, 30);
+  GraphletView view;
+  uint32_t count = 0;
+  while (graphlets.HasMore()) {
+    count += graphlets.GetNext(&view);
+  }
+  EXPECT_EQ(count, 6);
+  graphlets.Reset();
+  ASSERT_TRUE(graphlets.GetNext(&view));
+  EXPECT_EQ(view.GetStartAddress(), 0x10);
+
+  GraphletEnumerator empty(CompactFlowgraph(Flowgraph()), 3, 30);
+  EXPECT_FALSE(empty.HasMore());
+}
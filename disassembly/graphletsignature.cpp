@@ -0,0 +1,303 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "disassembly/flowgraphutil.hpp"
+#include "disassembly/graphletsignature.hpp"
+
+namespace {
+
+// The seeds of Flowgraph::CalculateHash.
+constexpr uint64_t kHashSeed = 0x0BADDEED600DDEEDL;
+constexpr uint64_t kPerEdgeHashSeed = 0x600DDEED0BADDEEDL;
+
+// Enough start nodes for a typical function without growing.
+constexpr uint64_t kInitialSignatureSlots = 1024;
+
+} // namespace
+
+void GraphletSignature::Reset(const GraphletView& graphlet) {
+  graphlet_ = graphlet;
+  uint32_t size = graphlet.GetSize();
+  node_values_.assign(kNodeValues * size, 0);
+  distances_.resize(kOrders * size);
+  for (uint32_t source = 0; source < size; ++source) {
+    for (uint32_t target : graphlet.GetOutEdges(source)) {
+      if (target < size) {
+        ++node_values_[kNodeValues * source + kOutdegree];
+        ++node_values_[kNodeValues * target + kIndegree];
+      }
+    }
+  }
+
+  const Direction directions[kOrders] = { direction_down, direction_up,
+    direction_bidirectional };
+  for (uint32_t order = 0; order < kOrders; ++order) {
+    search_.Search(graphlet_, graphlet_.GetStart(), directions[order]);
+    for (uint32_t node = 0; node < size; ++node) {
+      distances_[kOrders * node + order] = search_.GetDistance(node);
+    }
+  }
+  for (uint32_t node = 0; node < size; ++node) {
+    UpdateOrders(node);
+  }
+  if (tracking_) {
+    RecalculateTrackedHash();
+  }
+}
+
+void GraphletSignature::UpdateOrders(uint32_t node) {
+  uint64_t* values = &node_values_[kNodeValues * node];
+  const uint32_t* distances = &distances_[kOrders * node];
+  for (uint32_t order = 0; order < kOrders; ++order) {
+    // Sign-extended, as Flowgraph hashes it.
+    values[order] = (distances[order] == BreadthFirstSearch::kUnreached) ?
+      -1ULL : distances[order];
+  }
+  // Flowgraph only keeps nodes with in-edges (any edges) in the map it walks
+  // backward (in both directions), and unreachable nodes missing from it get
+  // order 0 instead of -1.
+  if ((values[kIndegree] == 0) && (values[kOrderBackward] == -1ULL)) {
+    values[kOrderBackward] = 0;
+  }
+  if ((values[kIndegree] + values[kOutdegree] == 0) &&
+    (values[kOrderBoth] == -1ULL)) {
+    values[kOrderBoth] = 0;
+  }
+}
+
+void GraphletSignature::MarkChanged(uint32_t node) {
+  if (!is_changed_[node]) {
+    is_changed_[node] = true;
+    changed_.push_back(node);
+  }
+}
+
+void GraphletSignature::Relax(uint32_t order, uint32_t from, uint32_t to) {
+  uint32_t distance = distances_[kOrders * from + order];
+  if ((distance != BreadthFirstSearch::kUnreached) &&
+    (distance + 1 < distances_[kOrders * to + order])) {
+    distances_[kOrders * to + order] = distance + 1;
+    worklist_.push_back(kOrders * to + order);
+    MarkChanged(to);
+  }
+}
+
+// New edges can only shorten paths, so the distances are updated by passing
+// on the improvements the new edges bring (like the label-correcting search
+// Flowgraph::GetTopologicalOrder used to do) instead of searching again.
+void GraphletSignature::Extend(const GraphletView& graphlet) {
+  uint32_t old_size = graphlet_.GetSize();
+  uint32_t size = graphlet.GetSize();
+  graphlet_ = graphlet;
+  node_values_.resize(kNodeValues * size, 0);
+  distances_.resize(kOrders * size, BreadthFirstSearch::kUnreached);
+  if (is_changed_.size() < size) {
+    is_changed_.resize(size, false);
+  }
+  changed_.clear();
+  worklist_.clear();
+
+  // The new edges are those with at least one new end.
+  auto add_edge = [&](uint32_t source, uint32_t target) {
+    ++node_values_[kNodeValues * source + kOutdegree];
+    ++node_values_[kNodeValues * target + kIndegree];
+    MarkChanged(source);
+    MarkChanged(target);
+    Relax(kOrderForward, source, target);
+    Relax(kOrderBackward, target, source);
+    Relax(kOrderBoth, source, target);
+    Relax(kOrderBoth, target, source);
+  };
+  for (uint32_t node = old_size; node < size; ++node) {
+    MarkChanged(node);
+    for (uint32_t target : graphlet_.GetOutEdges(node)) {
+      if (target < size) {
+        add_edge(node, target);
+      }
+    }
+    for (uint32_t source : graphlet_.GetInEdges(node)) {
+      if (source < old_size) {
+        add_edge(source, node);
+      }
+    }
+  }
+  for (uint32_t head = 0; head < worklist_.size(); ++head) {
+    uint32_t node = worklist_[head] / kOrders;
+    uint32_t order = worklist_[head] % kOrders;
+    if (order != kOrderBackward) {
+      for (uint32_t target : graphlet_.GetOutEdges(node)) {
+        if (target < size) {
+          Relax(order, node, target);
+        }
+      }
+    }
+    if (order != kOrderForward) {
+      for (uint32_t source : graphlet_.GetInEdges(node)) {
+        if (source < size) {
+          Relax(order, node, source);
+        }
+      }
+    }
+  }
+
+  for (uint32_t node : changed_) {
+    UpdateOrders(node);
+  }
+  if (tracking_) {
+    // A source has to be rehashed if it has new edges or if its values or
+    // those of one of its targets changed.
+    source_hashes_.resize(size, 0);
+    uint32_t number_changed = changed_.size();
+    for (uint32_t index = 0; index < number_changed; ++index) {
+      for (uint32_t source : graphlet_.GetInEdges(changed_[index])) {
+        if (source < size) {
+          MarkChanged(source);
+        }
+      }
+    }
+    for (uint32_t source : changed_) {
+      tracked_hash_ -= source_hashes_[source];
+      source_hashes_[source] = HashSource(source, tracked_seeds_[0],
+        tracked_seeds_[1], tracked_seeds_[2]);
+      tracked_hash_ += source_hashes_[source];
+    }
+  }
+  for (uint32_t node : changed_) {
+    is_changed_[node] = false;
+  }
+}
+
+void GraphletSignature::TrackHash(uint64_t k0, uint64_t k1, uint64_t k2) {
+  tracking_ = true;
+  tracked_seeds_[0] = k0;
+  tracked_seeds_[1] = k1;
+  tracked_seeds_[2] = k2;
+}
+
+void GraphletSignature::RecalculateTrackedHash() {
+  uint32_t size = graphlet_.GetSize();
+  source_hashes_.resize(size);
+  tracked_hash_ = kHashSeed;
+  for (uint32_t source = 0; source < size; ++source) {
+    source_hashes_[source] = HashSource(source, tracked_seeds_[0],
+      tracked_seeds_[1], tracked_seeds_[2]);
+    tracked_hash_ += source_hashes_[source];
+  }
+}
+
+// See Flowgraph::CalculateHash for the structure of the hash.
+uint64_t GraphletSignature::HashSource(uint32_t source, uint64_t k0,
+  uint64_t k1, uint64_t k2) const {
+  uint32_t size = graphlet_.GetSize();
+  const uint64_t* source_values = &node_values_[kNodeValues * source];
+  uint64_t per_edge_hash = kPerEdgeHashSeed;
+  for (uint32_t target : graphlet_.GetOutEdges(source)) {
+    if (target >= size) {
+      continue;
+    }
+    const uint64_t* target_values = &node_values_[kNodeValues * target];
+    per_edge_hash += k0 * source_values[kOrderForward];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k1 * source_values[kOrderBackward];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k2 * source_values[kOrderBoth];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k0 * source_values[kIndegree];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k1 * source_values[kOutdegree];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+
+    per_edge_hash += k2 * target_values[kOrderForward];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k0 * target_values[kOrderBackward];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k1 * target_values[kOrderBoth];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k2 * target_values[kIndegree];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+    per_edge_hash += k0 * target_values[kOutdegree];
+    per_edge_hash = rotl64( per_edge_hash, 7 );
+  }
+  return per_edge_hash;
+}
+
+uint64_t GraphletSignature::CalculateHash(uint64_t k0, uint64_t k1,
+  uint64_t k2) const {
+  uint64_t hash_result = kHashSeed;
+  for (uint32_t source = 0; source < graphlet_.GetSize(); ++source) {
+    hash_result += HashSource(source, k0, k1, k2);
+  }
+  return hash_result;
+}
+
+GraphletSignatures::GraphletSignatures() : epoch_(1), used_(0) {
+  Rehash(kInitialSignatureSlots);
+}
+
+void GraphletSignatures::Clear() {
+  used_ = 0;
+  if (++epoch_ == 0) {
+    // After 2^32 - 1 epochs, stale slots could look current again.
+    for (Slot& slot : slots_) {
+      slot.epoch = 0;
+    }
+    epoch_ = 1;
+  }
+}
+
+void GraphletSignatures::Rehash(uint64_t capacity) {
+  std::vector<Slot> old_slots(capacity, Slot{ 0, 0, 0 });
+  old_slots.swap(slots_);
+  mask_ = capacity - 1;
+  shift_ = 64 - (63 - __builtin_clzll(capacity));
+  for (const Slot& slot : old_slots) {
+    if (slot.epoch != epoch_) {
+      continue;
+    }
+    uint64_t index = SlotIndex(slot.start_address);
+    while (slots_[index].epoch == epoch_) {
+      index = (index + 1) & mask_;
+    }
+    slots_[index] = slot;
+  }
+}
+
+const GraphletSignature& GraphletSignatures::Get(
+  const GraphletView& graphlet) {
+  address start_address = graphlet.GetStartAddress();
+  uint64_t index = SlotIndex(start_address);
+  while ((slots_[index].epoch == epoch_) &&
+    (slots_[index].start_address != start_address)) {
+    index = (index + 1) & mask_;
+  }
+  bool inserted = (slots_[index].epoch != epoch_);
+  if (inserted) {
+    if (2 * (used_ + 1) > slots_.size()) {
+      Rehash(2 * slots_.size());
+      return Get(graphlet);
+    }
+    slots_[index] = Slot{ start_address, used_, epoch_ };
+    if (used_ == signatures_.size()) {
+      signatures_.emplace_back();
+    }
+    ++used_;
+  }
+  GraphletSignature& signature = signatures_[slots_[index].signature];
+  if (!inserted && signature.GetGraphlet().IsPrefixOf(graphlet)) {
+    signature.Extend(graphlet);
+  } else {
+    signature.Reset(graphlet);
+  }
+  return signature;
+}
@@ -0,0 +1,150 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GRAPHLETSIGNATURE_HPP
+#define GRAPHLETSIGNATURE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "disassembly/breadthfirstsearch.hpp"
+#include "disassembly/compactflowgraph.hpp"
+
+// Everything Flowgraph::CalculateHash derives from the structure of a graphlet
+// before the seeds k0, k1 and k2 come in: For every node, the topological
+// order (breadth-first distance from the start node) forward, backward and in
+// both directions, the indegree and the outdegree. The hasher calculates many
+// seeded hashes of each graphlet (its ID, its ID with occurrence count and
+// every 64-bit word of its feature hash), and with the signature each of them
+// is a single pass over the edges.
+//
+// The graphlets of growing radius around a node are nested, so a signature
+// can also be extended from one to the next: Extend() only looks at the edges
+// that are new, updates the orders and degrees they change, and keeps one
+// hash (see TrackHash) up to date by rehashing only the edges of the sources
+// affected. The hash is a sum over sources, so the others stay as they are.
+//
+// A signature is meant to be reused for many graphlets; Reset() keeps the
+// memory, so no allocations happen once the largest graphlet has been seen.
+class GraphletSignature {
+public:
+  GraphletSignature() : tracking_(false), tracked_hash_(0) {}
+  explicit GraphletSignature(const GraphletView& graphlet) :
+    tracking_(false), tracked_hash_(0) {
+    Reset(graphlet);
+  }
+
+  void Reset(const GraphletView& graphlet);
+  // Moves on to a graphlet that contains the current one as its first
+  // GetSize() nodes (with the same start node and the same edges among
+  // them), like the views of a GraphletEnumerator around the same node.
+  void Extend(const GraphletView& graphlet);
+  const GraphletView& GetGraphlet() const { return graphlet_; }
+
+  // Identical to GraphletView::CalculateHash (and Flowgraph::CalculateHash) of
+  // the graphlet.
+  uint64_t CalculateHash(uint64_t k0 = 0xc3a5c85c97cb3127ULL,
+    uint64_t k1 = 0xb492b66fbe98f273ULL,
+    uint64_t k2 = 0x9ae16a3b2f90404fULL) const;
+
+  // From the next Reset() on, keeps CalculateHash(k0, k1, k2) up to date as
+  // GetTrackedHash(), incrementally through Extend().
+  void TrackHash(uint64_t k0, uint64_t k1, uint64_t k2);
+  uint64_t GetTrackedHash() const { return tracked_hash_; }
+private:
+  // The values hashed for each end of an edge, in the order they are hashed
+  // for the source. The orders come first, in the order of 'distances_'.
+  enum NodeValue {
+    kOrderForward,
+    kOrderBackward,
+    kOrderBoth,
+    kIndegree,
+    kOutdegree,
+    kNodeValues
+  };
+  static constexpr uint32_t kOrders = kIndegree;
+
+  // Brings the hashed orders of a node in line with its distances and
+  // degrees.
+  void UpdateOrders(uint32_t node);
+  // Lowers the distance of 'to' in order 'order' if the edge from 'from'
+  // gives a shorter path, and queues it to pass that on.
+  void Relax(uint32_t order, uint32_t from, uint32_t to);
+  void MarkChanged(uint32_t node);
+  // The hash of the edges of one source, which CalculateHash sums up.
+  uint64_t HashSource(uint32_t source, uint64_t k0, uint64_t k1, uint64_t k2)
+    const;
+  void RecalculateTrackedHash();
+
+  GraphletView graphlet_;
+  // kNodeValues values per node.
+  std::vector<uint64_t> node_values_;
+  // kOrders distances from the start node per node, or
+  // BreadthFirstSearch::kUnreached.
+  std::vector<uint32_t> distances_;
+  BreadthFirstSearch search_;
+
+  bool tracking_;
+  uint64_t tracked_seeds_[3];
+  uint64_t tracked_hash_;
+  std::vector<uint64_t> source_hashes_;
+
+  // Scratch space for Extend(): Whether each node is in 'changed_', the
+  // nodes whose values changed, and (node, order) pairs whose shorter
+  // distance still has to be passed on.
+  std::vector<bool> is_changed_;
+  std::vector<uint32_t> changed_;
+  std::vector<uint32_t> worklist_;
+};
+
+// The signatures of a batch of graphlets, one per start node: A graphlet that
+// extends the previous one around its start node (see GraphletView::IsPrefixOf)
+// extends its signature, any other graphlet resets it. This way the graphlets
+// of growing radius around each node are only searched once, in whatever order
+// they arrive. The graphlets have to stay valid until the next Clear().
+class GraphletSignatures {
+public:
+  GraphletSignatures();
+
+  void Clear();
+  // The signature of the graphlet, valid until the next call.
+  const GraphletSignature& Get(const GraphletView& graphlet);
+private:
+  // The index in 'signatures_' of a start node seen since Clear(). Like in
+  // FeatureCounter, slots of an earlier epoch are empty, so that clearing
+  // keeps the table - one per thread - and does not allocate once it is
+  // large enough for the biggest function seen so far.
+  struct Slot {
+    address start_address;
+    uint32_t signature;
+    uint32_t epoch;
+  };
+
+  inline uint64_t SlotIndex(address start_address) const {
+    return (start_address * 0x9E3779B97F4A7C15ULL) >> shift_;
+  }
+  void Rehash(uint64_t capacity);
+
+  std::vector<Slot> slots_;
+  uint64_t mask_;
+  uint32_t shift_;
+  // Epoch zero is never current.
+  uint32_t epoch_;
+  // Kept across Clear() for their memory; a deque does not move them.
+  std::deque<GraphletSignature> signatures_;
+  uint32_t used_;
+};
+
+#endif // GRAPHLETSIGNATURE_HPP
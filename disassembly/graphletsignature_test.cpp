@@ -0,0 +1,230 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "disassembly/compactflowgraph.hpp"
+#include "disassembly/flowgraphwithinstructions.hpp"
+#include "disassembly/graphletenumerator.hpp"
+#include "disassembly/graphletsignature.hpp"
+
+namespace {
+
+// Checks that one signature per graphlet reproduces Flowgraph::CalculateHash
+// for several seeds, with the signature reused across graphlets.
+void ExpectSameHashes(const Flowgraph& original) {
+  Flowgraph graph(original);
+  GraphletEnumerator graphlets(CompactFlowgraph(original), 3, 30);
+  GraphletSignature signature;
+  GraphletView graphlet;
+  uint32_t distance = 1;
+  std::vector<address> nodes;
+  original.GetNodes(&nodes);
+  uint32_t index = 0;
+  while (graphlets.HasMore()) {
+    address node;
+    bool found = graphlets.GetNext(&graphlet, &node);
+    ASSERT_EQ(node, nodes[index]);
+    std::unique_ptr<Flowgraph> subgraph(graph.GetSubgraph(node, distance, 30));
+    ASSERT_EQ(found, subgraph != nullptr);
+    if (found) {
+      signature.Reset(graphlet);
+      EXPECT_EQ(signature.GetGraphlet().GetStartAddress(), node);
+      EXPECT_EQ(signature.CalculateHash(), subgraph->CalculateHash(node));
+      for (uint64_t seed = 1; seed < 5; ++seed) {
+        EXPECT_EQ(signature.CalculateHash(seed, seed * 3, seed * 7),
+          subgraph->CalculateHash(node, seed, seed * 3, seed * 7));
+      }
+      EXPECT_EQ(graphlet.CalculateHash(1, 2, 3),
+        signature.CalculateHash(1, 2, 3));
+    }
+    if (++index == nodes.size()) {
+      index = 0;
+      ++distance;
+    }
+  }
+}
+
+// A random graph in the compressed sparse row form of GraphletView, so that
+// views of any prefix of its nodes can be taken.
+struct RandomGraph {
+  explicit RandomGraph(std::mt19937_64* random) {
+    uint32_t size = 1 + (*random)() % 30;
+    std::vector<std::vector<uint32_t>> out_edges(size), in_edges(size);
+    for (uint32_t edge = 0; edge < 2 * size; ++edge) {
+      uint32_t source = (*random)() % size;
+      uint32_t target = (*random)() % size;
+      out_edges[source].push_back(target);
+      in_edges[target].push_back(source);
+    }
+    out_offsets.push_back(0);
+    in_offsets.push_back(0);
+    for (uint32_t node = 0; node < size; ++node) {
+      addresses.push_back(0x1000 + 0x10 * node);
+      out_targets.insert(out_targets.end(), out_edges[node].begin(),
+        out_edges[node].end());
+      in_sources.insert(in_sources.end(), in_edges[node].begin(),
+        in_edges[node].end());
+      out_offsets.push_back(out_targets.size());
+      in_offsets.push_back(in_sources.size());
+    }
+  }
+  GraphletView GetView(uint32_t size) const {
+    return GraphletView(addresses.data(), out_offsets.data(),
+      out_targets.data(), in_offsets.data(), in_sources.data(), size, 0);
+  }
+
+  std::vector<address> addresses;
+  std::vector<uint32_t> out_offsets;
+  std::vector<uint32_t> out_targets;
+  std::vector<uint32_t> in_offsets;
+  std::vector<uint32_t> in_sources;
+};
+
+void ExpectSameSignatures(const GraphletSignature& extended,
+  const GraphletSignature& reset) {
+  EXPECT_EQ(extended.CalculateHash(), reset.CalculateHash());
+  EXPECT_EQ(extended.CalculateHash(1, 2, 3), reset.CalculateHash(1, 2, 3));
+  EXPECT_EQ(extended.GetTrackedHash(), reset.CalculateHash(3, 5, 7));
+}
+
+} // namespace
+
+TEST(graphletsignature, matches_flowgraph_on_vp9) {
+  for (const char* filename : {
+    "../testdata/vp9_set_target_rate.clang.nothumb.json",
+    "../testdata/vp9_set_target_rate.clang.with.thumb.json" }) {
+    FlowgraphWithInstructions graph;
+    ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(filename, &graph));
+    ExpectSameHashes(graph);
+  }
+}
+
+TEST(graphletsignature, matches_flowgraph_on_random_graphs) {
+  std::mt19937_64 random(2);
+  for (uint32_t round = 0; round < 20; ++round) {
+    // Self-loops, duplicate edges and isolated nodes exercise the corner cases
+    // of the orders and degrees.
+    Flowgraph graph;
+    uint32_t size = 1 + random() % 40;
+    for (uint32_t node = 0; node < size; ++node) {
+      graph.AddNode(0x1000 + 0x10 * node);
+    }
+    for (uint32_t edge = 0; edge < size + random() % size; ++edge) {
+      graph.AddEdge(0x1000 + 0x10 * (random() % size),
+        0x1000 + 0x10 * (random() % size));
+    }
+    ExpectSameHashes(graph);
+  }
+}
+
+TEST(graphletsignature, extend_by_radius) {
+  for (const char* filename : {
+    "../testdata/vp9_set_target_rate.clang.nothumb.json",
+    "../testdata/vp9_set_target_rate.clang.with.thumb.json" }) {
+    FlowgraphWithInstructions graph;
+    ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(filename, &graph));
+    CompactFlowgraph compact(graph);
+    GraphletEnumerator graphlets(compact, 3, 30);
+    // The views around each node, by distance.
+    std::vector<std::vector<GraphletView>> views(compact.GetSize());
+    for (uint32_t distance = 1; distance <= 3; ++distance) {
+      for (uint32_t node = 0; node < compact.GetSize(); ++node) {
+        GraphletView view;
+        if (graphlets.GetNext(&view)) {
+          views[node].push_back(view);
+        }
+      }
+    }
+    GraphletSignature extended;
+    extended.TrackHash(3, 5, 7);
+    for (const auto& node_views : views) {
+      for (uint32_t index = 0; index < node_views.size(); ++index) {
+        if (index == 0) {
+          extended.Reset(node_views[index]);
+        } else {
+          extended.Extend(node_views[index]);
+        }
+        ExpectSameSignatures(extended, GraphletSignature(node_views[index]));
+      }
+    }
+  }
+}
+
+TEST(graphletsignature, extend_by_node) {
+  std::mt19937_64 random(3);
+  GraphletSignature extended;
+  extended.TrackHash(3, 5, 7);
+  for (uint32_t round = 0; round < 50; ++round) {
+    // Adding nodes in arbitrary order makes new paths that shorten the
+    // distances of nodes that are already there, or reach them at all.
+    RandomGraph graph(&random);
+    extended.Reset(graph.GetView(1));
+    ExpectSameSignatures(extended, GraphletSignature(graph.GetView(1)));
+    for (uint32_t size = 2; size <= graph.addresses.size(); ++size) {
+      extended.Extend(graph.GetView(size));
+      ExpectSameSignatures(extended, GraphletSignature(graph.GetView(size)));
+    }
+    // Several nodes at once.
+    extended.Reset(graph.GetView(1));
+    extended.Extend(graph.GetView(graph.addresses.size()));
+    ExpectSameSignatures(extended, GraphletSignature(graph.GetView(
+      graph.addresses.size())));
+  }
+}
+
+TEST(graphletsignature, signatures_by_start_node) {
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+  CompactFlowgraph compact(graph);
+  GraphletEnumerator graphlets(compact, 3, 30);
+  // The views arrive by distance, so the views around one node are
+  // interleaved with those around all others.
+  std::vector<GraphletView> views;
+  GraphletView view;
+  while (graphlets.HasMore()) {
+    if (graphlets.GetNext(&view)) {
+      views.push_back(view);
+    }
+  }
+  uint32_t next = 1;
+  while ((next < views.size()) &&
+    (views[next].GetStartAddress() != views[0].GetStartAddress())) {
+    ++next;
+  }
+  ASSERT_LT(next, views.size());
+  EXPECT_TRUE(views[0].IsPrefixOf(views[next]));
+  EXPECT_FALSE(views[next].IsPrefixOf(views[0]));
+  EXPECT_FALSE(views[0].IsPrefixOf(views[1]));
+
+  GraphletSignatures signatures;
+  for (uint32_t round = 0; round < 2; ++round) {
+    signatures.Clear();
+    for (const GraphletView& graphlet : views) {
+      const GraphletSignature& signature = signatures.Get(graphlet);
+      GraphletSignature reset(graphlet);
+      EXPECT_EQ(signature.GetGraphlet().GetSize(), graphlet.GetSize());
+      EXPECT_EQ(signature.CalculateHash(), reset.CalculateHash());
+      EXPECT_EQ(signature.CalculateHash(1, 2, 3), reset.CalculateHash(1, 2, 3));
+    }
+  }
+  // A graphlet that does not extend the previous one around its node starts
+  // over.
+  const GraphletSignature& smaller = signatures.Get(views[0]);
+  EXPECT_EQ(smaller.CalculateHash(),
+    GraphletSignature(views[0]).CalculateHash());
+}
@@ -0,0 +1,119 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "disassembly/mnemonictable.hpp"
+#include "util/portablehash.hpp"
+
+namespace {
+
+struct Entry {
+  std::string mnemonic;
+  uint64_t hash;
+  uint64_t portable_hash;
+};
+
+// Entries live in segments that are allocated on demand, so that adding an
+// entry never moves existing ones while other threads read them. Segment s
+// holds kFirstSegmentSize << s entries, so a few dozen segments cover every
+// uint32_t ID, and the segment of an ID is found from its highest bit.
+constexpr uint32_t kFirstSegmentBits = 10;
+constexpr uint64_t kFirstSegmentSize = 1ULL << kFirstSegmentBits;
+constexpr uint32_t kSegments = 33 - kFirstSegmentBits;
+
+struct Table {
+  std::shared_mutex mutex;
+  std::unordered_map<std::string, uint32_t> ids;
+  std::atomic<Entry*> segments[kSegments] = {};
+  std::atomic<uint32_t> size{ 0 };
+};
+
+Table& GetTable() {
+  // Intentionally leaked: Instructions may be destroyed during static
+  // destruction.
+  static Table* table = new Table();
+  return *table;
+}
+
+// The segment of an ID and the index of the ID within it.
+inline void LocateEntry(uint32_t id, uint32_t* segment, uint64_t* index) {
+  uint64_t position = id + kFirstSegmentSize;
+  *segment = 63 - __builtin_clzll(position) - kFirstSegmentBits;
+  *index = position - (kFirstSegmentSize << *segment);
+}
+
+inline const Entry& GetEntry(uint32_t id) {
+  uint32_t segment;
+  uint64_t index;
+  LocateEntry(id, &segment, &index);
+  return GetTable().segments[segment].load(std::memory_order_acquire)[index];
+}
+
+} // namespace
+
+uint32_t MnemonicTable::Intern(const std::string& mnemonic) {
+  Table& table = GetTable();
+  {
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    auto iter = table.ids.find(mnemonic);
+    if (iter != table.ids.end()) {
+      return iter->second;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(table.mutex);
+  auto iter = table.ids.find(mnemonic);
+  if (iter != table.ids.end()) {
+    return iter->second;
+  }
+  uint32_t id = table.size.load(std::memory_order_relaxed);
+  if (id == UINT32_MAX) {
+    throw std::length_error("Too many distinct mnemonics");
+  }
+  uint32_t segment_index;
+  uint64_t index;
+  LocateEntry(id, &segment_index, &index);
+  Entry* segment = table.segments[segment_index].load(
+    std::memory_order_relaxed);
+  if (segment == nullptr) {
+    segment = new Entry[kFirstSegmentSize << segment_index];
+    table.segments[segment_index].store(segment, std::memory_order_release);
+  }
+  segment[index] = Entry{ mnemonic, std::hash<std::string>{}(mnemonic),
+    PortableHashBytes(mnemonic.data(), mnemonic.size(), 0) };
+  table.ids[mnemonic] = id;
+  table.size.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+const std::string& MnemonicTable::GetMnemonic(uint32_t id) {
+  return GetEntry(id).mnemonic;
+}
+
+uint64_t MnemonicTable::GetHash(uint32_t id) {
+  return GetEntry(id).hash;
+}
+
+uint64_t MnemonicTable::GetPortableHash(uint32_t id) {
+  return GetEntry(id).portable_hash;
+}
+
+uint32_t MnemonicTable::GetSize() {
+  return GetTable().size.load(std::memory_order_acquire);
+}
@@ -0,0 +1,50 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MNEMONICTABLE_HPP
+#define MNEMONICTABLE_HPP
+
+#include <cstdint>
+#include <string>
+
+// Process-wide table that interns instruction mnemonics to small integer IDs.
+// Mnemonics are interned once, when an Instruction is created during
+// disassembly; afterwards mnemonic n-grams are triples of IDs, and the
+// string hashes of every mnemonic (which go into the mnemonic feature hashes)
+// are computed only once.
+//
+// Interning takes a lock, but looking up the string or hash for an ID does
+// not: Entries are never moved or removed once they have been added.
+//
+// Every distinct mnemonic gets an ID of its own, however many there are, so
+// the features of a function never depend on what was interned before. The
+// table only runs out of IDs after 2^32 - 1 mnemonics; Intern then throws
+// std::length_error.
+class MnemonicTable {
+public:
+  // Returns the ID of the mnemonic, adding it on first use.
+  static uint32_t Intern(const std::string& mnemonic);
+
+  // The ID has to be one that Intern() returned.
+  static const std::string& GetMnemonic(uint32_t id);
+  // Returns std::hash<std::string> of the mnemonic.
+  static uint64_t GetHash(uint32_t id);
+  // Returns PortableHashBytes() of the mnemonic with seed zero.
+  static uint64_t GetPortableHash(uint32_t id);
+
+  // The number of entries in the table.
+  static uint32_t GetSize();
+};
+
+#endif // MNEMONICTABLE_HPP
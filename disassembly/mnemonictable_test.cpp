@@ -0,0 +1,84 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "disassembly/flowgraph.hpp"
+#include "disassembly/mnemonictable.hpp"
+
+TEST(mnemonictable, intern_and_lookup) {
+  uint32_t mov = MnemonicTable::Intern("mov");
+  uint32_t add = MnemonicTable::Intern("add");
+  EXPECT_NE(mov, add);
+  EXPECT_EQ(MnemonicTable::Intern("mov"), mov);
+  EXPECT_EQ(MnemonicTable::GetMnemonic(add), "add");
+  // Mnemonic feature hashes depend on the string hash, so it must not change.
+  EXPECT_EQ(MnemonicTable::GetHash(mov), std::hash<std::string>{}("mov"));
+  EXPECT_EQ(MnemonicTable::GetPortableHash(mov), 0xecd3c77e594ff2d5ULL);
+
+  Instruction instruction("add", { "eax", "ebx" });
+  EXPECT_EQ(instruction.GetMnemonicId(), add);
+}
+
+TEST(mnemonictable, distinct_ids) {
+  // Long mnemonics and mnemonics beyond the first segments of the table keep
+  // IDs and hashes of their own.
+  std::string long_mnemonic(67, 'x');
+  uint32_t id = MnemonicTable::Intern(long_mnemonic);
+  EXPECT_EQ(MnemonicTable::GetMnemonic(id), long_mnemonic);
+  EXPECT_EQ(MnemonicTable::GetHash(id),
+    std::hash<std::string>{}(long_mnemonic));
+
+  std::vector<uint32_t> ids;
+  for (uint32_t index = 0; index < 5000; ++index) {
+    ids.push_back(MnemonicTable::Intern("m" + std::to_string(index)));
+  }
+  EXPECT_GE(MnemonicTable::GetSize(), 5000);
+  for (uint32_t index = 0; index < 5000; ++index) {
+    std::string mnemonic = "m" + std::to_string(index);
+    EXPECT_EQ(MnemonicTable::Intern(mnemonic), ids[index]);
+    EXPECT_EQ(MnemonicTable::GetMnemonic(ids[index]), mnemonic);
+    EXPECT_EQ(MnemonicTable::GetHash(ids[index]),
+      std::hash<std::string>{}(mnemonic));
+  }
+}
+
+TEST(mnemonictable, concurrent_interning) {
+  // More mnemonics than fit into one chunk of the table.
+  const uint32_t mnemonics = 3000;
+  std::vector<std::vector<uint32_t>> ids(4);
+  std::vector<std::thread> threads;
+  for (uint32_t thread = 0; thread < ids.size(); ++thread) {
+    threads.emplace_back([&ids, thread, mnemonics]() {
+      for (uint32_t index = 0; index < mnemonics; ++index) {
+        ids[thread].push_back(MnemonicTable::Intern(
+          "test" + std::to_string((index + thread * 7) % mnemonics)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (uint32_t thread = 0; thread < ids.size(); ++thread) {
+    for (uint32_t index = 0; index < mnemonics; ++index) {
+      EXPECT_EQ(MnemonicTable::GetMnemonic(ids[thread][index]),
+        "test" + std::to_string((index + thread * 7) % mnemonics));
+    }
+  }
+  EXPECT_GE(MnemonicTable::GetSize(), mnemonics);
+}
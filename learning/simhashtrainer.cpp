@@ -20,11 +20,13 @@ SimHashTrainer::SimHashTrainer(
   const std::vector<FunctionFeatures>* all_functions,
   const std::vector<FeatureHash>* all_features,
   const std::vector<std::pair<uint32_t, uint32_t>>* attractionset,
-  const std::vector<std::pair<uint32_t, uint32_t>>* repulsionset) :
+  const std::vector<std::pair<uint32_t, uint32_t>>* repulsionset,
+  HasherVersion hasher_version) :
   all_functions_(all_functions),
   all_features_(all_features),
   attractionset_(attractionset),
-  repulsionset_(repulsionset) {};
+  repulsionset_(repulsionset),
+  hasher_version_(hasher_version) {};
 
 void SimHashTrainer::AddPairLossTerm(const std::pair<uint32_t, uint32_t>& pair,
   spii::Function* function,
@@ -70,12 +72,17 @@ void SimHashTrainer::AddPairLossTerm(const std::pair<uint32_t, uint32_t>& pair,
 
 bool WriteWeightsFile(const std::string& outputfile,
   const std::vector<FeatureHash>& all_features_vector,
-  const std::vector<double>& weights) {
+  const std::vector<double>& weights, HasherVersion hasher_version) {
   std::ofstream outfile(outputfile);
   if (!outfile) {
     printf("Failed to open outputfile %s.\n", outputfile.c_str());
     return false;
   }
+  // Legacy weights files have no version line, keep it that way.
+  if (hasher_version != HasherVersion::kLegacy) {
+    outfile << "hasher_version " << HasherVersionName(hasher_version)
+      << std::endl;
+  }
   for (uint32_t i = 0; i < all_features_vector.size(); ++i) {
     char buf[512];
     const FeatureHash& hash = all_features_vector[i];
@@ -142,7 +149,8 @@ void SimHashTrainer::Train(std::vector<double>* output_weights,
           for (uint32_t index = 0; index < number_of_weights; ++index) {
             (*output_weights)[index] = weights[index][0];
           }
-          WriteWeightsFile(snapshotfile, *all_features_, *output_weights);
+          WriteWeightsFile(snapshotfile, *all_features_, *output_weights,
+            hasher_version_);
         }
         return true;
       };
@@ -158,7 +166,8 @@ void SimHashTrainer::Train(std::vector<double>* output_weights,
 }
 
 bool TrainSimHashFromDataDirectory(const std::string& directory, const
-  std::string& outputfile, bool use_lbfgs, uint32_t max_steps) {
+  std::string& outputfile, bool use_lbfgs, uint32_t max_steps,
+  HasherVersion hasher_version) {
   std::vector<FunctionFeatures> all_functions;
   std::vector<FeatureHash> all_features_vector;
   std::vector<std::pair<uint32_t, uint32_t>> attractionset;
@@ -178,7 +187,8 @@ bool TrainSimHashFromDataDirectory(const std::string& directory, const
     &all_functions,
     &all_features_vector,
     &attractionset,
-    &repulsionset);
+    &repulsionset,
+    hasher_version);
 
   std::unique_ptr<spii::Solver> solver;
   if (use_lbfgs) {
@@ -191,7 +201,8 @@ bool TrainSimHashFromDataDirectory(const std::string& directory, const
   std::vector<double> weights;
   trainer.Train(&weights, solver.get());
 
-  return WriteWeightsFile(outputfile, all_features_vector, weights);
+  return WriteWeightsFile(outputfile, all_features_vector, weights,
+    hasher_version);
 }
 
 
@@ -3,13 +3,16 @@
 
 #include <spii/function.h>
 
+#include "searchbackend/hasherversion.hpp"
 #include "util/util.hpp"
 
 // Convenience function. Expects the data described in LoadTrainingData, outputs
-// a file full of weights.
+// a file full of weights. The features in the data have to be hashed with
+// 'hasher_version', which is recorded in the weights file.
 bool TrainSimHashFromDataDirectory(const std::string& directory,
   const std::string& weights_filename, bool use_lbfgs=true, 
-  uint32_t max_steps=100);
+  uint32_t max_steps=100,
+  HasherVersion hasher_version = HasherVersion::kLegacy);
 
 class SimHashTrainer {
 public:
@@ -17,7 +20,8 @@ public:
     const std::vector<FunctionFeatures>* all_functions,
     const std::vector<FeatureHash>* all_features,
     const std::vector<std::pair<uint32_t, uint32_t>>* attractionset,
-    const std::vector<std::pair<uint32_t, uint32_t>>* repulsionset);
+    const std::vector<std::pair<uint32_t, uint32_t>>* repulsionset,
+    HasherVersion hasher_version = HasherVersion::kLegacy);
 
   void Train(std::vector<double>* weights, spii::Solver* solver,
     const std::string& snapshot_directory = "./");
@@ -33,6 +37,8 @@ private:
   const std::vector<FeatureHash>* all_features_;
   const std::vector<std::pair<uint32_t, uint32_t>>* attractionset_;
   const std::vector<std::pair<uint32_t, uint32_t>>* repulsionset_;
+  // Written into the snapshots.
+  HasherVersion hasher_version_;
 };
 
 #endif // SIMHASHTRAINER_HPP
@@ -1,5 +1,6 @@
 #include <spii/solver.h>
 #include "gtest/gtest.h"
+#include "searchbackend/featureweights.hpp"
 #include "searchbackend/functionsimhash.hpp"
 #include "sgdsolver.hpp"
 #include "learning/simhashtrainer.hpp"
@@ -319,3 +320,20 @@ TEST(simhashtrainer, full_training) {
   EXPECT_TRUE((untrained_max - trained_max > 10));
 }
 
+// The weights file records the hash family of the training data.
+TEST(simhashtrainer, hasher_version) {
+  ASSERT_TRUE(TrainSimHashFromDataDirectory(
+    "../testdata/train_simple_attraction", "/tmp/legacy_weights.txt", true,
+    1));
+  FeatureWeights legacy;
+  ASSERT_TRUE(legacy.Load("/tmp/legacy_weights.txt"));
+  EXPECT_EQ(legacy.GetHasherVersion(), HasherVersion::kLegacy);
+
+  ASSERT_TRUE(TrainSimHashFromDataDirectory(
+    "../testdata/train_simple_attraction", "/tmp/portable_weights.txt", true,
+    1, HasherVersion::kPortable));
+  FeatureWeights portable;
+  ASSERT_TRUE(portable.Load("/tmp/portable_weights.txt"));
+  EXPECT_EQ(portable.GetHasherVersion(), HasherVersion::kPortable);
+  EXPECT_EQ(portable.size(), legacy.size());
+}
@@ -5,6 +5,10 @@
 // The Python bindings, all in one file. Please refer to ./pybindings/README.md
 // for details about the provided API and more commentary.
 
+#include <algorithm>
+#include <memory>
+#include <thread>
+
 #include "disassembly/flowgraphutil.hpp"
 #include "disassembly/flowgraphwithinstructions.hpp"
 #include "disassembly/flowgraphwithinstructionsfeaturegenerator.hpp"
@@ -285,24 +289,40 @@ static int PySimHasher_init(PySimHasher* self, PyObject* args, PyObject *kwds) {
     (char*)"mnem_weight",
     (char*)"graphlet_weight",
     (char*)"immediate_weight",
+    (char*)"hasher_version",
     NULL };
   double mnem_weight = FunctionSimHasher::kMnemonicDefaultWeight;
   double graphlet_weight = FunctionSimHasher::kGraphletDefaultWeight;
   double immediate_weight = FunctionSimHasher::kImmediateDefaultWeight;
 
   char* weightsfile = (char*)"weights.txt";
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sddd", kwlist, &weightsfile,
-      &mnem_weight, &graphlet_weight, &immediate_weight)) {
+  // Has to match the version of the weights and of the search index the
+  // hashes are used with.
+  char* hasher_version_name = (char*)"legacy";
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sddds", kwlist, &weightsfile,
+      &mnem_weight, &graphlet_weight, &immediate_weight,
+      &hasher_version_name)) {
     PyErr_SetString(functionsimsearch_error, "Failed to convert arguments.");
     return NULL;
   }
+  HasherVersion hasher_version;
+  if (!ParseHasherVersion(hasher_version_name, &hasher_version)) {
+    PyErr_SetString(functionsimsearch_error, "Unknown hasher version.");
+    return -1;
+  }
   // Debug code to enable logging.
   FeatureOptions feature_options = default_features;
   FeatureLoggingOptions logging_options = default_logging;
 
   // End of debug code.
-  self->function_simhasher_ = new FunctionSimHasher(weightsfile,
-    feature_options, logging_options);
+  try {
+    self->function_simhasher_ = new FunctionSimHasher(weightsfile,
+      feature_options, logging_options, mnem_weight, graphlet_weight,
+      immediate_weight, hasher_version);
+  } catch (const std::exception& error) {
+    PyErr_SetString(functionsimsearch_error, error.what());
+    return -1;
+  }
   return 0;
 }
 
@@ -328,6 +348,68 @@ static PyObject* PySimHasher__calculate_hash(PyObject* self,
   return return_tuple;
 }
 
+// Hashes a whole sequence of flowgraphs in one call and returns a list of hash
+// tuples in the same order. The hashing itself runs on all cores without the
+// GIL; the sequence keeps the flowgraphs alive until it is done.
+static PyObject* PySimHasher__calculate_hashes(PyObject* self,
+  PyObject* args) {
+  PyObject* flowgraphs;
+  if (!PyArg_ParseTuple(args, "O", &flowgraphs)) {
+    PyErr_SetString(functionsimsearch_error, "Failed to parse arguments.");
+    return NULL;
+  }
+  PyObject* sequence = PySequence_Fast(flowgraphs,
+    "Expected a sequence of FlowgraphWithInstructions.");
+  if (sequence == NULL) {
+    return NULL;
+  }
+  Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+  std::vector<std::unique_ptr<FlowgraphWithInstructionsFeatureGenerator>>
+    generators;
+  std::vector<FunctionFeatureGenerator*> generator_pointers;
+  for (Py_ssize_t index = 0; index < count; ++index) {
+    PyObject* item = PySequence_Fast_GET_ITEM(sequence, index);
+    if (!PyObject_TypeCheck(item, &PyFlowgraphWithInstructionsType)) {
+      Py_DECREF(sequence);
+      PyErr_SetString(functionsimsearch_error,
+        "Expected a sequence of FlowgraphWithInstructions.");
+      return NULL;
+    }
+    PyFlowgraphWithInstructions* flowgraph =
+      (PyFlowgraphWithInstructions*)item;
+    generators.emplace_back(new FlowgraphWithInstructionsFeatureGenerator(
+      *(flowgraph->flowgraph_with_instructions_)));
+    generator_pointers.push_back(generators.back().get());
+  }
+
+  std::vector<FunctionSimHasher::SimHash<128>> output_hashes(count);
+  PySimHasher* this_ = (PySimHasher*)self;
+  uint32_t threads = std::max(1U, std::thread::hardware_concurrency());
+  Py_BEGIN_ALLOW_THREADS
+  this_->function_simhasher_->CalculateFunctionSimHashes<128>(
+    generator_pointers.data(), count, output_hashes.data(), threads);
+  Py_END_ALLOW_THREADS
+  Py_DECREF(sequence);
+
+  PyObject* return_list = PyList_New(count);
+  for (Py_ssize_t index = 0; index < count; ++index) {
+    PyObject* hash_tuple = PyTuple_New(2);
+    PyTuple_SetItem(hash_tuple, 0,
+      PyLong_FromUnsignedLong(output_hashes[index][0]));
+    PyTuple_SetItem(hash_tuple, 1,
+      PyLong_FromUnsignedLong(output_hashes[index][1]));
+    PyList_SetItem(return_list, index, hash_tuple);
+  }
+  return return_list;
+}
+
+static PyObject* PySimHasher__hasher_version(PyObject* self,
+  PyObject* args) {
+  PySimHasher* hasher = (PySimHasher*)self;
+  return PyUnicode_FromString(
+    HasherVersionName(hasher->function_simhasher_->GetHasherVersion()));
+}
+
 // No externally accessible members.
 static PyMemberDef PySimHasher_members[] = {
   { NULL },
@@ -335,6 +417,8 @@ static PyMemberDef PySimHasher_members[] = {
 
 static PyMethodDef PySimHasher_methods[] = {
   { "calculate_hash", (PyCFunction)PySimHasher__calculate_hash, METH_VARARGS, NULL },
+  { "calculate_hashes", (PyCFunction)PySimHasher__calculate_hashes, METH_VARARGS, NULL },
+  { "hasher_version", (PyCFunction)PySimHasher__hasher_version, METH_VARARGS, NULL },
   { NULL, NULL, 0, NULL },
 };
 
@@ -379,20 +463,80 @@ static int PySimHashSearchIndex_init(PySimHashSearchIndex* self,
   PyObject* args, PyObject *kwds) {
   // Parse keyword arguments.
   static char* kwlist[] = { (char*)"indexfile", (char*)"create", 
-    (char*)"buckets", NULL };
+    (char*)"buckets", (char*)"prefix_bits", (char*)"hasher_version",
+    (char*)"hasher", NULL };
   char* indexfile = nullptr;
   bool create = false;
   uint32_t buckets = 28;
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|bi", kwlist, &indexfile,
-    &create, &buckets)) {
+  uint32_t prefix_bits = 8;
+  // Both are optional; when given, they have to agree with each other and
+  // with the version recorded in the header of an existing index.
+  char* hasher_version_name = nullptr;
+  PySimHasher* hasher = nullptr;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|biizO!", kwlist, &indexfile,
+    &create, &buckets, &prefix_bits, &hasher_version_name, &PySimHasherType,
+    &hasher)) {
     //PyErr_SetString(functionsimsearch_error, "Expected string argument");
     return -1;
   }
 
-  self->search_index_ = new SimHashSearchIndex(indexfile, create, buckets);
+  // The index stores both values in a byte each.
+  if ((buckets == 0) || (buckets > 255)) {
+    PyErr_SetString(PyExc_ValueError,
+      "The number of buckets has to be between 1 and 255.");
+    return -1;
+  }
+  if ((prefix_bits == 0) || (prefix_bits > 64)) {
+    PyErr_SetString(PyExc_ValueError,
+      "The number of prefix bits has to be between 1 and 64.");
+    return -1;
+  }
+  bool version_requested = (hasher_version_name != nullptr) ||
+    (hasher != nullptr);
+  HasherVersion hasher_version = HasherVersion::kLegacy;
+  if (hasher_version_name &&
+    !ParseHasherVersion(hasher_version_name, &hasher_version)) {
+    PyErr_SetString(PyExc_ValueError, "Unknown hasher version.");
+    return -1;
+  }
+  if (hasher) {
+    HasherVersion hasher_has =
+      hasher->function_simhasher_->GetHasherVersion();
+    if (hasher_version_name && (hasher_has != hasher_version)) {
+      PyErr_SetString(PyExc_ValueError,
+        "The hasher_version does not match the version of the hasher.");
+      return -1;
+    }
+    hasher_version = hasher_has;
+  }
+  try {
+    self->search_index_ = new SimHashSearchIndex(indexfile, create, buckets,
+      prefix_bits, hasher_version);
+  } catch (const std::exception& error) {
+    PyErr_SetString(functionsimsearch_error, error.what());
+    return -1;
+  }
+  // An existing index keeps the version it was created with.
+  if (version_requested &&
+    (self->search_index_->GetHasherVersion() != hasher_version)) {
+    PyErr_Format(PyExc_ValueError,
+      "The index holds %s hashes, but %s hashes were requested.",
+      HasherVersionName(self->search_index_->GetHasherVersion()),
+      HasherVersionName(hasher_version));
+    delete self->search_index_;
+    self->search_index_ = nullptr;
+    return -1;
+  }
   return 0;
 }
 
+static PyObject* PySimHashSearchIndex__hasher_version(PyObject* self,
+  PyObject* args) {
+  PySimHashSearchIndex* index = (PySimHashSearchIndex*)self;
+  return PyUnicode_FromString(
+    HasherVersionName(index->search_index_->GetHasherVersion()));
+}
+
 static PyObject* PySimHashSearchIndex__get_free_size(PyObject* self,
   PyObject* args) {
   PySimHashSearchIndex* index = (PySimHashSearchIndex*)self;
@@ -513,6 +657,7 @@ static PyMethodDef PySimHashSearchIndex_methods[] = {
   { "query_top_N", (PyCFunction)PySimHashSearchIndex__query_top_N, METH_VARARGS, NULL },
   { "indexed_functions", (PyCFunction)PySimHashSearchIndex__indexed_functions, METH_VARARGS, NULL },
   { "odds_of_random_hit", (PyCFunction)PySimHashSearchIndex__odds_of_random_hit, METH_VARARGS, NULL },
+  { "hasher_version", (PyCFunction)PySimHashSearchIndex__hasher_version, METH_VARARGS, NULL },
   { NULL, NULL, 0, NULL },
 };
 
@@ -57,6 +57,25 @@ class TestFunctionSimSearch(unittest.TestCase):
     function_hash = hasher.calculate_hash(fg)
     self.assertTrue(function_hash[0] == 0xa7ef296fa5dea3ee)
 
+  def test_calculate_hashes(self):
+    """ Test that hashing a list of graphs in one call gives the same results
+    as hashing them one by one """
+    jsonstring = """{"edges":[{"destination":1518838580,"source":1518838565},{"destination":1518838572,"source":1518838565},{"destination":1518838578,"source":1518838572},{"destination":1518838574,"source":1518838572},{"destination":1518838580,"source":1518838574},{"destination":1518838578,"source":1518838574},{"destination":1518838580,"source":1518838578}],"name":"CFG","nodes":[{"address":1518838565,"instructions":[{"mnemonic":"xor","operands":["EAX","EAX"]},{"mnemonic":"cmp","operands":["[ECX + 4]","EAX"]},{"mnemonic":"jnle","operands":["5a87a334"]}]},{"address":1518838572,"instructions":[{"mnemonic":"jl","operands":["5a87a332"]}]},{"address":1518838574,"instructions":[{"mnemonic":"cmp","operands":["[ECX]","EAX"]},{"mnemonic":"jnb","operands":["5a87a334"]}]},{"address":1518838578,"instructions":[{"mnemonic":"mov","operands":["AL","1"]}]},{"address":1518838580,"instructions":[{"mnemonic":"ret near","operands":["[ESP]"]}]}]}"""
+
+    graphs = []
+    for index in range(3):
+      fg = functionsimsearch.FlowgraphWithInstructions()
+      fg.from_json(jsonstring)
+      graphs.append(fg)
+    graphs[1].add_node(0)
+    graphs[1].add_edge(0, 1518838565)
+    hasher = functionsimsearch.SimHasher()
+    function_hashes = hasher.calculate_hashes(graphs)
+    self.assertEqual(len(function_hashes), 3)
+    for fg, function_hash in zip(graphs, function_hashes):
+      self.assertEqual(function_hash, hasher.calculate_hash(fg))
+    self.assertTrue(function_hashes[0][0] == 0xa7ef296fa5dea3ee)
+
   def test_add_and_search(self):
     """ Test adding hashes to the searchindex and searching for the nearest
     neighbor """
@@ -90,6 +109,17 @@ class TestFunctionSimSearch(unittest.TestCase):
     odds = searchindex.odds_of_random_hit(110.0)
     print(odds)
 
+  def test_index_parameters(self):
+    """ Tests whether invalid index parameters raise instead of crashing. """
+    with self.assertRaises(ValueError):
+      functionsimsearch.SimHashSearchIndex("/tmp/invalid.index", True, 256)
+    with self.assertRaises(ValueError):
+      functionsimsearch.SimHashSearchIndex("/tmp/invalid.index", True, 28, 0)
+    with self.assertRaises(ValueError):
+      functionsimsearch.SimHashSearchIndex("/tmp/invalid.index", True, 28, 65)
+    with self.assertRaises(Exception):
+      functionsimsearch.SimHashSearchIndex("/tmp/does/not/exist.index", False)
+
   def test_hasher_with_weights(self):
     """ Tests whether the loading of a weights file works. """
     jsonstring = """{"edges":[{"destination":1518838580,"source":1518838565},{"destination":1518838572,"source":1518838565},{"destination":1518838578,"source":1518838572},{"destination":1518838574,"source":1518838572},{"destination":1518838580,"source":1518838574},{"destination":1518838578,"source":1518838574},{"destination":1518838580,"source":1518838578}],"name":"CFG","nodes":[{"address":1518838565,"instructions":[{"mnemonic":"xor","operands":["EAX","EAX"]},{"mnemonic":"cmp","operands":["[ECX + 4]","EAX"]},{"mnemonic":"jnle","operands":["5a87a334"]}]},{"address":1518838572,"instructions":[{"mnemonic":"jl","operands":["5a87a332"]}]},{"address":1518838574,"instructions":[{"mnemonic":"cmp","operands":["[ECX]","EAX"]},{"mnemonic":"jnb","operands":["5a87a334"]}]},{"address":1518838578,"instructions":[{"mnemonic":"mov","operands":["AL","1"]}]},{"address":1518838580,"instructions":[{"mnemonic":"ret near","operands":["[ESP]"]}]}]}"""
@@ -101,7 +131,51 @@ class TestFunctionSimSearch(unittest.TestCase):
     self.assertTrue(function_hash[0] == 0xa6ef292a658e83ee)
 
 
-if __name__ == '__main__':
-  unittest.main()
+  def test_hasher_version(self):
+    """ Tests whether the hash family can be selected. """
+    jsonstring = """{"edges":[{"destination":1518838580,"source":1518838565},{"destination":1518838572,"source":1518838565},{"destination":1518838578,"source":1518838572},{"destination":1518838574,"source":1518838572},{"destination":1518838580,"source":1518838574},{"destination":1518838578,"source":1518838574},{"destination":1518838580,"source":1518838578}],"name":"CFG","nodes":[{"address":1518838565,"instructions":[{"mnemonic":"xor","operands":["EAX","EAX"]},{"mnemonic":"cmp","operands":["[ECX + 4]","EAX"]},{"mnemonic":"jnle","operands":["5a87a334"]}]},{"address":1518838572,"instructions":[{"mnemonic":"jl","operands":["5a87a332"]}]},{"address":1518838574,"instructions":[{"mnemonic":"cmp","operands":["[ECX]","EAX"]},{"mnemonic":"jnb","operands":["5a87a334"]}]},{"address":1518838578,"instructions":[{"mnemonic":"mov","operands":["AL","1"]}]},{"address":1518838580,"instructions":[{"mnemonic":"ret near","operands":["[ESP]"]}]}]}"""
 
+    fg = functionsimsearch.FlowgraphWithInstructions()
+    fg.from_json(jsonstring)
+    function_hash = functionsimsearch.SimHasher().calculate_hash(fg)
+    legacy = functionsimsearch.SimHasher(hasher_version="legacy")
+    self.assertEqual(legacy.calculate_hash(fg), function_hash)
+    portable = functionsimsearch.SimHasher(hasher_version="portable")
+    self.assertNotEqual(portable.calculate_hash(fg), function_hash)
+    with self.assertRaises(Exception):
+      functionsimsearch.SimHasher(hasher_version="unknown")
+
+  def test_index_hasher_version(self):
+    """ Tests whether a hasher and an index of different versions are
+    rejected. """
+    import os
+    for name in ("/tmp/legacy.index", "/tmp/portable.index"):
+      if os.path.isfile(name):
+        os.remove(name)
+    legacy = functionsimsearch.SimHasher(hasher_version="legacy")
+    portable = functionsimsearch.SimHasher(hasher_version="portable")
+    index = functionsimsearch.SimHashSearchIndex("/tmp/portable.index", True,
+      28, hasher_version="portable")
+    self.assertEqual(index.hasher_version(), "portable")
+    del index
+    index = functionsimsearch.SimHashSearchIndex("/tmp/legacy.index", True,
+      28, hasher=legacy)
+    self.assertEqual(index.hasher_version(), legacy.hasher_version())
+    del index
+
+    index = functionsimsearch.SimHashSearchIndex("/tmp/portable.index", False,
+      hasher=portable)
+    self.assertEqual(index.hasher_version(), "portable")
+    del index
+    with self.assertRaises(ValueError):
+      functionsimsearch.SimHashSearchIndex("/tmp/portable.index", False,
+        hasher=legacy)
+    with self.assertRaises(ValueError):
+      functionsimsearch.SimHashSearchIndex("/tmp/legacy.index", False,
+        hasher_version="portable")
+    with self.assertRaises(ValueError):
+      functionsimsearch.SimHashSearchIndex("/tmp/other.index", True, 28,
+        hasher_version="legacy", hasher=portable)
 
+if __name__ == '__main__':
+  unittest.main()
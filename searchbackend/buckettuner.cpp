@@ -0,0 +1,106 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "searchbackend/buckettuner.hpp"
+#include "util/bitpermutation.hpp"
+
+BucketTuner::BucketTuner(const std::vector<FeatureHash>& population,
+  uint32_t max_buckets) : max_buckets_(max_buckets), population_(population) {
+}
+
+void BucketTuner::Evaluate(
+  const std::vector<std::pair<FeatureHash, FeatureHash>>& pairs,
+  uint32_t prefix_bits, std::vector<BucketConfiguration>* results) const {
+  uint64_t mask = PrefixMask(prefix_bits);
+  // For each bucket, how many pairs collided there for the first time, and the
+  // sorted prefixes of the permuted queries.
+  std::vector<uint64_t> first_collisions(max_buckets_, 0);
+  std::vector<std::vector<uint64_t>> query_prefixes(max_buckets_);
+  for (auto& prefixes : query_prefixes) {
+    prefixes.reserve(pairs.size());
+  }
+
+  std::vector<uint128_t> permuted_query;
+  std::vector<uint128_t> permuted_target;
+  for (const auto& pair : pairs) {
+    permuted_query.clear();
+    permuted_target.clear();
+    get_n_permutations(to128(pair.first.first, pair.first.second),
+      max_buckets_, &permuted_query);
+    get_n_permutations(to128(pair.second.first, pair.second.second),
+      max_buckets_, &permuted_target);
+
+    bool found = false;
+    for (uint32_t bucket = 0; bucket < max_buckets_; ++bucket) {
+      uint64_t query_high = getHigh64(permuted_query[bucket]);
+      uint64_t target_high = getHigh64(permuted_target[bucket]);
+      if (!found && ((query_high & mask) == (target_high & mask))) {
+        ++first_collisions[bucket];
+        found = true;
+      }
+      query_prefixes[bucket].push_back(query_high & mask);
+    }
+  }
+  for (auto& prefixes : query_prefixes) {
+    std::sort(prefixes.begin(), prefixes.end());
+  }
+
+  // The entries the queries scan in a bucket are the (query, population entry)
+  // combinations that share a prefix there, so they can be counted from the
+  // side of the population in a single pass over it.
+  std::vector<uint64_t> entries_scanned(max_buckets_, 0);
+  std::vector<uint128_t> permuted_values;
+  for (const FeatureHash& hash : population_) {
+    permuted_values.clear();
+    get_n_permutations(to128(hash.first, hash.second), max_buckets_,
+      &permuted_values);
+    for (uint32_t bucket = 0; bucket < max_buckets_; ++bucket) {
+      const std::vector<uint64_t>& prefixes = query_prefixes[bucket];
+      auto matches = std::equal_range(prefixes.begin(), prefixes.end(),
+        getHigh64(permuted_values[bucket]) & mask);
+      entries_scanned[bucket] += matches.second - matches.first;
+    }
+  }
+
+  double number_of_pairs = pairs.empty() ? 1.0 : pairs.size();
+  uint64_t cumulative_collisions = 0;
+  uint64_t cumulative_scanned = 0;
+  for (uint32_t bucket = 0; bucket < max_buckets_; ++bucket) {
+    cumulative_collisions += first_collisions[bucket];
+    cumulative_scanned += entries_scanned[bucket];
+    results->push_back(BucketConfiguration{ bucket + 1, prefix_bits,
+      cumulative_collisions / number_of_pairs,
+      cumulative_scanned / number_of_pairs });
+  }
+}
+
+bool BucketTuner::Recommend(const std::vector<BucketConfiguration>& candidates,
+  double target_recall, BucketConfiguration* result) {
+  bool found = false;
+  for (const BucketConfiguration& candidate : candidates) {
+    if (candidate.recall < target_recall) {
+      continue;
+    }
+    if (!found ||
+      (candidate.entries_scanned < result->entries_scanned) ||
+      ((candidate.entries_scanned == result->entries_scanned) &&
+       (candidate.buckets < result->buckets))) {
+      *result = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
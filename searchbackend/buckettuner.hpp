@@ -0,0 +1,72 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUCKETTUNER_HPP
+#define BUCKETTUNER_HPP
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "util/util.hpp"
+
+// The result of evaluating one (bucket count, prefix width) combination.
+struct BucketConfiguration {
+  uint32_t buckets;
+  uint32_t prefix_bits;
+  // Fraction of the labelled pairs for which the second element ends up in
+  // the candidate set when querying for the first.
+  double recall;
+  // Average number of index entries that a query has to examine.
+  double entries_scanned;
+};
+
+// The comment in simhashsearchindex.hpp derives a bucket count analytically
+// from assumptions about the distribution of hamming distances. This class
+// does the same empirically: Given a population of SimHashes (the contents of
+// an index) and a set of pairs of SimHashes that should find each other, it
+// measures the recall and the number of entries scanned for every bucket count
+// up to a maximum and for a given prefix width.
+//
+// A query finds a candidate if, for at least one of the first N permutations
+// of the 128-bit SimHash, the top prefix_bits of query and candidate agree.
+// The cost of a query is the number of population entries that share the
+// query's prefix in each of the N permutations - precisely the range that
+// SimHashSearchIndex::QueryTopN walks.
+//
+// The tuner keeps a copy of the population, not its permutations: Evaluate
+// permutes one population entry at a time and compares it against the sorted
+// prefixes of the queries, so memory grows with the population plus the
+// number of pairs times max_buckets.
+class BucketTuner {
+public:
+  BucketTuner(const std::vector<FeatureHash>& population,
+    uint32_t max_buckets);
+
+  // Fills results with one entry per bucket count 1..max_buckets.
+  void Evaluate(const std::vector<std::pair<FeatureHash, FeatureHash>>& pairs,
+    uint32_t prefix_bits, std::vector<BucketConfiguration>* results) const;
+
+  // Picks the configuration with the fewest entries scanned that still reaches
+  // the target recall. Ties are broken by the smaller bucket count, as every
+  // bucket costs one index entry per function. Returns false if no candidate
+  // reaches the target.
+  static bool Recommend(const std::vector<BucketConfiguration>& candidates,
+    double target_recall, BucketConfiguration* result);
+private:
+  uint32_t max_buckets_;
+  std::vector<FeatureHash> population_;
+};
+
+#endif // BUCKETTUNER_HPP
@@ -0,0 +1,164 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <array>
+
+#include "gtest/gtest.h"
+#include "searchbackend/buckettuner.hpp"
+#include "util/bitpermutation.hpp"
+
+static const std::array<uint64_t, 12> constantarray = {
+  0xba5eba11bedabb1eUL,
+  0xbe5077edb0a710adUL,
+  0xb01dfacecab005e0UL,
+  0xca11ab1eca55e77eUL,
+  0xdeadbea700defec8UL,
+  0xf01dab1ef005ba11UL,
+  0x0ddba115ca1ab1e0UL,
+  0x7e1eca57deadbeefUL,
+  0xca5cadab1ef00d50UL,
+  0x0b501e7edecea5edUL,
+  0x7e55e118df00d500UL,
+  0x0e1ec7edba11a575UL };
+
+static std::vector<FeatureHash> GetPopulation() {
+  std::vector<FeatureHash> population;
+  for (uint32_t i = 0; i < constantarray.size()-1; ++i) {
+    population.push_back(std::make_pair(constantarray[i], constantarray[i+1]));
+  }
+  return population;
+}
+
+TEST(buckettuner, identical_pairs_are_always_found) {
+  std::vector<FeatureHash> population = GetPopulation();
+  BucketTuner tuner(population, 28);
+
+  std::vector<std::pair<FeatureHash, FeatureHash>> pairs;
+  for (const FeatureHash& hash : population) {
+    pairs.push_back(std::make_pair(hash, hash));
+  }
+  std::vector<BucketConfiguration> results;
+  tuner.Evaluate(pairs, 64, &results);
+  ASSERT_EQ(results.size(), 28);
+  for (const BucketConfiguration& result : results) {
+    EXPECT_EQ(result.recall, 1.0);
+    // With a full-width prefix, each query only sees itself in each bucket.
+    EXPECT_EQ(result.entries_scanned, result.buckets);
+  }
+}
+
+TEST(buckettuner, complements_are_never_found) {
+  std::vector<FeatureHash> population = GetPopulation();
+  BucketTuner tuner(population, 28);
+
+  // Permuting the complement yields the complement of the permutation, so no
+  // prefix can ever agree.
+  std::vector<std::pair<FeatureHash, FeatureHash>> pairs;
+  for (const FeatureHash& hash : population) {
+    pairs.push_back(std::make_pair(hash,
+      std::make_pair(~hash.first, ~hash.second)));
+  }
+  std::vector<BucketConfiguration> results;
+  tuner.Evaluate(pairs, 1, &results);
+  for (const BucketConfiguration& result : results) {
+    EXPECT_EQ(result.recall, 0.0);
+  }
+}
+
+TEST(buckettuner, cost_and_recall_grow_with_buckets) {
+  std::vector<FeatureHash> population = GetPopulation();
+  BucketTuner tuner(population, 50);
+
+  std::vector<std::pair<FeatureHash, FeatureHash>> pairs;
+  for (const FeatureHash& hash : population) {
+    // Flip a handful of bits to simulate a near-duplicate.
+    pairs.push_back(std::make_pair(hash, std::make_pair(
+      hash.first ^ 0x0180018001800180UL, hash.second ^ 0x0101010101010101UL)));
+  }
+  std::vector<BucketConfiguration> results;
+  tuner.Evaluate(pairs, 4, &results);
+  for (uint32_t index = 1; index < results.size(); ++index) {
+    EXPECT_GE(results[index].recall, results[index-1].recall);
+    EXPECT_GT(results[index].entries_scanned, results[index-1].entries_scanned);
+  }
+  // 18 differing bits out of 128 leave plenty of 4-bit runs intact.
+  EXPECT_EQ(results.back().recall, 1.0);
+  // A single bucket with a zero-width prefix would scan everything, so a 4-bit
+  // prefix has to scan less than the full population per bucket.
+  EXPECT_LE(results[0].entries_scanned, population.size());
+}
+
+// The entries scanned agree with counting, query by query, the population
+// entries that share the query's prefix in each permutation.
+TEST(buckettuner, entries_scanned_match_direct_count) {
+  std::vector<FeatureHash> population = GetPopulation();
+  // Duplicates and near-duplicates share long prefixes with each other.
+  for (const FeatureHash& hash : GetPopulation()) {
+    population.push_back(hash);
+    population.push_back(std::make_pair(hash.first ^ 1, hash.second));
+  }
+  const uint32_t max_buckets = 20;
+  BucketTuner tuner(population, max_buckets);
+
+  std::vector<std::pair<FeatureHash, FeatureHash>> pairs;
+  for (const FeatureHash& hash : GetPopulation()) {
+    pairs.push_back(std::make_pair(hash, std::make_pair(hash.second,
+      hash.first)));
+  }
+  for (uint32_t prefix_bits : { 1, 3, 8, 64 }) {
+    uint64_t mask = PrefixMask(prefix_bits);
+    std::vector<BucketConfiguration> results;
+    tuner.Evaluate(pairs, prefix_bits, &results);
+    ASSERT_EQ(results.size(), max_buckets);
+
+    uint64_t expected = 0;
+    for (uint32_t bucket = 0; bucket < max_buckets; ++bucket) {
+      for (const auto& pair : pairs) {
+        std::vector<uint128_t> permuted_query;
+        get_n_permutations(to128(pair.first.first, pair.first.second),
+          max_buckets, &permuted_query);
+        for (const FeatureHash& hash : population) {
+          std::vector<uint128_t> permuted;
+          get_n_permutations(to128(hash.first, hash.second), max_buckets,
+            &permuted);
+          if ((getHigh64(permuted[bucket]) & mask) ==
+            (getHigh64(permuted_query[bucket]) & mask)) {
+            ++expected;
+          }
+        }
+      }
+      EXPECT_DOUBLE_EQ(results[bucket].entries_scanned,
+        static_cast<double>(expected) / pairs.size());
+    }
+  }
+}
+
+TEST(buckettuner, recommend_cheapest) {
+  std::vector<BucketConfiguration> candidates = {
+    { 10, 8, 0.90, 100.0 },
+    { 20, 8, 0.96, 200.0 },
+    { 30, 6, 0.97, 150.0 },
+    { 40, 6, 0.99, 150.0 },
+    { 50, 4, 0.99, 900.0 } };
+
+  BucketConfiguration best;
+  ASSERT_TRUE(BucketTuner::Recommend(candidates, 0.95, &best));
+  EXPECT_EQ(best.buckets, 30);
+  EXPECT_EQ(best.prefix_bits, 6);
+
+  ASSERT_TRUE(BucketTuner::Recommend(candidates, 0.99, &best));
+  EXPECT_EQ(best.buckets, 40);
+
+  EXPECT_FALSE(BucketTuner::Recommend(candidates, 0.999, &best));
+}
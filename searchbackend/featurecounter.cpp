@@ -0,0 +1,64 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "searchbackend/featurecounter.hpp"
+
+namespace {
+
+// Enough for the features of a typical function without growing.
+constexpr uint64_t kInitialCapacity = 1024;
+
+} // namespace
+
+FeatureCounter::FeatureCounter() : epoch_(1), size_(0) {
+  Rehash(kInitialCapacity);
+}
+
+uint32_t FeatureCounter::Get(uint64_t key) const {
+  for (uint64_t index = SlotIndex(key); slots_[index].epoch == epoch_;
+    index = (index + 1) & mask_) {
+    if (slots_[index].key == key) {
+      return slots_[index].count;
+    }
+  }
+  return 0;
+}
+
+void FeatureCounter::Clear() {
+  size_ = 0;
+  if (++epoch_ == 0) {
+    // After 2^32 - 1 epochs, stale slots could look current again.
+    for (Slot& slot : slots_) {
+      slot.epoch = 0;
+    }
+    epoch_ = 1;
+  }
+}
+
+void FeatureCounter::Rehash(uint64_t capacity) {
+  std::vector<Slot> old_slots(capacity, Slot{ 0, 0, 0 });
+  old_slots.swap(slots_);
+  mask_ = capacity - 1;
+  shift_ = 64 - (63 - __builtin_clzll(capacity));
+  for (const Slot& slot : old_slots) {
+    if (slot.epoch != epoch_) {
+      continue;
+    }
+    uint64_t index = SlotIndex(slot.key);
+    while (slots_[index].epoch == epoch_) {
+      index = (index + 1) & mask_;
+    }
+    slots_[index] = slot;
+  }
+}
@@ -0,0 +1,80 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FEATURECOUNTER_HPP
+#define FEATURECOUNTER_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Counts how often each feature ID has been seen while hashing one function.
+// A counter is meant to be reused for many functions (one per thread): Its
+// slots are tagged with the epoch in which they were written, and Clear() just
+// starts a new epoch, so clearing costs nothing no matter how large the table
+// has grown, and no memory is allocated once the table is large enough for the
+// biggest function seen so far.
+class FeatureCounter {
+public:
+  FeatureCounter();
+
+  // Counts one more occurrence of the key and returns the number of
+  // occurrences before this one.
+  uint32_t Increment(uint64_t key) {
+    uint64_t index = SlotIndex(key);
+    while (slots_[index].epoch == epoch_) {
+      if (slots_[index].key == key) {
+        return slots_[index].count++;
+      }
+      index = (index + 1) & mask_;
+    }
+    if (2 * (size_ + 1) > slots_.size()) {
+      Rehash(2 * slots_.size());
+      return Increment(key);
+    }
+    slots_[index] = Slot{ key, 1, epoch_ };
+    ++size_;
+    return 0;
+  }
+
+  // Returns the number of occurrences of the key counted so far.
+  uint32_t Get(uint64_t key) const;
+
+  // Forgets all counts.
+  void Clear();
+
+  // The number of distinct keys counted since the last Clear().
+  uint64_t size() const { return size_; }
+  uint64_t capacity() const { return slots_.size(); }
+private:
+  struct Slot {
+    uint64_t key;
+    uint32_t count;
+    uint32_t epoch;
+  };
+
+  inline uint64_t SlotIndex(uint64_t key) const {
+    return (key * 0x9E3779B97F4A7C15ULL) >> shift_;
+  }
+  void Rehash(uint64_t capacity);
+
+  std::vector<Slot> slots_;
+  uint64_t mask_;
+  uint32_t shift_;
+  // Slots with a different epoch are empty. Epoch zero is never current, so
+  // freshly allocated slots start out empty.
+  uint32_t epoch_;
+  uint64_t size_;
+};
+
+#endif // FEATURECOUNTER_HPP
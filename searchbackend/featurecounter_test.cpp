@@ -0,0 +1,53 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "searchbackend/featurecounter.hpp"
+
+TEST(featurecounter, behaves_like_map) {
+  std::mt19937_64 random(1);
+  FeatureCounter counter;
+  // Several rounds, so that the table has to grow and the later rounds run on
+  // a table full of stale slots from earlier ones.
+  for (uint32_t round = 0; round < 4; ++round) {
+    std::map<uint64_t, uint32_t> reference;
+    counter.Clear();
+    EXPECT_EQ(counter.size(), 0);
+    for (uint32_t index = 0; index < 5000 * (round + 1); ++index) {
+      uint64_t key = (index % 3) ? random() : (random() % 1000);
+      EXPECT_EQ(counter.Increment(key), reference[key]++);
+    }
+    EXPECT_EQ(counter.size(), reference.size());
+    for (const auto& entry : reference) {
+      EXPECT_EQ(counter.Get(entry.first), entry.second);
+    }
+  }
+}
+
+TEST(featurecounter, clear_keeps_capacity) {
+  FeatureCounter counter;
+  for (uint64_t key = 0; key < 10000; ++key) {
+    counter.Increment(key);
+  }
+  uint64_t capacity = counter.capacity();
+  counter.Clear();
+  EXPECT_EQ(counter.capacity(), capacity);
+  EXPECT_EQ(counter.Get(5), 0);
+  EXPECT_EQ(counter.Increment(5), 0);
+  EXPECT_EQ(counter.Increment(5), 1);
+  EXPECT_EQ(counter.size(), 1);
+}
@@ -0,0 +1,275 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fstream>
+#include <utility>
+
+#include "searchbackend/featureweights.hpp"
+#include "util/util.hpp"
+
+namespace {
+
+// Tables start with this many slots and double in size once they are more
+// than half full; linear probing degrades quickly beyond that.
+constexpr uint64_t kMinimumCapacity = 16;
+
+uint32_t Log2(uint64_t power_of_two) {
+  return 63 - __builtin_clzll(power_of_two);
+}
+
+} // namespace
+
+FeatureWeights::FeatureWeights() : slots_(nullptr), empty_key_(0), size_(0),
+  hasher_version_(HasherVersion::kLegacy) {
+  Rehash(kMinimumCapacity);
+}
+
+FeatureWeights::FeatureWeights(const std::map<uint64_t, float>& weights) :
+  slots_(nullptr), empty_key_(0), size_(0),
+  hasher_version_(HasherVersion::kLegacy) {
+  Rehash(kMinimumCapacity);
+  Reserve(weights.size());
+  for (const auto& weight : weights) {
+    Set(weight.first, weight.second);
+  }
+}
+
+bool FeatureWeights::IsBinaryWeightsFile(const std::string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  uint64_t magic = 0;
+  file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  return file.good() && (magic == FileHeader::kMagic);
+}
+
+bool FeatureWeights::Load(const std::string& filename) {
+  if (IsBinaryWeightsFile(filename)) {
+    return MapBinary(filename);
+  }
+  return LoadText(filename);
+}
+
+// Text weights files have one feature per line: Either the full feature hash
+// or its first 64 bits in hex, followed by the weight. A "hasher_version" line
+// names the hash family; older code skips it like any other unknown line.
+bool FeatureWeights::LoadText(const std::string& filename) {
+  std::vector<std::vector<std::string>> tokenized_lines;
+  if (!FileToLineTokens(filename, &tokenized_lines)) {
+    return false;
+  }
+  // The weights are parsed into a separate table, so a file that is rejected
+  // halfway through leaves the current weights untouched.
+  FeatureWeights loaded;
+  loaded.Reserve(tokenized_lines.size());
+  for (const std::vector<std::string>& line : tokenized_lines) {
+    if (line.size() < 2) {
+      printf("[!] Truncated line found!\n");
+      continue;
+    }
+    if (line[0] == "hasher_version") {
+      if (!ParseHasherVersion(line[1], &loaded.hasher_version_)) {
+        printf("[!] %s uses unknown hasher version %s\n", filename.c_str(),
+          line[1].c_str());
+        return false;
+      }
+      continue;
+    }
+    double weight = strtod(line[1].c_str(), nullptr);
+    if ((line[0].size() == 32) || (line[0].size() == 35)) {
+      FeatureHash hash = StringToFeatureHash(line[0]);
+      loaded.Set(hash.first, weight);
+    } else if (line[0].size() == 16) {
+      uint64_t value = strtoull(line[0].c_str(), nullptr, 16);
+      loaded.Set(value, weight);
+    }
+  }
+  Swap(&loaded);
+  return true;
+}
+
+bool FeatureWeights::MapBinary(const std::string& filename) {
+  std::unique_ptr<boost::interprocess::file_mapping> file;
+  std::unique_ptr<boost::interprocess::mapped_region> region;
+  try {
+    file.reset(new boost::interprocess::file_mapping(filename.c_str(),
+      boost::interprocess::read_only));
+    region.reset(new boost::interprocess::mapped_region(*file,
+      boost::interprocess::read_only));
+  } catch (const boost::interprocess::interprocess_exception& exception) {
+    printf("[!] Failed to map %s: %s\n", filename.c_str(), exception.what());
+    return false;
+  }
+  const FileHeader* header =
+    static_cast<const FileHeader*>(region->get_address());
+  if ((region->get_size() < sizeof(FileHeader)) ||
+    (header->magic != FileHeader::kMagic) ||
+    (header->version != FileHeader::kCurrentVersion) ||
+    (header->slot_size != sizeof(Slot)) ||
+    !IsKnownHasherVersion(header->hasher_version) ||
+    (header->capacity < kMinimumCapacity) ||
+    ((header->capacity & (header->capacity - 1)) != 0) ||
+    (header->size > header->capacity / 2) ||
+    // Bounding the capacity by the file size first keeps the product below
+    // from overflowing for corrupt headers.
+    (header->capacity >
+      (region->get_size() - sizeof(FileHeader)) / sizeof(Slot)) ||
+    (region->get_size() !=
+      sizeof(FileHeader) + header->capacity * sizeof(Slot))) {
+    printf("[!] %s is not a valid binary weights file\n", filename.c_str());
+    return false;
+  }
+  // Lookups probe until they hit an empty slot, so the stored size has to be
+  // right: A table without empty slots would make them spin forever.
+  const Slot* slots = reinterpret_cast<const Slot*>(header + 1);
+  uint64_t used = 0;
+  for (uint64_t index = 0; index < header->capacity; ++index) {
+    if (slots[index].key != header->empty_key) {
+      ++used;
+    }
+  }
+  if (used != header->size) {
+    printf("[!] %s is not a valid binary weights file\n", filename.c_str());
+    return false;
+  }
+  owned_slots_.clear();
+  owned_slots_.shrink_to_fit();
+  slots_ = slots;
+  SetCapacity(header->capacity);
+  empty_key_ = header->empty_key;
+  size_ = header->size;
+  hasher_version_ = static_cast<HasherVersion>(header->hasher_version);
+  file_ = std::move(file);
+  region_ = std::move(region);
+  return true;
+}
+
+bool FeatureWeights::Save(const std::string& filename) const {
+  FileHeader header = {};
+  header.magic = FileHeader::kMagic;
+  header.version = FileHeader::kCurrentVersion;
+  header.slot_size = sizeof(Slot);
+  header.capacity = mask_ + 1;
+  // MapBinary rejects anything else.
+  if (((header.capacity & (header.capacity - 1)) != 0) ||
+    (header.capacity > UINT64_MAX / sizeof(Slot))) {
+    return false;
+  }
+  header.size = size_;
+  header.empty_key = empty_key_;
+  header.hasher_version = static_cast<uint32_t>(hasher_version_);
+  std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(slots_),
+    header.capacity * sizeof(Slot));
+  return file.good();
+}
+
+void FeatureWeights::Swap(FeatureWeights* other) {
+  // Swapping the vector and the mapping keeps slots_ pointing at the slots it
+  // belongs to.
+  std::swap(slots_, other->slots_);
+  owned_slots_.swap(other->owned_slots_);
+  file_.swap(other->file_);
+  region_.swap(other->region_);
+  std::swap(mask_, other->mask_);
+  std::swap(shift_, other->shift_);
+  std::swap(empty_key_, other->empty_key_);
+  std::swap(size_, other->size_);
+  std::swap(hasher_version_, other->hasher_version_);
+}
+
+void FeatureWeights::Unmap() {
+  if (!region_) {
+    return;
+  }
+  owned_slots_.assign(slots_, slots_ + mask_ + 1);
+  slots_ = owned_slots_.data();
+  region_.reset();
+  file_.reset();
+}
+
+void FeatureWeights::Set(uint64_t key, float value) {
+  Unmap();
+  if (key == empty_key_) {
+    ChangeEmptyKey();
+  }
+  if (2 * (size_ + 1) > owned_slots_.size()) {
+    Rehash(2 * owned_slots_.size());
+  }
+  uint64_t index = SlotIndex(key);
+  while ((owned_slots_[index].key != empty_key_) &&
+    (owned_slots_[index].key != key)) {
+    index = (index + 1) & mask_;
+  }
+  if (owned_slots_[index].key == empty_key_) {
+    owned_slots_[index].key = key;
+    ++size_;
+  }
+  owned_slots_[index].value = value;
+}
+
+void FeatureWeights::Reserve(uint64_t weights) {
+  Unmap();
+  uint64_t capacity = owned_slots_.size();
+  while (capacity < 2 * weights) {
+    capacity *= 2;
+  }
+  if (capacity != owned_slots_.size()) {
+    Rehash(capacity);
+  }
+}
+
+void FeatureWeights::SetCapacity(uint64_t capacity) {
+  mask_ = capacity - 1;
+  shift_ = 64 - Log2(capacity);
+}
+
+void FeatureWeights::Rehash(uint64_t capacity) {
+  std::vector<Slot> old_slots(capacity, Slot{ empty_key_, 0.0f, 0 });
+  old_slots.swap(owned_slots_);
+  slots_ = owned_slots_.data();
+  SetCapacity(capacity);
+  for (const Slot& slot : old_slots) {
+    if (slot.key == empty_key_) {
+      continue;
+    }
+    uint64_t index = SlotIndex(slot.key);
+    while (owned_slots_[index].key != empty_key_) {
+      index = (index + 1) & mask_;
+    }
+    owned_slots_[index] = slot;
+  }
+}
+
+void FeatureWeights::ChangeEmptyKey() {
+  // Feature IDs are hashes, so the first few candidates are almost certainly
+  // unused; verifying that takes one pass over the table.
+  uint64_t candidate = empty_key_;
+  bool in_use = true;
+  while (in_use) {
+    candidate += 0x9E3779B97F4A7C15ULL;
+    in_use = false;
+    for (const Slot& slot : owned_slots_) {
+      if (slot.key == candidate) {
+        in_use = true;
+        break;
+      }
+    }
+  }
+  for (Slot& slot : owned_slots_) {
+    if (slot.key == empty_key_) {
+      slot.key = candidate;
+    }
+  }
+  empty_key_ = candidate;
+}
@@ -0,0 +1,160 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FEATUREWEIGHTS_HPP
+#define FEATUREWEIGHTS_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "searchbackend/hasherversion.hpp"
+
+// Maps 64-bit feature IDs to float weights. Weight lookups happen for every
+// feature of every function that is hashed, and trained weight files contain
+// millions of entries, so this is an open-addressing hash table with linear
+// probing instead of a tree: A lookup usually touches a single cache line.
+//
+// The feature IDs are hash values already, so the slot of a key is derived
+// from its bits with a single multiplication. Empty slots are marked with a
+// key that does not occur in the table (usually zero), which keeps the slots
+// at 16 bytes and the probe loop free of extra checks.
+//
+// Weights come either from the text format written by trainsimhashweights or
+// from a binary file that contains the table exactly as it is laid out in
+// memory. Binary files are memory-mapped and used without copying, so loading
+// them is independent of their size; the convertweights tool creates them.
+//
+// Weights are keyed by feature IDs, which depend on the hash family, so both
+// formats record the HasherVersion they belong to. Text files declare it with
+// a line "hasher_version <name>"; files without one are legacy weights.
+class FeatureWeights {
+public:
+  struct Slot {
+    uint64_t key;
+    float value;
+    uint32_t reserved;
+  };
+
+  // The binary file is this header followed by 'capacity' slots, in native
+  // byte order.
+  struct FileHeader {
+    static constexpr uint64_t kMagic = 0x4847494557535346ULL; // "FSSWEIGH"
+    static constexpr uint32_t kCurrentVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t empty_key;
+    // A HasherVersion. Older files have zero here, which is kLegacy.
+    uint32_t hasher_version;
+    uint32_t reserved_0;
+    uint64_t reserved[2];
+  };
+
+  FeatureWeights();
+  explicit FeatureWeights(const std::map<uint64_t, float>& weights);
+  FeatureWeights(const FeatureWeights&) = delete;
+  FeatureWeights& operator=(const FeatureWeights&) = delete;
+
+  // Replaces the contents with the weights from a binary or text weights file.
+  bool Load(const std::string& filename);
+  // Writes the table as a binary weights file.
+  bool Save(const std::string& filename) const;
+  static bool IsBinaryWeightsFile(const std::string& filename);
+  bool IsMapped() const { return region_ != nullptr; }
+
+  // Inserts or overwrites a weight. A memory-mapped table is copied into
+  // memory first.
+  void Set(uint64_t key, float value);
+  // Makes room for the given number of weights without further rehashing.
+  void Reserve(uint64_t weights);
+
+  // Returns the weight for the key, or the given default.
+  inline float Get(uint64_t key, float standard) const {
+    const Slot* slot = FindSlot(key);
+    return slot ? slot->value : standard;
+  }
+  bool Contains(uint64_t key) const { return FindSlot(key) != nullptr; }
+  // Starts loading the slot for the key into the cache. Batch lookups issue
+  // this a few keys ahead, so that cache misses on large tables overlap.
+  inline void Prefetch(uint64_t key) const {
+    __builtin_prefetch(&slots_[SlotIndex(key)]);
+  }
+
+  uint64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  HasherVersion GetHasherVersion() const { return hasher_version_; }
+  void SetHasherVersion(HasherVersion version) { hasher_version_ = version; }
+
+  // Calls function(key, value) for every weight, in no particular order.
+  template <typename Function> void ForEach(Function function) const {
+    for (uint64_t index = 0; index <= mask_; ++index) {
+      if (slots_[index].key != empty_key_) {
+        function(slots_[index].key, slots_[index].value);
+      }
+    }
+  }
+private:
+  inline uint64_t SlotIndex(uint64_t key) const {
+    // Fibonacci hashing: the upper bits of the product are well mixed.
+    return (key * 0x9E3779B97F4A7C15ULL) >> shift_;
+  }
+
+  inline const Slot* FindSlot(uint64_t key) const {
+    if (key == empty_key_) {
+      return nullptr;
+    }
+    for (uint64_t index = SlotIndex(key); ; index = (index + 1) & mask_) {
+      const Slot& slot = slots_[index];
+      if (slot.key == key) {
+        return &slot;
+      }
+      if (slot.key == empty_key_) {
+        return nullptr;
+      }
+    }
+  }
+
+  bool LoadText(const std::string& filename);
+  bool MapBinary(const std::string& filename);
+  void Swap(FeatureWeights* other);
+  // Copies a memory-mapped table into owned_slots_ so it can be modified.
+  void Unmap();
+  // Rebuilds the table with the given number of slots (a power of two).
+  void Rehash(uint64_t capacity);
+  // Picks a new marker for empty slots once the current one is used as a key.
+  void ChangeEmptyKey();
+  void SetCapacity(uint64_t capacity);
+
+  // Points either into owned_slots_ or into the mapped file.
+  const Slot* slots_;
+  std::vector<Slot> owned_slots_;
+  std::unique_ptr<boost::interprocess::file_mapping> file_;
+  std::unique_ptr<boost::interprocess::mapped_region> region_;
+  uint64_t mask_;
+  uint32_t shift_;
+  uint64_t empty_key_;
+  uint64_t size_;
+  HasherVersion hasher_version_;
+};
+
+#endif // FEATUREWEIGHTS_HPP
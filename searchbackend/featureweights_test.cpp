@@ -0,0 +1,223 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+
+#include "gtest/gtest.h"
+#include "searchbackend/featureweights.hpp"
+
+TEST(featureweights, behaves_like_map) {
+  std::mt19937_64 random(1);
+  std::map<uint64_t, float> reference;
+  FeatureWeights weights;
+  for (uint32_t index = 0; index < 100000; ++index) {
+    // Small keys collide often, which exercises overwriting and probing.
+    uint64_t key = (index % 2) ? random() : (random() % 5000);
+    float value = static_cast<float>(random() % 1000) / 100.0f;
+    reference[key] = value;
+    weights.Set(key, value);
+  }
+  EXPECT_EQ(weights.size(), reference.size());
+  for (const auto& entry : reference) {
+    ASSERT_TRUE(weights.Contains(entry.first));
+    EXPECT_EQ(weights.Get(entry.first, -1.0f), entry.second);
+  }
+  for (uint32_t index = 0; index < 1000; ++index) {
+    uint64_t key = random();
+    if (reference.find(key) == reference.end()) {
+      EXPECT_FALSE(weights.Contains(key));
+      EXPECT_EQ(weights.Get(key, -1.0f), -1.0f);
+    }
+  }
+  uint64_t visited = 0;
+  weights.ForEach([&](uint64_t key, float value) {
+    EXPECT_EQ(reference.at(key), value);
+    ++visited;
+  });
+  EXPECT_EQ(visited, reference.size());
+}
+
+TEST(featureweights, zero_and_marker_keys) {
+  FeatureWeights weights;
+  EXPECT_FALSE(weights.Contains(0));
+  // Zero is the initial marker for empty slots, so storing it forces a new
+  // marker to be chosen; storing that one forces yet another.
+  weights.Set(1, 1.0f);
+  weights.Set(0, 2.0f);
+  weights.Set(0x9E3779B97F4A7C15ULL, 3.0f);
+  weights.Set(2 * 0x9E3779B97F4A7C15ULL, 4.0f);
+  EXPECT_EQ(weights.size(), 4);
+  EXPECT_EQ(weights.Get(0, -1.0f), 2.0f);
+  EXPECT_EQ(weights.Get(1, -1.0f), 1.0f);
+  EXPECT_EQ(weights.Get(0x9E3779B97F4A7C15ULL, -1.0f), 3.0f);
+  EXPECT_EQ(weights.Get(2 * 0x9E3779B97F4A7C15ULL, -1.0f), 4.0f);
+  EXPECT_FALSE(weights.Contains(3 * 0x9E3779B97F4A7C15ULL));
+}
+
+TEST(featureweights, from_map) {
+  std::map<uint64_t, float> reference = { { 0, 0.5f }, { 7, 1.5f },
+    { ~0ULL, 2.5f } };
+  FeatureWeights weights(reference);
+  EXPECT_EQ(weights.size(), 3);
+  for (const auto& entry : reference) {
+    EXPECT_EQ(weights.Get(entry.first, -1.0f), entry.second);
+  }
+}
+
+TEST(featureweights, binary_round_trip) {
+  std::mt19937_64 random(2);
+  FeatureWeights weights;
+  weights.Set(0, 0.25f);
+  for (uint32_t index = 0; index < 5000; ++index) {
+    weights.Set(random(), static_cast<float>(index));
+  }
+  const std::string filename = "/tmp/featureweights_test.bin";
+  ASSERT_TRUE(weights.Save(filename));
+  EXPECT_TRUE(FeatureWeights::IsBinaryWeightsFile(filename));
+
+  FeatureWeights mapped;
+  ASSERT_TRUE(mapped.Load(filename));
+  EXPECT_TRUE(mapped.IsMapped());
+  EXPECT_EQ(mapped.size(), weights.size());
+  weights.ForEach([&](uint64_t key, float value) {
+    EXPECT_EQ(mapped.Get(key, -1.0f), value);
+  });
+  EXPECT_FALSE(mapped.Contains(1));
+
+  // Modifying a mapped table copies it and leaves the file untouched.
+  mapped.Set(1, 1.0f);
+  EXPECT_FALSE(mapped.IsMapped());
+  EXPECT_EQ(mapped.Get(1, -1.0f), 1.0f);
+  EXPECT_EQ(mapped.Get(0, -1.0f), 0.25f);
+  FeatureWeights reloaded;
+  ASSERT_TRUE(reloaded.Load(filename));
+  EXPECT_FALSE(reloaded.Contains(1));
+  EXPECT_EQ(reloaded.size(), weights.size());
+}
+
+TEST(featureweights, text_file) {
+  const std::string filename = "/tmp/featureweights_test.txt";
+  FILE* output = fopen(filename.c_str(), "wt");
+  ASSERT_NE(output, nullptr);
+  fprintf(output, "00000000000000070000000000000001 1.5\n");
+  fprintf(output, "0000000000000009 2.5\n");
+  fclose(output);
+  EXPECT_FALSE(FeatureWeights::IsBinaryWeightsFile(filename));
+  FeatureWeights weights;
+  ASSERT_TRUE(weights.Load(filename));
+  EXPECT_FALSE(weights.IsMapped());
+  EXPECT_EQ(weights.size(), 2);
+  EXPECT_EQ(weights.Get(7, -1.0f), 1.5f);
+  EXPECT_EQ(weights.Get(9, -1.0f), 2.5f);
+}
+
+TEST(featureweights, hasher_version) {
+  const std::string text_filename = "/tmp/featureweights_version_test.txt";
+  FILE* output = fopen(text_filename.c_str(), "wt");
+  ASSERT_NE(output, nullptr);
+  fprintf(output, "hasher_version portable\n");
+  fprintf(output, "0000000000000009 2.5\n");
+  fclose(output);
+  FeatureWeights weights;
+  ASSERT_TRUE(weights.Load(text_filename));
+  EXPECT_EQ(weights.GetHasherVersion(), HasherVersion::kPortable);
+  EXPECT_EQ(weights.size(), 1);
+
+  // The version survives the conversion to the binary format.
+  const std::string binary_filename = "/tmp/featureweights_version_test.bin";
+  ASSERT_TRUE(weights.Save(binary_filename));
+  FeatureWeights mapped;
+  ASSERT_TRUE(mapped.Load(binary_filename));
+  EXPECT_EQ(mapped.GetHasherVersion(), HasherVersion::kPortable);
+
+  FeatureWeights empty;
+  EXPECT_EQ(empty.GetHasherVersion(), HasherVersion::kLegacy);
+}
+
+TEST(featureweights, rejected_text_file_keeps_weights) {
+  const std::string filename = "/tmp/featureweights_rejected_test.txt";
+  FILE* output = fopen(filename.c_str(), "wt");
+  ASSERT_NE(output, nullptr);
+  fprintf(output, "0000000000000009 2.5\n");
+  fprintf(output, "hasher_version unknown\n");
+  fclose(output);
+  FeatureWeights weights;
+  weights.Set(7, 1.5f);
+  weights.SetHasherVersion(HasherVersion::kPortable);
+  EXPECT_FALSE(weights.Load(filename));
+  EXPECT_EQ(weights.size(), 1);
+  EXPECT_EQ(weights.Get(7, -1.0f), 1.5f);
+  EXPECT_FALSE(weights.Contains(9));
+  EXPECT_EQ(weights.GetHasherVersion(), HasherVersion::kPortable);
+}
+
+TEST(featureweights, corrupt_binary_header) {
+  FeatureWeights weights;
+  weights.Set(7, 1.5f);
+  const std::string filename = "/tmp/featureweights_corrupt_test.bin";
+  ASSERT_TRUE(weights.Save(filename));
+  FeatureWeights::FileHeader header;
+  FILE* file = fopen(filename.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fread(&header, sizeof(header), 1, file), 1);
+  fclose(file);
+
+  // A file without slots whose capacity in bytes wraps around to zero, and
+  // capacities that are not a power of two.
+  uint64_t capacity = header.capacity;
+  std::vector<std::pair<uint64_t, uint64_t>> corrupt = {
+    { 1ULL << 60, 0 }, { capacity + 1, capacity + 1 },
+    { 3 * capacity, 3 * capacity } };
+  for (const auto& candidate : corrupt) {
+    header.capacity = candidate.first;
+    file = fopen(filename.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(fwrite(&header, sizeof(header), 1, file), 1);
+    std::vector<FeatureWeights::Slot> slots(candidate.second,
+      FeatureWeights::Slot{ header.empty_key, 0.0f, 0 });
+    ASSERT_EQ(fwrite(slots.data(), sizeof(FeatureWeights::Slot),
+      slots.size(), file), slots.size());
+    fclose(file);
+    FeatureWeights mapped;
+    EXPECT_FALSE(mapped.Load(filename)) << candidate.first;
+  }
+}
+
+TEST(featureweights, binary_file_without_empty_slots) {
+  FeatureWeights weights;
+  weights.Set(7, 1.5f);
+  const std::string filename = "/tmp/featureweights_full_test.bin";
+  ASSERT_TRUE(weights.Save(filename));
+  FeatureWeights::FileHeader header;
+  FILE* file = fopen(filename.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fread(&header, sizeof(header), 1, file), 1);
+  fclose(file);
+
+  // Every slot holds a key, but the header claims a half-empty table. Looking
+  // up a missing key in such a table would never find an empty slot.
+  std::vector<FeatureWeights::Slot> slots;
+  for (uint64_t index = 0; index < header.capacity; ++index) {
+    slots.push_back(FeatureWeights::Slot{ header.empty_key + index + 1, 1.0f,
+      0 });
+  }
+  file = fopen(filename.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fwrite(&header, sizeof(header), 1, file), 1);
+  ASSERT_EQ(fwrite(slots.data(), sizeof(FeatureWeights::Slot), slots.size(),
+    file), slots.size());
+  fclose(file);
+  FeatureWeights mapped;
+  EXPECT_FALSE(mapped.Load(filename));
+}
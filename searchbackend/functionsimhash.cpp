@@ -12,10 +12,89 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
 #include "InstructionDecoder.h"
 #include "util/util.hpp"
+#include "disassembly/mnemonictable.hpp"
 #include "searchbackend/functionsimhash.hpp"
+#include "searchbackend/featurecounter.hpp"
 #include "searchbackend/functionsimhashfeaturedump.hpp"
+#include "searchbackend/simhashaccumulator.hpp"
+#include "searchbackend/simhashsearchindex.hpp"
+#include "util/portablehash.hpp"
+#include "util/threadpool.hpp"
+
+namespace {
+
+// Seeds that keep the feature kinds apart in the portable hash family.
+constexpr uint64_t kPortableGraphletSeed = 1;
+constexpr uint64_t kPortableMnemonicSeed = 2;
+constexpr uint64_t kPortableImmediateSeed = 3;
+constexpr uint64_t kPortableFeatureWordSeed = 4;
+
+// In the portable family, every feature is hashed into a 64-bit key once. Word
+// 'word' of the feature hash for its occurrence-th occurrence is derived from
+// the key; the words do not depend on each other, so their multiplications can
+// all be in flight at once.
+inline uint64_t PortableFeatureWord(uint64_t key, uint64_t occurrence,
+  uint64_t word) {
+  return PortableHashWords(key, (occurrence << 32) | word,
+    kPortableFeatureWordSeed);
+}
+
+template <size_t kWords>
+void PortableFeatureHash(uint64_t key, uint64_t occurrence,
+  uint64_t first_word, std::array<uint64_t, kWords>* output) {
+  for (uint64_t word = 0; word < kWords; ++word) {
+    (*output)[word] = PortableFeatureWord(key, occurrence, first_word + word);
+  }
+}
+
+// The signature the legacy graph hashes are calculated from, reused for all
+// graphlets hashed on this thread.
+GraphletSignature& GetThreadSignature() {
+  static thread_local GraphletSignature signature;
+  return signature;
+}
+
+// The same for the graphlets of one batch, one signature per start node.
+GraphletSignatures& GetThreadGraphletSignatures() {
+  static thread_local GraphletSignatures signatures;
+  return signatures;
+}
+
+// Calls function(index) for every index below count, on the given number of
+// threads. Indices are handed out in small chunks, so that all threads stay
+// busy even if the functions being hashed differ a lot in size.
+template <typename Function>
+void ParallelFor(uint64_t count, uint32_t threads, Function function) {
+  constexpr uint64_t kChunkSize = 16;
+  if ((threads <= 1) || (count <= kChunkSize)) {
+    for (uint64_t index = 0; index < count; ++index) {
+      function(index);
+    }
+    return;
+  }
+  std::atomic<uint64_t> next_chunk(0);
+  threadpool::ThreadPool pool(threads);
+  for (uint32_t thread = 0; thread < threads; ++thread) {
+    pool.Push([&](int /* thread_id */) {
+      uint64_t begin;
+      while ((begin = next_chunk.fetch_add(kChunkSize)) < count) {
+        uint64_t end = std::min(begin + kChunkSize, count);
+        for (uint64_t index = begin; index < end; ++index) {
+          function(index);
+        }
+      }
+    });
+  }
+  pool.Stop(true);
+}
+
+} // namespace
 
 FeatureOptions DisabledFeatures(bool graphs, bool mnemonics, bool immediates) {
   return (graphs ? disable_graphs : default_features) |
@@ -38,17 +117,20 @@ uint64_t FunctionSimHasher::FloatsToBits(const std::vector<float>& floats) {
 
 bool FunctionSimHasher::FloatsToBits(const std::vector<float>& floats,
   std::vector<uint64_t>* outputs) {
-  uint64_t index = 0;
-  outputs->resize((floats.size() / 64) + 1);
-  for (float entry : floats) {
+  FloatsToBits(floats.data(), floats.size(), outputs);
+  return true;
+}
+
+void FunctionSimHasher::FloatsToBits(const float* floats, uint64_t count,
+  std::vector<uint64_t>* outputs) {
+  outputs->resize((count / 64) + 1);
+  for (uint64_t index = 0; index < count; ++index) {
     uint64_t vector_index = index / 64;
     uint64_t bit_index = index % 64;
-    if (entry >= 0) {
+    if (floats[index] >= 0) {
       (*outputs)[vector_index] |= (1ULL << bit_index);
     }
-    ++index;
   }
-  return true;
 }
 
 void FunctionSimHasher::DumpFloatState(std::vector<float>* output_floats) {
@@ -69,180 +151,357 @@ void FunctionSimHasher::DumpFloatState(std::vector<float>* output_floats) {
 // vectors with the same bits. Unfortunately, the construction of SimHash is
 // such that repeated entries in a multiset will "overwhelm" the hash, so
 // care has to be taken to add cardinalities into the construction.
+bool FunctionSimHasher::CalculateFunctionSimHash(
+  FunctionFeatureGenerator* generator, uint64_t number_of_outputs,
+  std::vector<uint64_t>* output_simhash_values, std::vector<FeatureHash>*
+  feature_hashes) {
+  if (number_of_outputs == 0) {
+    printf("[!] Cannot calculate a SimHash of 0 bits.\n");
+    return false;
+  }
+  switch ((number_of_outputs + 63) / 64) {
+    case 1:
+      CalculateNBitFunctionSimHash<64>(generator, number_of_outputs,
+        output_simhash_values, feature_hashes);
+      return true;
+    case 2:
+      CalculateNBitFunctionSimHash<128>(generator, number_of_outputs,
+        output_simhash_values, feature_hashes);
+      return true;
+    case 3:
+      CalculateNBitFunctionSimHash<192>(generator, number_of_outputs,
+        output_simhash_values, feature_hashes);
+      return true;
+    case 4:
+      CalculateNBitFunctionSimHash<256>(generator, number_of_outputs,
+        output_simhash_values, feature_hashes);
+      return true;
+  }
+  // Wider SimHashes are accumulated in chunks of 256 floats, each of which is
+  // hashed with the feature hash words that follow those of the chunk before.
+  uint64_t chunks = (number_of_outputs + 255) / 256;
+  std::vector<float> output_simhash_floats(chunks * 256);
+  AccumulateFeatures<256>(generator, output_simhash_floats.data(), chunks,
+    feature_hashes);
+  FloatsToBits(output_simhash_floats.data(), number_of_outputs,
+    output_simhash_values);
+  return true;
+}
+
+template <uint64_t kBits>
 void FunctionSimHasher::CalculateFunctionSimHash(
+  FunctionFeatureGenerator* generator, SimHash<kBits>* output_simhash,
+  std::vector<FeatureHash>* feature_hashes) {
+  static_assert(kBits % 64 == 0, "SimHash widths are multiples of 64 bits.");
+  std::array<float, kBits> output_simhash_floats;
+  AccumulateFeatures<kBits>(generator, output_simhash_floats.data(), 1,
+    feature_hashes);
+  FloatsToSimHash<kBits>(output_simhash_floats, output_simhash);
+}
+
+template <uint64_t kBits>
+void FunctionSimHasher::CalculateFunctionSimHashes(
+  FunctionFeatureGenerator* const* generators, uint64_t count,
+  SimHash<kBits>* output_simhashes, uint32_t threads) {
+  ParallelFor(count, threads, [&](uint64_t index) {
+    CalculateFunctionSimHash<kBits>(generators[index],
+      &output_simhashes[index]);
+  });
+}
+
+void FunctionSimHasher::CalculateFunctionSimHashes(
+  const std::vector<FeatureHash>* features, uint64_t count,
+  SimHash<128>* output_simhashes, uint32_t threads) {
+  ParallelFor(count, threads, [&](uint64_t index) {
+    std::array<float, 128> floats;
+    AccumulateFeatureHashes(features[index], &floats);
+    FloatsToSimHash<128>(floats, &output_simhashes[index]);
+  });
+}
+
+template <uint64_t kBits>
+void FunctionSimHasher::FloatsToSimHash(const std::array<float, kBits>& floats,
+  SimHash<kBits>* simhash) {
+  simhash->fill(0);
+  for (uint64_t index = 0; index < kBits; ++index) {
+    if (floats[index] >= 0) {
+      (*simhash)[index / 64] |= (1ULL << (index % 64));
+    }
+  }
+}
+
+// Widths that are not a multiple of 64 use the next larger width and ignore the
+// surplus floats; each float only depends on the bit with the same index.
+template <uint64_t kBits>
+void FunctionSimHasher::CalculateNBitFunctionSimHash(
   FunctionFeatureGenerator* generator, uint64_t number_of_outputs,
   std::vector<uint64_t>* output_simhash_values, std::vector<FeatureHash>*
   feature_hashes) {
+  std::array<float, kBits> output_simhash_floats;
+  AccumulateFeatures<kBits>(generator, output_simhash_floats.data(), 1,
+    feature_hashes);
+  FloatsToBits(output_simhash_floats.data(), number_of_outputs,
+    output_simhash_values);
+}
 
-  std::vector<float> output_simhash_floats;
-  output_simhash_floats.resize(number_of_outputs);
+// The visitor is final, so the per-feature calls below are resolved at compile
+// time; only the batches go through virtual calls.
+template <uint64_t kBits>
+class FunctionSimHasher::FeatureAccumulator final : public FeatureVisitor {
+public:
+  FeatureAccumulator(const FunctionSimHasher* hasher,
+    FeatureCounter* feature_cardinalities, float* output_simhash_floats,
+    uint64_t chunks, std::vector<FeatureHash>* feature_hashes) :
+    hasher_(hasher), feature_cardinalities_(feature_cardinalities),
+    output_simhash_floats_(output_simhash_floats), chunks_(chunks),
+    feature_hashes_(feature_hashes) {}
+
+  bool WantsGraphlets() const override {
+    return !(hasher_->feature_options_ & disable_graphs);
+  }
+  bool WantsMnemonics() const override {
+    return !(hasher_->feature_options_ & disable_mnemonics);
+  }
+  bool WantsImmediates() const override {
+    return !(hasher_->feature_options_ & disable_immediates);
+  }
+  bool WantsDecodedImmediates() const override {
+    return UsesDecodedImmediates(hasher_->hasher_version_);
+  }
+  // The graphlet hashes are turned into graphlet IDs without occurrence.
+  void GetGraphletHashKeys(uint64_t* keys) const override {
+    hasher_->GetGraphletIdSeeds(keys);
+  }
 
-  // A map to keep track of how often each feature has been seen during the
-  // calculation of this SimHash. Needed to deal with multisets -- if one simply
-  // adds the same per-feature-hash into the calculation the resulting SimHash
-  // will with high likelihood end up being just the per-feature hash (adding
-  // the same value over and over again will 'dominate' the entire hash).
-  std::map<uint64_t, uint64_t> feature_cardinalities;
-
-  // TODO(thomasdullien): The following code (for adding graph, mnemonic, and
-  // immediate features) has a lot of code duplication and should be cleaned
-  // up to be more DRY.
-  if (!(feature_options_ & disable_graphs)) {
-    // Process subgraphs.
-    while (generator->HasMoreSubgraphs()) {
-      std::pair<Flowgraph*, address> graphlet_and_node =
-        generator->GetNextSubgraph();
-      std::unique_ptr<Flowgraph> graphlet(graphlet_and_node.first);
-      address node = graphlet_and_node.second;
-      if (graphlet) {
-        uint64_t graphlet_id = GetGraphletIdNoOccurrence(graphlet, node);
-        uint64_t cardinality = feature_cardinalities[graphlet_id]++;
-        uint64_t graphlet_id_with_cardinality = GetGraphletIdOccurrence(
-          graphlet, cardinality, node);
-
-        // Get the weight for the graphlet.
-        float graphlet_weight = GetWeight(graphlet_id_with_cardinality,
-          default_graphlet_weight_);
-
-        ProcessSubgraph(graphlet, graphlet_weight, node, number_of_outputs,
-          cardinality, &output_simhash_floats, feature_hashes);
-      }
+  // The feature hashes depend on the occurrence count, so they are calculated
+  // graphlet by graphlet (see CalculateNBitGraphHash). The views point into
+  // the generator, so their signatures only live for this batch.
+  void VisitGraphlets(const GraphletView* graphlets, const uint64_t* hashes,
+    uint64_t count) override {
+    GraphletSignatures& signatures = GetThreadGraphletSignatures();
+    signatures.Clear();
+    for (uint64_t index = 0; index < count; ++index) {
+      uint64_t graphlet_id = hasher_->GetGraphletIdNoOccurrence(hashes[index]);
+      uint64_t cardinality = feature_cardinalities_->Increment(graphlet_id);
+      NBitHash<kBits> hash;
+      hasher_->CalculateNBitGraphHash<kBits>(graphlets[index], graphlet_id,
+        cardinality, &signatures, &hash);
+
+      // Get the weight for the graphlet.
+      float graphlet_weight = hasher_->GetWeight(hash[0],
+        hasher_->default_graphlet_weight_);
+
+      hasher_->ProcessSubgraph<kBits>(graphlets[index], hash, graphlet_weight,
+        output_simhash_floats_, feature_hashes_);
+      AddFurtherChunks(graphlet_weight, [&](uint64_t first_word,
+        NBitHash<kBits>* chunk_hash) {
+        hasher_->CalculateNBitGraphHash<kBits>(graphlets[index], graphlet_id,
+          cardinality, &signatures, chunk_hash, first_word);
+      });
     }
   }
-  if (!(feature_options_ & disable_mnemonics)) {
-    while (generator->HasMoreMnemonics()) {
-      MnemTuple tuple = generator->GetNextMnemTuple();
-      uint64_t tuple_id = GetMnemonicIdNoOccurrence(tuple);
-      uint64_t cardinality = feature_cardinalities[tuple_id]++;
-      uint64_t mnemonic_id_with_cardinality = GetMnemonicIdOccurrence(tuple,
-        cardinality);
-      float mnemonic_tuple_weight = GetWeight(mnemonic_id_with_cardinality,
-        default_mnemonic_weight_);
 
-      ProcessMnemTuple(tuple, mnemonic_tuple_weight, number_of_outputs,
-        cardinality, &output_simhash_floats, feature_hashes);
+  void VisitMnemTuples(const MnemTuple* tuples, uint64_t count) override {
+    for (uint64_t index = 0; index < count; ++index) {
+      const MnemTuple& tuple = tuples[index];
+      uint64_t tuple_id = hasher_->GetMnemonicIdNoOccurrence(tuple);
+      uint64_t cardinality = feature_cardinalities_->Increment(tuple_id);
+      uint64_t mnemonic_id_with_cardinality = hasher_->GetMnemonicIdOccurrence(
+        tuple, tuple_id, cardinality);
+      float mnemonic_tuple_weight = hasher_->GetWeight(
+        mnemonic_id_with_cardinality, hasher_->default_mnemonic_weight_);
+
+      hasher_->ProcessMnemTuple<kBits>(tuple, tuple_id, mnemonic_tuple_weight,
+        cardinality, output_simhash_floats_, feature_hashes_);
+      AddFurtherChunks(mnemonic_tuple_weight, [&](uint64_t first_word,
+        NBitHash<kBits>* chunk_hash) {
+        hasher_->CalculateNBitMnemTupleHash<kBits>(tuple, tuple_id,
+          cardinality, chunk_hash, first_word);
+      });
     }
   }
-  if (!(feature_options_ & disable_immediates)) {
-    while(generator->HasMoreImmediates()) {
-      // Multiply the immediate value with some random uint64_t to get a hash.
-      uint64_t immediate = generator->GetNextImmediate();
-      uint64_t immediate_id = GetImmediateIdNoOccurrence(immediate);
-      uint64_t cardinality = feature_cardinalities[immediate_id]++;
-      uint64_t immediate_id_with_cardinality = GetImmediateIdOccurrence(
-        immediate, cardinality);
-      float immediate_weight = GetWeight(immediate_id_with_cardinality,
-        default_immediate_weight_);
-
-      ProcessImmediate(immediate, immediate_weight, number_of_outputs,
-        cardinality, &output_simhash_floats, feature_hashes);
+
+  void VisitImmediates(const uint64_t* immediates, uint64_t count) override {
+    for (uint64_t index = 0; index < count; ++index) {
+      uint64_t immediate = immediates[index];
+      uint64_t immediate_id = hasher_->GetImmediateIdNoOccurrence(immediate);
+      uint64_t cardinality = feature_cardinalities_->Increment(immediate_id);
+      uint64_t immediate_id_with_cardinality =
+        hasher_->GetImmediateIdOccurrence(immediate, immediate_id,
+        cardinality);
+      float immediate_weight = hasher_->GetWeight(
+        immediate_id_with_cardinality, hasher_->default_immediate_weight_);
+
+      hasher_->ProcessImmediate<kBits>(immediate, immediate_id,
+        immediate_weight, cardinality, output_simhash_floats_,
+        feature_hashes_);
+      AddFurtherChunks(immediate_weight, [&](uint64_t first_word,
+        NBitHash<kBits>* chunk_hash) {
+        hasher_->CalculateNBitImmediateHash<kBits>(immediate, immediate_id,
+          cardinality, chunk_hash, first_word);
+      });
+    }
+  }
+private:
+  // For SimHashes wider than kBits, chunk i of the floats receives words
+  // i * kBits / 64 and up of the feature hash. There is a single chunk for
+  // all fixed widths, so this loop does not run for them.
+  template <typename CalculateChunkHash>
+  void AddFurtherChunks(float weight, CalculateChunkHash calculate_chunk_hash) {
+    for (uint64_t chunk = 1; chunk < chunks_; ++chunk) {
+      NBitHash<kBits> hash;
+      calculate_chunk_hash(chunk * hash.size(), &hash);
+      hasher_->AddWeightsInHashToOutput(hash.data(), kBits, weight,
+        output_simhash_floats_ + chunk * kBits);
     }
   }
 
-  FloatsToBits(output_simhash_floats, output_simhash_values);
+  const FunctionSimHasher* hasher_;
+  FeatureCounter* feature_cardinalities_;
+  float* output_simhash_floats_;
+  uint64_t chunks_;
+  std::vector<FeatureHash>* feature_hashes_;
+};
+
+template <uint64_t kBits>
+void FunctionSimHasher::AccumulateFeatures(
+  FunctionFeatureGenerator* generator, float* output_simhash_floats,
+  uint64_t chunks, std::vector<FeatureHash>* feature_hashes) {
+  std::fill_n(output_simhash_floats, chunks * kBits, 0.0f);
+
+  // A table to keep track of how often each feature has been seen during the
+  // calculation of this SimHash. Needed to deal with multisets -- if one simply
+  // adds the same per-feature-hash into the calculation the resulting SimHash
+  // will with high likelihood end up being just the per-feature hash (adding
+  // the same value over and over again will 'dominate' the entire hash).
+  // The table is reused for all functions hashed on this thread.
+  static thread_local FeatureCounter feature_cardinalities;
+  feature_cardinalities.Clear();
+
+  // The generator pushes graphlets, mnemonic tuples and immediates in this
+  // order, and skips the classes that feature_options_ disables.
+  FeatureAccumulator<kBits> accumulator(this, &feature_cardinalities,
+    output_simhash_floats, chunks, feature_hashes);
+  generator->VisitFeatures(&accumulator);
 }
 
 void FunctionSimHasher::CalculateFunctionSimHash(
   std::vector<FeatureHash>* features, std::vector<uint64_t>* output,
   std::vector<float>* optional_state) {
 
-  std::vector<float> floats(128);
-  for (const auto& feature : *features) {
-    std::vector<uint64_t> hash = { feature.first, feature.second };
-    double weight = 1.0;
-    if (weights_.find(feature.first) != weights_.end()) {
-      weight = weights_.at(feature.first);
-    }
-    AddWeightsInHashToOutput(hash, 128, weight, &floats);
-  }
+  std::array<float, 128> floats;
+  AccumulateFeatureHashes(*features, &floats);
   if (optional_state) {
-    optional_state->clear();
-    optional_state->insert(optional_state->begin(), floats.begin(), floats.end());
+    optional_state->assign(floats.begin(), floats.end());
   }
-  FloatsToBits(floats, output);
+  FloatsToBits(floats.data(), floats.size(), output);
 }
 
+// The weight of the feature a few positions ahead is prefetched, so that with
+// large weight tables the cache misses of consecutive lookups overlap.
+void FunctionSimHasher::AccumulateFeatureHashes(
+  const std::vector<FeatureHash>& features,
+  std::array<float, 128>* floats) const {
+  constexpr uint64_t kPrefetchDistance = 8;
+  floats->fill(0.0f);
+  for (uint64_t index = 0; index < features.size(); ++index) {
+    if (index + kPrefetchDistance < features.size()) {
+      weights_.Prefetch(features[index + kPrefetchDistance].first);
+    }
+    uint64_t hash[2] = { features[index].first, features[index].second };
+    float weight = weights_.Get(features[index].first, 1.0);
+    AddWeightsInHashToOutput(hash, 128, weight, floats->data());
+  }
+}
+
+
+template <uint64_t kBits>
+FeatureHash FunctionSimHasher::ToFeatureHash(const NBitHash<kBits>& hash) {
+  if constexpr (kBits > 64) {
+    return FeatureHash(hash[0], hash[1]);
+  } else {
+    return FeatureHash(hash[0], 0);
+  }
+}
 
 // Add a given subgraph into the vector of floats.
-void FunctionSimHasher::ProcessSubgraph(std::unique_ptr<Flowgraph>& graph,
-  float graphlet_weight, address node, uint64_t bits, uint64_t hash_index,
-  std::vector<float>* output_simhash_floats, std::vector<FeatureHash>*
+template <uint64_t kBits>
+void FunctionSimHasher::ProcessSubgraph(const GraphletView& graph,
+  const NBitHash<kBits>& hash, float graphlet_weight,
+  float* output_simhash_floats, std::vector<FeatureHash>*
   feature_hashes) const {
-
-  // Calculate n-bit hash of the subgraph.
-  std::vector<uint64_t> hash;
-  CalculateNBitGraphHash(graph, node, bits, hash_index, &hash);
+  FeatureHash feature = ToFeatureHash<kBits>(hash);
 
   // For diagnostics, it can be useful to write a DOT or JSON file with the
   // structure of the graph. This is particularly helpful to analyze weights
   // after the learning process.
   if (feature_logging_options_ & dump_graphlets) {
-    WriteFeatureDictionaryEntry(hash[0], hash[1], *graph);
+    std::unique_ptr<Flowgraph> flowgraph(graph.ToFlowgraph());
+    WriteFeatureDictionaryEntry(feature.first, feature.second, *flowgraph);
   }
   if (feature_hashes) {
-    feature_hashes->push_back(std::make_pair(hash[0], hash[1]));
+    feature_hashes->push_back(feature);
   }
   // Iterate over the bits in the hash.
-  AddWeightsInHashToOutput(hash, bits, graphlet_weight, output_simhash_floats);
+  AddWeightsInHashToOutput(hash.data(), kBits, graphlet_weight,
+    output_simhash_floats);
 }
 
 // Add a given mnemonic tuple into the vector of floats.
-void FunctionSimHasher::ProcessMnemTuple(const MnemTuple &tup,
-  float mnem_tuple_weight, uint64_t bits, uint64_t hash_index,
-  std::vector<float>* output_simhash_floats, std::vector<FeatureHash>*
+template <uint64_t kBits>
+void FunctionSimHasher::ProcessMnemTuple(const MnemTuple &tup, uint64_t key,
+  float mnem_tuple_weight, uint64_t hash_index,
+  float* output_simhash_floats, std::vector<FeatureHash>*
   feature_hashes) const {
 
-  std::vector<uint64_t> hash;
-  CalculateNBitMnemTupleHash(tup, bits, hash_index, &hash);
+  NBitHash<kBits> hash;
+  CalculateNBitMnemTupleHash<kBits>(tup, key, hash_index, &hash);
+  FeatureHash feature = ToFeatureHash<kBits>(hash);
 
   // For diagnostics, it can be useful to write a DOT or JSON file with the
   // structure of the graph. This is particularly helpful to analyze weights
   // after the learning process.
   if (feature_logging_options_ & dump_mnemonics) {
-    WriteFeatureDictionaryEntry(hash[0], hash[1], tup);
+    WriteFeatureDictionaryEntry(feature.first, feature.second, tup);
   }
 
   if (feature_hashes) {
-    feature_hashes->push_back(std::make_pair(hash[0], hash[1]));
+    feature_hashes->push_back(feature);
   }
-  AddWeightsInHashToOutput(hash, bits, mnem_tuple_weight, output_simhash_floats);
+  AddWeightsInHashToOutput(hash.data(), kBits, mnem_tuple_weight,
+    output_simhash_floats);
 }
 
 // Add a given mnemonic tuple into the vector of floats.
-void FunctionSimHasher::ProcessImmediate(uint64_t immediate,
-  float immediate_weight, uint64_t bits, uint64_t hash_index,
-  std::vector<float>* output_simhash_floats, std::vector<FeatureHash>*
+template <uint64_t kBits>
+void FunctionSimHasher::ProcessImmediate(uint64_t immediate, uint64_t key,
+  float immediate_weight, uint64_t hash_index,
+  float* output_simhash_floats, std::vector<FeatureHash>*
   feature_hashes) const {
 
-  std::vector<uint64_t> hash;
-  CalculateNBitImmediateHash(immediate, bits, hash_index, &hash);
+  NBitHash<kBits> hash;
+  CalculateNBitImmediateHash<kBits>(immediate, key, hash_index, &hash);
+  FeatureHash feature = ToFeatureHash<kBits>(hash);
 
   // For diagnostics, it can be useful to write a DOT or JSON file with the
   // structure of the graph. This is particularly helpful to analyze weights
   // after the learning process.
   if (feature_logging_options_ & dump_immediates) {
-    WriteFeatureDictionaryEntry(hash[0], hash[1], immediate);
+    WriteFeatureDictionaryEntry(feature.first, feature.second, immediate);
   }
 
   if (feature_hashes) {
-    feature_hashes->push_back(std::make_pair(hash[0], hash[1]));
+    feature_hashes->push_back(feature);
   }
-  AddWeightsInHashToOutput(hash, bits, immediate_weight, output_simhash_floats);
+  AddWeightsInHashToOutput(hash.data(), kBits, immediate_weight,
+    output_simhash_floats);
 }
 
 // Iterate over an n-bit hash; add weights into the vector for each one,
 // subtract the weights from the vector for each zero.
-void FunctionSimHasher::AddWeightsInHashToOutput(
-  const std::vector<uint64_t>& hash, uint64_t bits, float weight,
-  std::vector<float>* output_simhash_floats) const {
-
-  for (uint64_t bit_index = 0; bit_index < bits; ++bit_index) {
-    if (GetNthBit(hash, bit_index)) {
-      (*output_simhash_floats)[bit_index] += weight;
-    } else {
-      (*output_simhash_floats)[bit_index] -= weight;
-    }
-  }
+void FunctionSimHasher::AddWeightsInHashToOutput(const uint64_t* hash,
+  uint64_t bits, float weight, float* output_simhash_floats) const {
+  AccumulateSimHashWeight(hash, bits, weight, output_simhash_floats);
 }
 
 // In order to facilitate the creation of a hash function family, create a
@@ -265,11 +524,11 @@ uint64_t FunctionSimHasher::HashMnemTuple(const MnemTuple& tup,
   uint64_t hash_index) const {
   uint64_t value1 = SeedXForHashY(0, hash_index) ^ SeedXForHashY(1, hash_index) ^
     SeedXForHashY(2, hash_index);
-  value1 *= std::hash<std::string>{}(std::get<0>(tup));
+  value1 *= MnemonicTable::GetHash(std::get<0>(tup));
   value1 = rotl64(value1, 7);
-  value1 *= std::hash<std::string>{}(std::get<1>(tup));
+  value1 *= MnemonicTable::GetHash(std::get<1>(tup));
   value1 = rotl64(value1, 7);
-  value1 *= std::hash<std::string>{}(std::get<2>(tup));
+  value1 *= MnemonicTable::GetHash(std::get<2>(tup));
   value1 = rotl64(value1, 7);
   value1 *= (k2 * (hash_index + 1));
   return value1;
@@ -278,9 +537,9 @@ uint64_t FunctionSimHasher::HashMnemTuple(const MnemTuple& tup,
 // Hash a graph into a 64-bit value, using a hash family index and a counter.
 // The hash family index is used for choosing a hash family (clearly ;), the
 // counter is used for generating multi-word hash outputs.
-uint64_t FunctionSimHasher::HashGraph(std::unique_ptr<Flowgraph>& graph,
-  address node, uint64_t hash_index, uint64_t counter) const {
-  return graph->CalculateHash(node,
+uint64_t FunctionSimHasher::HashGraph(const GraphletSignature& graph,
+  uint64_t hash_index, uint64_t counter) const {
+  return graph.CalculateHash(
     SeedXForHashY(0, hash_index) * (counter + 1),
     SeedXForHashY(1, hash_index) * (counter + 1),
     SeedXForHashY(2, hash_index) * (counter + 1));
@@ -301,102 +560,171 @@ uint64_t FunctionSimHasher::HashImmediate(uint64_t immediate,
   return value1;
 }
 
+template <uint64_t kBits>
 void FunctionSimHasher::CalculateNBitImmediateHash(uint64_t immediate,
-  uint64_t bits, uint64_t hash_index, std::vector<uint64_t>*output) const {
-  output->clear();
-
-  for (uint64_t counter = 0; counter < bits; counter += 64) {
-    output->push_back(HashImmediate(immediate, hash_index, counter));
+  uint64_t key, uint64_t hash_index, NBitHash<kBits>* output,
+  uint64_t first_word) const {
+  if (UsesPortableHashes(hasher_version_)) {
+    PortableFeatureHash(key, hash_index, first_word, output);
+    return;
+  }
+  for (uint64_t word = 0; word < output->size(); ++word) {
+    (*output)[word] = HashImmediate(immediate, hash_index,
+      (first_word + word) * 64);
   }
 }
 
 // Extend a 64-bit graph hash family to a N-bit hash family by just increasing
-// the hash function index.
+// the hash function index. In the legacy family, each word is a seeded hash of
+// the graphlet, so its orders and degrees are calculated once up front - and
+// for the graphlets of growing radius around a node, only the part the larger
+// radius adds. The portable family derives the words from the ID instead.
+template <uint64_t kBits>
 void FunctionSimHasher::CalculateNBitGraphHash(
-  std::unique_ptr<Flowgraph>& graph, address node, uint64_t bits,
-  uint64_t hash_index, std::vector<uint64_t>* output) const {
-  output->clear();
+  const GraphletView& graphlet, uint64_t key, uint64_t hash_index,
+  GraphletSignatures* signatures, NBitHash<kBits>* output,
+  uint64_t first_word) const {
+  if (UsesPortableHashes(hasher_version_)) {
+    PortableFeatureHash(key, hash_index, first_word, output);
+    return;
+  }
+  if (graphlet_hash_cache_ && (first_word == 0)) {
+    CalculateCachedGraphHash(graphlet, hash_index, output->data(),
+      output->size());
+    return;
+  }
+  const GraphletSignature& signature = signatures->Get(graphlet);
+  for (uint64_t word = 0; word < output->size(); ++word) {
+    (*output)[word] = HashGraph(signature, hash_index,
+      (first_word + word) * 64);
+  }
+}
 
-  for (uint64_t counter = 0; counter < bits; counter += 64) {
-    output->push_back(HashGraph(graph, node, hash_index, counter));
+// On a hit, the graphlet is not even looked at beyond its encoding, except
+// for the samples that measure what hashing it would have cost. Narrower
+// hashes still calculate and cache both words on a miss, so that the entries
+// serve hashes of every width.
+void FunctionSimHasher::CalculateCachedGraphHash(
+  const GraphletView& graphlet, uint64_t hash_index, uint64_t* words,
+  uint64_t count) const {
+  static thread_local std::vector<uint32_t> encoding;
+  static thread_local uint64_t hits_until_sample = 0;
+  GraphletHashCache::Clock::time_point start = GraphletHashCache::Clock::now();
+  graphlet.GetEncoding(&encoding);
+  GraphletSignature& signature = GetThreadSignature();
+  FeatureHash feature;
+  bool found = graphlet_hash_cache_->Lookup(encoding, hash_index, start,
+    &feature);
+  bool sample = found && (hits_until_sample-- == 0);
+  if (!found || sample) {
+    start = GraphletHashCache::Clock::now();
+    signature.Reset(graphlet);
+    feature = FeatureHash(HashGraph(signature, hash_index, 0),
+      HashGraph(signature, hash_index, 64));
+    uint64_t nanoseconds = GraphletHashCache::NanosecondsSince(start);
+    if (sample) {
+      graphlet_hash_cache_->RecordHashTime(nanoseconds);
+      hits_until_sample = GraphletHashCache::kHashSampleInterval - 1;
+    } else {
+      graphlet_hash_cache_->Insert(encoding, hash_index, feature,
+        nanoseconds);
+    }
+  } else if (count > 2) {
+    signature.Reset(graphlet);
+  }
+  words[0] = feature.first;
+  if (count > 1) {
+    words[1] = feature.second;
+  }
+  for (uint64_t word = 2; word < count; ++word) {
+    words[word] = HashGraph(signature, hash_index, word * 64);
   }
 }
 
 // Extend a 64-bit mnemonic tuple hash family to a N-bit hash family by just
 // increasing the hash function index.
+template <uint64_t kBits>
 void FunctionSimHasher::CalculateNBitMnemTupleHash(
-  const MnemTuple& tup, uint64_t bits, uint64_t hash_index,
-  std::vector<uint64_t>* output) const {
-  output->clear();
-
-  for (uint64_t counter = 0; counter < bits; counter += 64) {
-    output->push_back(HashMnemTuple(tup, hash_index + (counter + 1)));
+  const MnemTuple& tup, uint64_t key, uint64_t hash_index,
+  NBitHash<kBits>* output, uint64_t first_word) const {
+  if (UsesPortableHashes(hasher_version_)) {
+    PortableFeatureHash(key, hash_index, first_word, output);
+    return;
+  }
+  for (uint64_t word = 0; word < output->size(); ++word) {
+    (*output)[word] = HashMnemTuple(tup,
+      hash_index + ((first_word + word) * 64 + 1));
   }
 }
 
 // Return a weight for a given key, default to 1.0.
 float FunctionSimHasher::GetWeight(uint64_t key, float standard = 1.0) const {
-  const auto& iter = weights_.find(key);
-  if (iter == weights_.end()) {
-    return standard;
-  }
-  return iter->second;
+  return weights_.Get(key, standard);
 }
 
-// Calculates an ID for a graphlet, taking the occurrence count of the graphlet
-// into account. This is used for weight lookup.
-uint64_t FunctionSimHasher::GetGraphletIdOccurrence(
-  std::unique_ptr<Flowgraph>& graph, uint32_t occurrence, address node) const {
-  uint64_t graphlet_id = graph->CalculateHash(node, SeedXForHashY(0, occurrence),
-    SeedXForHashY(1, occurrence), SeedXForHashY(2, occurrence));
-
-  return graphlet_id;
+// The ID for a graphlet without taking the occurrence into account is derived
+// from its hash with these seeds. This is needed so that we can count how
+// often a given graphlet has shown up.
+void FunctionSimHasher::GetGraphletIdSeeds(uint64_t* seeds) const {
+  if (UsesPortableHashes(hasher_version_)) {
+    // The default seeds of CalculateHash, which is plain integer arithmetic
+    // and hence portable already.
+    seeds[0] = 0xc3a5c85c97cb3127ULL;
+    seeds[1] = 0xb492b66fbe98f273ULL;
+    seeds[2] = 0x9ae16a3b2f90404fULL;
+    return;
+  }
+  // The seeds of HashGraph(graph, 0, 0).
+  for (uint64_t seed_index = 0; seed_index < 3; ++seed_index) {
+    seeds[seed_index] = SeedXForHashY(seed_index, 0);
+  }
 }
 
-// Calculates an ID for a graphlet without taking the occurrence into account.
-// This is needed so that we can count how often a given graphlet has shown up.
-uint64_t FunctionSimHasher::GetGraphletIdNoOccurrence(
-  std::unique_ptr<Flowgraph>& graph, address node) const {
-  return HashGraph(graph, node, 0, 0);
+uint64_t FunctionSimHasher::GetGraphletIdNoOccurrence(uint64_t graph_hash)
+  const {
+  if (UsesPortableHashes(hasher_version_)) {
+    return PortableHashWords(graph_hash, 0, kPortableGraphletSeed);
+  }
+  return graph_hash;
 }
 
+// The IDs are the first word of the corresponding feature hash, which is all
+// that needs to be calculated.
 uint64_t FunctionSimHasher::GetMnemonicIdNoOccurrence(const MnemTuple& tuple)
   const {
-  std::vector<uint64_t> hash;
-  CalculateNBitMnemTupleHash(tuple, 128, 0, &hash);
-  return hash[0];
+  if (UsesPortableHashes(hasher_version_)) {
+    return PortableHashWords(PortableHashWords(
+      MnemonicTable::GetPortableHash(std::get<0>(tuple)),
+      MnemonicTable::GetPortableHash(std::get<1>(tuple)),
+      kPortableMnemonicSeed),
+      MnemonicTable::GetPortableHash(std::get<2>(tuple)),
+      kPortableMnemonicSeed);
+  }
+  return HashMnemTuple(tuple, 1);
 }
 
 uint64_t FunctionSimHasher::GetMnemonicIdOccurrence(const MnemTuple& tuple,
-  uint32_t occurrence) const {
-  std::vector<uint64_t> hash;
-  CalculateNBitMnemTupleHash(tuple, 128, occurrence, &hash);
-
-  return hash[0];
+  uint64_t key, uint32_t occurrence) const {
+  if (UsesPortableHashes(hasher_version_)) {
+    return PortableFeatureWord(key, occurrence, 0);
+  }
+  return HashMnemTuple(tuple, occurrence + 1);
 }
 
 uint64_t FunctionSimHasher::GetImmediateIdNoOccurrence(uint64_t immediate)
   const {
-  std::vector<uint64_t> hash;
-  CalculateNBitImmediateHash(immediate, 128, 0, &hash);
-  return hash[0];
+  if (UsesPortableHashes(hasher_version_)) {
+    return PortableHashWords(immediate, 0, kPortableImmediateSeed);
+  }
+  return HashImmediate(immediate, 0, 0);
 }
 
 uint64_t FunctionSimHasher::GetImmediateIdOccurrence(uint64_t immediate,
-  uint32_t occurrence) const {
-  std::vector<uint64_t> hash;
-  CalculateNBitImmediateHash(immediate, 128, occurrence, &hash);
-
-  return hash[0];
-}
-
-// Given a vector of 64-bit values, retrieve the n-th bit.
-inline bool FunctionSimHasher::GetNthBit(const std::vector<uint64_t>& nbit_hash,
-  uint64_t bitindex) const {
-  uint64_t index = bitindex / 64;
-  uint64_t value = nbit_hash[index];
-  uint64_t sub_word_index = bitindex % 64;
-  return (value >> sub_word_index) & 1;
+  uint64_t key, uint32_t occurrence) const {
+  if (UsesPortableHashes(hasher_version_)) {
+    return PortableFeatureWord(key, occurrence, 0);
+  }
+  return HashImmediate(immediate, occurrence, 0);
 }
 
 FunctionSimHasher::FunctionSimHasher(const std::string& weight_file,
@@ -404,40 +732,62 @@ FunctionSimHasher::FunctionSimHasher(const std::string& weight_file,
   FeatureLoggingOptions feature_logging,
   double default_mnemonic_weight,
   double default_graphlet_weight,
-  double default_immediate_weight) :
+  double default_immediate_weight,
+  HasherVersion hasher_version) :
     default_mnemonic_weight_(default_mnemonic_weight),
     default_graphlet_weight_(default_graphlet_weight),
     default_immediate_weight_(default_immediate_weight),
     feature_options_(feature_options),
-    feature_logging_options_(feature_logging) {
-  std::vector<std::vector<std::string>> tokenized_lines;
-
+    feature_logging_options_(feature_logging),
+    hasher_version_(hasher_version), graphlet_hash_cache_(nullptr) {
   if (weight_file == "") {
     return;
   }
-  if (FileToLineTokens(weight_file, &tokenized_lines)) {
-    for (const std::vector<std::string>& line : tokenized_lines) {
-      if (line.size() < 2) {
-        printf("[!] Truncated line found!\n");
-        continue;
-      }
-      double weight = strtod(line[1].c_str(), nullptr);
-      if ((line[0].size() == 32) || (line[0].size() == 35)) {
-        FeatureHash hash = StringToFeatureHash(line[0]);
-        weights_[hash.first] = weight;
-      } else if (line[0].size() == 16) {
-        uint64_t value = strtoull(line[0].c_str(), nullptr, 16);
-        weights_[value] = weight;
-      }
-    }
+  weights_.Load(weight_file);
+  // Weights of another hash family do not match any feature, so every feature
+  // would silently get the default weight.
+  if (!weights_.empty() && (weights_.GetHasherVersion() != hasher_version_)) {
+    throw std::runtime_error(weight_file + " holds weights for the " +
+      HasherVersionName(weights_.GetHasherVersion()) + " hasher, but "
+      "functions are hashed with the " + HasherVersionName(hasher_version_) +
+      " hasher!");
   }
 }
 
-FunctionSimHasher::FunctionSimHasher(std::map<uint64_t, float>* weights) :
+FunctionSimHasher::FunctionSimHasher(std::map<uint64_t, float>* weights,
+  HasherVersion hasher_version) :
   weights_(*weights), default_mnemonic_weight_(kMnemonicDefaultWeight),
   default_graphlet_weight_(kGraphletDefaultWeight), default_immediate_weight_(
-    kImmediateDefaultWeight) {
-  weights_ = *weights;
+    kImmediateDefaultWeight), feature_options_(default_features),
+  feature_logging_options_(default_logging), hasher_version_(hasher_version),
+  graphlet_hash_cache_(nullptr) {
+  weights_.SetHasherVersion(hasher_version);
 }
 
-
+FunctionSimHasher::FunctionSimHasher(const SimHashSearchIndex& index,
+  const std::string& weight_file,
+  double default_mnemonic_weight,
+  double default_graphlet_weight,
+  double default_immediate_weight) :
+    FunctionSimHasher(weight_file, default_features, default_logging,
+      default_mnemonic_weight, default_graphlet_weight,
+      default_immediate_weight, index.GetHasherVersion()) {}
+
+template void FunctionSimHasher::CalculateFunctionSimHash<64>(
+  FunctionFeatureGenerator* generator, SimHash<64>* output_simhash,
+  std::vector<FeatureHash>* feature_hashes);
+template void FunctionSimHasher::CalculateFunctionSimHash<128>(
+  FunctionFeatureGenerator* generator, SimHash<128>* output_simhash,
+  std::vector<FeatureHash>* feature_hashes);
+template void FunctionSimHasher::CalculateFunctionSimHash<256>(
+  FunctionFeatureGenerator* generator, SimHash<256>* output_simhash,
+  std::vector<FeatureHash>* feature_hashes);
+template void FunctionSimHasher::CalculateFunctionSimHashes<64>(
+  FunctionFeatureGenerator* const* generators, uint64_t count,
+  SimHash<64>* output_simhashes, uint32_t threads);
+template void FunctionSimHasher::CalculateFunctionSimHashes<128>(
+  FunctionFeatureGenerator* const* generators, uint64_t count,
+  SimHash<128>* output_simhashes, uint32_t threads);
+template void FunctionSimHasher::CalculateFunctionSimHashes<256>(
+  FunctionFeatureGenerator* const* generators, uint64_t count,
+  SimHash<256>* output_simhashes, uint32_t threads);
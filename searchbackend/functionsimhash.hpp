@@ -15,6 +15,7 @@
 #ifndef FUNCTIONSIMHASH_HPP
 #define FUNCTIONSIMHASH_HPP
 
+#include <array>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -24,9 +25,14 @@
 #include <vector>
 
 #include "CodeObject.h"
+#include "disassembly/compactflowgraph.hpp"
 #include "disassembly/flowgraph.hpp"
 #include "disassembly/flowgraphutil.hpp"
 #include "disassembly/functionfeaturegenerator.hpp"
+#include "disassembly/graphletsignature.hpp"
+#include "searchbackend/featureweights.hpp"
+#include "searchbackend/graphlethashcache.hpp"
+#include "searchbackend/hasherversion.hpp"
 #include "util/util.hpp"
 
 // Below the code I am following the advice of the C++ standard, section 
@@ -81,6 +87,8 @@ constexpr enum FeatureLoggingOptions operator&(const enum FeatureLoggingOptions
     static_cast<uint32_t>(a) & static_cast<uint32_t>(b));
 }
 
+class SimHashSearchIndex;
+
 FeatureOptions DisabledFeatures(bool graphs, bool mnemonics, bool immediates);
 FeatureLoggingOptions FeatureLogging(bool graphs, bool mnemonics,
   bool immediates);
@@ -102,8 +110,12 @@ constexpr FeatureLoggingOptions dump_all = dump_graphlets | dump_mnemonics |
 //   5) Convert the vector of floats to a vector of zeroes and ones again.
 //
 // The weights themselves are given in a flat text file. The keys in this
-// map are the hash values of the feature using the first hash function of the
+// table are the hash values of the feature using the first hash function of the
 // hash family (subsequent hash functions are used for the calculations).
+//
+// Which hash family is used is selected by a HasherVersion. SimHashes are only
+// comparable if they were calculated with the same version, and weights only
+// apply to the version they were trained for.
 class FunctionSimHasher {
 public:
   static constexpr double kMnemonicDefaultWeight = 0.05;
@@ -111,7 +123,8 @@ public:
   static constexpr double kImmediateDefaultWeight = 4.0;
 
   // The weight_file is a simple memory-mapped map that maps uint64_t IDs for
-  // a feature to float weights. The second argument is used to obtain the
+  // a feature to float weights. Throws std::runtime_error if the weights were
+  // trained for another hasher version than 'hasher_version'. The second argument is used to obtain the
   // IDs for features used in the calculation of the SimHash, and mainly used
   // for debugging.
   FunctionSimHasher(const std::string& weight_file,
@@ -119,52 +132,143 @@ public:
     FeatureLoggingOptions logging_options = default_logging,
     double default_mnemomic_weight = kMnemonicDefaultWeight,
     double default_graphlet_weight = kGraphletDefaultWeight,
-    double default_immediate_weight = kImmediateDefaultWeight);
+    double default_immediate_weight = kImmediateDefaultWeight,
+    HasherVersion hasher_version = HasherVersion::kLegacy);
 
-  FunctionSimHasher(std::map<uint64_t, float>* weights);
+  FunctionSimHasher(std::map<uint64_t, float>* weights,
+    HasherVersion hasher_version = HasherVersion::kLegacy);
+
+  // A hasher for functions that are added to or looked up in the given index.
+  // The SimHashes have to come from the hash family the index was built with,
+  // so the hasher version is taken from the index.
+  FunctionSimHasher(const SimHashSearchIndex& index,
+    const std::string& weight_file,
+    double default_mnemomic_weight = kMnemonicDefaultWeight,
+    double default_graphlet_weight = kGraphletDefaultWeight,
+    double default_immediate_weight = kImmediateDefaultWeight);
 
   // Calculate a simhash value for a given function. Outputs a vector of 64-bit
   // values, number_of_outputs describes how many bits of SimHash should be
-  // calculated. Reasonable use is usually 128.
-  void CalculateFunctionSimHash(
+  // calculated. Reasonable use is usually 128; any width above 0 works, but
+  // widths above 256 bits are slower. Returns false for a width of 0.
+  bool CalculateFunctionSimHash(
     FunctionFeatureGenerator* generator, uint64_t number_of_outputs,
     std::vector<uint64_t>* output_simhash_values,
     std::vector<FeatureHash>* feature_hashes=nullptr);
 
+  // A SimHash of kBits bits, least significant bit of the first word first.
+  template <uint64_t kBits>
+  using SimHash = std::array<uint64_t, kBits / 64>;
+
+  // Calculates a SimHash whose width is fixed at compile time, so that all
+  // per-feature loops have constant trip counts. Instantiated for 64, 128 and
+  // 256 bits. Narrower SimHashes of a function are prefixes of wider ones.
+  template <uint64_t kBits>
+  void CalculateFunctionSimHash(FunctionFeatureGenerator* generator,
+    SimHash<kBits>* output_simhash,
+    std::vector<FeatureHash>* feature_hashes = nullptr);
+
   void CalculateFunctionSimHash(
     std::vector<FeatureHash>* features, std::vector<uint64_t>* output,
     std::vector<float>* optional_state = nullptr);
 
+  // Batch versions of the above: Hash 'count' functions and write the SimHash
+  // of function i to output_simhashes[i]. The work is spread over 'threads'
+  // threads; each thread reuses its scratch buffers for all functions it
+  // hashes. The generators must be independent of each other.
+  template <uint64_t kBits>
+  void CalculateFunctionSimHashes(FunctionFeatureGenerator* const* generators,
+    uint64_t count, SimHash<kBits>* output_simhashes, uint32_t threads = 1);
+  void CalculateFunctionSimHashes(const std::vector<FeatureHash>* features,
+    uint64_t count, SimHash<128>* output_simhashes, uint32_t threads = 1);
+
   static uint64_t FloatsToBits(const std::vector<float>& floats);
   static bool FloatsToBits(const std::vector<float>& floats,
     std::vector<uint64_t>* outputs);
 
   // Primarily exposed for testing.
-  const std::map<uint64_t, float>* GetWeights() const {
+  const FeatureWeights* GetWeights() const {
     return &weights_;
   }
+  HasherVersion GetHasherVersion() const { return hasher_version_; }
+
+  // Looks up the feature hashes of graphlets in 'cache' before hashing them,
+  // and stores them there afterwards. The cache is not owned and may be shared
+  // by several hashers of the same hasher version. Only the legacy family
+  // uses it; the portable family derives the feature hash from the graphlet
+  // ID with two multiplications, which is cheaper than any lookup.
+  void SetGraphletHashCache(GraphletHashCache* cache) {
+    graphlet_hash_cache_ = cache;
+  }
 private:
-  // Process one subgraph and hash it into the output vector.
-  void ProcessSubgraph(std::unique_ptr<Flowgraph>& graph, float graphlet_weight,
-    address node, uint64_t bits, uint64_t cardinality,
-    std::vector<float>* output_simhash_floats, std::vector<FeatureHash>*
-    feature_hashes = nullptr) const;
+  // The per-feature hashing below works on hashes of a fixed number of bits
+  // that live on the stack, so that hashing a feature does not allocate.
+  template <uint64_t kBits>
+  using NBitHash = std::array<uint64_t, (kBits + 63) / 64>;
+
+  // Calculates the SimHash with kBits-bit feature hashes, of which the first
+  // 'bits' are used.
+  template <uint64_t kBits>
+  void CalculateNBitFunctionSimHash(FunctionFeatureGenerator* generator,
+    uint64_t bits, std::vector<uint64_t>* output_simhash_values,
+    std::vector<FeatureHash>* feature_hashes);
+
+  // Adds the weights of precomputed feature hashes into the floats.
+  void AccumulateFeatureHashes(const std::vector<FeatureHash>& features,
+    std::array<float, 128>* floats) const;
+
+  template <uint64_t kBits>
+  static void FloatsToSimHash(const std::array<float, kBits>& floats,
+    SimHash<kBits>* simhash);
+
+  // Receives the features of a function from its generator and adds their
+  // weights into the floats, a batch at a time.
+  template <uint64_t kBits>
+  class FeatureAccumulator;
+
+  // Adds the weights of all features of the function into 'chunks' times kBits
+  // floats.
+  template <uint64_t kBits>
+  void AccumulateFeatures(FunctionFeatureGenerator* generator,
+    float* output_simhash_floats, uint64_t chunks,
+    std::vector<FeatureHash>* feature_hashes);
+
+  // The functions below take the ID of the feature without occurrence (its
+  // 'key') in addition to the feature itself: The portable hash family derives
+  // everything else from the key instead of hashing the feature again.
+
+  // Process one subgraph, given its feature hash, and hash it into the output
+  // vector.
+  template <uint64_t kBits>
+  void ProcessSubgraph(const GraphletView& graph,
+    const NBitHash<kBits>& hash, float graphlet_weight,
+    float* output_simhash_floats,
+    std::vector<FeatureHash>* feature_hashes = nullptr) const;
 
   // Process one mnemonic n-gram and hash it into the output vector.
-  void ProcessMnemTuple(const MnemTuple &tup, float weight, uint64_t bits,
-    uint64_t hash_index, std::vector<float>* output_simhash_floats,
+  template <uint64_t kBits>
+  void ProcessMnemTuple(const MnemTuple &tup, uint64_t key, float weight,
+    uint64_t hash_index, float* output_simhash_floats,
     std::vector<FeatureHash>* feature_hashes = nullptr) const;
 
   // Process the immediate value and hash it into the output vector.
-  void ProcessImmediate(uint64_t immediate,
-    float immediate_weight, uint64_t bits, uint64_t hash_index,
-    std::vector<float>* output_simhash_floats, std::vector<FeatureHash>*
-    feature_hashes) const;
+  template <uint64_t kBits>
+  void ProcessImmediate(uint64_t immediate, uint64_t key,
+    float immediate_weight, uint64_t hash_index, float* output_simhash_floats,
+    std::vector<FeatureHash>* feature_hashes) const;
+
+  // The first 128 bits of a feature hash, as used for weights and feature
+  // dumps (zero-extended for narrower hashes).
+  template <uint64_t kBits>
+  static FeatureHash ToFeatureHash(const NBitHash<kBits>& hash);
 
   // Given an n-bit hash and a weight, hash the weight into the output vector
   // with positive sign for 1's and negative sign for 0's.
-  void AddWeightsInHashToOutput(const std::vector<uint64_t>& hash, uint64_t bits,
-    float weight, std::vector<float>* output_simhash_floats) const;
+  void AddWeightsInHashToOutput(const uint64_t* hash, uint64_t bits,
+    float weight, float* output_simhash_floats) const;
+
+  static void FloatsToBits(const float* floats, uint64_t count,
+    std::vector<uint64_t>* outputs);
 
   // Helper function to obtain seed values for a given hash index.
   inline uint64_t SeedXForHashY(uint64_t seed_index, uint64_t hash_index) const;
@@ -173,48 +277,57 @@ private:
   uint64_t HashMnemTuple(const MnemTuple& tup, uint64_t hash_index) const;
 
   // Hash a graph into a 64-bit value, using a hash family index.
-  uint64_t HashGraph(std::unique_ptr<Flowgraph>& graph, address node,
-    uint64_t hash_index, uint64_t counter) const;
+  uint64_t HashGraph(const GraphletSignature& graph, uint64_t hash_index,
+    uint64_t counter) const;
 
   // Hash an immediate value.
   uint64_t HashImmediate(uint64_t immediate, uint64_t hash_index,
     uint64_t counter) const;
 
   // Extend a 64-bit graph hash family to a N-bit hash family by just increasing
-  // the hash function index.
-  void CalculateNBitGraphHash(std::unique_ptr<Flowgraph>& graph, address node,
-    uint64_t bits, uint64_t hash_index, std::vector<uint64_t>* output) const;
+  // the hash function index. The legacy hashes take the signature of the
+  // graphlet from 'signatures'. The output holds the words from 'first_word'
+  // on, which lets SimHashes wider than kBits hash a feature chunk by chunk.
+  template <uint64_t kBits>
+  void CalculateNBitGraphHash(const GraphletView& graphlet, uint64_t key,
+    uint64_t hash_index, GraphletSignatures* signatures,
+    NBitHash<kBits>* output, uint64_t first_word = 0) const;
+  // The legacy graph hash words through the graphlet hash cache: The first
+  // two words (the 128-bit feature hash) are cached, the others calculated.
+  void CalculateCachedGraphHash(const GraphletView& graphlet,
+    uint64_t hash_index, uint64_t* words, uint64_t count) const;
 
   // Extend a 64-bit mnemonic tuple hash family to a N-bit hash family by just
   // increasing the hash function index.
-  void CalculateNBitMnemTupleHash(const MnemTuple& tup, uint64_t bits,
-    uint64_t hash_index, std::vector<uint64_t>* output) const;
+  template <uint64_t kBits>
+  void CalculateNBitMnemTupleHash(const MnemTuple& tup, uint64_t key,
+    uint64_t hash_index, NBitHash<kBits>* output,
+    uint64_t first_word = 0) const;
 
   // Extend a 64-bit immediate hash.
-  void CalculateNBitImmediateHash(uint64_t immediate, uint64_t bits,
-    uint64_t hash_index, std::vector<uint64_t>*output) const;
+  template <uint64_t kBits>
+  void CalculateNBitImmediateHash(uint64_t immediate, uint64_t key,
+    uint64_t hash_index, NBitHash<kBits>* output,
+    uint64_t first_word = 0) const;
  
   // Return a weight for a given key.
   float GetWeight(uint64_t key, float standard) const;
 
-  // Obtain graphlet or mnemonic IDs with or without occurrence.
-  uint64_t GetGraphletIdOccurrence(std::unique_ptr<Flowgraph>& graph,
-    uint32_t occurrence, address node) const;
-  uint64_t GetGraphletIdNoOccurrence(std::unique_ptr<Flowgraph>& graph,
-    address node) const;
-  uint64_t GetMnemonicIdOccurrence(const MnemTuple& tuple,
+  // Obtain graphlet or mnemonic IDs with or without occurrence. The graphlet
+  // ID with occurrence is the first word of its feature hash; the one without
+  // occurrence is derived from the graphlet hash with these three seeds.
+  void GetGraphletIdSeeds(uint64_t* seeds) const;
+  uint64_t GetGraphletIdNoOccurrence(uint64_t graph_hash) const;
+  uint64_t GetMnemonicIdOccurrence(const MnemTuple& tuple, uint64_t key,
     uint32_t occurrence) const;
   uint64_t GetMnemonicIdNoOccurrence(const MnemTuple& tuple) const;
   uint64_t GetImmediateIdNoOccurrence(uint64_t immediate) const;
-  uint64_t GetImmediateIdOccurrence(uint64_t immediate, uint32_t occurrence) 
-    const;
-
-  inline bool GetNthBit(const std::vector<uint64_t>& nbit_hash,
-    uint64_t bitindex) const;
+  uint64_t GetImmediateIdOccurrence(uint64_t immediate, uint64_t key,
+    uint32_t occurrence) const;
 
   void DumpFloatState(std::vector<float>* output_floats);
 
-  std::map<uint64_t, float> weights_;
+  FeatureWeights weights_;
 
   double default_mnemonic_weight_;
   double default_graphlet_weight_;
@@ -222,6 +335,8 @@ private:
 
   FeatureOptions feature_options_;
   FeatureLoggingOptions feature_logging_options_;
+  HasherVersion hasher_version_;
+  GraphletHashCache* graphlet_hash_cache_;
 
   // Some primes between 2^63 and 2^64 from CityHash.
   static constexpr uint64_t seed0_ = 0xc3a5c85c97cb3127ULL;
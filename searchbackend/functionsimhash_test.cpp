@@ -1,14 +1,45 @@
 #include <array>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
 #include <map>
+#include <memory>
+#include <new>
 #include <set>
+#include <stdexcept>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
+#include "third_party/json/src/json.hpp"
 #include "disassembly/flowgraphwithinstructions.hpp"
 #include "disassembly/flowgraphwithinstructionsfeaturegenerator.hpp"
+#include "disassembly/mnemonictable.hpp"
 #include "searchbackend/functionsimhash.hpp"
+#include "searchbackend/simhashsearchindex.hpp"
 #include "util/testutil.hpp"
 #include "util/util_with_dyninst.hpp"
 
+// Counts heap allocations so that tests can check that the hashing path does
+// not allocate per feature. Replacing the global operator new affects the whole
+// test binary, but it only adds a counter.
+static std::atomic<uint64_t> heap_allocations(0);
+
+void* operator new(size_t size) {
+  ++heap_allocations;
+  if (void* memory = malloc(size ? size : 1)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+  free(memory);
+}
+
 TEST(functionsimhash, check_feature_uniqueness) {
   FunctionSimHasher hasher("");
   for (const auto& hash_addr : id_to_address_function_1) {
@@ -33,7 +64,7 @@ TEST(functionsimhash, check_feature_uniqueness) {
 TEST(functionsimhash, zero_weight_hasher) {
   FunctionSimHasher hasher_trained(
     "../testdata/train_zero_weights/weights.txt");
-  const std::map<uint64_t, float>* weights = hasher_trained.GetWeights();
+  const FeatureWeights* weights = hasher_trained.GetWeights();
 
   std::map<std::pair<uint64_t, uint64_t>, FeatureHash> hashes_trained;
 
@@ -61,8 +92,8 @@ TEST(functionsimhash, zero_weight_hasher) {
     for (uint32_t index = 0; index < feature_hashes.size(); ++index) {
       uint64_t feature_id = feature_hashes[index].first;
       // Assume that each feature_id has an associated weight.
-      EXPECT_TRUE(weights->find(feature_id) != weights->end());
-      if (weights->find(feature_id) == weights->end()) {
+      EXPECT_TRUE(weights->Contains(feature_id));
+      if (!weights->Contains(feature_id)) {
         // A feature was found in the set of features for the function that
         // did not have a corresponding weight in the weights.txt that was
         // loaded. This should not happen, and can be investigated by dumping
@@ -75,7 +106,7 @@ TEST(functionsimhash, zero_weight_hasher) {
           id_to_mode[file_hash].c_str(), id_to_filename[file_hash].c_str(),
           address);
       } else {
-        EXPECT_EQ(weights->at(feature_id), 0.0);
+        EXPECT_EQ(weights->Get(feature_id, 1.0), 0.0);
       }
     }
     ASSERT_TRUE((trained.first != 0) || (trained.second !=0));
@@ -159,3 +190,534 @@ TEST(functionsimhash, zero_weight_for_mnemonics) {
 
 
 
+
+// Emits the same mnemonic tuple over and over, and distinct immediates.
+class SyntheticFeatureGenerator : public FunctionFeatureGenerator {
+public:
+  explicit SyntheticFeatureGenerator(uint64_t count) :
+    mnemonics_(count), immediates_(count) {}
+  bool HasMoreSubgraphs() const override { return false; }
+  std::pair<Flowgraph*, address> GetNextSubgraph() override {
+    return std::make_pair(nullptr, 0);
+  }
+  bool HasMoreMnemonics() const override { return mnemonics_ > 0; }
+  MnemTuple GetNextMnemTuple() override {
+    --mnemonics_;
+    return std::make_tuple(MnemonicTable::Intern("mov"),
+      MnemonicTable::Intern("add"), MnemonicTable::Intern("ret"));
+  }
+  bool HasMoreImmediates() const override { return immediates_ > 0; }
+  uint64_t GetNextImmediate() override {
+    return 0x1337 + --immediates_;
+  }
+private:
+  uint64_t mnemonics_;
+  uint64_t immediates_;
+};
+
+// Loads a testdata function and scales it up: The copies of the function live
+// at distinct addresses, and the last node of each copy branches to the first
+// node of the next one.
+bool LoadScaledUpFlowgraph(const std::string& filename, uint32_t copies,
+  FlowgraphWithInstructions* graph) {
+  std::ifstream file(filename);
+  nlohmann::json function = nlohmann::json::parse(file, nullptr, false);
+  if (function.is_discarded()) {
+    return false;
+  }
+  const uint64_t first = function["nodes"].front()["address"];
+  const uint64_t last = function["nodes"].back()["address"];
+  nlohmann::json scaled = { { "name", function["name"] },
+    { "nodes", nlohmann::json::array() }, { "edges", nlohmann::json::array() } };
+  for (uint32_t copy = 0; copy < copies; ++copy) {
+    const uint64_t offset = copy * 0x100000ULL;
+    for (nlohmann::json node : function["nodes"]) {
+      node["address"] = node["address"].get<uint64_t>() + offset;
+      scaled["nodes"].push_back(node);
+    }
+    for (nlohmann::json edge : function["edges"]) {
+      edge["source"] = edge["source"].get<uint64_t>() + offset;
+      edge["destination"] = edge["destination"].get<uint64_t>() + offset;
+      scaled["edges"].push_back(edge);
+    }
+    if (copy > 0) {
+      scaled["edges"].push_back({ { "source", last + offset - 0x100000ULL },
+        { "destination", first + offset } });
+    }
+  }
+  return graph->ParseJSON(scaled);
+}
+
+// Hashing a feature must not allocate: Once the per-thread tables have grown to
+// the size of the largest function, the number of allocations per function does
+// not depend on the number of graphlets, mnemonic tuples and immediates. The
+// generator extracts the features on the first hash and keeps them, so the
+// second hash of each function measures the hashing alone.
+TEST(functionsimhash, no_allocations_per_feature) {
+  FunctionSimHasher hasher("");
+  std::vector<uint64_t> allocations_per_function;
+  std::vector<uint64_t> features_per_function;
+  for (uint32_t copies : { 64, 1, 64 }) {
+    FlowgraphWithInstructions graph;
+    ASSERT_TRUE(LoadScaledUpFlowgraph(
+      "../testdata/vp9_set_target_rate.clang.nothumb.json", copies, &graph));
+    FlowgraphWithInstructionsFeatureGenerator generator(graph);
+    FunctionSimHasher::SimHash<128> simhash;
+    std::vector<FeatureHash> features;
+    hasher.CalculateFunctionSimHash<128>(&generator, &simhash, &features);
+    features_per_function.push_back(features.size());
+
+    generator.reinit();
+    uint64_t before = heap_allocations;
+    hasher.CalculateFunctionSimHash<128>(&generator, &simhash);
+    allocations_per_function.push_back(heap_allocations - before);
+  }
+  // The scaled-up function really has many more features.
+  EXPECT_GT(features_per_function[2], 32 * features_per_function[1]);
+  EXPECT_EQ(allocations_per_function[1], allocations_per_function[2]);
+}
+
+// The fixed-width SimHashes agree with the runtime-width ones, and narrower
+// SimHashes are prefixes of wider ones.
+TEST(functionsimhash, fixed_width_simhashes) {
+  FunctionSimHasher hasher("");
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  std::vector<uint64_t> runtime_width;
+  hasher.CalculateFunctionSimHash(&generator, 128, &runtime_width);
+
+  FunctionSimHasher::SimHash<64> simhash_64;
+  FunctionSimHasher::SimHash<128> simhash_128;
+  FunctionSimHasher::SimHash<256> simhash_256;
+  generator.reinit();
+  hasher.CalculateFunctionSimHash<64>(&generator, &simhash_64);
+  generator.reinit();
+  hasher.CalculateFunctionSimHash<128>(&generator, &simhash_128);
+  generator.reinit();
+  hasher.CalculateFunctionSimHash<256>(&generator, &simhash_256);
+
+  EXPECT_EQ(simhash_128[0], runtime_width[0]);
+  EXPECT_EQ(simhash_128[1], runtime_width[1]);
+  EXPECT_EQ(simhash_64[0], simhash_128[0]);
+  EXPECT_EQ(simhash_256[0], simhash_128[0]);
+  EXPECT_EQ(simhash_256[1], simhash_128[1]);
+}
+
+// SimHashes wider than 256 bits extend the 256-bit ones, for both hash
+// families and with the graphlet hash cache; a width of 0 is refused.
+TEST(functionsimhash, wide_simhashes) {
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+  GraphletHashCache cache(1 << 16);
+  FunctionSimHasher legacy("");
+  FunctionSimHasher cached("");
+  cached.SetGraphletHashCache(&cache);
+  FunctionSimHasher portable("", default_features, default_logging,
+    FunctionSimHasher::kMnemonicDefaultWeight,
+    FunctionSimHasher::kGraphletDefaultWeight,
+    FunctionSimHasher::kImmediateDefaultWeight, HasherVersion::kPortable);
+  for (FunctionSimHasher* hasher : { &legacy, &cached, &portable }) {
+    FlowgraphWithInstructionsFeatureGenerator generator(graph);
+    FunctionSimHasher::SimHash<256> simhash_256;
+    std::vector<FeatureHash> features_256;
+    hasher->CalculateFunctionSimHash<256>(&generator, &simhash_256,
+      &features_256);
+
+    std::vector<uint64_t> simhash_320, simhash_512, simhash_1000;
+    std::vector<FeatureHash> features_512;
+    generator.reinit();
+    EXPECT_TRUE(hasher->CalculateFunctionSimHash(&generator, 320,
+      &simhash_320));
+    generator.reinit();
+    EXPECT_TRUE(hasher->CalculateFunctionSimHash(&generator, 512,
+      &simhash_512, &features_512));
+    generator.reinit();
+    EXPECT_TRUE(hasher->CalculateFunctionSimHash(&generator, 1000,
+      &simhash_1000));
+
+    for (uint64_t word = 0; word < 4; ++word) {
+      EXPECT_EQ(simhash_512[word], simhash_256[word]);
+    }
+    for (uint64_t word = 0; word < 5; ++word) {
+      EXPECT_EQ(simhash_320[word], simhash_512[word]);
+    }
+    for (uint64_t word = 0; word < 8; ++word) {
+      EXPECT_EQ(simhash_1000[word], simhash_512[word]);
+    }
+    EXPECT_EQ(features_512, features_256);
+    // The words beyond the first 256 bits are not copies of the first ones.
+    EXPECT_NE(simhash_512[4], simhash_512[0]);
+    EXPECT_NE(simhash_512[5], simhash_512[1]);
+  }
+  // The cache only changes how the hashes are calculated.
+  std::vector<uint64_t> expected, actual;
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  legacy.CalculateFunctionSimHash(&generator, 512, &expected);
+  generator.reinit();
+  cached.CalculateFunctionSimHash(&generator, 512, &actual);
+  EXPECT_EQ(expected, actual);
+
+  std::vector<uint64_t> empty;
+  generator.reinit();
+  EXPECT_FALSE(legacy.CalculateFunctionSimHash(&generator, 0, &empty));
+  EXPECT_TRUE(empty.empty());
+}
+
+// Hashing a batch of functions on several threads gives the same SimHashes as
+// hashing them one at a time.
+TEST(functionsimhash, batch_simhashes) {
+  FunctionSimHasher hasher("");
+  constexpr uint64_t kFunctions = 100;
+  std::vector<std::unique_ptr<SyntheticFeatureGenerator>> generators;
+  std::vector<FunctionFeatureGenerator*> generator_pointers;
+  std::vector<FunctionSimHasher::SimHash<128>> expected(kFunctions);
+  std::vector<std::vector<FeatureHash>> features(kFunctions);
+  for (uint64_t index = 0; index < kFunctions; ++index) {
+    SyntheticFeatureGenerator generator(7 * index + 1);
+    hasher.CalculateFunctionSimHash<128>(&generator, &expected[index],
+      &features[index]);
+    generators.emplace_back(new SyntheticFeatureGenerator(7 * index + 1));
+    generator_pointers.push_back(generators.back().get());
+  }
+  std::vector<FunctionSimHasher::SimHash<128>> batch(kFunctions);
+  hasher.CalculateFunctionSimHashes<128>(generator_pointers.data(),
+    kFunctions, batch.data(), 4);
+  EXPECT_EQ(expected, batch);
+
+  std::vector<FunctionSimHasher::SimHash<128>> from_features(kFunctions);
+  hasher.CalculateFunctionSimHashes(features.data(), kFunctions,
+    from_features.data(), 4);
+  for (uint64_t index = 0; index < kFunctions; ++index) {
+    std::vector<uint64_t> single;
+    hasher.CalculateFunctionSimHash(&features[index], &single);
+    EXPECT_EQ(single[0], from_features[index][0]);
+    EXPECT_EQ(single[1], from_features[index][1]);
+  }
+}
+
+// The portable hasher gives the same SimHash on every platform. Its SimHashes
+// have nothing in common with those of the legacy hasher, but narrower ones are
+// still prefixes of wider ones, and the feature IDs used for weight lookups are
+// still the first word of the feature hashes.
+TEST(functionsimhash, portable_hasher) {
+  FunctionSimHasher legacy("");
+  FunctionSimHasher portable("", default_features, default_logging,
+    FunctionSimHasher::kMnemonicDefaultWeight,
+    FunctionSimHasher::kGraphletDefaultWeight,
+    FunctionSimHasher::kImmediateDefaultWeight, HasherVersion::kPortable);
+  EXPECT_EQ(portable.GetHasherVersion(), HasherVersion::kPortable);
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  FunctionSimHasher::SimHash<128> legacy_simhash;
+  legacy.CalculateFunctionSimHash<128>(&generator, &legacy_simhash);
+  FunctionSimHasher::SimHash<64> simhash_64;
+  FunctionSimHasher::SimHash<128> simhash_128;
+  std::vector<FeatureHash> features;
+  generator.reinit();
+  portable.CalculateFunctionSimHash<64>(&generator, &simhash_64);
+  generator.reinit();
+  portable.CalculateFunctionSimHash<128>(&generator, &simhash_128, &features);
+
+  EXPECT_EQ(simhash_128[0], 0xca35b368fce733e3ULL);
+  EXPECT_EQ(simhash_128[1], 0xb747016876e5514aULL);
+  EXPECT_EQ(simhash_64[0], simhash_128[0]);
+  EXPECT_NE(simhash_128, legacy_simhash);
+
+  // Weighting the first feature heavily enough makes the SimHash equal to its
+  // feature hash.
+  std::map<uint64_t, float> weights = { { features[0].first, 1e6 } };
+  FunctionSimHasher weighted(&weights, HasherVersion::kPortable);
+  generator.reinit();
+  weighted.CalculateFunctionSimHash<128>(&generator, &simhash_128);
+  EXPECT_EQ(simhash_128[0], features[0].first);
+  EXPECT_EQ(simhash_128[1], features[0].second);
+}
+
+// Weights of another hash family would not match any feature, so a hasher
+// refuses them instead of hashing with the default weights.
+TEST(functionsimhash, weights_of_other_hasher_version) {
+  const std::string filename = "/tmp/functionsimhash_portable_weights.txt";
+  {
+    std::ofstream weights(filename);
+    weights << "hasher_version portable\n";
+    weights << "0123456789abcdef 0.5\n";
+  }
+  EXPECT_THROW(FunctionSimHasher legacy(filename), std::runtime_error);
+  FunctionSimHasher portable(filename, default_features, default_logging,
+    FunctionSimHasher::kMnemonicDefaultWeight,
+    FunctionSimHasher::kGraphletDefaultWeight,
+    FunctionSimHasher::kImmediateDefaultWeight, HasherVersion::kPortable);
+  EXPECT_EQ(portable.GetWeights()->Get(0x0123456789abcdefULL, 1.0), 0.5);
+  unlink(filename.c_str());
+}
+
+// The decoded-immediates hasher is the portable hasher, except that it takes
+// the immediates that the disassembler decoded where an instruction has them.
+TEST(functionsimhash, decoded_immediates_hasher) {
+  auto make_hasher = [](HasherVersion version) {
+    return std::unique_ptr<FunctionSimHasher>(new FunctionSimHasher("",
+      default_features, default_logging,
+      FunctionSimHasher::kMnemonicDefaultWeight,
+      FunctionSimHasher::kGraphletDefaultWeight,
+      FunctionSimHasher::kImmediateDefaultWeight, version));
+  };
+  std::unique_ptr<FunctionSimHasher> portable =
+    make_hasher(HasherVersion::kPortable);
+  std::unique_ptr<FunctionSimHasher> decoded =
+    make_hasher(HasherVersion::kDecodedImmediates);
+
+  // Only operand strings: No difference.
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  FunctionSimHasher::SimHash<128> portable_simhash, decoded_simhash;
+  portable->CalculateFunctionSimHash<128>(&generator, &portable_simhash);
+  generator.reinit();
+  decoded->CalculateFunctionSimHash<128>(&generator, &decoded_simhash);
+  EXPECT_EQ(portable_simhash, decoded_simhash);
+
+  // A decoded immediate that is not in the operand strings.
+  FlowgraphWithInstructions with_decoded;
+  with_decoded.AddEdge(0x10, 0x20);
+  with_decoded.AddInstructions(0x10, {
+    Instruction("mov", { "EAX", "BH" }, { 0x12345 }),
+    Instruction("jmp", { "20" }) });
+  with_decoded.AddInstructions(0x20, { Instruction("ret", {}, {}) });
+  FlowgraphWithInstructionsFeatureGenerator decoded_generator(with_decoded);
+  std::vector<FeatureHash> portable_features, decoded_features;
+  portable->CalculateFunctionSimHash<128>(&decoded_generator,
+    &portable_simhash, &portable_features);
+  decoded_generator.reinit();
+  decoded->CalculateFunctionSimHash<128>(&decoded_generator,
+    &decoded_simhash, &decoded_features);
+  EXPECT_EQ(decoded_features.size(), portable_features.size() + 1);
+  EXPECT_NE(portable_simhash, decoded_simhash);
+}
+
+// A hasher for an index hashes with the family the index was created with.
+TEST(functionsimhash, hasher_for_index) {
+  SimHashSearchIndex index("./hasherindex.index", true, 28, 8,
+    HasherVersion::kPortable);
+  FunctionSimHasher hasher(index, "");
+  EXPECT_EQ(hasher.GetHasherVersion(), HasherVersion::kPortable);
+  EXPECT_EQ(unlink("./hasherindex.index"), 0);
+}
+
+// The graphlet hash cache returns exactly the hashes that would have been
+// calculated, for SimHashes of every width.
+TEST(functionsimhash, graphlet_hash_cache) {
+  FunctionSimHasher hasher("");
+  FunctionSimHasher cached_hasher("");
+  GraphletHashCache cache(1 << 16);
+  cached_hasher.SetGraphletHashCache(&cache);
+  for (const char* filename : {
+    "../testdata/vp9_set_target_rate.clang.nothumb.json",
+    "../testdata/vp9_set_target_rate.clang.with.thumb.json" }) {
+    FlowgraphWithInstructions graph;
+    ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(filename, &graph));
+    // Twice, so that the second time around all graphlets are found.
+    for (uint32_t round = 0; round < 2; ++round) {
+      FlowgraphWithInstructionsFeatureGenerator generator(graph);
+      FunctionSimHasher::SimHash<128> expected, cached;
+      std::vector<FeatureHash> expected_features, cached_features;
+      hasher.CalculateFunctionSimHash<128>(&generator, &expected,
+        &expected_features);
+      generator.reinit();
+      cached_hasher.CalculateFunctionSimHash<128>(&generator, &cached,
+        &cached_features);
+      EXPECT_EQ(expected, cached);
+      EXPECT_EQ(expected_features, cached_features);
+
+      FunctionSimHasher::SimHash<64> expected_64, cached_64;
+      FunctionSimHasher::SimHash<256> expected_256, cached_256;
+      generator.reinit();
+      hasher.CalculateFunctionSimHash<64>(&generator, &expected_64);
+      generator.reinit();
+      cached_hasher.CalculateFunctionSimHash<64>(&generator, &cached_64);
+      generator.reinit();
+      hasher.CalculateFunctionSimHash<256>(&generator, &expected_256);
+      generator.reinit();
+      cached_hasher.CalculateFunctionSimHash<256>(&generator, &cached_256);
+      EXPECT_EQ(expected_64, cached_64);
+      EXPECT_EQ(expected_256, cached_256);
+    }
+  }
+  GraphletHashCache::Statistics statistics = cache.GetStatistics();
+  EXPECT_GT(statistics.lookups, 0);
+  EXPECT_GT(statistics.GetHitRate(), 0.5);
+}
+
+// Records the features a generator pushes, optionally skipping classes.
+class RecordingVisitor : public FeatureVisitor {
+public:
+  explicit RecordingVisitor(bool wants_mnemonics = true) :
+    wants_mnemonics_(wants_mnemonics) {}
+  bool WantsMnemonics() const override { return wants_mnemonics_; }
+  void GetGraphletHashKeys(uint64_t* keys) const override {
+    keys[0] = 1;
+    keys[1] = 2;
+    keys[2] = 3;
+  }
+  void VisitGraphlets(const GraphletView* graphlets, const uint64_t* hashes,
+    uint64_t count) override {
+    for (uint64_t index = 0; index < count; ++index) {
+      EXPECT_EQ(hashes[index], graphlets[index].CalculateHash(1, 2, 3));
+      graphlets_.push_back(std::make_pair(graphlets[index].GetStartAddress(),
+        hashes[index]));
+    }
+  }
+  void VisitMnemTuples(const MnemTuple* tuples, uint64_t count) override {
+    tuples_.insert(tuples_.end(), tuples, tuples + count);
+  }
+  void VisitImmediates(const uint64_t* immediates, uint64_t count) override {
+    immediates_.insert(immediates_.end(), immediates, immediates + count);
+  }
+
+  std::vector<std::pair<address, uint64_t>> graphlets_;
+  std::vector<MnemTuple> tuples_;
+  std::vector<uint64_t> immediates_;
+private:
+  bool wants_mnemonics_;
+};
+
+// The generator passes its arrays in the same order as the default
+// VisitFeatures that adapts the pull interface, and both consume the features.
+TEST(functionsimhash, visit_features) {
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  RecordingVisitor direct, adapted, after_visit;
+  generator.VisitFeatures(&direct);
+  generator.reinit();
+  generator.FunctionFeatureGenerator::VisitFeatures(&adapted);
+  generator.VisitFeatures(&after_visit);
+
+  EXPECT_GT(direct.graphlets_.size(), 0);
+  EXPECT_GT(direct.tuples_.size(), 0);
+  EXPECT_GT(direct.immediates_.size(), 0);
+  EXPECT_EQ(direct.graphlets_, adapted.graphlets_);
+  EXPECT_EQ(direct.tuples_, adapted.tuples_);
+  EXPECT_EQ(direct.immediates_, adapted.immediates_);
+  EXPECT_TRUE(after_visit.graphlets_.empty());
+  EXPECT_TRUE(after_visit.tuples_.empty());
+  EXPECT_TRUE(after_visit.immediates_.empty());
+
+  // Unwanted classes are left alone; later visits resume where the pull
+  // interface stopped.
+  generator.reinit();
+  RecordingVisitor without_mnemonics(false), remaining;
+  generator.VisitFeatures(&without_mnemonics);
+  EXPECT_TRUE(without_mnemonics.tuples_.empty());
+  EXPECT_EQ(without_mnemonics.immediates_, direct.immediates_);
+  ASSERT_TRUE(generator.HasMoreMnemonics());
+  EXPECT_EQ(generator.GetNextMnemTuple(), direct.tuples_[0]);
+  generator.VisitFeatures(&remaining);
+  EXPECT_EQ(remaining.tuples_, std::vector<MnemTuple>(
+    direct.tuples_.begin() + 1, direct.tuples_.end()));
+}
+
+// Provides graphlet views, but leaves the hashes to the default
+// GetGraphletHashes.
+class ViewsWithoutHashes : public FunctionFeatureGenerator {
+public:
+  explicit ViewsWithoutHashes(FunctionFeatureGenerator* generator) :
+    generator_(generator) {}
+  bool HasMoreSubgraphs() const override {
+    return generator_->HasMoreSubgraphs();
+  }
+  std::pair<Flowgraph*, address> GetNextSubgraph() override {
+    return generator_->GetNextSubgraph();
+  }
+  bool SupportsGraphletViews() const override { return true; }
+  bool GetNextGraphlet(GraphletView* graphlet) override {
+    return generator_->GetNextGraphlet(graphlet);
+  }
+  bool HasMoreMnemonics() const override {
+    return generator_->HasMoreMnemonics();
+  }
+  MnemTuple GetNextMnemTuple() override {
+    return generator_->GetNextMnemTuple();
+  }
+  bool HasMoreImmediates() const override {
+    return generator_->HasMoreImmediates();
+  }
+  uint64_t GetNextImmediate() override {
+    return generator_->GetNextImmediate();
+  }
+private:
+  FunctionFeatureGenerator* generator_;
+};
+
+// The default VisitFeatures passes the hashes that belong to the graphlets it
+// visits, also if some graphlets have been consumed already or the generator
+// does not provide hashes at all.
+TEST(functionsimhash, visit_features_default) {
+  FlowgraphWithInstructions graph;
+  ASSERT_TRUE(FlowgraphWithInstructionsFromJSONFile(
+    "../testdata/vp9_set_target_rate.clang.nothumb.json", &graph));
+  FlowgraphWithInstructionsFeatureGenerator generator(graph);
+  RecordingVisitor all;
+  generator.VisitFeatures(&all);
+  ASSERT_GT(all.graphlets_.size(), 1);
+
+  generator.reinit();
+  GraphletView first;
+  ASSERT_TRUE(generator.GetNextGraphlet(&first));
+  RecordingVisitor remaining;
+  generator.FunctionFeatureGenerator::VisitFeatures(&remaining);
+  std::vector<std::pair<address, uint64_t>> expected(
+    all.graphlets_.begin() + 1, all.graphlets_.end());
+  EXPECT_EQ(remaining.graphlets_, expected);
+
+  generator.reinit();
+  ViewsWithoutHashes without_hashes(&generator);
+  RecordingVisitor recomputed;
+  without_hashes.VisitFeatures(&recomputed);
+  EXPECT_EQ(recomputed.graphlets_, all.graphlets_);
+  EXPECT_EQ(recomputed.tuples_, all.tuples_);
+  EXPECT_EQ(recomputed.immediates_, all.immediates_);
+}
+
+// Only provides Flowgraphs, and hands out a graphlet whose start node is not
+// part of it.
+class SubgraphWithoutStartNode : public FunctionFeatureGenerator {
+public:
+  SubgraphWithoutStartNode() : done_(false) {}
+  bool HasMoreSubgraphs() const override { return !done_; }
+  std::pair<Flowgraph*, address> GetNextSubgraph() override {
+    done_ = true;
+    Flowgraph* graphlet = new Flowgraph();
+    graphlet->AddNode(0x10);
+    graphlet->AddNode(0x20);
+    graphlet->AddEdge(0x10, 0x20);
+    return std::make_pair(graphlet, 0x30);
+  }
+  bool HasMoreMnemonics() const override { return false; }
+  MnemTuple GetNextMnemTuple() override { return MnemTuple(); }
+  bool HasMoreImmediates() const override { return false; }
+  uint64_t GetNextImmediate() override { return 0; }
+private:
+  bool done_;
+};
+
+TEST(functionsimhash, visit_features_missing_start_node) {
+  SubgraphWithoutStartNode generator;
+  RecordingVisitor visitor;
+  generator.VisitFeatures(&visitor);
+  Flowgraph graphlet;
+  graphlet.AddNode(0x10);
+  graphlet.AddNode(0x20);
+  graphlet.AddEdge(0x10, 0x20);
+  std::vector<std::pair<address, uint64_t>> expected = {
+    std::make_pair(0x30, graphlet.CalculateHash(0x30, 1, 2, 3)) };
+  EXPECT_EQ(visitor.graphlets_, expected);
+}
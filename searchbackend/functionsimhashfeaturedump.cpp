@@ -3,6 +3,7 @@
 
 #include "disassembly/flowgraph.hpp"
 #include "disassembly/functionfeaturegenerator.hpp"
+#include "disassembly/mnemonictable.hpp"
 #include "searchbackend/functionsimhashfeaturedump.hpp"
 
 // Writes a DOT file for a given graphlet.
@@ -20,8 +21,9 @@ void WriteFeatureDictionaryEntry(uint64_t hashA, uint64_t hashB,
   sprintf(buf, "/var/tmp/%16.16lx%16.16lx.json", hashA, hashB);
   std::ofstream jsonfile;
   jsonfile.open(std::string(buf));
-  jsonfile << "[ " << std::get<0>(tuple) << ", " << std::get<1>(tuple) << ", "
-    << std::get<2>(tuple) << " ]" << std::endl;
+  jsonfile << "[ " << MnemonicTable::GetMnemonic(std::get<0>(tuple)) << ", "
+    << MnemonicTable::GetMnemonic(std::get<1>(tuple)) << ", "
+    << MnemonicTable::GetMnemonic(std::get<2>(tuple)) << " ]" << std::endl;
 }
 
 // Writes an immediate that was encountered.
@@ -0,0 +1,122 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "searchbackend/graphlethashcache.hpp"
+#include "util/portablehash.hpp"
+
+double GraphletHashCache::Statistics::GetHitRate() const {
+  return lookups ? static_cast<double>(hits) / lookups : 0.0;
+}
+
+double GraphletHashCache::Statistics::GetSecondsSaved() const {
+  if (hashes == 0) {
+    return 0.0;
+  }
+  double average_hash = static_cast<double>(hash_nanoseconds) / hashes;
+  return (average_hash * hits - lookup_nanoseconds) / 1e9;
+}
+
+std::string GraphletHashCache::Statistics::ToString() const {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "%lu lookups, %lu hits (%.1f%%), %lu "
+    "evictions, about %f s saved", lookups, hits, 100.0 * GetHitRate(),
+    evictions, GetSecondsSaved());
+  return buffer;
+}
+
+GraphletHashCache::GraphletHashCache(uint64_t max_entries) :
+  max_entries_per_shard_(std::max<uint64_t>(1, max_entries / kShards)),
+  shards_(new Shard[kShards]) {}
+
+uint64_t GraphletHashCache::Fingerprint(const std::vector<uint32_t>& encoding,
+  uint64_t occurrence) {
+  return PortableHashBytes(encoding.data(),
+    encoding.size() * sizeof(uint32_t), occurrence);
+}
+
+bool GraphletHashCache::Lookup(const std::vector<uint32_t>& encoding,
+  uint64_t occurrence, Clock::time_point start, FeatureHash* hash) {
+  uint64_t fingerprint = Fingerprint(encoding, occurrence);
+  Shard& shard = GetShard(fingerprint);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  ++shard.statistics.lookups;
+  auto iter = shard.entries.find(fingerprint);
+  bool found = (iter != shard.entries.end()) &&
+    (iter->second.occurrence == occurrence) &&
+    (iter->second.encoding == encoding);
+  if (found) {
+    *hash = iter->second.hash;
+    ++shard.statistics.hits;
+  }
+  shard.statistics.lookup_nanoseconds += NanosecondsSince(start);
+  return found;
+}
+
+void GraphletHashCache::Insert(const std::vector<uint32_t>& encoding,
+  uint64_t occurrence, const FeatureHash& hash, uint64_t nanoseconds) {
+  uint64_t fingerprint = Fingerprint(encoding, occurrence);
+  Shard& shard = GetShard(fingerprint);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  ++shard.statistics.hashes;
+  shard.statistics.hash_nanoseconds += nanoseconds;
+  if ((shard.entries.size() >= max_entries_per_shard_) &&
+    (shard.entries.count(fingerprint) == 0)) {
+    shard.statistics.evictions += shard.entries.size();
+    shard.entries.clear();
+  }
+  Entry& entry = shard.entries[fingerprint];
+  entry.occurrence = occurrence;
+  entry.encoding = encoding;
+  entry.hash = hash;
+}
+
+void GraphletHashCache::RecordHashTime(uint64_t nanoseconds) {
+  // Samples are rare, so they all go to the first shard.
+  std::lock_guard<std::mutex> lock(shards_[0].mutex);
+  ++shards_[0].statistics.hashes;
+  shards_[0].statistics.hash_nanoseconds += nanoseconds;
+}
+
+GraphletHashCache::Statistics GraphletHashCache::GetStatistics() const {
+  Statistics statistics;
+  for (uint32_t index = 0; index < kShards; ++index) {
+    std::lock_guard<std::mutex> lock(shards_[index].mutex);
+    const Statistics& shard = shards_[index].statistics;
+    statistics.lookups += shard.lookups;
+    statistics.hits += shard.hits;
+    statistics.evictions += shard.evictions;
+    statistics.lookup_nanoseconds += shard.lookup_nanoseconds;
+    statistics.hashes += shard.hashes;
+    statistics.hash_nanoseconds += shard.hash_nanoseconds;
+  }
+  return statistics;
+}
+
+void GraphletHashCache::ResetStatistics() {
+  for (uint32_t index = 0; index < kShards; ++index) {
+    std::lock_guard<std::mutex> lock(shards_[index].mutex);
+    shards_[index].statistics = Statistics();
+  }
+}
+
+uint64_t GraphletHashCache::size() const {
+  uint64_t entries = 0;
+  for (uint32_t index = 0; index < kShards; ++index) {
+    std::lock_guard<std::mutex> lock(shards_[index].mutex);
+    entries += shards_[index].entries.size();
+  }
+  return entries;
+}
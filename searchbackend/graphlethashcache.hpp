@@ -0,0 +1,116 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GRAPHLETHASHCACHE_HPP
+#define GRAPHLETHASHCACHE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util/util.hpp"
+
+// A bounded cache of graphlet feature hashes, shared by all threads hashing
+// with the same FunctionSimHasher. Large binaries contain the same small
+// graphlets (diamonds, simple loops, chains) over and over, and the legacy
+// hash family hashes each occurrence by finding its orders and degrees and
+// then making several seeded passes over its edges. The cache is keyed on the
+// encoding of the graphlet (see GraphletView::GetEncoding) and the occurrence
+// count, which together determine the feature hash, so a hit returns exactly
+// what hashing would have.
+//
+// The entries are spread over shards by a fingerprint of the key, each with
+// its own lock and its own statistics. A shard that is full is emptied before
+// the next insertion; repeated graphlets come back quickly, so this costs
+// little and keeps the memory bounded without bookkeeping on every hit.
+class GraphletHashCache {
+public:
+  using Clock = std::chrono::steady_clock;
+  static uint64_t NanosecondsSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - start).count();
+  }
+
+  struct Statistics {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t evictions = 0;
+    // The time all lookups took, from the start the caller gave to the result.
+    uint64_t lookup_nanoseconds = 0;
+    // The time hashing took for the misses and for the hits that were hashed
+    // anyway as samples.
+    uint64_t hashes = 0;
+    uint64_t hash_nanoseconds = 0;
+
+    double GetHitRate() const;
+    // An estimate of the time the cache saved (negative if it cost time):
+    // Each hit saved hashing the graphlet, but every lookup cost time.
+    double GetSecondsSaved() const;
+    std::string ToString() const;
+  };
+
+  explicit GraphletHashCache(uint64_t max_entries);
+
+  // One in this many hits should be hashed anyway and passed to
+  // RecordHashTime, so that the time saved can be estimated from warm
+  // hashing instead of from the misses alone, which are few and cold.
+  static constexpr uint64_t kHashSampleInterval = 64;
+
+  // Returns true and the feature hash if the graphlet with this encoding has
+  // been hashed for this occurrence before. 'start' is when the caller began
+  // working on the graphlet, so that the lookup time includes the encoding.
+  bool Lookup(const std::vector<uint32_t>& encoding, uint64_t occurrence,
+    Clock::time_point start, FeatureHash* hash);
+  // Stores the feature hash after a miss; hashing it took 'nanoseconds'.
+  void Insert(const std::vector<uint32_t>& encoding, uint64_t occurrence,
+    const FeatureHash& hash, uint64_t nanoseconds);
+  // Accounts the time hashing a graphlet took despite a hit.
+  void RecordHashTime(uint64_t nanoseconds);
+
+  Statistics GetStatistics() const;
+  // Starts counting anew, e.g. for the next binary; the entries stay.
+  void ResetStatistics();
+  uint64_t size() const;
+private:
+  static constexpr uint32_t kShards = 64;
+
+  struct Entry {
+    uint64_t occurrence;
+    std::vector<uint32_t> encoding;
+    FeatureHash hash;
+  };
+  // Aligned to keep threads working on different shards off each other's
+  // cache lines.
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    // Keyed by fingerprint; a fingerprint collision just replaces the entry.
+    std::unordered_map<uint64_t, Entry> entries;
+    Statistics statistics;
+  };
+
+  static uint64_t Fingerprint(const std::vector<uint32_t>& encoding,
+    uint64_t occurrence);
+  Shard& GetShard(uint64_t fingerprint) const {
+    return shards_[fingerprint >> 58];
+  }
+
+  uint64_t max_entries_per_shard_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+#endif // GRAPHLETHASHCACHE_HPP
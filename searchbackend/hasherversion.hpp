@@ -0,0 +1,79 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HASHERVERSION_HPP
+#define HASHERVERSION_HPP
+
+#include <cstdint>
+#include <string>
+
+// Identifies the hash family that turns features into feature hashes. Feature
+// IDs, weights and SimHashes computed with different families have nothing in
+// common, so the version is recorded in search indices and weights files. The
+// values are stored on disk; zero is what files without a version contain.
+enum class HasherVersion : uint32_t {
+  // The original family. Mnemonics are hashed with std::hash<std::string>,
+  // whose values differ between standard libraries.
+  kLegacy = 0,
+  // Built on util/portablehash.hpp, identical on every platform and toolchain.
+  // Each feature is hashed once, and all words of its feature hash are derived
+  // from that value independently of each other.
+  kPortable = 1,
+  // The portable family, but immediates are the values the disassembler
+  // decoded from the instructions where it provides them, instead of the
+  // numbers found in the operand strings. Decoded immediates are sign-extended
+  // to 64 bits, and register names such as "bh" no longer count as numbers.
+  kDecodedImmediates = 2
+};
+
+inline const char* HasherVersionName(HasherVersion version) {
+  switch (version) {
+    case HasherVersion::kLegacy:
+      return "legacy";
+    case HasherVersion::kPortable:
+      return "portable";
+    case HasherVersion::kDecodedImmediates:
+      return "decoded";
+  }
+  return "unknown";
+}
+
+inline bool ParseHasherVersion(const std::string& name,
+  HasherVersion* version) {
+  for (HasherVersion candidate : { HasherVersion::kLegacy,
+    HasherVersion::kPortable, HasherVersion::kDecodedImmediates }) {
+    if (name == HasherVersionName(candidate)) {
+      *version = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool IsKnownHasherVersion(uint32_t value) {
+  return value <= static_cast<uint32_t>(HasherVersion::kDecodedImmediates);
+}
+
+// Whether features are hashed with the portable family.
+inline bool UsesPortableHashes(HasherVersion version) {
+  return version != HasherVersion::kLegacy;
+}
+
+// Whether immediates decoded by the disassembler replace the ones parsed from
+// the operand strings.
+inline bool UsesDecodedImmediates(HasherVersion version) {
+  return version == HasherVersion::kDecodedImmediates;
+}
+
+#endif // HASHERVERSION_HPP
@@ -0,0 +1,244 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "searchbackend/queryprotocol.hpp"
+
+namespace {
+
+// The sizes of the encoded parts of a response.
+constexpr uint64_t kResponseHeaderSize = 12;
+constexpr uint64_t kResultCountSize = 4;
+constexpr uint64_t kResultSize = 20;
+
+// Little-endian serialization helpers. The payload is built byte by byte so
+// the format does not depend on the endianness or padding of the host.
+template <typename T> void Append(T value, std::vector<uint8_t>* payload) {
+  for (size_t index = 0; index < sizeof(T); ++index) {
+    payload->push_back(static_cast<uint8_t>(value >> (8 * index)));
+  }
+}
+
+void AppendFloat(float value, std::vector<uint8_t>* payload) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  Append(bits, payload);
+}
+
+// Reads values from a payload, keeping track of whether the payload was long
+// enough for everything that was read.
+class PayloadReader {
+public:
+  PayloadReader(const std::vector<uint8_t>& payload) : payload_(payload),
+    offset_(0), ok_(true) {};
+  template <typename T> T Read() {
+    T value = 0;
+    if (offset_ + sizeof(T) > payload_.size()) {
+      ok_ = false;
+      return value;
+    }
+    for (size_t index = 0; index < sizeof(T); ++index) {
+      value |= static_cast<T>(payload_[offset_ + index]) << (8 * index);
+    }
+    offset_ += sizeof(T);
+    return value;
+  }
+  float ReadFloat() {
+    uint32_t bits = Read<uint32_t>();
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  size_t Remaining() const { return payload_.size() - offset_; }
+  // True if all reads succeeded and the payload was consumed entirely.
+  bool Complete() const { return ok_ && (offset_ == payload_.size()); }
+  bool Ok() const { return ok_; }
+private:
+  const std::vector<uint8_t>& payload_;
+  size_t offset_;
+  bool ok_;
+};
+
+bool WriteFully(int socket, const uint8_t* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = send(socket, data, size, MSG_NOSIGNAL);
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool ReadFully(int socket, uint8_t* data, size_t size) {
+  while (size > 0) {
+    ssize_t received = recv(socket, data, size, 0);
+    if (received <= 0) {
+      return false;
+    }
+    data += received;
+    size -= received;
+  }
+  return true;
+}
+
+} // namespace
+
+void EncodeQueryRequest(const QueryRequest& request,
+  std::vector<uint8_t>* payload) {
+  payload->clear();
+  payload->reserve(16 + request.hashes.size() * 16);
+  Append(kQueryRequestMagic, payload);
+  Append(kQueryProtocolVersion, payload);
+  Append(static_cast<uint16_t>(0), payload);
+  Append(request.results_per_query, payload);
+  Append(static_cast<uint32_t>(request.hashes.size()), payload);
+  for (const FeatureHash& hash : request.hashes) {
+    Append(hash.first, payload);
+    Append(hash.second, payload);
+  }
+}
+
+bool DecodeQueryRequest(const std::vector<uint8_t>& payload,
+  QueryRequest* request) {
+  PayloadReader reader(payload);
+  if ((reader.Read<uint32_t>() != kQueryRequestMagic) ||
+    (reader.Read<uint16_t>() != kQueryProtocolVersion)) {
+    return false;
+  }
+  reader.Read<uint16_t>();
+  request->results_per_query = reader.Read<uint32_t>();
+  uint32_t number_of_queries = reader.Read<uint32_t>();
+  if (!reader.Ok() || (reader.Remaining() != number_of_queries * 16ULL)) {
+    return false;
+  }
+  request->hashes.clear();
+  request->hashes.reserve(number_of_queries);
+  for (uint32_t index = 0; index < number_of_queries; ++index) {
+    uint64_t hash_A = reader.Read<uint64_t>();
+    uint64_t hash_B = reader.Read<uint64_t>();
+    request->hashes.push_back(std::make_pair(hash_A, hash_B));
+  }
+  return reader.Complete();
+}
+
+void EncodeQueryResponse(const QueryResponse& response,
+  std::vector<uint8_t>* payload) {
+  payload->clear();
+  Append(kQueryResponseMagic, payload);
+  Append(kQueryProtocolVersion, payload);
+  Append(response.status, payload);
+  Append(static_cast<uint32_t>(response.results.size()), payload);
+  for (const std::vector<QueryResult>& results : response.results) {
+    Append(static_cast<uint32_t>(results.size()), payload);
+    for (const QueryResult& result : results) {
+      AppendFloat(result.similarity, payload);
+      Append(result.file_id, payload);
+      Append(result.address, payload);
+    }
+  }
+}
+
+bool DecodeQueryResponse(const std::vector<uint8_t>& payload,
+  QueryResponse* response) {
+  PayloadReader reader(payload);
+  if ((reader.Read<uint32_t>() != kQueryResponseMagic) ||
+    (reader.Read<uint16_t>() != kQueryProtocolVersion)) {
+    return false;
+  }
+  response->status = reader.Read<uint16_t>();
+  uint32_t number_of_queries = reader.Read<uint32_t>();
+  // Every query needs at least its four-byte result count.
+  if (!reader.Ok() || (reader.Remaining() < number_of_queries * 4ULL)) {
+    return false;
+  }
+  response->results.clear();
+  response->results.resize(number_of_queries);
+  for (std::vector<QueryResult>& results : response->results) {
+    uint32_t number_of_results = reader.Read<uint32_t>();
+    if (!reader.Ok() ||
+      (reader.Remaining() < number_of_results * kResultSize)) {
+      return false;
+    }
+    results.resize(number_of_results);
+    for (QueryResult& result : results) {
+      result.similarity = reader.ReadFloat();
+      result.file_id = reader.Read<uint64_t>();
+      result.address = reader.Read<uint64_t>();
+    }
+  }
+  return reader.Complete();
+}
+
+bool QueryResponseFitsIntoFrame(uint64_t number_of_queries,
+  uint64_t results_per_query) {
+  // Both are bounded by the request limits before this is asked, but the
+  // divisions keep the products from overflowing for any input.
+  uint64_t available = kMaxFrameSize - kResponseHeaderSize;
+  if (results_per_query > available / kResultSize) {
+    return number_of_queries == 0;
+  }
+  uint64_t query_size = kResultCountSize + results_per_query * kResultSize;
+  return number_of_queries <= available / query_size;
+}
+
+bool WriteFrame(int socket, const std::vector<uint8_t>& payload) {
+  // The length would not survive the truncation to 32 bits, and the peer
+  // refuses anything larger anyway.
+  if (payload.size() > kMaxFrameSize) {
+    return false;
+  }
+  std::vector<uint8_t> length;
+  Append(static_cast<uint32_t>(payload.size()), &length);
+  return WriteFully(socket, length.data(), length.size()) &&
+    WriteFully(socket, payload.data(), payload.size());
+}
+
+bool ReadFrame(int socket, std::vector<uint8_t>* payload, uint32_t max_size) {
+  std::vector<uint8_t> length(4);
+  if (!ReadFully(socket, length.data(), length.size())) {
+    return false;
+  }
+  uint32_t size = PayloadReader(length).Read<uint32_t>();
+  if (size > max_size) {
+    return false;
+  }
+  payload->resize(size);
+  return ReadFully(socket, payload->data(), size);
+}
+
+int ConnectToQueryServer(const std::string& socket_path) {
+  struct sockaddr_un address;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) {
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+  if (connect(connection, reinterpret_cast<struct sockaddr*>(&address),
+    sizeof(address)) != 0) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
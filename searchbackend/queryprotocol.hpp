@@ -0,0 +1,100 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef QUERYPROTOCOL_HPP
+#define QUERYPROTOCOL_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "util/util.hpp"
+
+// The binary protocol spoken between the queryserver tool and its clients over
+// a Unix domain socket. Every message is a frame consisting of a little-endian
+// uint32 payload length followed by the payload. All integers in the payload
+// are little-endian as well.
+//
+// Request payload:
+//   uint32 magic ("FSSQ"), uint16 version, uint16 reserved,
+//   uint32 number of results per query (N), uint32 number of queries (Q),
+//   Q times: uint64 hash_A, uint64 hash_B
+//
+// Response payload:
+//   uint32 magic ("FSSR"), uint16 version, uint16 status,
+//   uint32 number of queries (Q),
+//   Q times: uint32 number of results (R),
+//            R times: float similarity, uint64 file_id, uint64 address
+//
+// A client may send any number of requests on one connection; they are
+// answered in order.
+
+static const uint32_t kQueryRequestMagic = 0x51535346;
+static const uint32_t kQueryResponseMagic = 0x52535346;
+static const uint16_t kQueryProtocolVersion = 1;
+// Upper bounds that keep a malformed or malicious frame from making the server
+// allocate arbitrary amounts of memory. Each bound alone is not enough: The
+// response to a request also has to fit into a frame (see
+// QueryResponseFitsIntoFrame), which at the full number of results per query
+// allows only about 800 queries.
+static const uint32_t kMaxQueriesPerRequest = 1 << 16;
+static const uint32_t kMaxResultsPerQuery = 1 << 12;
+static const uint32_t kMaxFrameSize = 64 << 20;
+
+enum QueryStatus : uint16_t {
+  kQueryOk = 0,
+  kQueryMalformedRequest = 1,
+  kQueryTooLarge = 2,
+};
+
+struct QueryRequest {
+  uint32_t results_per_query;
+  std::vector<FeatureHash> hashes;
+};
+
+struct QueryResult {
+  float similarity;
+  uint64_t file_id;
+  uint64_t address;
+};
+
+struct QueryResponse {
+  uint16_t status;
+  std::vector<std::vector<QueryResult>> results;
+};
+
+void EncodeQueryRequest(const QueryRequest& request,
+  std::vector<uint8_t>* payload);
+bool DecodeQueryRequest(const std::vector<uint8_t>& payload,
+  QueryRequest* request);
+void EncodeQueryResponse(const QueryResponse& response,
+  std::vector<uint8_t>* payload);
+bool DecodeQueryResponse(const std::vector<uint8_t>& payload,
+  QueryResponse* response);
+// Whether the response to 'number_of_queries' queries with up to
+// 'results_per_query' results each is at most kMaxFrameSize bytes.
+bool QueryResponseFitsIntoFrame(uint64_t number_of_queries,
+  uint64_t results_per_query);
+
+// Blocking frame I/O on a socket. Both return false if the connection was
+// closed or failed; WriteFrame also fails for payloads larger than
+// kMaxFrameSize, and ReadFrame for frames larger than max_size.
+bool WriteFrame(int socket, const std::vector<uint8_t>& payload);
+bool ReadFrame(int socket, std::vector<uint8_t>* payload,
+  uint32_t max_size = kMaxFrameSize);
+
+// Returns a connected socket, or -1.
+int ConnectToQueryServer(const std::string& socket_path);
+
+#endif // QUERYPROTOCOL_HPP
@@ -0,0 +1,142 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "searchbackend/queryprotocol.hpp"
+
+TEST(queryprotocol, request_roundtrip) {
+  QueryRequest request;
+  request.results_per_query = 7;
+  request.hashes.push_back(std::make_pair(0xba5eba11bedabb1eUL,
+    0xbe5077edb0a710adUL));
+  request.hashes.push_back(std::make_pair(0UL, ~0UL));
+
+  std::vector<uint8_t> payload;
+  EncodeQueryRequest(request, &payload);
+  EXPECT_EQ(payload.size(), 16 + 2 * 16);
+  // The magic is written little-endian, so the frame starts with "FSSQ".
+  EXPECT_EQ(std::string(payload.begin(), payload.begin() + 4), "FSSQ");
+
+  QueryRequest decoded;
+  ASSERT_TRUE(DecodeQueryRequest(payload, &decoded));
+  EXPECT_EQ(decoded.results_per_query, 7);
+  EXPECT_EQ(decoded.hashes, request.hashes);
+}
+
+TEST(queryprotocol, response_roundtrip) {
+  QueryResponse response;
+  response.status = kQueryOk;
+  response.results.resize(3);
+  response.results[0].push_back({ 1.0f, 0xdeadbea700defec8UL, 0x401000 });
+  response.results[0].push_back({ 0.75f, 0xf01dab1ef005ba11UL, 0x402000 });
+  response.results[2].push_back({ 0.5f, 0x7e1eca57deadbeefUL, 0x403000 });
+
+  std::vector<uint8_t> payload;
+  EncodeQueryResponse(response, &payload);
+  QueryResponse decoded;
+  ASSERT_TRUE(DecodeQueryResponse(payload, &decoded));
+  EXPECT_EQ(decoded.status, kQueryOk);
+  ASSERT_EQ(decoded.results.size(), 3);
+  ASSERT_EQ(decoded.results[0].size(), 2);
+  EXPECT_EQ(decoded.results[1].size(), 0);
+  ASSERT_EQ(decoded.results[2].size(), 1);
+  EXPECT_EQ(decoded.results[0][1].similarity, 0.75f);
+  EXPECT_EQ(decoded.results[0][1].file_id, 0xf01dab1ef005ba11UL);
+  EXPECT_EQ(decoded.results[2][0].address, 0x403000);
+}
+
+TEST(queryprotocol, rejects_malformed_payloads) {
+  QueryRequest request;
+  request.results_per_query = 5;
+  request.hashes.push_back(std::make_pair(1UL, 2UL));
+  std::vector<uint8_t> payload;
+  EncodeQueryRequest(request, &payload);
+
+  QueryRequest decoded;
+  std::vector<uint8_t> truncated(payload.begin(), payload.end() - 1);
+  EXPECT_FALSE(DecodeQueryRequest(truncated, &decoded));
+  std::vector<uint8_t> extended(payload);
+  extended.push_back(0);
+  EXPECT_FALSE(DecodeQueryRequest(extended, &decoded));
+  std::vector<uint8_t> bad_magic(payload);
+  bad_magic[0] ^= 0xFF;
+  EXPECT_FALSE(DecodeQueryRequest(bad_magic, &decoded));
+  // A response payload is not a valid request.
+  QueryResponse response{ kQueryOk, {} };
+  EncodeQueryResponse(response, &payload);
+  EXPECT_FALSE(DecodeQueryRequest(payload, &decoded));
+}
+
+TEST(queryprotocol, frames_over_socket) {
+  int sockets[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+  std::vector<uint8_t> first = { 1, 2, 3 };
+  std::vector<uint8_t> second(100000, 0x41);
+  std::vector<uint8_t> empty;
+  // Write from a separate thread, the larger frame exceeds the socket buffer.
+  std::thread writer([&]() {
+    EXPECT_TRUE(WriteFrame(sockets[0], first));
+    EXPECT_TRUE(WriteFrame(sockets[0], second));
+    EXPECT_TRUE(WriteFrame(sockets[0], empty));
+    EXPECT_TRUE(WriteFrame(sockets[0], first));
+    close(sockets[0]);
+  });
+  std::vector<uint8_t> payload;
+  ASSERT_TRUE(ReadFrame(sockets[1], &payload));
+  EXPECT_EQ(payload, first);
+  ASSERT_TRUE(ReadFrame(sockets[1], &payload));
+  EXPECT_EQ(payload, second);
+  ASSERT_TRUE(ReadFrame(sockets[1], &payload));
+  EXPECT_TRUE(payload.empty());
+  // Frames above the size limit are refused.
+  EXPECT_FALSE(ReadFrame(sockets[1], &payload, 2));
+  writer.join();
+  EXPECT_FALSE(ReadFrame(sockets[1], &payload));
+  close(sockets[1]);
+}
+
+// A response with the full number of results per query has room for 819
+// queries: 12 header bytes plus 819 * (4 + 4096 * 20) bytes are just below
+// 64 MB.
+TEST(queryprotocol, response_frame_limit) {
+  EXPECT_TRUE(QueryResponseFitsIntoFrame(819, kMaxResultsPerQuery));
+  EXPECT_FALSE(QueryResponseFitsIntoFrame(820, kMaxResultsPerQuery));
+  EXPECT_TRUE(QueryResponseFitsIntoFrame(kMaxQueriesPerRequest, 50));
+  EXPECT_FALSE(QueryResponseFitsIntoFrame(kMaxQueriesPerRequest, 52));
+  EXPECT_TRUE(QueryResponseFitsIntoFrame(0, ~0ULL));
+  EXPECT_FALSE(QueryResponseFitsIntoFrame(1, ~0ULL));
+
+  // The largest response that fits is exactly as large as the bound says.
+  QueryResponse response;
+  response.status = kQueryOk;
+  response.results.resize(819,
+    std::vector<QueryResult>(kMaxResultsPerQuery, { 1.0f, 2, 3 }));
+  std::vector<uint8_t> payload;
+  EncodeQueryResponse(response, &payload);
+  EXPECT_LE(payload.size(), kMaxFrameSize);
+  response.results.resize(820, response.results[0]);
+  EncodeQueryResponse(response, &payload);
+  EXPECT_GT(payload.size(), kMaxFrameSize);
+
+  // Writing it would truncate the length, so it is refused.
+  int sockets[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+  EXPECT_FALSE(WriteFrame(sockets[0], payload));
+  close(sockets[0]);
+  close(sockets[1]);
+}
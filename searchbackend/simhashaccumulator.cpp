@@ -0,0 +1,144 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+
+#include "searchbackend/simhashaccumulator.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMHASH_ACCUMULATOR_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Handles the bits [first_bit, bits) one at a time. Negating a float only
+// flips its sign bit, so a clear hash bit is turned into that flip with integer
+// arithmetic; compilers emit a branch for 'set ? weight : -weight', and hash
+// bits are as unpredictable as branch conditions get.
+inline void AccumulateScalar(const uint64_t* hash, uint64_t first_bit,
+  uint64_t bits, float weight, float* output) {
+  uint32_t weight_bits;
+  memcpy(&weight_bits, &weight, sizeof(weight_bits));
+  for (uint64_t bit_index = first_bit; bit_index < bits; ++bit_index) {
+    uint32_t bit = (hash[bit_index / 64] >> (bit_index % 64)) & 1;
+    uint32_t signed_bits = weight_bits ^ ((bit ^ 1) << 31);
+    float signed_weight;
+    memcpy(&signed_weight, &signed_bits, sizeof(signed_weight));
+    output[bit_index] += signed_weight;
+  }
+}
+
+#ifdef SIMHASH_ACCUMULATOR_X86
+
+// Expands 8 bits at a time into a mask of 8 floats and blends weight and
+// -weight with it.
+__attribute__((target("avx2")))
+void AccumulateAVX2(const uint64_t* hash, uint64_t bits, float weight,
+  float* output) {
+  const __m256 positive = _mm256_set1_ps(weight);
+  const __m256 negative = _mm256_set1_ps(-weight);
+  const __m256i selectors = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+  uint64_t vector_bits = bits & ~7ULL;
+  for (uint64_t bit_index = 0; bit_index < vector_bits; bit_index += 8) {
+    int32_t byte = (hash[bit_index / 64] >> (bit_index % 64)) & 0xFF;
+    __m256i set = _mm256_cmpeq_epi32(
+      _mm256_and_si256(_mm256_set1_epi32(byte), selectors), selectors);
+    __m256 signed_weights = _mm256_blendv_ps(negative, positive,
+      _mm256_castsi256_ps(set));
+    __m256 sums = _mm256_add_ps(_mm256_loadu_ps(&output[bit_index]),
+      signed_weights);
+    _mm256_storeu_ps(&output[bit_index], sums);
+  }
+  AccumulateScalar(hash, vector_bits, bits, weight, output);
+}
+
+// AVX-512 takes 16 bits of the hash directly as a blend mask.
+__attribute__((target("avx512f")))
+void AccumulateAVX512(const uint64_t* hash, uint64_t bits, float weight,
+  float* output) {
+  const __m512 positive = _mm512_set1_ps(weight);
+  const __m512 negative = _mm512_set1_ps(-weight);
+  uint64_t vector_bits = bits & ~15ULL;
+  for (uint64_t bit_index = 0; bit_index < vector_bits; bit_index += 16) {
+    __mmask16 set = (hash[bit_index / 64] >> (bit_index % 64)) & 0xFFFF;
+    __m512 signed_weights = _mm512_mask_blend_ps(set, negative, positive);
+    __m512 sums = _mm512_add_ps(_mm512_loadu_ps(&output[bit_index]),
+      signed_weights);
+    _mm512_storeu_ps(&output[bit_index], sums);
+  }
+  AccumulateScalar(hash, vector_bits, bits, weight, output);
+}
+
+#endif // SIMHASH_ACCUMULATOR_X86
+
+} // namespace
+
+bool IsSimHashAccumulatorSupported(SimHashAccumulator accumulator) {
+  switch (accumulator) {
+    case SimHashAccumulator::kScalar:
+      return true;
+#ifdef SIMHASH_ACCUMULATOR_X86
+    case SimHashAccumulator::kAVX2:
+      return __builtin_cpu_supports("avx2");
+    case SimHashAccumulator::kAVX512:
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+  }
+}
+
+SimHashAccumulator GetBestSimHashAccumulator() {
+  static const SimHashAccumulator best =
+    IsSimHashAccumulatorSupported(SimHashAccumulator::kAVX512) ?
+      SimHashAccumulator::kAVX512 :
+    IsSimHashAccumulatorSupported(SimHashAccumulator::kAVX2) ?
+      SimHashAccumulator::kAVX2 : SimHashAccumulator::kScalar;
+  return best;
+}
+
+const char* SimHashAccumulatorName(SimHashAccumulator accumulator) {
+  switch (accumulator) {
+    case SimHashAccumulator::kScalar:
+      return "scalar";
+    case SimHashAccumulator::kAVX2:
+      return "avx2";
+    case SimHashAccumulator::kAVX512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+void AccumulateSimHashWeight(SimHashAccumulator accumulator,
+  const uint64_t* hash, uint64_t bits, float weight, float* output) {
+  switch (accumulator) {
+#ifdef SIMHASH_ACCUMULATOR_X86
+    case SimHashAccumulator::kAVX512:
+      AccumulateAVX512(hash, bits, weight, output);
+      return;
+    case SimHashAccumulator::kAVX2:
+      AccumulateAVX2(hash, bits, weight, output);
+      return;
+#endif
+    default:
+      AccumulateScalar(hash, 0, bits, weight, output);
+  }
+}
+
+void AccumulateSimHashWeight(const uint64_t* hash, uint64_t bits, float weight,
+  float* output) {
+  AccumulateSimHashWeight(GetBestSimHashAccumulator(), hash, bits, weight,
+    output);
+}
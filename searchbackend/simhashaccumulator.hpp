@@ -0,0 +1,45 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMHASHACCUMULATOR_HPP
+#define SIMHASHACCUMULATOR_HPP
+
+#include <cstdint>
+
+// The inner loop of SimHash: For every feature, the weight of the feature is
+// added to output float i if bit i of the feature hash is set, and subtracted
+// otherwise. This happens for every bit of every feature, so the loop is
+// implemented without per-bit branches, using AVX-512 or AVX2 where the CPU
+// supports it. All implementations produce bit-identical results: Each float
+// receives exactly one addition or subtraction of the same weight per feature.
+enum class SimHashAccumulator {
+  kScalar,
+  kAVX2,
+  kAVX512
+};
+
+// Returns the fastest implementation the current CPU supports.
+SimHashAccumulator GetBestSimHashAccumulator();
+bool IsSimHashAccumulatorSupported(SimHashAccumulator accumulator);
+const char* SimHashAccumulatorName(SimHashAccumulator accumulator);
+
+// Adds 'weight' to output[i] for every set bit i in the first 'bits' bits of
+// 'hash' and subtracts it for every clear bit. 'hash' holds the bits in 64-bit
+// words, least significant bit first.
+void AccumulateSimHashWeight(const uint64_t* hash, uint64_t bits, float weight,
+  float* output);
+void AccumulateSimHashWeight(SimHashAccumulator accumulator,
+  const uint64_t* hash, uint64_t bits, float weight, float* output);
+
+#endif // SIMHASHACCUMULATOR_HPP
@@ -0,0 +1,60 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "searchbackend/simhashaccumulator.hpp"
+
+TEST(simhashaccumulator, scalar_adds_and_subtracts) {
+  uint64_t hash[2] = { 0x5ULL, 0x8000000000000000ULL };
+  std::vector<float> output(128, 1.0f);
+  AccumulateSimHashWeight(SimHashAccumulator::kScalar, hash, 128, 0.5f,
+    output.data());
+  for (uint64_t bit = 0; bit < 128; ++bit) {
+    bool set = (bit == 0) || (bit == 2) || (bit == 127);
+    EXPECT_EQ(output[bit], set ? 1.5f : 0.5f);
+  }
+}
+
+// Every implementation the CPU supports has to match the scalar one bit for
+// bit, including for bit counts that do not fill a whole vector.
+TEST(simhashaccumulator, implementations_agree) {
+  std::mt19937_64 random(1);
+  std::uniform_real_distribution<float> weight(-2.0f, 4.0f);
+  for (SimHashAccumulator accumulator : { SimHashAccumulator::kAVX2,
+    SimHashAccumulator::kAVX512 }) {
+    if (!IsSimHashAccumulatorSupported(accumulator)) {
+      continue;
+    }
+    for (uint64_t bits : { 7, 64, 100, 128, 256 }) {
+      std::vector<float> expected(bits, 0.0f);
+      std::vector<float> actual(bits, 0.0f);
+      std::vector<uint64_t> hash((bits + 63) / 64);
+      for (uint32_t feature = 0; feature < 1000; ++feature) {
+        for (uint64_t& word : hash) {
+          word = random();
+        }
+        float feature_weight = weight(random);
+        AccumulateSimHashWeight(SimHashAccumulator::kScalar, hash.data(), bits,
+          feature_weight, expected.data());
+        AccumulateSimHashWeight(accumulator, hash.data(), bits,
+          feature_weight, actual.data());
+      }
+      EXPECT_EQ(expected, actual) << SimHashAccumulatorName(accumulator) <<
+        " with " << bits << " bits";
+    }
+  }
+}
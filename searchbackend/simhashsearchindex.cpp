@@ -12,8 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cerrno>
+#include <ctime>
 #include <tuple>
 #include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "util/bitpermutation.hpp"
 #include "searchbackend/simhashsearchindex.hpp"
@@ -21,28 +25,137 @@
 #include "util/util.hpp"
 
 SimHashSearchIndex::SimHashSearchIndex(const std::string& indexname,
-  bool create, uint8_t buckets) :
+  bool create, uint8_t buckets, uint8_t prefix_bits,
+  HasherVersion hasher_version) :
+    SimHashSearchIndex(indexname, create, buckets, prefix_bits, hasher_version,
+      Access::kReadWrite) {}
+
+SimHashSearchIndex::SimHashSearchIndex(const std::string& indexname,
+  Access access) :
+    SimHashSearchIndex(indexname, false, 50, 8, HasherVersion::kLegacy,
+      access) {}
+
+SimHashSearchIndex::SimHashSearchIndex(const std::string& indexname,
+  bool create, uint8_t buckets, uint8_t prefix_bits,
+  HasherVersion hasher_version, Access access) :
+    log_file_(indexname + ".wal"),
+    read_only_(access == Access::kReadOnly),
+    replayed_functions_(0),
     id_to_file_and_address_(indexname, create),
-    search_index_("index", id_to_file_and_address_.getSegment(), create),
-    buckets_(buckets) {
+    search_index_("index", id_to_file_and_address_.getSegment(), create) {
   if (id_to_file_and_address_.getMap() == nullptr) {
     throw std::runtime_error("Loading search index map failed!");
   }
   if (search_index_.getSet() == nullptr) {
     throw std::runtime_error("Loading search index set failed!");
   }
-  // Validate that the number of buckets specified was correct if loading an
-  // existing search index with data therein.
-  if ((search_index_.getSet()->size() != 0) && 
-    (GetNumberOfBuckets() != buckets)) {
-    throw std::runtime_error("Specified incorrect number of buckets for index!");
+  if (create) {
+    if ((buckets == 0) || (prefix_bits == 0) || (prefix_bits > 64)) {
+      throw std::runtime_error("Invalid bucket parameters for new index!");
+    }
+    std::shared_ptr<managed_mapped_file>& segment =
+      id_to_file_and_address_.getSegment();
+    header_ = SimHashSearchIndexHeader{};
+    header_.magic = SimHashSearchIndexHeader::kMagic;
+    header_.version = SimHashSearchIndexHeader::kCurrentVersion;
+    header_.layout = SimHashSearchIndexHeader::kTreeSetLayout;
+    header_.hash_bits = 128;
+    header_.buckets = buckets;
+    header_.prefix_bits = prefix_bits;
+    header_.hasher_version = static_cast<uint32_t>(hasher_version);
+    header_.permutation_seed = SimHashSearchIndexHeader::kDefaultPermutationSeed;
+    header_.creation_time = std::time(nullptr);
+    header_.initial_file_size = segment->get_size();
+    segment->construct<SimHashSearchIndexHeader>("header")(header_);
+  } else {
+    LoadHeader(buckets);
+  }
+  // Dispatch on the header: Refuse anything this code does not know how to
+  // read.
+  if (header_.magic != SimHashSearchIndexHeader::kMagic) {
+    throw std::runtime_error("Search index header is corrupt!");
+  }
+  if (header_.version > SimHashSearchIndexHeader::kCurrentVersion) {
+    throw std::runtime_error("Search index was written by a newer version!");
+  }
+  if ((header_.layout != SimHashSearchIndexHeader::kTreeSetLayout) ||
+    (header_.hash_bits != 128)) {
+    throw std::runtime_error("Unsupported search index layout!");
+  }
+  if (!IsKnownHasherVersion(header_.hasher_version)) {
+    throw std::runtime_error("Search index uses an unknown hasher version!");
+  }
+  // A stored header gets the same checks as the parameters of a new index: The
+  // bucket count has to fit the 8-bit permutation index, and the prefix mask
+  // is built by shifting a 64-bit value.
+  if ((header_.buckets == 0) || (header_.buckets > 255) ||
+    (header_.prefix_bits == 0) || (header_.prefix_bits > 64)) {
+    throw std::runtime_error("Invalid bucket parameters in index header!");
+  }
+  buckets_ = header_.buckets;
+  prefix_mask_ = PrefixMask(header_.prefix_bits);
+
+  if (create) {
+    // A log next to a new index was left behind by an index that is gone.
+    unlink(log_file_.c_str());
+  } else {
+    RecoverWriteAheadLog();
+  }
+}
+
+SimHashSearchIndex::~SimHashSearchIndex() {
+  if (write_ahead_log_) {
+    try {
+      Checkpoint();
+    } catch (std::runtime_error& error) {
+      // The log is kept and replayed the next time the index is opened.
+    }
+  }
+}
+
+void SimHashSearchIndex::LoadHeader(uint8_t buckets) {
+  std::shared_ptr<managed_mapped_file>& segment =
+    id_to_file_and_address_.getSegment();
+  SimHashSearchIndexHeader* stored =
+    segment->find<SimHashSearchIndexHeader>("header").first;
+  if (stored != nullptr) {
+    header_ = *stored;
+    return;
+  }
+  // The index predates headers. The bucket count can be inferred from the last
+  // element of the set, the prefix width was always 8 bits.
+  header_ = SimHashSearchIndexHeader{};
+  header_.magic = SimHashSearchIndexHeader::kMagic;
+  header_.version = SimHashSearchIndexHeader::kCurrentVersion;
+  header_.layout = SimHashSearchIndexHeader::kTreeSetLayout;
+  header_.hash_bits = 128;
+  header_.buckets = buckets;
+  if (!search_index_.getSet()->empty()) {
+    const IndexEntry& last = *(search_index_.getSet()->rbegin());
+    header_.buckets = std::get<0>(last) + 1;
+  }
+  header_.prefix_bits = 8;
+  header_.permutation_seed = SimHashSearchIndexHeader::kDefaultPermutationSeed;
+  if (read_only_) {
+    return;
+  }
+  try {
+    segment->construct<SimHashSearchIndexHeader>("header")(header_);
+  } catch (boost::interprocess::bad_alloc& out_of_space) {
+    // Keep working with the inferred header; the file is simply not upgraded.
   }
 }
 
 uint8_t SimHashSearchIndex::GetNumberOfBuckets() const {
-  const IndexEntry& last = *(search_index_.getSet()->rbegin());
-  uint8_t max_index = std::get<0>(last);
-  return max_index + 1;
+  return buckets_;
+}
+
+uint8_t SimHashSearchIndex::GetPrefixBits() const {
+  return header_.prefix_bits;
+}
+
+HasherVersion SimHashSearchIndex::GetHasherVersion() const {
+  return static_cast<HasherVersion>(header_.hasher_version);
 }
 
 uint64_t SimHashSearchIndex::QueryTopN(uint64_t hash_A, uint64_t hash_B,
@@ -57,12 +170,12 @@ uint64_t SimHashSearchIndex::QueryTopN(uint64_t hash_A, uint64_t hash_B,
 
   // Identify the N different buckets that need to be checked.
   for (uint8_t bucket_count = 0; bucket_count < buckets_; ++bucket_count) {
-    // Permute the input hash, then mask off all but 8 bits to identify the
-    // hash bucket to use.
+    // Permute the input hash, then mask off all but the prefix bits to
+    // identify the hash bucket to use.
     uint128_t permuted = permuted_values[bucket_count];
 
     uint64_t hash_component_A = getHigh64(permuted);
-    uint64_t hash_component_A_masked = hash_component_A & 0xFF00000000000000ULL;
+    uint64_t hash_component_A_masked = hash_component_A & prefix_mask_;
     uint64_t hash_component_B = getLow64(permuted);
 
     // Build a synthetic index entry to perform the search.
@@ -89,7 +202,7 @@ uint64_t SimHashSearchIndex::QueryTopN(uint64_t hash_A, uint64_t hash_B,
         // Check if we have processed the entire bucket.
         uint64_t entry_component_A = std::get<1>(current_entry);
         PermutationIndex index = std::get<0>(current_entry);
-        if (((entry_component_A & 0xFF00000000000000ULL) !=
+        if (((entry_component_A & prefix_mask_) !=
               hash_component_A_masked) || (index != bucket_count)) {
           break;
         }
@@ -158,9 +271,67 @@ double SimHashSearchIndex::GetOddsOfRandomHit(
 
 uint64_t SimHashSearchIndex::AddFunction(uint64_t hash_A, uint64_t hash_B,
   SimHashSearchIndex::FileID file_id, SimHashSearchIndex::Address address) {
+  if (read_only_) {
+    throw std::runtime_error("Search index was opened read-only!");
+  }
+  if (write_ahead_log_) {
+    AddFunctions({ FunctionToAdd{ hash_A, hash_B, file_id, address } });
+    return 0;
+  }
   // Obtain a new function ID and insert the mapping from function ID to
   // target file and address into the corresponding map.
   FunctionID function_id = id_to_file_and_address_.getMap()->size() + 1;
+  InsertFunction(function_id, hash_A, hash_B, file_id, address);
+  return 0; // TODO(thomasdullien): Why return anything at all?
+}
+
+void SimHashSearchIndex::AddFunctions(
+  const std::vector<FunctionToAdd>& functions) {
+  if (read_only_) {
+    throw std::runtime_error("Search index was opened read-only!");
+  }
+  std::lock_guard<std::mutex> lock(batch_mutex_);
+  FunctionID next_id = id_to_file_and_address_.getMap()->size() + 1;
+  std::vector<LoggedFunction> batch;
+  batch.reserve(functions.size());
+  for (const FunctionToAdd& function : functions) {
+    batch.push_back(LoggedFunction{ next_id++, function.hash_A,
+      function.hash_B, function.file_id, function.address });
+  }
+  // The batch is committed once it is in the log; only then may the index be
+  // modified.
+  if (write_ahead_log_ && !write_ahead_log_->LogBatch(batch)) {
+    throw std::runtime_error("Writing to the write-ahead log failed!");
+  }
+  uint64_t inserted = 0;
+  try {
+    for (const LoggedFunction& function : batch) {
+      ++inserted;
+      InsertFunction(function.function_id, function.hash_A, function.hash_B,
+        function.file_id, function.address);
+    }
+  } catch (boost::interprocess::bad_alloc& out_of_space) {
+    // Replaying the batch would run out of space again. Take the functions of
+    // the batch out of the index again - including the one that was only
+    // partially inserted - so that the batch is dropped as a whole, and only
+    // then drop it from the log.
+    for (uint64_t index = 0; index < inserted; ++index) {
+      const LoggedFunction& function = batch[index];
+      RemoveFunction(function.function_id, function.hash_A, function.hash_B);
+    }
+    Checkpoint();
+    throw;
+  }
+  if (write_ahead_log_ &&
+    (write_ahead_log_->GetSize() > kCheckpointLogSize)) {
+    Checkpoint();
+  }
+}
+
+// Inserting is idempotent: Repeating it for the same function ID leaves the
+// index unchanged, which is what makes replaying the write-ahead log safe.
+void SimHashSearchIndex::InsertFunction(FunctionID function_id,
+  uint64_t hash_A, uint64_t hash_B, FileID file_id, Address address) {
   (*id_to_file_and_address_.getMap())[function_id] = std::make_pair(
     file_id, address);
 
@@ -183,7 +354,76 @@ uint64_t SimHashSearchIndex::AddFunction(uint64_t hash_A, uint64_t hash_B,
         bucket_count, hash_component_A, hash_component_B, function_id));
     }
   }
-  return 0; // TODO(thomasdullien): Why return anything at all?
+}
+
+// Undoes InsertFunction, also if it was interrupted halfway. Only erases, so it
+// does not need any space in the index.
+void SimHashSearchIndex::RemoveFunction(FunctionID function_id,
+  uint64_t hash_A, uint64_t hash_B) {
+  id_to_file_and_address_.getMap()->erase(function_id);
+
+  uint128_t full_hash = to128(hash_A, hash_B);
+  std::vector<uint128_t> permuted_values;
+  get_n_permutations(full_hash, buckets_, &permuted_values);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (uint8_t bucket_count = 0; bucket_count < buckets_; ++bucket_count) {
+    uint128_t permuted = permuted_values[bucket_count];
+    search_index_.getSet()->erase(std::make_tuple(bucket_count,
+      getHigh64(permuted), getLow64(permuted), function_id));
+  }
+}
+
+void SimHashSearchIndex::RecoverWriteAheadLog() {
+  struct stat info;
+  if (stat(log_file_.c_str(), &info) != 0) {
+    if (errno == ENOENT) {
+      return;
+    }
+    throw std::runtime_error("Checking the write-ahead log failed!");
+  }
+  if (read_only_) {
+    if (info.st_size != 0) {
+      throw std::runtime_error("Search index has batches in its write-ahead "
+        "log that were not applied yet!");
+    }
+    return;
+  }
+  WriteAheadLog log(log_file_);
+  std::vector<LoggedFunction> committed;
+  if (!log.IsOpen() || !log.Recover(&committed)) {
+    throw std::runtime_error("Opening the write-ahead log failed!");
+  }
+  // Batches in the log were committed, but the process that wrote them may
+  // have died before (or while) adding them to the index.
+  for (const LoggedFunction& function : committed) {
+    InsertFunction(function.function_id, function.hash_A, function.hash_B,
+      function.file_id, function.address);
+  }
+  replayed_functions_ = committed.size();
+  id_to_file_and_address_.getSegment()->flush();
+  if (!log.Clear()) {
+    throw std::runtime_error("Clearing the write-ahead log failed!");
+  }
+}
+
+void SimHashSearchIndex::EnableWriteAheadLog(bool sync) {
+  if (read_only_) {
+    throw std::runtime_error("Search index was opened read-only!");
+  }
+  // The log has been emptied when the index was opened.
+  std::unique_ptr<WriteAheadLog> log(new WriteAheadLog(log_file_, sync));
+  if (!log->IsOpen()) {
+    throw std::runtime_error("Opening the write-ahead log failed!");
+  }
+  write_ahead_log_ = std::move(log);
+}
+
+void SimHashSearchIndex::Checkpoint() {
+  id_to_file_and_address_.getSegment()->flush();
+  if (write_ahead_log_ && !write_ahead_log_->Clear()) {
+    throw std::runtime_error("Clearing the write-ahead log failed!");
+  }
 }
 
 uint64_t SimHashSearchIndex::GetIndexFileSize() {
@@ -210,6 +450,22 @@ uint64_t SimHashSearchIndex::GetNumberOfIndexedFunctions() const {
   return id_to_file_and_address_.getMap()->size();
 }
 
+// The zeroth permutation is the identity, so the entries of the first bucket
+// hold the original SimHashes of every function in the index.
+uint64_t SimHashSearchIndex::GetIndexedHashes(
+  std::vector<std::pair<HashValueA, HashValueB>>* hashes) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t count = 0;
+  for (const IndexEntry& entry : *search_index_.getSet()) {
+    if (std::get<0>(entry) != 0) {
+      break;
+    }
+    hashes->push_back(std::make_pair(std::get<1>(entry), std::get<2>(entry)));
+    ++count;
+  }
+  return count;
+}
+
 void SimHashSearchIndex::DumpIndexToStdout(bool all = false) const {
   std::lock_guard<std::mutex> lock(mutex_);
   const auto map = id_to_file_and_address_.getMap();
@@ -17,12 +17,46 @@
 #define SIMHASHSEARCHINDEX_HPP
 
 #include <cstdint>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
+#include "searchbackend/hasherversion.hpp"
+#include "searchbackend/writeaheadlog.hpp"
 #include "util/persistentmap.hpp"
 
 // Pretend uint128_t was a standard type already.
 typedef __uint128_t uint128_t;
 
+// Every index file carries a small fixed-size header describing how the index
+// was built, so that opening an index does not need to inspect its contents and
+// so that different on-disk layouts can be told apart. The header lives in the
+// mapped file as a named object next to the map and the set.
+struct SimHashSearchIndexHeader {
+  // The only layout so far: a map from function ID to file and address, plus
+  // a sorted set of (permutation, hash, function ID) tuples.
+  static constexpr uint32_t kTreeSetLayout = 1;
+  static constexpr uint64_t kMagic = 0x5845444E49535346ULL; // "FSSINDEX"
+  static constexpr uint32_t kCurrentVersion = 1;
+  // Identifies the fixed permutation network in util/bitpermutation.cpp.
+  static constexpr uint64_t kDefaultPermutationSeed = 0;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t layout;
+  uint32_t hash_bits;
+  uint32_t buckets;
+  uint32_t prefix_bits;
+  // The HasherVersion of all SimHashes in the index. Indices written before
+  // this field existed have zero here, which is kLegacy.
+  uint32_t hasher_version;
+  uint64_t permutation_seed;
+  // Creation parameters, purely informational.
+  uint64_t creation_time;
+  uint64_t initial_file_size;
+  uint64_t reserved[8];
+};
+
 // A simple memory-mapping backed index for querying a 128-bit SimHash.
 // Permutations of the full 128-bit value are used for turning the SimHash
 // into a family of hashes.
@@ -102,8 +136,26 @@ public:
   typedef uint64_t Address;
   typedef std::pair<FileID, Address> FileAndAddress;
 
+  // How an existing index is opened. A read-only index cannot be added to.
+  enum class Access { kReadWrite, kReadOnly };
+
+  // The number of buckets, the width of the bucket prefix and the hasher
+  // version are only used when creating a new index; an existing index is
+  // opened with the values stored in its header.
+  //
+  // Opening an existing index for writing first replays the batches that a
+  // process which died before checkpointing left in the write-ahead log next
+  // to the index ([indexname].wal), whether or not the log is enabled later.
+  // Otherwise new functions would be handed the IDs of logged functions.
   SimHashSearchIndex(const std::string& indexname,
-    bool create, uint8_t buckets = 50);
+    bool create, uint8_t buckets = 50, uint8_t prefix_bits = 8,
+    HasherVersion hasher_version = HasherVersion::kLegacy);
+  // Opens an existing index. A read-only open cannot replay the write-ahead
+  // log, so it fails while the log is not empty, as the index may hold
+  // partially added functions until a writer has opened it.
+  SimHashSearchIndex(const std::string& indexname, Access access);
+  // Checkpoints if a write-ahead log is enabled.
+  ~SimHashSearchIndex();
 
   uint64_t QueryTopN(uint64_t hash_A, uint64_t hash_B, uint32_t how_many,
     std::vector<std::pair<float, FileAndAddress>>* results);
@@ -111,23 +163,75 @@ public:
   uint64_t AddFunction(uint64_t hash_A, uint64_t hash_B, FileID file_id,
     Address address);
 
+  struct FunctionToAdd {
+    uint64_t hash_A;
+    uint64_t hash_B;
+    FileID file_id;
+    Address address;
+  };
+  // Adds a batch of functions. With a write-ahead log enabled, the batch is
+  // logged (one write, no per-function fsync) before the index is touched.
+  // If the index runs out of space, none of the functions of the batch are
+  // added and boost::interprocess::bad_alloc is thrown.
+  void AddFunctions(const std::vector<FunctionToAdd>& functions);
+
+  // Logs all further additions to the write-ahead log of the index.
+  void EnableWriteAheadLog(bool sync = false);
+  // The number of logged functions that were replayed when opening the index.
+  // Torn batches at the end of the log were never applied and are discarded.
+  uint64_t GetNumberOfReplayedFunctions() const { return replayed_functions_; }
+  // Flushes the index to disk and empties the write-ahead log. Happens
+  // automatically whenever the log grows beyond kCheckpointLogSize.
+  void Checkpoint();
+  static const uint64_t kCheckpointLogSize = 16ULL << 20;
+
   uint64_t GetIndexFileSize();
   uint64_t GetIndexFileFreeSpace();
   uint64_t GetIndexSetSize() const;
   uint64_t GetNumberOfIndexedFunctions() const;
   uint8_t GetNumberOfBuckets() const;
+  uint8_t GetPrefixBits() const;
+  // Functions added to the index have to be hashed with this version.
+  HasherVersion GetHasherVersion() const;
+  const SimHashSearchIndexHeader& GetHeader() const { return header_; }
   double GetOddsOfRandomHit(uint32_t count) const;
+  // Retrieves the (unpermuted) SimHashes of all indexed functions.
+  uint64_t GetIndexedHashes(
+    std::vector<std::pair<HashValueA, HashValueB>>* hashes) const;
 
   void DumpIndexToStdout(bool all) const;
 private:
+  SimHashSearchIndex(const std::string& indexname, bool create,
+    uint8_t buckets, uint8_t prefix_bits, HasherVersion hasher_version,
+    Access access);
+  // Fills header_ when opening an index: Either from the header stored in the
+  // file, or - for index files written before headers existed - by inferring
+  // the values from the contents, in which case a header is added to the file.
+  void LoadHeader(uint8_t buckets);
+  // Replays and empties the write-ahead log of an index opened for writing,
+  // or checks that it is empty for an index opened read-only.
+  void RecoverWriteAheadLog();
+  void InsertFunction(FunctionID function_id, uint64_t hash_A, uint64_t hash_B,
+    FileID file_id, Address address);
+  void RemoveFunction(FunctionID function_id, uint64_t hash_A,
+    uint64_t hash_B);
 
   // TODO(thomasdullien): As soon as the codebase is ported to C++14,
   // replace the following mutex with a shared_mutex to allow concurrent
   // reading from the index.
   mutable std::mutex mutex_;
+  // Serializes batches, so that function IDs are assigned and logged in the
+  // order in which the batches are applied.
+  std::mutex batch_mutex_;
+  std::string log_file_;
+  bool read_only_;
+  uint64_t replayed_functions_;
+  std::unique_ptr<WriteAheadLog> write_ahead_log_;
   PersistentMap<FunctionID, FileAndAddress> id_to_file_and_address_;
   PersistentSet<IndexEntry> search_index_;
+  SimHashSearchIndexHeader header_;
   uint8_t buckets_;
+  uint64_t prefix_mask_;
 };
 
 #endif // SIMHASHSEARCHINDEX_HPP
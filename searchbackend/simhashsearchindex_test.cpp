@@ -44,6 +44,240 @@ TEST(simhashsearchindex, persistence) {
   EXPECT_EQ(unlink("./testindex.index"), 0);
 }
 
+TEST(simhashsearchindex, header) {
+  {
+    SimHashSearchIndex index("./testindex.index", true, 28, 10);
+    EXPECT_EQ(index.GetNumberOfBuckets(), 28);
+    EXPECT_EQ(index.GetPrefixBits(), 10);
+  }
+  // Opening an existing, empty index takes the parameters from the header
+  // and ignores the ones passed in.
+  {
+    SimHashSearchIndex index("./testindex.index", false);
+    EXPECT_EQ(index.GetNumberOfBuckets(), 28);
+    EXPECT_EQ(index.GetPrefixBits(), 10);
+    EXPECT_EQ(index.GetHeader().version,
+      SimHashSearchIndexHeader::kCurrentVersion);
+    EXPECT_EQ(index.GetHeader().layout,
+      SimHashSearchIndexHeader::kTreeSetLayout);
+    EXPECT_EQ(index.GetHeader().hash_bits, 128);
+    EXPECT_EQ(index.GetHasherVersion(), HasherVersion::kLegacy);
+    index.AddFunction(0xDEADBEEF0BADBABE, 0x0BADFEEDBA551055, 0x1,
+      0x400000);
+    EXPECT_EQ(index.GetIndexSetSize(), 28);
+  }
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+}
+
+TEST(simhashsearchindex, invalid_header) {
+  {
+    SimHashSearchIndex index("./testindex.index", true, 28);
+  }
+  // A stored header with parameters that would be refused at creation time is
+  // refused on open, too.
+  std::vector<std::pair<uint32_t, uint32_t>> invalid = {
+    { 0, 8 }, { 256, 8 }, { 28, 0 }, { 28, 65 } };
+  for (const auto& buckets_and_prefix_bits : invalid) {
+    {
+      PersistentMap<SimHashSearchIndex::FunctionID,
+        SimHashSearchIndex::FileAndAddress> map("./testindex.index", false);
+      SimHashSearchIndexHeader* header = map.getSegment()->find<
+        SimHashSearchIndexHeader>("header").first;
+      ASSERT_TRUE(header != nullptr);
+      header->buckets = buckets_and_prefix_bits.first;
+      header->prefix_bits = buckets_and_prefix_bits.second;
+    }
+    EXPECT_THROW(SimHashSearchIndex("./testindex.index", false),
+      std::runtime_error);
+  }
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+}
+
+TEST(simhashsearchindex, hasher_version) {
+  {
+    SimHashSearchIndex index("./testindex.index", true, 28, 8,
+      HasherVersion::kPortable);
+    EXPECT_EQ(index.GetHasherVersion(), HasherVersion::kPortable);
+  }
+  {
+    SimHashSearchIndex index("./testindex.index", false);
+    EXPECT_EQ(index.GetHasherVersion(), HasherVersion::kPortable);
+  }
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+}
+
+TEST(simhashsearchindex, legacy_index_without_header) {
+  {
+    // Write an index file the way it was written before headers existed.
+    PersistentMap<SimHashSearchIndex::FunctionID,
+      SimHashSearchIndex::FileAndAddress> map("./testindex.index", true);
+    PersistentSet<SimHashSearchIndex::IndexEntry> set("index",
+      map.getSegment(), true);
+    (*map.getMap())[1] = std::make_pair(1, 0x400000);
+    for (uint8_t bucket = 0; bucket < 18; ++bucket) {
+      set.getSet()->insert(std::make_tuple(bucket, 0x1234ULL, 0x5678ULL, 1));
+    }
+  }
+  {
+    SimHashSearchIndex index("./testindex.index", false);
+    EXPECT_EQ(index.GetNumberOfBuckets(), 18);
+    EXPECT_EQ(index.GetPrefixBits(), 8);
+    EXPECT_EQ(index.GetHasherVersion(), HasherVersion::kLegacy);
+  }
+  // The inferred header has been written to the file.
+  {
+    PersistentMap<SimHashSearchIndex::FunctionID,
+      SimHashSearchIndex::FileAndAddress> map("./testindex.index", false);
+    EXPECT_TRUE(map.getSegment()->find<SimHashSearchIndexHeader>(
+      "header").first != nullptr);
+  }
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+}
+
+TEST(simhashsearchindex, addfunctions_with_write_ahead_log) {
+  {
+    SimHashSearchIndex index("./testindex.index", true, 28);
+    index.EnableWriteAheadLog();
+    index.AddFunctions({
+      { 0xDEADBEEF0BADBABE, 0x0BADFEEDBA551055, 0x1, 0x400000 },
+      { 0xBA5EBA11BEDABB1E, 0xBE5077EDB0A710AD, 0x1, 0x401000 } });
+    index.AddFunction(0xCA11AB1ECA55E77E, 0xDEADBEA700DEFEC8, 0x2, 0x400000);
+    EXPECT_EQ(index.GetNumberOfIndexedFunctions(), 3);
+    EXPECT_EQ(index.GetIndexSetSize(), 3 * 28);
+  }
+  // A clean shutdown checkpoints, so nothing is left to replay.
+  SimHashSearchIndex index("./testindex.index", false);
+  EXPECT_EQ(index.GetNumberOfReplayedFunctions(), 0);
+  EXPECT_EQ(index.GetNumberOfIndexedFunctions(), 3);
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+  EXPECT_EQ(unlink("./testindex.index.wal"), 0);
+}
+
+namespace {
+
+// Simulates a process that logged a batch of functions 2 and 3 and died while
+// applying it: function 2 made it into the index, function 3 did not.
+void WriteInterruptedBatch() {
+  {
+    SimHashSearchIndex index("./testindex.index", true, 28);
+    index.AddFunction(0xDEADBEEF0BADBABE, 0x0BADFEEDBA551055, 0x1, 0x400000);
+    index.AddFunction(0xBA5EBA11BEDABB1E, 0xBE5077EDB0A710AD, 0x1, 0x401000);
+  }
+  WriteAheadLog log("./testindex.index.wal");
+  ASSERT_TRUE(log.LogBatch({
+    { 2, 0xBA5EBA11BEDABB1E, 0xBE5077EDB0A710AD, 0x1, 0x401000 },
+    { 3, 0xCA11AB1ECA55E77E, 0xDEADBEA700DEFEC8, 0x2, 0x400000 } }));
+}
+
+} // namespace
+
+TEST(simhashsearchindex, write_ahead_log_replay) {
+  WriteInterruptedBatch();
+  {
+    // Replaying happens on open, also without enabling the log.
+    SimHashSearchIndex index("./testindex.index", false);
+    EXPECT_EQ(index.GetNumberOfReplayedFunctions(), 2);
+    EXPECT_EQ(index.GetNumberOfIndexedFunctions(), 3);
+    EXPECT_EQ(index.GetIndexSetSize(), 3 * 28);
+
+    // A function added afterwards does not reuse the ID of a logged one.
+    index.AddFunction(0x0123456789ABCDEF, 0xFEDCBA9876543210, 0x3, 0x400000);
+    EXPECT_EQ(index.GetNumberOfIndexedFunctions(), 4);
+
+    std::vector<std::pair<float, SimHashSearchIndex::FileAndAddress>> results;
+    index.QueryTopN(0xCA11AB1ECA55E77E, 0xDEADBEA700DEFEC8, 1, &results);
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results[0].first, 128.0);
+    EXPECT_EQ(results[0].second, std::make_pair(0x2UL, 0x400000UL));
+  }
+  // Replaying made the log redundant, it has been cleared.
+  WriteAheadLog log("./testindex.index.wal");
+  EXPECT_EQ(log.GetSize(), 0);
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+  EXPECT_EQ(unlink("./testindex.index.wal"), 0);
+}
+
+TEST(simhashsearchindex, read_only_with_write_ahead_log) {
+  WriteInterruptedBatch();
+  // A read-only open cannot replay the log, so it refuses the index.
+  EXPECT_THROW(SimHashSearchIndex("./testindex.index",
+    SimHashSearchIndex::Access::kReadOnly), std::runtime_error);
+  {
+    SimHashSearchIndex index("./testindex.index", false);
+    EXPECT_EQ(index.GetNumberOfReplayedFunctions(), 2);
+  }
+  SimHashSearchIndex index("./testindex.index",
+    SimHashSearchIndex::Access::kReadOnly);
+  EXPECT_EQ(index.GetNumberOfIndexedFunctions(), 3);
+  EXPECT_THROW(index.AddFunction(0x0123456789ABCDEF, 0xFEDCBA9876543210, 0x3,
+    0x400000), std::runtime_error);
+  EXPECT_THROW(index.EnableWriteAheadLog(), std::runtime_error);
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+  EXPECT_EQ(unlink("./testindex.index.wal"), 0);
+}
+
+TEST(simhashsearchindex, addfunctions_until_full) {
+  // An index file that was created small (the default is 1GB): Opening an
+  // existing file keeps its size.
+  {
+    managed_mapped_file file(create_only, "./testindex.index", 64 << 10);
+  }
+  uint64_t added = 0;
+  {
+    SimHashSearchIndex index("./testindex.index", true, 28);
+    index.EnableWriteAheadLog();
+    bool full = false;
+    for (uint64_t batch = 0; (batch < 1000) && !full; ++batch) {
+      std::vector<SimHashSearchIndex::FunctionToAdd> functions;
+      for (uint64_t function = 0; function < 4; ++function) {
+        uint64_t id = batch * 4 + function;
+        functions.push_back({ id * 0x9E3779B97F4A7C15ULL, ~id, 0x1, id });
+      }
+      try {
+        index.AddFunctions(functions);
+        added += functions.size();
+      } catch (boost::interprocess::bad_alloc& out_of_space) {
+        full = true;
+      }
+      // Either the whole batch made it into the index or none of it.
+      EXPECT_EQ(index.GetNumberOfIndexedFunctions(), added);
+      EXPECT_EQ(index.GetIndexSetSize(), added * 28);
+    }
+    ASSERT_TRUE(full);
+    ASSERT_GT(added, 0);
+  }
+  // The failed batch is not in the log either, so nothing is replayed and the
+  // index can be used as before.
+  SimHashSearchIndex index("./testindex.index", false);
+  EXPECT_EQ(index.GetNumberOfReplayedFunctions(), 0);
+  EXPECT_EQ(index.GetNumberOfIndexedFunctions(), added);
+  EXPECT_EQ(index.GetIndexSetSize(), added * 28);
+  uint64_t last = added - 1;
+  std::vector<std::pair<float, SimHashSearchIndex::FileAndAddress>> results;
+  index.QueryTopN(last * 0x9E3779B97F4A7C15ULL, ~last, 1, &results);
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].first, 128.0);
+  EXPECT_EQ(results[0].second, std::make_pair(0x1UL, last));
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+  EXPECT_EQ(unlink("./testindex.index.wal"), 0);
+}
+
+TEST(simhashsearchindex, getindexedhashes) {
+  SimHashSearchIndex index("./testindex.index", true, 28);
+  index.AddFunction(0xDEADBEEF0BADBABE, 0x0BADFEEDBA551055, 0x1,
+    0x400000);
+  index.AddFunction(0x0BADFEEDBA551055, 0xDEADBEEF0BADBABE, 0x1,
+    0x400100);
+  std::vector<std::pair<uint64_t, uint64_t>> hashes;
+  EXPECT_EQ(index.GetIndexedHashes(&hashes), 2);
+  ASSERT_EQ(hashes.size(), 2);
+  EXPECT_EQ(hashes[0].first, 0x0BADFEEDBA551055);
+  EXPECT_EQ(hashes[0].second, 0xDEADBEEF0BADBABE);
+  EXPECT_EQ(hashes[1].first, 0xDEADBEEF0BADBABE);
+  EXPECT_EQ(hashes[1].second, 0x0BADFEEDBA551055);
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+}
+
 TEST(simhashsearchindex, querytopn_precise) {
   SimHashSearchIndex index("./testindex.index", true, 28);
   std::array<uint64_t, 12> constantarray = {
@@ -79,6 +313,35 @@ TEST(simhashsearchindex, querytopn_precise) {
 
 }
 
+TEST(simhashsearchindex, querytopn_wide_prefix) {
+  SimHashSearchIndex index("./testindex.index", true, 50, 4);
+  std::array<uint64_t, 12> constantarray = {
+    0xba5eba11bedabb1eUL,
+    0xbe5077edb0a710adUL,
+    0xb01dfacecab005e0UL,
+    0xca11ab1eca55e77eUL,
+    0xdeadbea700defec8UL,
+    0xf01dab1ef005ba11UL,
+    0x0ddba115ca1ab1e0UL,
+    0x7e1eca57deadbeefUL,
+    0xca5cadab1ef00d50UL,
+    0x0b501e7edecea5edUL,
+    0x7e55e118df00d500UL,
+    0x0e1ec7edba11a575UL };
+
+  for (uint32_t i = 0; i < constantarray.size()-1; ++i) {
+    index.AddFunction(constantarray[i], constantarray[i+1],
+      static_cast<uint64_t>(i), static_cast<uint64_t>(i));
+  }
+  for (uint32_t i = 0; i < constantarray.size()-1; ++i) {
+    std::vector<std::pair<float, SimHashSearchIndex::FileAndAddress>> results;
+    index.QueryTopN(constantarray[i] ^ 0x0101010101010101UL,
+      constantarray[i+1], 5, &results);
+    EXPECT_EQ(results[0].second.first, i);
+  }
+  EXPECT_EQ(unlink("./testindex.index"), 0);
+}
+
 TEST(simhashsearchindex, querytopn) {
   SimHashSearchIndex index("./testindex.index", true, 28);
   std::array<uint64_t, 12> constantarray = {
@@ -0,0 +1,147 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "searchbackend/writeaheadlog.hpp"
+
+namespace {
+
+struct BatchHeader {
+  uint32_t magic;
+  uint32_t count;
+};
+
+struct BatchTrailer {
+  uint64_t checksum;
+  uint32_t magic;
+  uint32_t padding;
+};
+
+bool ReadAt(int fd, uint64_t offset, void* data, size_t size) {
+  return pread(fd, data, size, offset) == static_cast<ssize_t>(size);
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& filename, bool sync) :
+  filename_(filename), sync_(sync), size_(0) {
+  fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ >= 0) {
+    struct stat info;
+    if (fstat(fd_, &info) == 0) {
+      size_ = info.st_size;
+    }
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+// FNV-1a over the record count and the raw records.
+uint64_t WriteAheadLog::Checksum(const LoggedFunction* records,
+  uint32_t count) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&hash](const uint8_t* data, size_t size) {
+    for (size_t index = 0; index < size; ++index) {
+      hash = (hash ^ data[index]) * 0x100000001b3ULL;
+    }
+  };
+  mix(reinterpret_cast<const uint8_t*>(&count), sizeof(count));
+  mix(reinterpret_cast<const uint8_t*>(records), count * sizeof(*records));
+  return hash;
+}
+
+bool WriteAheadLog::Recover(std::vector<LoggedFunction>* committed) {
+  if (fd_ < 0) {
+    return false;
+  }
+  uint64_t offset = 0;
+  std::vector<LoggedFunction> batch;
+  while (offset < size_) {
+    BatchHeader header;
+    if (!ReadAt(fd_, offset, &header, sizeof(header)) ||
+      (header.magic != kBatchMagic)) {
+      break;
+    }
+    uint64_t records_size = header.count * sizeof(LoggedFunction);
+    if (offset + sizeof(header) + records_size + sizeof(BatchTrailer) >
+      size_) {
+      break;
+    }
+    batch.resize(header.count);
+    BatchTrailer trailer;
+    if (!ReadAt(fd_, offset + sizeof(header), batch.data(), records_size) ||
+      !ReadAt(fd_, offset + sizeof(header) + records_size, &trailer,
+        sizeof(trailer)) ||
+      (trailer.magic != kEndMagic) ||
+      (trailer.checksum != Checksum(batch.data(), header.count))) {
+      break;
+    }
+    committed->insert(committed->end(), batch.begin(), batch.end());
+    offset += sizeof(header) + records_size + sizeof(trailer);
+  }
+  if (offset != size_) {
+    // Drop the torn batch so that new batches are appended after intact data.
+    if (ftruncate(fd_, offset) != 0) {
+      return false;
+    }
+    size_ = offset;
+  }
+  return true;
+}
+
+bool WriteAheadLog::LogBatch(const std::vector<LoggedFunction>& batch) {
+  if (fd_ < 0) {
+    return false;
+  }
+  BatchHeader header = { kBatchMagic, static_cast<uint32_t>(batch.size()) };
+  BatchTrailer trailer = { Checksum(batch.data(), header.count), kEndMagic, 0 };
+  size_t records_size = batch.size() * sizeof(LoggedFunction);
+  std::vector<uint8_t> buffer(sizeof(header) + records_size + sizeof(trailer));
+  memcpy(&buffer[0], &header, sizeof(header));
+  if (records_size > 0) {
+    memcpy(&buffer[sizeof(header)], batch.data(), records_size);
+  }
+  memcpy(&buffer[sizeof(header) + records_size], &trailer, sizeof(trailer));
+
+  size_t written = 0;
+  while (written < buffer.size()) {
+    ssize_t result = pwrite(fd_, &buffer[written], buffer.size() - written,
+      size_ + written);
+    if (result <= 0) {
+      return false;
+    }
+    written += result;
+  }
+  if (sync_ && (fdatasync(fd_) != 0)) {
+    return false;
+  }
+  size_ += buffer.size();
+  return true;
+}
+
+bool WriteAheadLog::Clear() {
+  if ((fd_ < 0) || (ftruncate(fd_, 0) != 0)) {
+    return false;
+  }
+  size_ = 0;
+  return !sync_ || (fdatasync(fd_) == 0);
+}
@@ -0,0 +1,77 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WRITEAHEADLOG_HPP
+#define WRITEAHEADLOG_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A function as it is recorded in the log. The function ID is assigned before
+// logging, so replaying a record is idempotent: It always produces the same
+// map entry and the same set entries in the index.
+struct LoggedFunction {
+  uint64_t function_id;
+  uint64_t hash_A;
+  uint64_t hash_B;
+  uint64_t file_id;
+  uint64_t address;
+};
+
+// An append-only log of batches of functions that are about to be added to a
+// SimHashSearchIndex. A batch is written in a single write() and ends with a
+// checksum, so after a crash it is either complete or detectably torn.
+//
+// File layout (native byte order; the log never leaves the machine):
+//   per batch: uint32 batch magic, uint32 number of records,
+//              records (LoggedFunction), uint64 checksum, uint32 end magic,
+//              uint32 padding
+//
+// The log only protects against the ingesting process dying. It does not make
+// the mapped index itself survive a power loss, as the kernel may write back
+// pages of the index in any order.
+class WriteAheadLog {
+public:
+  // If sync is set, every batch is fsync()ed before LogBatch returns.
+  WriteAheadLog(const std::string& filename, bool sync = false);
+  ~WriteAheadLog();
+
+  bool IsOpen() const { return fd_ >= 0; }
+
+  // Reads all complete batches. Everything after the first torn or damaged
+  // batch is cut off the end of the log.
+  bool Recover(std::vector<LoggedFunction>* committed);
+
+  // Appends a batch; once this returns true, the batch is considered
+  // committed and will be replayed if the index is not checkpointed.
+  bool LogBatch(const std::vector<LoggedFunction>& batch);
+
+  // Empties the log. Called after the index has been flushed to disk.
+  bool Clear();
+
+  uint64_t GetSize() const { return size_; }
+private:
+  static const uint32_t kBatchMagic = 0x48435442;  // "BTCH"
+  static const uint32_t kEndMagic = 0x444E4542;  // "BEND"
+
+  static uint64_t Checksum(const LoggedFunction* records, uint32_t count);
+
+  std::string filename_;
+  bool sync_;
+  int fd_;
+  uint64_t size_;
+};
+
+#endif // WRITEAHEADLOG_HPP
@@ -0,0 +1,99 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "searchbackend/writeaheadlog.hpp"
+
+static std::vector<LoggedFunction> MakeBatch(uint64_t first_id,
+  uint32_t count) {
+  std::vector<LoggedFunction> batch;
+  for (uint64_t id = first_id; id < first_id + count; ++id) {
+    batch.push_back(LoggedFunction{ id, 0xDEADBEEF0BADBABE ^ id,
+      0x0BADFEEDBA551055 + id, 0x1, 0x400000 + id });
+  }
+  return batch;
+}
+
+TEST(writeaheadlog, log_and_recover) {
+  {
+    WriteAheadLog log("./test.wal");
+    ASSERT_TRUE(log.IsOpen());
+    EXPECT_TRUE(log.LogBatch(MakeBatch(1, 3)));
+    EXPECT_TRUE(log.LogBatch(MakeBatch(4, 2)));
+  }
+  WriteAheadLog log("./test.wal");
+  std::vector<LoggedFunction> committed;
+  ASSERT_TRUE(log.Recover(&committed));
+  ASSERT_EQ(committed.size(), 5);
+  for (uint32_t index = 0; index < committed.size(); ++index) {
+    EXPECT_EQ(committed[index].function_id, index + 1);
+    EXPECT_EQ(committed[index].address, 0x400000 + index + 1);
+  }
+  EXPECT_TRUE(log.Clear());
+  EXPECT_EQ(log.GetSize(), 0);
+  committed.clear();
+  ASSERT_TRUE(log.Recover(&committed));
+  EXPECT_TRUE(committed.empty());
+  EXPECT_EQ(unlink("./test.wal"), 0);
+}
+
+TEST(writeaheadlog, torn_batch_is_dropped) {
+  uint64_t intact_size;
+  {
+    WriteAheadLog log("./test.wal");
+    EXPECT_TRUE(log.LogBatch(MakeBatch(1, 3)));
+    intact_size = log.GetSize();
+    EXPECT_TRUE(log.LogBatch(MakeBatch(4, 3)));
+  }
+  // Simulate a crash in the middle of writing the second batch.
+  ASSERT_EQ(truncate("./test.wal", intact_size + 50), 0);
+  {
+    WriteAheadLog log("./test.wal");
+    std::vector<LoggedFunction> committed;
+    ASSERT_TRUE(log.Recover(&committed));
+    EXPECT_EQ(committed.size(), 3);
+    EXPECT_EQ(log.GetSize(), intact_size);
+    // New batches go after the intact data.
+    EXPECT_TRUE(log.LogBatch(MakeBatch(4, 1)));
+  }
+  WriteAheadLog log("./test.wal");
+  std::vector<LoggedFunction> committed;
+  ASSERT_TRUE(log.Recover(&committed));
+  EXPECT_EQ(committed.size(), 4);
+  EXPECT_EQ(unlink("./test.wal"), 0);
+}
+
+TEST(writeaheadlog, corrupted_batch_is_dropped) {
+  {
+    WriteAheadLog log("./test.wal");
+    EXPECT_TRUE(log.LogBatch(MakeBatch(1, 2)));
+    EXPECT_TRUE(log.LogBatch(MakeBatch(3, 2)));
+  }
+  // Flip a byte inside the first record of the first batch; the checksum no
+  // longer matches, so nothing after it can be trusted either.
+  FILE* file = fopen("./test.wal", "r+b");
+  ASSERT_NE(file, nullptr);
+  fseek(file, 12, SEEK_SET);
+  fputc(0x42, file);
+  fclose(file);
+
+  WriteAheadLog log("./test.wal");
+  std::vector<LoggedFunction> committed;
+  ASSERT_TRUE(log.Recover(&committed));
+  EXPECT_TRUE(committed.empty());
+  EXPECT_EQ(log.GetSize(), 0);
+  EXPECT_EQ(unlink("./test.wal"), 0);
+}
@@ -2,17 +2,29 @@ from distutils.core import setup, Extension
 
 module = Extension(
   'functionsimsearch',
-  sources = [ 'disassembly/extractimmediate.cpp',
+  sources = [ 'disassembly/breadthfirstsearch.cpp',
+    'disassembly/compactflowgraph.cpp',
+    'disassembly/extractimmediate.cpp',
     'disassembly/flowgraphwithinstructions.cpp',
     'disassembly/flowgraphwithinstructionsfeaturegenerator.cpp',
     'disassembly/flowgraph.cpp',
     'disassembly/flowgraphutil.cpp',
+    'disassembly/functionfeaturegenerator.cpp',
+    'disassembly/graphletenumerator.cpp',
+    'disassembly/graphletsignature.cpp',
+    'disassembly/mnemonictable.cpp',
     'searchbackend/functionsimhash.cpp',
+    'searchbackend/featureweights.cpp',
+    'searchbackend/featurecounter.cpp',
+    'searchbackend/graphlethashcache.cpp',
     'searchbackend/functionsimhashfeaturedump.cpp',
+    'searchbackend/simhashaccumulator.cpp',
     'searchbackend/simhashsearchindex.cpp',
+    'searchbackend/writeaheadlog.cpp',
     'util/bitpermutation.cpp',
     'util/buffertokeniterator.cpp',
     'util/mappedtextfile.cpp',
+    'util/portablehash.cpp',
     'util/threadtimer.cpp',
     'util/util.cpp',
     'pybindings/pybindings.cpp'],
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -32,6 +33,11 @@ DEFINE_string(index, "./similarity.index", "Index file");
 DEFINE_string(weights, "weights.txt", "Feature weights file");
 DEFINE_uint64(minimum_function_size, 5, "Minimum size of a function to be added.");
 DEFINE_bool(no_shared_blocks, false, "Skip functions with shared blocks.");
+DEFINE_bool(write_ahead_log, true, "Log batches to [index].wal before adding "
+  "them, so that an interrupted run cannot leave the index inconsistent.");
+DEFINE_uint64(batch_size, 256, "Number of functions added to the index at once");
+DEFINE_uint64(graphlet_cache_size, 0, "Entries in the cache of graphlet feature "
+  "hashes shared by all threads (0: no cache)");
 
 DEFINE_double(default_graphlet_weight, FunctionSimHasher::kGraphletDefaultWeight,
   "Default weight for graphlets.");
@@ -50,6 +56,25 @@ using namespace gflags;
 
 using namespace std;
 
+// Returns false if the batch could not be added to the index.
+bool AddPendingFunctions(SimHashSearchIndex* search_index,
+  std::vector<SimHashSearchIndex::FunctionToAdd>* pending) {
+  bool added = true;
+  try {
+    search_index->AddFunctions(*pending);
+  } catch (boost::interprocess::bad_alloc& out_of_space) {
+    printf("[!] boost::interprocess::bad_alloc - no space in index file "
+      "left!\n");
+    added = false;
+  } catch (std::runtime_error& error) {
+    printf("[!] Adding %lu functions failed: %s\n", pending->size(),
+      error.what());
+    added = false;
+  }
+  pending->clear();
+  return added;
+}
+
 int main(int argc, char** argv) {
   SetUsageMessage(
     "Add the functions of the input executable which exceed a certain minimum "
@@ -70,21 +95,42 @@ int main(int argc, char** argv) {
 
   // Load the search index.
   SimHashSearchIndex search_index(index_file, false);
+  if (search_index.GetNumberOfReplayedFunctions()) {
+    printf("[!] Replayed %lu functions from an interrupted run.\n",
+      search_index.GetNumberOfReplayedFunctions());
+  }
+  if (FLAGS_write_ahead_log) {
+    search_index.EnableWriteAheadLog();
+  }
 
   Disassembly disassembly(mode, binary_path_string);
+  disassembly.SetDecodeImmediates(
+    UsesDecodedImmediates(search_index.GetHasherVersion()));
   if (!disassembly.Load()) {
     exit(1);
   }
 
   std::mutex search_index_mutex;
   std::mutex* mutex_pointer = &search_index_mutex;
+  // Hashed functions waiting to be added to the index as one batch.
+  std::vector<SimHashSearchIndex::FunctionToAdd> pending_functions;
+  std::vector<SimHashSearchIndex::FunctionToAdd>* pending = &pending_functions;
+  // Set once a batch failed; the tool then exits with an error.
+  bool batch_failed = false;
+  bool* failed = &batch_failed;
+  uint64_t batch_size = std::max<uint64_t>(1, FLAGS_batch_size);
   threadpool::ThreadPool pool(std::thread::hardware_concurrency());
   std::atomic_ulong atomic_processed_functions(0);
   std::atomic_ulong* processed_functions = &atomic_processed_functions;
   uint64_t number_of_functions = disassembly.GetNumberOfFunctions();
-  FunctionSimHasher hasher(FLAGS_weights, default_features, default_logging,
+  FunctionSimHasher hasher(search_index, FLAGS_weights,
     FLAGS_default_mnemonic_weight, FLAGS_default_graphlet_weight,
     FLAGS_default_immediate_weight);
+  std::unique_ptr<GraphletHashCache> graphlet_cache;
+  if (FLAGS_graphlet_cache_size > 0) {
+    graphlet_cache.reset(new GraphletHashCache(FLAGS_graphlet_cache_size));
+    hasher.SetGraphletHashCache(graphlet_cache.get());
+  }
 
   for (uint32_t index = 0; index < number_of_functions; ++index) {
     // Skip functions that contain shared basic blocks.
@@ -93,9 +139,9 @@ int main(int argc, char** argv) {
     }
 
     pool.Push(
-      [&search_index, &disassembly, mutex_pointer, &binary_path_string, &hasher,
-      processed_functions, file_id, index, minimum_size,
-      number_of_functions](int threadid) {
+      [&search_index, &disassembly, mutex_pointer, pending, failed, batch_size,
+      &binary_path_string, &hasher, processed_functions, file_id, index,
+      minimum_size, number_of_functions](int threadid) {
         std::unique_ptr<FlowgraphWithInstructions> graph =
           disassembly.GetFlowgraphWithInstructions(index);
         (*processed_functions)++;
@@ -120,23 +166,35 @@ int main(int argc, char** argv) {
           "nodes)\n", processed_functions->load(), number_of_functions,
           binary_path_string.c_str(), file_id, function_address, branching_nodes);
 
-        std::vector<uint64_t> hashes;
+        FunctionSimHasher::SimHash<128> hashes;
         std::unique_ptr<FunctionFeatureGenerator> generator =
           disassembly.GetFeatureGenerator(index);
 
-        hasher.CalculateFunctionSimHash(generator.get(), 128, &hashes);
+        hasher.CalculateFunctionSimHash<128>(generator.get(), &hashes);
         uint64_t hash_A = hashes[0];
         uint64_t hash_B = hashes[1];
         {
           std::lock_guard<std::mutex> lock(*mutex_pointer);
-          try {
-            search_index.AddFunction(hash_A, hash_B, file_id, function_address);
-          } catch (boost::interprocess::bad_alloc& out_of_space) {
-            printf("[!] boost::interprocess::bad_alloc - no space in index file "
-              "left!\n");
+          pending->push_back(SimHashSearchIndex::FunctionToAdd{ hash_A, hash_B,
+            file_id, function_address });
+          if ((pending->size() >= batch_size) &&
+            !AddPendingFunctions(&search_index, pending)) {
+            *failed = true;
           }
         }
       });
   }
   pool.Stop(true);
+  if (!AddPendingFunctions(&search_index, pending)) {
+    batch_failed = true;
+  }
+  if (graphlet_cache) {
+    printf("[!] Graphlet hash cache for %s: %s\n", binary_path_string.c_str(),
+      graphlet_cache->GetStatistics().ToString().c_str());
+  }
+  if (batch_failed) {
+    printf("[!] Not all functions of %s were added to the index.\n",
+      binary_path_string.c_str());
+    return -1;
+  }
 }
@@ -66,6 +66,8 @@ int main(int argc, char** argv) {
   SimHashSearchIndex search_index(index_file, false);
 
   Disassembly disassembly(mode, binary_path_string);
+  disassembly.SetDecodeImmediates(
+    UsesDecodedImmediates(search_index.GetHasherVersion()));
   if (!disassembly.Load()) {
     exit(1);
   }
@@ -77,7 +79,7 @@ int main(int argc, char** argv) {
     return -1;
   }
 
-  FunctionSimHasher hasher("weights.txt", default_features, default_logging,
+  FunctionSimHasher hasher(search_index, "weights.txt",
     FLAGS_default_mnemonic_weight, FLAGS_default_graphlet_weight,
     FLAGS_default_immediate_weight);
 
@@ -0,0 +1,210 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <gflags/gflags.h>
+
+#include "disassembly/compactflowgraph.hpp"
+#include "disassembly/disassembly.hpp"
+#include "disassembly/flowgraphwithinstructions.hpp"
+#include "disassembly/graphletenumerator.hpp"
+#include "util/util.hpp"
+
+DEFINE_string(format, "ELF", "Executable format: PE,ELF,JSON");
+DEFINE_string(inputs, "", "Comma-separated executables whose functions are "
+  "used");
+DEFINE_uint64(iterations, 1, "How often the graphlets of all functions are "
+  "extracted");
+DEFINE_uint64(max_size, 30, "Largest graphlet (in nodes) that is hashed");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+using namespace std;
+
+// The distances at which FlowgraphWithInstructionsFeatureGenerator extracts
+// graphlets around every node.
+static const uint32_t kDistances[] = { 1, 2, 3 };
+
+struct GraphletStats {
+  uint64_t graphlets = 0;
+  uint64_t checksum = 0;
+  double seconds = 0.0;
+};
+
+static void PrintStats(const char* name, const GraphletStats& stats) {
+  printf("[!] %s: %lu graphlets in %f s: %f graphlets/s (checksum "
+    "%16.16lx)\n", name, stats.graphlets, stats.seconds,
+    stats.graphlets / stats.seconds, stats.checksum);
+}
+
+// Extracts and hashes the graphlets the way the feature generator did so far:
+// Each one is a new Flowgraph.
+static GraphletStats BenchmarkFlowgraph(
+  const std::vector<std::unique_ptr<Flowgraph>>& graphs) {
+  GraphletStats stats;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t iteration = 0; iteration < FLAGS_iterations; ++iteration) {
+    for (const auto& graph : graphs) {
+      std::vector<address> nodes;
+      graph->GetNodes(&nodes);
+      for (uint32_t distance : kDistances) {
+        for (address node : nodes) {
+          std::unique_ptr<Flowgraph> subgraph(graph->GetSubgraph(node,
+            distance, FLAGS_max_size));
+          if (subgraph) {
+            stats.checksum += subgraph->CalculateHash(node);
+            ++stats.graphlets;
+          }
+        }
+      }
+    }
+  }
+  stats.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+// The same with a CompactFlowgraph built for each function (its construction
+// is included in the time) and a single reused subgraph.
+static GraphletStats BenchmarkCompactFlowgraph(
+  const std::vector<std::unique_ptr<Flowgraph>>& graphs) {
+  GraphletStats stats;
+  CompactFlowgraph subgraph;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t iteration = 0; iteration < FLAGS_iterations; ++iteration) {
+    for (const auto& graph : graphs) {
+      CompactFlowgraph compact(*graph);
+      for (uint32_t distance : kDistances) {
+        for (uint32_t node = 0; node < compact.GetSize(); ++node) {
+          if (compact.GetSubgraph(node, distance, FLAGS_max_size, &subgraph)) {
+            stats.checksum += subgraph.CalculateHash(
+              subgraph.GetNode(compact.GetAddress(node)));
+            ++stats.graphlets;
+          }
+        }
+      }
+    }
+  }
+  stats.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+// The same with one breadth-first search per node for all distances, and the
+// graphlets as views into the results.
+static GraphletStats BenchmarkGraphletEnumerator(
+  const std::vector<std::unique_ptr<Flowgraph>>& graphs) {
+  GraphletStats stats;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t iteration = 0; iteration < FLAGS_iterations; ++iteration) {
+    for (const auto& graph : graphs) {
+      GraphletEnumerator graphlets(CompactFlowgraph(*graph), 3,
+        FLAGS_max_size);
+      GraphletView graphlet;
+      while (graphlets.HasMore()) {
+        if (graphlets.GetNext(&graphlet)) {
+          stats.checksum += graphlet.CalculateHash();
+          ++stats.graphlets;
+        }
+      }
+    }
+  }
+  stats.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+// The same with the graphlets around each node hashed incrementally, each one
+// by extending the signature of the next smaller one.
+static GraphletStats BenchmarkIncrementalHashes(
+  const std::vector<std::unique_ptr<Flowgraph>>& graphs) {
+  GraphletStats stats;
+  std::vector<uint64_t> hashes;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t iteration = 0; iteration < FLAGS_iterations; ++iteration) {
+    for (const auto& graph : graphs) {
+      GraphletEnumerator graphlets(CompactFlowgraph(*graph), 3,
+        FLAGS_max_size);
+      graphlets.CalculateHashes(0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+        0x9ae16a3b2f90404fULL, &hashes);
+      for (uint64_t hash : hashes) {
+        stats.checksum += hash;
+      }
+      stats.graphlets += hashes.size();
+    }
+  }
+  stats.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Measure how fast the graphlets of all functions in the given executables "
+    "are extracted and hashed, with Flowgraph, with CompactFlowgraph and with "
+    "GraphletEnumerator, hashing each graphlet from scratch or incrementally.");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  std::vector<std::unique_ptr<Flowgraph>> graphs;
+  uint64_t nodes = 0;
+  for (const std::string& input : Tokenize(FLAGS_inputs.c_str(), ',')) {
+    Disassembly disassembly(FLAGS_format, input);
+    if (!disassembly.Load()) {
+      printf("[!] Failed to load %s\n", input.c_str());
+      return -1;
+    }
+    for (uint32_t index = 0; index < disassembly.GetNumberOfFunctions();
+      ++index) {
+      graphs.emplace_back(disassembly.GetFlowgraphWithInstructions(index));
+      nodes += graphs.back()->GetSize();
+    }
+  }
+  if (graphs.empty()) {
+    printf("[!] No functions found.\n");
+    return -1;
+  }
+  printf("[!] Loaded %lu functions with %lu basic blocks\n", graphs.size(),
+    nodes);
+
+  GraphletStats flowgraph_stats = BenchmarkFlowgraph(graphs);
+  PrintStats("Flowgraph", flowgraph_stats);
+  GraphletStats compact_stats = BenchmarkCompactFlowgraph(graphs);
+  PrintStats("CompactFlowgraph", compact_stats);
+  GraphletStats enumerator_stats = BenchmarkGraphletEnumerator(graphs);
+  PrintStats("GraphletEnumerator", enumerator_stats);
+  GraphletStats incremental_stats = BenchmarkIncrementalHashes(graphs);
+  PrintStats("Incremental", incremental_stats);
+  printf("[!] Speedup over Flowgraph: CompactFlowgraph %f, GraphletEnumerator "
+    "%f, Incremental %f\n", flowgraph_stats.seconds / compact_stats.seconds,
+    flowgraph_stats.seconds / enumerator_stats.seconds,
+    flowgraph_stats.seconds / incremental_stats.seconds);
+
+  for (const GraphletStats& stats : { compact_stats, enumerator_stats,
+    incremental_stats }) {
+    if ((flowgraph_stats.graphlets != stats.graphlets) ||
+      (flowgraph_stats.checksum != stats.checksum)) {
+      printf("[!] Error: The graphlets differ!\n");
+      return -1;
+    }
+  }
+  return 0;
+}
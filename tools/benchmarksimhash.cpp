@@ -0,0 +1,202 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <gflags/gflags.h>
+
+#include "disassembly/flowgraphwithinstructions.hpp"
+#include "disassembly/flowgraphwithinstructionsfeaturegenerator.hpp"
+#include "searchbackend/functionsimhash.hpp"
+#include "searchbackend/simhashaccumulator.hpp"
+#include "util/util.hpp"
+
+DEFINE_string(inputs, "testdata/vp9_set_target_rate.clang.nothumb.json,"
+  "testdata/vp9_set_target_rate.clang.with.thumb.json",
+  "Comma-separated flowgraphs in JSON format");
+DEFINE_string(weights, "", "Feature weights file");
+DEFINE_uint64(generate_weights, 0, "If nonzero, first write a weights file "
+  "with this many entries (including all features of the inputs) to "
+  "--weights");
+DEFINE_uint64(iterations, 2000, "How often each input is hashed");
+DEFINE_bool(disable_graphs, false, "Disable graphs as features");
+DEFINE_bool(disable_instructions, false, "Disable instructions as features");
+DEFINE_bool(disable_immediates, false, "Disable immediates as features");
+DEFINE_string(hasher_version, "legacy", "Feature hash family: legacy, "
+  "portable or decoded");
+DEFINE_uint64(graphlet_cache_size, 0, "Entries in the cache of graphlet feature "
+  "hashes (0: no cache)");
+DEFINE_uint64(accumulator_features, 10000000, "Number of random features "
+  "accumulated with each supported SimHash accumulator (0 to skip)");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+using namespace std;
+
+// Writes a weights file in the format produced by trainsimhashweights. It
+// contains every feature of the given graphs, so that each lookup during the
+// benchmark hits, padded with random features to the requested size.
+static bool GenerateWeightsFile(
+  const std::vector<std::unique_ptr<FlowgraphWithInstructions>>& graphs,
+  uint64_t entries, const std::string& filename,
+  HasherVersion hasher_version) {
+  FunctionSimHasher hasher("", default_features, default_logging,
+    FunctionSimHasher::kMnemonicDefaultWeight,
+    FunctionSimHasher::kGraphletDefaultWeight,
+    FunctionSimHasher::kImmediateDefaultWeight, hasher_version);
+  std::set<FeatureHash> features;
+  for (const auto& graph : graphs) {
+    FlowgraphWithInstructionsFeatureGenerator generator(*graph);
+    std::vector<uint64_t> hashes;
+    std::vector<FeatureHash> feature_hashes;
+    hasher.CalculateFunctionSimHash(&generator, 128, &hashes, &feature_hashes);
+    features.insert(feature_hashes.begin(), feature_hashes.end());
+  }
+  std::mt19937_64 random(1);
+  while (features.size() < entries) {
+    uint64_t hash_A = random();
+    features.insert(std::make_pair(hash_A, random()));
+  }
+  FILE* output = fopen(filename.c_str(), "wt");
+  if (output == nullptr) {
+    return false;
+  }
+  std::uniform_real_distribution<double> weight(0.0, 4.0);
+  if (hasher_version != HasherVersion::kLegacy) {
+    fprintf(output, "hasher_version %s\n", HasherVersionName(hasher_version));
+  }
+  for (const FeatureHash& feature : features) {
+    fprintf(output, "%16.16lx%16.16lx %f\n", feature.first, feature.second,
+      weight(random));
+  }
+  fclose(output);
+  return true;
+}
+
+// Measures the accumulation of weights into the 128 SimHash floats in
+// isolation, for every implementation the CPU supports.
+static void BenchmarkAccumulators(uint64_t feature_count) {
+  std::mt19937_64 random(1);
+  std::vector<uint64_t> hashes(2 * 4096);
+  for (uint64_t& hash : hashes) {
+    hash = random();
+  }
+  for (SimHashAccumulator accumulator : { SimHashAccumulator::kScalar,
+    SimHashAccumulator::kAVX2, SimHashAccumulator::kAVX512 }) {
+    if (!IsSimHashAccumulatorSupported(accumulator)) {
+      printf("[!] Accumulator %s is not supported on this CPU\n",
+        SimHashAccumulatorName(accumulator));
+      continue;
+    }
+    std::vector<float> floats(128);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t feature = 0; feature < feature_count; ++feature) {
+      const uint64_t* hash = &hashes[(2 * feature) % hashes.size()];
+      AccumulateSimHashWeight(accumulator, hash, 128, 0.5f, floats.data());
+    }
+    double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    printf("[!] Accumulator %s: %lu features in %f s: %f features/s "
+      "(checksum %16.16lx)\n", SimHashAccumulatorName(accumulator),
+      feature_count, seconds, feature_count / seconds,
+      FunctionSimHasher::FloatsToBits(floats));
+  }
+}
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Measure how long loading a weights file takes and how many functions per "
+    "second can be SimHashed with it.");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  HasherVersion hasher_version;
+  if (!ParseHasherVersion(FLAGS_hasher_version, &hasher_version)) {
+    printf("[!] Unknown hasher version %s\n", FLAGS_hasher_version.c_str());
+    return -1;
+  }
+
+  std::vector<std::unique_ptr<FlowgraphWithInstructions>> graphs;
+  for (const std::string& input : Tokenize(FLAGS_inputs.c_str(), ',')) {
+    graphs.emplace_back(new FlowgraphWithInstructions());
+    if (!FlowgraphWithInstructionsFromJSONFile(input, graphs.back().get())) {
+      printf("[!] Failed to load %s\n", input.c_str());
+      return -1;
+    }
+  }
+
+  if (FLAGS_generate_weights > 0) {
+    if (!GenerateWeightsFile(graphs, FLAGS_generate_weights, FLAGS_weights,
+      hasher_version)) {
+      printf("[!] Failed to write %s\n", FLAGS_weights.c_str());
+      return -1;
+    }
+    printf("[!] Wrote %lu weights to %s\n", FLAGS_generate_weights,
+      FLAGS_weights.c_str());
+  }
+
+  if (FLAGS_accumulator_features > 0) {
+    BenchmarkAccumulators(FLAGS_accumulator_features);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  FunctionSimHasher hasher(FLAGS_weights, DisabledFeatures(
+    FLAGS_disable_graphs, FLAGS_disable_instructions, FLAGS_disable_immediates),
+    default_logging, FunctionSimHasher::kMnemonicDefaultWeight,
+    FunctionSimHasher::kGraphletDefaultWeight,
+    FunctionSimHasher::kImmediateDefaultWeight, hasher_version);
+  double load_seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("[!] Loaded weights from '%s' in %f ms\n", FLAGS_weights.c_str(),
+    load_seconds * 1000.0);
+  std::unique_ptr<GraphletHashCache> graphlet_cache;
+  if (FLAGS_graphlet_cache_size > 0) {
+    graphlet_cache.reset(new GraphletHashCache(FLAGS_graphlet_cache_size));
+    hasher.SetGraphletHashCache(graphlet_cache.get());
+  }
+
+  uint64_t functions = 0;
+  uint64_t features = 0;
+  uint64_t checksum = 0;
+  FunctionSimHasher::SimHash<128> hashes;
+  std::vector<FeatureHash> feature_hashes;
+  start = std::chrono::steady_clock::now();
+  for (uint64_t iteration = 0; iteration < FLAGS_iterations; ++iteration) {
+    for (const auto& graph : graphs) {
+      FlowgraphWithInstructionsFeatureGenerator generator(*graph);
+      feature_hashes.clear();
+      hasher.CalculateFunctionSimHash<128>(&generator, &hashes,
+        &feature_hashes);
+      checksum += hashes[0] ^ hashes[1];
+      features += feature_hashes.size();
+      ++functions;
+    }
+  }
+  double hash_seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("[!] Hashed %lu functions (%lu features) in %f s: %f functions/s, "
+    "%f features/s (checksum %16.16lx)\n", functions, features, hash_seconds,
+    functions / hash_seconds, features / hash_seconds, checksum);
+  if (graphlet_cache) {
+    printf("[!] Graphlet hash cache: %s\n",
+      graphlet_cache->GetStatistics().ToString().c_str());
+  }
+}
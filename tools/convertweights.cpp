@@ -0,0 +1,59 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <gflags/gflags.h>
+
+#include "searchbackend/featureweights.hpp"
+
+DEFINE_string(input, "", "Weights file to convert (text or binary)");
+DEFINE_string(output, "", "Binary weights file to write");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Convert a text weights file as written by trainsimhashweights into the "
+    "binary format that can be memory-mapped when hashing.");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+    printf("[!] Please specify --input and --output\n");
+    return -1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  FeatureWeights weights;
+  if (!weights.Load(FLAGS_input)) {
+    printf("[!] Failed to load weights from %s\n", FLAGS_input.c_str());
+    return -1;
+  }
+  double load_seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("[!] Loaded %lu weights from %s in %f s\n", weights.size(),
+    FLAGS_input.c_str(), load_seconds);
+
+  if (!weights.Save(FLAGS_output)) {
+    printf("[!] Failed to write %s\n", FLAGS_output.c_str());
+    return -1;
+  }
+  printf("[!] Wrote %s\n", FLAGS_output.c_str());
+  return 0;
+}
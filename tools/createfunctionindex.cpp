@@ -26,6 +26,10 @@
 #include "disassembly/pecodesource.hpp"
 
 DEFINE_string(index, "./similarity.index", "Index file");
+DEFINE_uint64(buckets, 50, "Number of buckets (permutations) per function");
+DEFINE_uint64(prefix_bits, 8, "Number of hash bits that identify a bucket");
+DEFINE_string(hasher_version, "legacy", "Feature hash family of the functions "
+  "in the index: legacy, portable or decoded");
 // The google namespace is there for compatibility with legacy gflags and will
 // be removed eventually.
 #ifndef gflags
@@ -45,6 +49,21 @@ int main(int argc, char** argv) {
     "size to the search index specified.");
   ParseCommandLineFlags(&argc, &argv, true);
 
+  HasherVersion hasher_version;
+  if (!ParseHasherVersion(FLAGS_hasher_version, &hasher_version)) {
+    printf("[!] Unknown hasher version %s\n", FLAGS_hasher_version.c_str());
+    return -1;
+  }
+  // The index stores both values in a byte each.
+  if ((FLAGS_buckets == 0) || (FLAGS_buckets > 255)) {
+    printf("[!] The number of buckets has to be between 1 and 255\n");
+    return -1;
+  }
+  if ((FLAGS_prefix_bits == 0) || (FLAGS_prefix_bits > 64)) {
+    printf("[!] The number of prefix bits has to be between 1 and 64\n");
+    return -1;
+  }
   std::string index_file(FLAGS_index);
-  SimHashSearchIndex(index_file, true);
+  SimHashSearchIndex(index_file, true, FLAGS_buckets, FLAGS_prefix_bits,
+    hasher_version);
 }
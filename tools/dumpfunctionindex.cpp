@@ -37,7 +37,8 @@ int main(int argc, char** argv) {
   ParseCommandLineFlags(&argc, &argv, true);
 
   std::string index_file(FLAGS_index);
-  SimHashSearchIndex search_index(index_file, false);
+  SimHashSearchIndex search_index(index_file,
+    SimHashSearchIndex::Access::kReadOnly);
   printf("[!] Indexed %lu functions, total index has %lu elements\n",
     search_index.GetNumberOfIndexedFunctions(),
     search_index.GetIndexSetSize());
@@ -35,7 +35,15 @@ int main(int argc, char** argv) {
   ParseCommandLineFlags(&argc, &argv, true);
 
   std::string index_file(FLAGS_index);
-  SimHashSearchIndex search_index(index_file, false);
+  SimHashSearchIndex search_index(index_file,
+    SimHashSearchIndex::Access::kReadOnly);
+  const SimHashSearchIndexHeader& header = search_index.GetHeader();
+  printf("[!] Version %d, layout %d, %d-bit hashes, %d buckets with %d-bit "
+    "prefixes, permutation seed %lx\n", header.version, header.layout,
+    header.hash_bits, header.buckets, header.prefix_bits,
+    header.permutation_seed);
+  printf("[!] SimHashes calculated with the %s hasher\n",
+    HasherVersionName(search_index.GetHasherVersion()));
   printf("[!] FileSize: %lu bytes, FreeSpace: %lu bytes\n",
     search_index.GetIndexFileSize(), search_index.GetIndexFileFreeSpace());
   printf("[!] Indexed %lu functions, total index has %lu elements\n",
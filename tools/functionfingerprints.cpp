@@ -12,9 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <map>
+#include <thread>
 #include <gflags/gflags.h>
 
 #include "disassembly/disassembly.hpp"
@@ -22,6 +25,8 @@
 #include "disassembly/flowgraphutil_dyninst.hpp"
 #include "searchbackend/functionsimhash.hpp"
 #include "disassembly/pecodesource.hpp"
+#include "disassembly/flowgraphwithinstructionsfeaturegenerator.hpp"
+#include "util/threadpool.hpp"
 #include "util/util.hpp"
 
 DEFINE_string(format, "PE", "Executable format: PE,ELF,JSON");
@@ -37,6 +42,11 @@ DEFINE_bool(no_shared_blocks, false, "Skip functions with shared blocks.");
 DEFINE_bool(dump_graphlets, false, "Dump graphlet features into /var/tmp.");
 DEFINE_bool(dump_mnemonics, false, "Dump instruction features into /var/tmp.");
 DEFINE_bool(dump_immediates, false, "Dump immediate features into /var/tmp.");
+DEFINE_uint64(threads, 0, "Threads hashing functions (0: all cores)");
+DEFINE_string(hasher_version, "legacy", "Feature hash family: legacy, "
+  "portable or decoded");
+DEFINE_uint64(graphlet_cache_size, 0, "Entries in the cache of graphlet feature "
+  "hashes shared by all threads (0: no cache)");
 
 DEFINE_double(default_graphlet_weight, FunctionSimHasher::kGraphletDefaultWeight,
   "Default weight for graphlets.");
@@ -59,6 +69,55 @@ using namespace Dyninst;
 using namespace ParseAPI;
 using namespace InstructionAPI;
 
+// Disassembles and hashes one function and returns the line to print for it,
+// or an empty string if the function is too small.
+std::string FingerprintFunction(const Disassembly& disassembly,
+  FunctionSimHasher* sim_hasher, uint64_t file_id, uint32_t index,
+  uint64_t minimum_size, bool verbose) {
+  std::unique_ptr<FlowgraphWithInstructions> graph =
+    disassembly.GetFlowgraphWithInstructions(index);
+  Address function_address = disassembly.GetAddressOfFunction(index);
+
+  uint64_t branching_nodes = graph->GetNumberOfBranchingNodes();
+
+  if (branching_nodes <= minimum_size) {
+    return "";
+  }
+
+  // Dump out the file ID and address.
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%16.16lx:%16.16lx ", file_id,
+    function_address);
+  std::string line(buffer);
+
+  // If we are in verbose mode, the following lines will dump out the
+  // individual feature hashes. The generator takes over the graph that was
+  // already built instead of disassembling the function a second time.
+  std::vector<FeatureHash> feature_hashes;
+  FunctionSimHasher::SimHash<128> hashes;
+  FlowgraphWithInstructionsFeatureGenerator generator(std::move(graph));
+  sim_hasher->CalculateFunctionSimHash<128>(&generator, &hashes,
+    verbose ? &feature_hashes : nullptr);
+
+  uint64_t hash1 = hashes[0];
+  uint64_t hash2 = hashes[1];
+
+  // Dump out the final simhash of the function only if we are in non-verbose
+  // mode.
+  if (!verbose) {
+    snprintf(buffer, sizeof(buffer), "%16.16lx%16.16lx\n", hash1, hash2);
+    line.append(buffer);
+  } else {
+    for (const auto& feature_hash : feature_hashes) {
+      snprintf(buffer, sizeof(buffer), "%16.16lx%16.16lx ", feature_hash.first,
+        feature_hash.second);
+      line.append(buffer);
+    }
+    line.append("\n");
+  }
+  return line;
+}
+
 int main(int argc, char** argv) {
   SetUsageMessage(
     "Dump simhash values from a binary to stdout. If verbose is true, "
@@ -90,54 +149,70 @@ int main(int argc, char** argv) {
   FeatureLoggingOptions logging = FeatureLogging(FLAGS_dump_graphlets,
     FLAGS_dump_mnemonics, FLAGS_dump_immediates);
 
+  HasherVersion hasher_version;
+  if (!ParseHasherVersion(FLAGS_hasher_version, &hasher_version)) {
+    printf("[!] Unknown hasher version %s\n", FLAGS_hasher_version.c_str());
+    return -1;
+  }
+  disassembly.SetDecodeImmediates(UsesDecodedImmediates(hasher_version));
+
   FunctionSimHasher sim_hasher(FLAGS_weights, features, logging,
     FLAGS_default_mnemonic_weight, FLAGS_default_graphlet_weight,
-    FLAGS_default_immediate_weight);
+    FLAGS_default_immediate_weight, hasher_version);
+  std::unique_ptr<GraphletHashCache> graphlet_cache;
+  if (FLAGS_graphlet_cache_size > 0) {
+    graphlet_cache.reset(new GraphletHashCache(FLAGS_graphlet_cache_size));
+    sim_hasher.SetGraphletHashCache(graphlet_cache.get());
+  }
 
-  for (uint32_t index = 0; index < disassembly.GetNumberOfFunctions(); ++index) {
-    std::unique_ptr<FlowgraphWithInstructions> graph =
-      disassembly.GetFlowgraphWithInstructions(index);
-    Address function_address = disassembly.GetAddressOfFunction(index);
+  // The feature dumps all write into the same files in /var/tmp, so dumping
+  // runs on a single thread.
+  uint32_t threads = FLAGS_threads ? FLAGS_threads :
+    std::max(1U, std::thread::hardware_concurrency());
+  if (logging != default_logging) {
+    threads = 1;
+  }
 
+  // Functions are hashed on the thread pool, but their lines are printed in
+  // the order of the functions, so the output does not depend on the number
+  // of threads. Only a bounded number of functions is in flight at any time.
+  threadpool::ThreadPool pool(threads);
+  std::deque<std::future<std::string>> pending_lines;
+  const uint64_t max_pending_lines = 64 * threads;
+
+  for (uint32_t index = 0; index < disassembly.GetNumberOfFunctions(); ++index) {
     // Skip functions that contain shared basic blocks.
     if (FLAGS_no_shared_blocks && disassembly.ContainsSharedBasicBlocks(index)) {
       continue;
     }
 
-    if ((target_address != 0) && (target_address != function_address)) {
+    if ((target_address != 0) &&
+      (target_address != disassembly.GetAddressOfFunction(index))) {
       continue;
     }
 
-    uint64_t branching_nodes = graph->GetNumberOfBranchingNodes();
-
-    if (branching_nodes <= minimum_size) {
-      continue;
-    }
-
-    // Dump out the file ID and address.
-    printf("%16.16lx:%16.16lx ", file_id, function_address);
-
-    // If we are in verbose mode, the following lines will dump out the
-    // individual feature hashes.
-    std::vector<FeatureHash> feature_hashes;
-    std::vector<uint64_t> hashes;
-    std::unique_ptr<FunctionFeatureGenerator> generator =
-      disassembly.GetFeatureGenerator(index);
-    sim_hasher.CalculateFunctionSimHash(generator.get(), 128, &hashes,
-      &feature_hashes);
-
-    uint64_t hash1 = hashes[0];
-    uint64_t hash2 = hashes[1];
-
-    // Dump out the final simhash of the function only if we are in non-verbose
-    // mode.
-    if (!verbose) {
-      printf("%16.16lx%16.16lx\n", hash1, hash2);
-    } else {
-      for (const auto& feature_hash : feature_hashes) {
-        printf("%16.16lx%16.16lx ", feature_hash.first, feature_hash.second);
-      }
-      printf("\n");
+    pending_lines.push_back(pool.Push(
+      [&disassembly, &sim_hasher, file_id, index, minimum_size,
+      verbose](int threadid) {
+        return FingerprintFunction(disassembly, &sim_hasher, file_id, index,
+          minimum_size, verbose);
+      }));
+    while ((pending_lines.size() > max_pending_lines) ||
+      ((pending_lines.size() > 0) && (pending_lines.front().wait_for(
+        std::chrono::seconds(0)) == std::future_status::ready))) {
+      fputs(pending_lines.front().get().c_str(), stdout);
+      pending_lines.pop_front();
     }
   }
+  while (pending_lines.size() > 0) {
+    fputs(pending_lines.front().get().c_str(), stdout);
+    pending_lines.pop_front();
+  }
+  pool.Stop(true);
+  // The fingerprints go to stdout, so the statistics go to stderr.
+  if (graphlet_cache) {
+    fprintf(stderr, "[!] Graphlet hash cache for %s: %s\n",
+      binary_path_string.c_str(),
+      graphlet_cache->GetStatistics().ToString().c_str());
+  }
 }
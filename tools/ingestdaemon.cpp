@@ -0,0 +1,572 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <gflags/gflags.h>
+
+#include "disassembly/disassembly.hpp"
+#include "disassembly/flowgraph.hpp"
+#include "disassembly/flowgraphwithinstructions.hpp"
+#include "searchbackend/functionsimhash.hpp"
+#include "searchbackend/simhashsearchindex.hpp"
+#include "util/threadpool.hpp"
+#include "util/util.hpp"
+
+DEFINE_string(format, "PE", "Executable format: PE,ELF,JSON");
+DEFINE_string(index, "./similarity.index", "Index file");
+DEFINE_string(weights, "weights.txt", "Feature weights file");
+DEFINE_string(spool_dir, "", "Directory to watch for executables to add");
+DEFINE_string(socket, "", "Unix socket to read executable paths from");
+DEFINE_uint64(minimum_function_size, 5, "Minimum size of a function to be added.");
+DEFINE_bool(no_shared_blocks, false, "Skip functions with shared blocks.");
+DEFINE_uint64(disassembly_threads, 1, "Threads disassembling executables");
+DEFINE_uint64(hashing_threads, 0, "Threads hashing functions (0: all cores)");
+DEFINE_uint64(queue_depth, 64, "Maximum number of executables waiting to be "
+  "disassembled; further submissions block until there is room");
+DEFINE_uint64(function_queue_depth, 4096, "Maximum number of functions "
+  "waiting to be hashed or inserted");
+DEFINE_uint64(batch_size, 256, "Number of functions added to the index at once");
+DEFINE_bool(write_ahead_log, true, "Log batches to [index].wal before adding "
+  "them, so that a crash cannot leave the index inconsistent.");
+DEFINE_uint64(poll_interval_ms, 1000, "Interval for scanning the spool dir");
+DEFINE_uint64(progress_interval, 10, "Seconds between progress reports");
+
+DEFINE_double(default_graphlet_weight, FunctionSimHasher::kGraphletDefaultWeight,
+  "Default weight for graphlets.");
+DEFINE_double(default_mnemonic_weight, FunctionSimHasher::kMnemonicDefaultWeight,
+  "Default weight for mnemonics.");
+DEFINE_double(default_immediate_weight,
+  FunctionSimHasher::kImmediateDefaultWeight, "Default weight for immediates.");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+using namespace std;
+
+// The daemon is a three-stage pipeline connected by bounded queues:
+//
+//   spool dir / socket -> [paths] -> disassembly threads -> [functions] ->
+//     hashing threads -> [hashes] -> a single inserter thread -> index
+//
+// The index stays mapped for the lifetime of the process, and only the
+// inserter touches it, so there is no lock contention on the index. The
+// inserter adds functions in batches, each of which is written to the
+// write-ahead log before the index is modified. Because
+// every queue is bounded, a slow stage throttles the stages before it: Socket
+// clients block while the path queue is full, and the spool directory is only
+// scanned for as many files as there is room for.
+//
+// Files picked up from the spool directory are moved to spool/processing while
+// they are worked on, and to spool/done or spool/failed afterwards.
+
+static std::atomic<bool> stop_requested(false);
+// Set when the index could not be written, e.g. because the write-ahead log
+// failed. The daemon then shuts down and exits with an error.
+static std::atomic<bool> index_failed(false);
+
+static void HandleSignal(int) {
+  stop_requested = true;
+}
+
+// Progress counters, reported periodically and on request over the socket.
+struct IngestCounters {
+  std::atomic_ulong files_queued{0};
+  std::atomic_ulong files_done{0};
+  std::atomic_ulong files_failed{0};
+  std::atomic_ulong functions_hashed{0};
+  std::atomic_ulong functions_skipped{0};
+  std::atomic_ulong functions_added{0};
+};
+
+// An executable that has been submitted to the daemon.
+struct IngestJob {
+  std::string path;
+  // Path inside spool/processing if the job came from the spool directory.
+  std::string spool_path;
+  uint64_t file_id = 0;
+  std::unique_ptr<Disassembly> disassembly;
+  // Number of functions that have not yet passed through the inserter.
+  std::atomic_ulong remaining{0};
+  std::atomic<bool> failed{false};
+};
+
+// A function on its way from the hashing threads to the inserter. Functions
+// that should not be added still pass through, so the inserter can tell when
+// an executable is complete.
+struct HashedFunction {
+  std::shared_ptr<IngestJob> job;
+  bool add = false;
+  uint64_t hash_A = 0;
+  uint64_t hash_B = 0;
+  uint64_t address = 0;
+};
+
+struct FunctionTask {
+  std::shared_ptr<IngestJob> job;
+  uint32_t index = 0;
+};
+
+static std::string JoinPath(const std::string& directory,
+  const std::string& name) {
+  return directory + "/" + name;
+}
+
+static std::string BaseName(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+static std::string FormatCounters(const IngestCounters& counters,
+  threadpool::BoundedQueue<std::shared_ptr<IngestJob>>* paths) {
+  char buffer[512];
+  snprintf(buffer, sizeof(buffer), "files: %lu queued, %lu done, %lu failed, "
+    "%lu waiting; functions: %lu hashed, %lu skipped, %lu added",
+    counters.files_queued.load(), counters.files_done.load(),
+    counters.files_failed.load(), paths->Size(),
+    counters.functions_hashed.load(), counters.functions_skipped.load(),
+    counters.functions_added.load());
+  return std::string(buffer);
+}
+
+// Called once all functions of an executable have passed the inserter (or the
+// executable could not be disassembled at all).
+static void FinishJob(IngestJob* job, IngestCounters* counters) {
+  bool failed = job->failed.load();
+  if (failed) {
+    (counters->files_failed)++;
+  } else {
+    (counters->files_done)++;
+  }
+  printf("[!] %s %s (FileID %lx)\n", failed ? "Failed" : "Finished",
+    job->path.c_str(), job->file_id);
+  if (job->spool_path != "") {
+    std::string target = JoinPath(JoinPath(FLAGS_spool_dir,
+      failed ? "failed" : "done"), BaseName(job->spool_path));
+    if (rename(job->spool_path.c_str(), target.c_str()) != 0) {
+      printf("[!] Failed to move %s to %s\n", job->spool_path.c_str(),
+        target.c_str());
+    }
+  }
+  // Release the disassembly as early as possible; it is the largest object.
+  job->disassembly.reset();
+}
+
+// Disassembles submitted executables and hands their functions to the hashing
+// threads.
+static void DisassemblyThread(
+  threadpool::BoundedQueue<std::shared_ptr<IngestJob>>* paths,
+  threadpool::BoundedQueue<FunctionTask>* functions,
+  bool decode_immediates, IngestCounters* counters) {
+  std::shared_ptr<IngestJob> job;
+  while (paths->Pop(&job)) {
+    // GenerateExecutableID terminates the process on unreadable files, so
+    // check first.
+    if (!std::ifstream(job->path.c_str()).good()) {
+      job->failed = true;
+      FinishJob(job.get(), counters);
+      continue;
+    }
+    job->file_id = GenerateExecutableID(job->path);
+    job->disassembly.reset(new Disassembly(FLAGS_format, job->path));
+    job->disassembly->SetDecodeImmediates(decode_immediates);
+    if (!job->disassembly->Load()) {
+      job->failed = true;
+      FinishJob(job.get(), counters);
+      continue;
+    }
+    uint32_t number_of_functions = job->disassembly->GetNumberOfFunctions();
+    printf("[!] Disassembled %s (FileID %lx): %d functions\n",
+      job->path.c_str(), job->file_id, number_of_functions);
+    if (number_of_functions == 0) {
+      FinishJob(job.get(), counters);
+      continue;
+    }
+    job->remaining = number_of_functions;
+    for (uint32_t index = 0; index < number_of_functions; ++index) {
+      functions->Push(FunctionTask{ job, index });
+    }
+  }
+}
+
+static void HashingThread(threadpool::BoundedQueue<FunctionTask>* functions,
+  threadpool::BoundedQueue<HashedFunction>* hashes,
+  FunctionSimHasher* hasher, IngestCounters* counters) {
+  FunctionTask task;
+  while (functions->Pop(&task)) {
+    const Disassembly* disassembly = task.job->disassembly.get();
+    HashedFunction result;
+    result.job = task.job;
+    result.address = disassembly->GetAddressOfFunction(task.index);
+
+    bool skip = FLAGS_no_shared_blocks &&
+      disassembly->ContainsSharedBasicBlocks(task.index);
+    if (!skip) {
+      std::unique_ptr<FlowgraphWithInstructions> graph =
+        disassembly->GetFlowgraphWithInstructions(task.index);
+      skip = graph->GetNumberOfBranchingNodes() <= FLAGS_minimum_function_size;
+    }
+    if (skip) {
+      (counters->functions_skipped)++;
+    } else {
+      FunctionSimHasher::SimHash<128> output;
+      std::unique_ptr<FunctionFeatureGenerator> generator =
+        disassembly->GetFeatureGenerator(task.index);
+      hasher->CalculateFunctionSimHash<128>(generator.get(), &output);
+      result.add = true;
+      result.hash_A = output[0];
+      result.hash_B = output[1];
+      (counters->functions_hashed)++;
+    }
+    hashes->Push(std::move(result));
+  }
+}
+
+// Adds the collected functions as one batch, then finishes the executables
+// whose last function was part of it.
+static void FlushBatch(SimHashSearchIndex* search_index,
+  std::vector<HashedFunction>* batch, IngestCounters* counters) {
+  std::vector<SimHashSearchIndex::FunctionToAdd> functions;
+  for (const HashedFunction& result : *batch) {
+    if (result.add) {
+      functions.push_back(SimHashSearchIndex::FunctionToAdd{ result.hash_A,
+        result.hash_B, result.job->file_id, result.address });
+    }
+  }
+  bool failed = false;
+  if (index_failed) {
+    printf("[!] Skipping %lu functions. Index is not writable.\n",
+      functions.size());
+    failed = true;
+  } else if (search_index->GetIndexFileFreeSpace() < (1ULL << 14)) {
+    printf("[!] Skipping %lu functions. Index file full.\n",
+      functions.size());
+    failed = true;
+  } else {
+    try {
+      search_index->AddFunctions(functions);
+      counters->functions_added += functions.size();
+    } catch (boost::interprocess::bad_alloc& out_of_space) {
+      printf("[!] boost::interprocess::bad_alloc - no space in index file "
+        "left!\n");
+      failed = true;
+    } catch (std::runtime_error& error) {
+      printf("[!] Adding %lu functions failed: %s\n", functions.size(),
+        error.what());
+      failed = true;
+      index_failed = true;
+      stop_requested = true;
+    }
+  }
+  for (HashedFunction& result : *batch) {
+    if (failed && result.add) {
+      result.job->failed = true;
+    }
+    if (--(result.job->remaining) == 0) {
+      FinishJob(result.job.get(), counters);
+    }
+  }
+  batch->clear();
+}
+
+// Collects hashed functions into batches. A batch is added once it is full or
+// when no further functions are waiting, so batching does not delay an idle
+// daemon.
+static void InserterThread(threadpool::BoundedQueue<HashedFunction>* hashes,
+  SimHashSearchIndex* search_index, IngestCounters* counters) {
+  HashedFunction result;
+  std::vector<HashedFunction> batch;
+  while (hashes->Pop(&result)) {
+    batch.push_back(std::move(result));
+    if ((batch.size() >= FLAGS_batch_size) || (hashes->Size() == 0)) {
+      FlushBatch(search_index, &batch, counters);
+    }
+  }
+  FlushBatch(search_index, &batch, counters);
+}
+
+// Moves new files from the spool directory into spool/processing and queues
+// them. Only claims as many files as the path queue has room for, so files
+// that cannot be processed soon stay visible in the spool directory.
+static void ScanSpoolDirectory(
+  threadpool::BoundedQueue<std::shared_ptr<IngestJob>>* paths,
+  IngestCounters* counters) {
+  DIR* directory = opendir(FLAGS_spool_dir.c_str());
+  if (directory == nullptr) {
+    printf("[!] Failed to open spool directory %s\n", FLAGS_spool_dir.c_str());
+    return;
+  }
+  std::set<std::string> names;
+  while (struct dirent* entry = readdir(directory)) {
+    std::string path = JoinPath(FLAGS_spool_dir, entry->d_name);
+    struct stat info;
+    if ((stat(path.c_str(), &info) == 0) && S_ISREG(info.st_mode)) {
+      names.insert(entry->d_name);
+    }
+  }
+  closedir(directory);
+
+  for (const std::string& name : names) {
+    if (paths->Size() >= paths->GetCapacity()) {
+      break;
+    }
+    std::string processing = JoinPath(JoinPath(FLAGS_spool_dir, "processing"),
+      name);
+    if (rename(JoinPath(FLAGS_spool_dir, name).c_str(),
+      processing.c_str()) != 0) {
+      continue;
+    }
+    std::shared_ptr<IngestJob> job = std::make_shared<IngestJob>();
+    job->path = processing;
+    job->spool_path = processing;
+    (counters->files_queued)++;
+    paths->Push(job);
+  }
+}
+
+// Reads newline-separated executable paths from one client. The line "stats"
+// returns the progress counters instead. Every line is acknowledged once it
+// has been queued, so a client that waits for the answer is throttled by the
+// pipeline.
+static void ServeSocketClient(int client,
+  threadpool::BoundedQueue<std::shared_ptr<IngestJob>>* paths,
+  IngestCounters* counters) {
+  std::string buffer;
+  char chunk[4096];
+  while (!stop_requested) {
+    struct pollfd descriptor = { client, POLLIN, 0 };
+    int ready = poll(&descriptor, 1, 200);
+    if ((ready == 0) || ((ready < 0) && (errno == EINTR))) {
+      continue;
+    } else if (ready < 0) {
+      break;
+    }
+    ssize_t received = recv(client, chunk, sizeof(chunk), 0);
+    if ((received < 0) && (errno == EINTR)) {
+      continue;
+    } else if (received <= 0) {
+      break;
+    }
+    buffer.append(chunk, received);
+    size_t newline;
+    while ((newline = buffer.find('\n')) != std::string::npos) {
+      std::string line = buffer.substr(0, newline);
+      buffer.erase(0, newline + 1);
+      if (!line.empty() && (line.back() == '\r')) {
+        line.pop_back();
+      }
+      std::string answer;
+      if (line == "") {
+        continue;
+      } else if (line == "stats") {
+        answer = FormatCounters(*counters, paths) + "\n";
+      } else {
+        std::shared_ptr<IngestJob> job = std::make_shared<IngestJob>();
+        job->path = line;
+        if (paths->Push(job)) {
+          (counters->files_queued)++;
+          answer = "queued " + line + "\n";
+        } else {
+          answer = "shutting down\n";
+        }
+      }
+      if (send(client, answer.c_str(), answer.size(), MSG_NOSIGNAL) < 0) {
+        return;
+      }
+    }
+  }
+}
+
+static int OpenListeningSocket(const std::string& socket_path) {
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return -1;
+  }
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    close(listener);
+    return -1;
+  }
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+  unlink(socket_path.c_str());
+  if ((bind(listener, reinterpret_cast<struct sockaddr*>(&address),
+    sizeof(address)) != 0) || (listen(listener, 16) != 0)) {
+    close(listener);
+    return -1;
+  }
+  return listener;
+}
+
+// Accepts clients one after the other; a client that submits a large batch
+// is served until it disconnects.
+static void SocketThread(int listener,
+  threadpool::BoundedQueue<std::shared_ptr<IngestJob>>* paths,
+  IngestCounters* counters) {
+  while (!stop_requested) {
+    struct pollfd descriptor = { listener, POLLIN, 0 };
+    if (poll(&descriptor, 1, 200) <= 0) {
+      continue;
+    }
+    int client = accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      continue;
+    }
+    ServeSocketClient(client, paths, counters);
+    close(client);
+  }
+}
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Keep the search index open and add executables to it as they arrive in "
+    "a spool directory or are submitted over a Unix socket.");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  if ((FLAGS_spool_dir == "") && (FLAGS_socket == "")) {
+    printf("[!] Need at least one of --spool_dir and --socket.\n");
+    return -1;
+  }
+
+  if (FLAGS_spool_dir != "") {
+    for (const char* subdirectory : { "processing", "done", "failed" }) {
+      mkdir(JoinPath(FLAGS_spool_dir, subdirectory).c_str(), 0755);
+    }
+    // Files left in processing by a previous run are resubmitted.
+    std::string processing = JoinPath(FLAGS_spool_dir, "processing");
+    if (DIR* directory = opendir(processing.c_str())) {
+      while (struct dirent* entry = readdir(directory)) {
+        std::string name(entry->d_name);
+        if ((name != ".") && (name != "..")) {
+          printf("[!] Resubmitting %s from an earlier run.\n", name.c_str());
+          rename(JoinPath(processing, name).c_str(),
+            JoinPath(FLAGS_spool_dir, name).c_str());
+        }
+      }
+      closedir(directory);
+    }
+  }
+
+  int listener = -1;
+  if (FLAGS_socket != "") {
+    listener = OpenListeningSocket(FLAGS_socket);
+    if (listener < 0) {
+      printf("[!] Failed to listen on %s\n", FLAGS_socket.c_str());
+      return -1;
+    }
+  }
+
+  signal(SIGINT, HandleSignal);
+  signal(SIGTERM, HandleSignal);
+
+  SimHashSearchIndex search_index(FLAGS_index, false);
+  if (search_index.GetNumberOfReplayedFunctions()) {
+    printf("[!] Replayed %lu functions from an interrupted run.\n",
+      search_index.GetNumberOfReplayedFunctions());
+  }
+  if (FLAGS_write_ahead_log) {
+    search_index.EnableWriteAheadLog();
+  }
+  FunctionSimHasher hasher(search_index, FLAGS_weights,
+    FLAGS_default_mnemonic_weight, FLAGS_default_graphlet_weight,
+    FLAGS_default_immediate_weight);
+
+  IngestCounters counters;
+  threadpool::BoundedQueue<std::shared_ptr<IngestJob>> paths(FLAGS_queue_depth);
+  threadpool::BoundedQueue<FunctionTask> functions(FLAGS_function_queue_depth);
+  threadpool::BoundedQueue<HashedFunction> hashes(FLAGS_function_queue_depth);
+
+  uint32_t hashing_threads = FLAGS_hashing_threads ? FLAGS_hashing_threads :
+    std::max(1U, std::thread::hardware_concurrency());
+  std::vector<std::thread> disassemblers;
+  for (uint32_t index = 0; index < std::max<uint64_t>(1, FLAGS_disassembly_threads);
+    ++index) {
+    disassemblers.emplace_back(DisassemblyThread, &paths, &functions,
+      UsesDecodedImmediates(hasher.GetHasherVersion()), &counters);
+  }
+  std::vector<std::thread> hashers;
+  for (uint32_t index = 0; index < hashing_threads; ++index) {
+    hashers.emplace_back(HashingThread, &functions, &hashes, &hasher,
+      &counters);
+  }
+  std::thread inserter(InserterThread, &hashes, &search_index, &counters);
+  std::thread socket_thread;
+  if (listener >= 0) {
+    socket_thread = std::thread(SocketThread, listener, &paths, &counters);
+  }
+
+  printf("[!] Ingesting into %s with %lu disassembly and %d hashing threads.\n",
+    FLAGS_index.c_str(), disassemblers.size(), hashing_threads);
+  auto last_scan = std::chrono::steady_clock::now() - std::chrono::hours(1);
+  auto last_report = std::chrono::steady_clock::now();
+  while (!stop_requested) {
+    auto now = std::chrono::steady_clock::now();
+    if ((FLAGS_spool_dir != "") && (now - last_scan >=
+      std::chrono::milliseconds(FLAGS_poll_interval_ms))) {
+      ScanSpoolDirectory(&paths, &counters);
+      last_scan = now;
+    }
+    if (now - last_report >= std::chrono::seconds(FLAGS_progress_interval)) {
+      printf("[!] %s\n", FormatCounters(counters, &paths).c_str());
+      fflush(stdout);
+      last_report = now;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  // Drain the pipeline stage by stage: everything that has been queued is
+  // still added to the index before the process exits.
+  printf("[!] Shutting down, finishing queued executables.\n");
+  if (socket_thread.joinable()) {
+    socket_thread.join();
+    close(listener);
+    unlink(FLAGS_socket.c_str());
+  }
+  paths.Close();
+  for (std::thread& thread : disassemblers) {
+    thread.join();
+  }
+  functions.Close();
+  for (std::thread& thread : hashers) {
+    thread.join();
+  }
+  hashes.Close();
+  inserter.join();
+  printf("[!] %s\n", FormatCounters(counters, &paths).c_str());
+  if (index_failed) {
+    printf("[!] Stopped because the index could not be written.\n");
+    return -1;
+  }
+}
@@ -98,11 +98,14 @@ int main(int argc, char** argv) {
   FunctionMetadataStore metadata(index_file + ".meta");
 
   // Load the search index.
-  SimHashSearchIndex search_index(index_file, false);
+  SimHashSearchIndex search_index(index_file,
+    SimHashSearchIndex::Access::kReadOnly);
 
   printf("[!] Loaded search index, starting disassembly.\n");
 
   Disassembly disassembly(mode, binary_path_string);
+  disassembly.SetDecodeImmediates(
+    UsesDecodedImmediates(search_index.GetHasherVersion()));
   if (!disassembly.Load()) {
     exit(1);
   }
@@ -123,7 +126,7 @@ int main(int argc, char** argv) {
   std::atomic_ulong atomic_processed_functions(0);
   std::atomic_ulong* processed_functions = &atomic_processed_functions;
   uint64_t number_of_functions = disassembly.GetNumberOfFunctions();
-  FunctionSimHasher hasher(FLAGS_weights, default_features, default_logging,
+  FunctionSimHasher hasher(search_index, FLAGS_weights,
     FLAGS_default_mnemonic_weight, FLAGS_default_graphlet_weight,
     FLAGS_default_immediate_weight);
 
@@ -44,7 +44,8 @@ int main(int argc, char** argv) {
   uint64_t max_matches = FLAGS_max_matches;
 
   // Load the search index.
-  SimHashSearchIndex search_index(index_file, false);
+  SimHashSearchIndex search_index(index_file,
+    SimHashSearchIndex::Access::kReadOnly);
   printf("[!] Loaded search index.\n");
 
   printf("[!] Querying for %16.16lx %16.16lx\n", hash.first, hash.second);
@@ -0,0 +1,152 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <gflags/gflags.h>
+
+#include "searchbackend/queryprotocol.hpp"
+#include "searchbackend/simhashsearchindex.hpp"
+#include "util/util.hpp"
+
+DEFINE_string(socket, "/tmp/functionsimsearch.sock", "Socket of the queryserver");
+DEFINE_string(index, "", "Optional index file to draw query hashes from");
+DEFINE_string(concurrency, "1,2,4,8,16", "Comma-separated client counts");
+DEFINE_uint64(requests, 2000, "Requests per concurrency level");
+DEFINE_uint64(batch_size, 16, "Hashes per request");
+DEFINE_uint64(results_per_query, 5, "Results per hash");
+DEFINE_uint64(seed, 1, "Seed for picking query hashes");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+using namespace std;
+
+// Issues requests from a shared budget until it is exhausted, recording the
+// round-trip time of each request in microseconds.
+static bool RunClient(const std::vector<FeatureHash>* hashes,
+  std::atomic<int64_t>* budget, uint64_t seed, std::vector<double>* latencies) {
+  int connection = ConnectToQueryServer(FLAGS_socket);
+  if (connection < 0) {
+    return false;
+  }
+  std::mt19937_64 random(seed);
+  QueryRequest request;
+  request.results_per_query = FLAGS_results_per_query;
+  QueryResponse response;
+  std::vector<uint8_t> payload;
+  bool ok = true;
+  while (ok && ((*budget)-- > 0)) {
+    request.hashes.clear();
+    for (uint32_t index = 0; index < FLAGS_batch_size; ++index) {
+      request.hashes.push_back((*hashes)[random() % hashes->size()]);
+    }
+    EncodeQueryRequest(request, &payload);
+    auto start = std::chrono::steady_clock::now();
+    ok = WriteFrame(connection, payload) && ReadFrame(connection, &payload) &&
+      DecodeQueryResponse(payload, &response) &&
+      (response.status == kQueryOk);
+    auto end = std::chrono::steady_clock::now();
+    // A failed round trip would skew the percentiles towards zero.
+    if (ok) {
+      latencies->push_back(
+        std::chrono::duration<double, std::micro>(end - start).count());
+    }
+  }
+  close(connection);
+  return ok;
+}
+
+static double Percentile(const std::vector<double>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t index = std::min<size_t>(sorted.size() - 1,
+    static_cast<size_t>(fraction * sorted.size()));
+  return sorted[index];
+}
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Measure throughput and latency of a running queryserver for different "
+    "numbers of concurrent clients.");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  // Queries either use hashes that are in the index (every query finds at
+  // least one result) or uniformly random hashes.
+  std::vector<FeatureHash> hashes;
+  if (FLAGS_index != "") {
+    SimHashSearchIndex search_index(FLAGS_index,
+      SimHashSearchIndex::Access::kReadOnly);
+    search_index.GetIndexedHashes(&hashes);
+  }
+  if (hashes.empty()) {
+    std::mt19937_64 random(FLAGS_seed);
+    for (uint32_t index = 0; index < 4096; ++index) {
+      uint64_t hash_A = random();
+      hashes.push_back(std::make_pair(hash_A, random()));
+    }
+  }
+
+  printf("# clients requests/s queries/s p50_us p90_us p99_us max_us\n");
+  for (const std::string& level : Tokenize(FLAGS_concurrency.c_str(), ',')) {
+    uint32_t clients = strtoul(level.c_str(), nullptr, 10);
+    if (clients == 0) {
+      continue;
+    }
+    std::atomic<int64_t> budget(FLAGS_requests);
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<std::thread> threads;
+    std::atomic<bool> all_ok(true);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t client = 0; client < clients; ++client) {
+      threads.emplace_back([&hashes, &budget, &latencies, &all_ok, client]() {
+        if (!RunClient(&hashes, &budget, FLAGS_seed + client,
+          &latencies[client])) {
+          all_ok = false;
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    if (!all_ok) {
+      printf("[!] Requests failed with %d clients, is the server running on "
+        "%s?\n", clients, FLAGS_socket.c_str());
+      return -1;
+    }
+
+    std::vector<double> all;
+    for (const std::vector<double>& client_latencies : latencies) {
+      all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+    }
+    std::sort(all.begin(), all.end());
+    printf("%d %f %f %f %f %f %f\n", clients, all.size() / seconds,
+      all.size() * FLAGS_batch_size / seconds, Percentile(all, 0.5),
+      Percentile(all, 0.9), Percentile(all, 0.99), all.empty() ? 0 : all.back());
+    fflush(stdout);
+  }
+}
@@ -0,0 +1,260 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include <gflags/gflags.h>
+
+#include "searchbackend/queryprotocol.hpp"
+#include "searchbackend/simhashsearchindex.hpp"
+#include "util/threadpool.hpp"
+
+DEFINE_string(index, "./similarity.index", "Index file");
+DEFINE_string(socket, "/tmp/functionsimsearch.sock", "Unix socket to listen on");
+DEFINE_uint64(threads, 0, "Number of requests answered concurrently "
+  "(0: number of cores)");
+DEFINE_uint64(timeout_ms, 5000, "Milliseconds a connection may stall in the "
+  "middle of a request or response before it is closed (0: no limit)");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+using namespace std;
+
+static std::atomic<bool> stop_requested(false);
+
+static void HandleSignal(int) {
+  stop_requested = true;
+}
+
+// Answers a single request. Malformed or oversized requests get an empty
+// response with an error status instead of closing the connection.
+static void AnswerRequest(SimHashSearchIndex* search_index,
+  const std::vector<uint8_t>& request_payload, QueryResponse* response) {
+  QueryRequest request;
+  response->results.clear();
+  if (!DecodeQueryRequest(request_payload, &request)) {
+    response->status = kQueryMalformedRequest;
+    return;
+  }
+  if ((request.hashes.size() > kMaxQueriesPerRequest) ||
+    (request.results_per_query > kMaxResultsPerQuery) ||
+    !QueryResponseFitsIntoFrame(request.hashes.size(),
+      request.results_per_query)) {
+    response->status = kQueryTooLarge;
+    return;
+  }
+  response->status = kQueryOk;
+  response->results.resize(request.hashes.size());
+  std::vector<std::pair<float, SimHashSearchIndex::FileAndAddress>> results;
+  for (uint32_t index = 0; index < request.hashes.size(); ++index) {
+    results.clear();
+    search_index->QueryTopN(request.hashes[index].first,
+      request.hashes[index].second, request.results_per_query, &results);
+    for (const auto& result : results) {
+      response->results[index].push_back(QueryResult{ result.first,
+        result.second.first, result.second.second });
+    }
+  }
+}
+
+// Connections are handed to the pool one request at a time, so an idle client
+// does not occupy a thread. A connection that was answered is handed back to
+// the polling loop through the wakeup pipe; failed connections are closed.
+class ConnectionQueue {
+ public:
+  ConnectionQueue() {
+    if (pipe(wakeup_) != 0) {
+      wakeup_[0] = wakeup_[1] = -1;
+      return;
+    }
+    // Neither draining the pipe nor waking up the loop may block.
+    fcntl(wakeup_[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeup_[1], F_SETFL, O_NONBLOCK);
+  }
+  ~ConnectionQueue() {
+    close(wakeup_[0]);
+    close(wakeup_[1]);
+  }
+  bool IsValid() const { return wakeup_[0] >= 0; }
+  int GetWakeupDescriptor() const { return wakeup_[0]; }
+
+  void Return(int connection) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      returned_.push_back(connection);
+    }
+    char byte = 0;
+    if (write(wakeup_[1], &byte, 1) != 1) {
+      // The pipe is full, so the polling loop wakes up anyhow.
+    }
+  }
+
+  // Moves all returned connections to the end of idle.
+  void Collect(std::vector<int>* idle) {
+    char buffer[64];
+    while (read(wakeup_[0], buffer, sizeof(buffer)) == sizeof(buffer)) {}
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle->insert(idle->end(), returned_.begin(), returned_.end());
+    returned_.clear();
+  }
+ private:
+  int wakeup_[2];
+  std::mutex mutex_;
+  std::vector<int> returned_;
+};
+
+// A thread that reads a request blocks until the whole frame has arrived, and
+// one that writes a response until the client has taken it. The timeouts keep
+// a client that stops halfway from holding on to the thread: the read or write
+// fails, and the connection is closed.
+static bool SetStallTimeout(int connection, uint64_t milliseconds) {
+  struct timeval timeout;
+  timeout.tv_sec = milliseconds / 1000;
+  timeout.tv_usec = (milliseconds % 1000) * 1000;
+  return (setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+    sizeof(timeout)) == 0) && (setsockopt(connection, SOL_SOCKET,
+    SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0);
+}
+
+static void ServeFrame(int connection, SimHashSearchIndex* search_index,
+  ConnectionQueue* queue) {
+  std::vector<uint8_t> request_payload;
+  std::vector<uint8_t> response_payload;
+  QueryResponse response;
+  if (!ReadFrame(connection, &request_payload)) {
+    close(connection);
+    return;
+  }
+  AnswerRequest(search_index, request_payload, &response);
+  EncodeQueryResponse(response, &response_payload);
+  if (!WriteFrame(connection, response_payload)) {
+    close(connection);
+    return;
+  }
+  queue->Return(connection);
+}
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Keep the search index open and answer batched SimHash queries over a "
+    "Unix socket (see searchbackend/queryprotocol.hpp for the format).");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  SimHashSearchIndex search_index(FLAGS_index,
+    SimHashSearchIndex::Access::kReadOnly);
+  printf("[!] Opened %s: %lu functions in %d buckets\n", FLAGS_index.c_str(),
+    search_index.GetNumberOfIndexedFunctions(),
+    search_index.GetNumberOfBuckets());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if ((listener < 0) || (FLAGS_socket.size() >= sizeof(address.sun_path))) {
+    printf("[!] Failed to create socket %s\n", FLAGS_socket.c_str());
+    return -1;
+  }
+  strncpy(address.sun_path, FLAGS_socket.c_str(), sizeof(address.sun_path) - 1);
+  unlink(FLAGS_socket.c_str());
+  if ((bind(listener, reinterpret_cast<struct sockaddr*>(&address),
+    sizeof(address)) != 0) || (listen(listener, 128) != 0)) {
+    printf("[!] Failed to listen on %s\n", FLAGS_socket.c_str());
+    return -1;
+  }
+
+  signal(SIGINT, HandleSignal);
+  signal(SIGTERM, HandleSignal);
+
+  // The threads answer requests, not connections: any number of clients can
+  // stay connected, and at most this many requests are answered at once.
+  uint32_t threads = FLAGS_threads ? FLAGS_threads :
+    std::max(1U, std::thread::hardware_concurrency());
+  threadpool::ThreadPool pool(threads);
+  ConnectionQueue queue;
+  if (!queue.IsValid()) {
+    printf("[!] Failed to create wakeup pipe\n");
+    return -1;
+  }
+  printf("[!] Listening on %s with %d threads\n", FLAGS_socket.c_str(),
+    threads);
+  fflush(stdout);
+
+  SimHashSearchIndex* index_pointer = &search_index;
+  ConnectionQueue* queue_pointer = &queue;
+  // Connections that wait for their next request.
+  std::vector<int> idle;
+  std::vector<struct pollfd> descriptors;
+  while (!stop_requested) {
+    queue.Collect(&idle);
+    descriptors.clear();
+    descriptors.push_back({ listener, POLLIN, 0 });
+    descriptors.push_back({ queue.GetWakeupDescriptor(), POLLIN, 0 });
+    for (int connection : idle) {
+      descriptors.push_back({ connection, POLLIN, 0 });
+    }
+    if (poll(descriptors.data(), descriptors.size(), 200) <= 0) {
+      continue;
+    }
+    // Readable (or closed) connections leave the idle set until answered.
+    idle.clear();
+    for (size_t index = 2; index < descriptors.size(); ++index) {
+      int connection = descriptors[index].fd;
+      if (descriptors[index].revents == 0) {
+        idle.push_back(connection);
+        continue;
+      }
+      pool.Push([connection, index_pointer, queue_pointer](int /* threadid */) {
+        ServeFrame(connection, index_pointer, queue_pointer);
+      });
+    }
+    if (descriptors[0].revents & POLLIN) {
+      int connection = accept(listener, nullptr, nullptr);
+      if (connection < 0) {
+        continue;
+      }
+      if (!SetStallTimeout(connection, FLAGS_timeout_ms)) {
+        close(connection);
+        continue;
+      }
+      idle.push_back(connection);
+    }
+  }
+  printf("[!] Shutting down.\n");
+  close(listener);
+  unlink(FLAGS_socket.c_str());
+  // Requests that were already read from are answered before the connections
+  // are closed.
+  pool.Stop(true);
+  queue.Collect(&idle);
+  for (int connection : idle) {
+    close(connection);
+  }
+}
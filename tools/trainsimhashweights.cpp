@@ -26,10 +26,13 @@
 
 #include "util/util.hpp"
 #include "learning/simhashtrainer.hpp"
+#include "searchbackend/hasherversion.hpp"
 
 DEFINE_string(data, "./data", "Data directory");
 DEFINE_string(weights, "weights.txt", "Feature weights file");
 DEFINE_uint64(train_steps, 500, "Number of training steps");
+DEFINE_string(hasher_version, "legacy", "Feature hash family of the training "
+  "data: legacy, portable or decoded");
 // The google namespace is there for compatibility with legacy gflags and will
 // be removed eventually.
 #ifndef gflags
@@ -59,12 +62,19 @@ int main(int argc, char** argv) {
     "source code for details regarding the data format in the data directory.");
   ParseCommandLineFlags(&argc, &argv, true);
 
+  HasherVersion hasher_version;
+  if (!ParseHasherVersion(FLAGS_hasher_version, &hasher_version)) {
+    printf("[!] Unknown hasher version %s\n", FLAGS_hasher_version.c_str());
+    return -1;
+  }
+
   printf("[!] Parsing training data.\n");
   std::string directory(FLAGS_data);
   std::string outputfile(FLAGS_weights);
   uint32_t train_steps = FLAGS_train_steps;
 
-  if(!TrainSimHashFromDataDirectory(directory, outputfile, true, train_steps)) {
+  if(!TrainSimHashFromDataDirectory(directory, outputfile, true, train_steps,
+    hasher_version)) {
     printf("[!] Training failed, exiting.\n");
     return -1;
   }
@@ -0,0 +1,215 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <unistd.h>
+#include <gflags/gflags.h>
+
+#include "learning/trainingdata.hpp"
+#include "searchbackend/buckettuner.hpp"
+#include "searchbackend/functionsimhash.hpp"
+#include "searchbackend/simhashsearchindex.hpp"
+#include "util/util.hpp"
+
+DEFINE_string(data, "./data", "Directory for sourcing data");
+DEFINE_string(weights, "weights.txt", "Feature weights file");
+DEFINE_string(index, "", "Optional index file to measure query cost against");
+DEFINE_uint64(max_buckets, 64, "Largest bucket count to evaluate");
+DEFINE_string(prefix_bits, "4,6,8,10,12", "Comma-separated prefix widths");
+DEFINE_double(target_recall, 0.95, "Minimum recall for a recommendation");
+DEFINE_string(write_index, "", "Create a new, empty index with the "
+  "recommended parameters in this file");
+DEFINE_string(hasher_version, "legacy", "Feature hash family of the new index "
+  "if no --index is given: legacy, portable or decoded");
+
+// The google namespace is there for compatibility with legacy gflags and will
+// be removed eventually.
+#ifndef gflags
+using namespace google;
+#else
+using namespace gflags;
+#endif
+
+using namespace std;
+
+// Calculates the SimHashes of the given functions from the training data in
+// one batch, using all cores.
+void HashTrainingFunctions(TrainingData* data, FunctionSimHasher* hasher,
+  const std::vector<uint32_t>& function_indices,
+  std::map<uint32_t, FeatureHash>* function_hashes) {
+  std::vector<std::vector<FeatureHash>> features(function_indices.size());
+  for (uint64_t index = 0; index < function_indices.size(); ++index) {
+    for (uint32_t feature : data->GetFunctions()->at(function_indices[index])) {
+      features[index].push_back(data->GetFeaturesVector()->at(feature));
+    }
+  }
+  std::vector<FunctionSimHasher::SimHash<128>> hashes(features.size());
+  hasher->CalculateFunctionSimHashes(features.data(), features.size(),
+    hashes.data(), std::max(1U, std::thread::hardware_concurrency()));
+  for (uint64_t index = 0; index < function_indices.size(); ++index) {
+    (*function_hashes)[function_indices[index]] =
+      std::make_pair(hashes[index][0], hashes[index][1]);
+  }
+}
+
+// The code expects the same data directory layout as evalsimhashweights, but
+// only makes use of functions.txt and attract.txt:
+//
+//  functions.txt - a text file formed by concatenating the output of the
+//                  functionfingerprints tool in verbose mode.
+//  attract.txt   - a file with pairs of [file_id]:[address] [file_id]:[address]
+//                  indicating which functions should be the same.
+//
+// Every attraction pair is treated as a query that should find its partner.
+// The population that determines query cost is either the content of the index
+// passed in via --index, or all functions from functions.txt.
+
+int main(int argc, char** argv) {
+  SetUsageMessage(
+    "Measure recall and query cost of the search index for different bucket "
+    "counts and prefix widths, and recommend the cheapest configuration that "
+    "reaches a target recall.");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  // The number of buckets is stored in a byte of each index entry.
+  if ((FLAGS_max_buckets == 0) || (FLAGS_max_buckets > 255)) {
+    printf("[!] The number of buckets has to be between 1 and 255\n");
+    return -1;
+  }
+  HasherVersion hasher_version;
+  if (!ParseHasherVersion(FLAGS_hasher_version, &hasher_version)) {
+    printf("[!] Unknown hasher version %s\n", FLAGS_hasher_version.c_str());
+    return -1;
+  }
+  if ((FLAGS_write_index != "") && (access(FLAGS_write_index.c_str(), F_OK)
+    == 0)) {
+    printf("[!] %s exists already, not overwriting it.\n",
+      FLAGS_write_index.c_str());
+    return -1;
+  }
+
+  TrainingData data(FLAGS_data);
+  if (!data.Load()) {
+    printf("[!] Failure to load the training data, exiting.\n");
+    return -1;
+  }
+  std::unique_ptr<SimHashSearchIndex> search_index;
+  if (FLAGS_index != "") {
+    search_index.reset(new SimHashSearchIndex(FLAGS_index,
+      SimHashSearchIndex::Access::kReadOnly));
+    hasher_version = search_index->GetHasherVersion();
+  }
+  // The pairs have to be hashed like the functions in the index.
+  FunctionSimHasher hasher(FLAGS_weights, default_features, default_logging,
+    FunctionSimHasher::kMnemonicDefaultWeight,
+    FunctionSimHasher::kGraphletDefaultWeight,
+    FunctionSimHasher::kImmediateDefaultWeight, hasher_version);
+
+  // Calculate the SimHashes of all functions that are part of a pair, and of
+  // all other functions if they make up the population.
+  std::vector<uint32_t> function_indices;
+  if (FLAGS_index != "") {
+    std::set<uint32_t> paired_functions;
+    for (const auto& pair : *data.GetAttractionSet()) {
+      paired_functions.insert(pair.first);
+      paired_functions.insert(pair.second);
+    }
+    function_indices.assign(paired_functions.begin(), paired_functions.end());
+  } else {
+    for (uint32_t index = 0; index < data.GetFunctions()->size(); ++index) {
+      function_indices.push_back(index);
+    }
+  }
+  std::map<uint32_t, FeatureHash> function_hashes;
+  HashTrainingFunctions(&data, &hasher, function_indices, &function_hashes);
+
+  std::vector<std::pair<FeatureHash, FeatureHash>> pairs;
+  for (const auto& pair : *data.GetAttractionSet()) {
+    pairs.push_back(std::make_pair(function_hashes[pair.first],
+      function_hashes[pair.second]));
+  }
+
+  std::vector<FeatureHash> population;
+  if (search_index) {
+    search_index->GetIndexedHashes(&population);
+  } else {
+    for (const auto& function_hash : function_hashes) {
+      population.push_back(function_hash.second);
+    }
+  }
+  printf("# Evaluating %ld pairs against a population of %ld functions.\n",
+    pairs.size(), population.size());
+
+  BucketTuner tuner(population, FLAGS_max_buckets);
+  std::vector<BucketConfiguration> candidates;
+  for (const std::string& width : Tokenize(FLAGS_prefix_bits.c_str(), ',')) {
+    uint32_t prefix_bits = strtoul(width.c_str(), nullptr, 10);
+    if ((prefix_bits == 0) || (prefix_bits > 64)) {
+      printf("[!] Ignoring invalid prefix width '%s'.\n", width.c_str());
+      continue;
+    }
+    std::vector<BucketConfiguration> results;
+    tuner.Evaluate(pairs, prefix_bits, &results);
+
+    // Write the results in gnuplot format.
+    printf("# Prefix width %d: buckets recall entries_scanned\n", prefix_bits);
+    for (const BucketConfiguration& result : results) {
+      printf("%d %f %f\n", result.buckets, result.recall,
+        result.entries_scanned);
+    }
+    printf("\n\n");
+    candidates.insert(candidates.end(), results.begin(), results.end());
+  }
+
+  BucketConfiguration best;
+  if (!BucketTuner::Recommend(candidates, FLAGS_target_recall, &best)) {
+    printf("# No configuration reaches a recall of %f.\n", FLAGS_target_recall);
+    return -1;
+  }
+  printf("# Recommended: %d buckets with %d-bit prefixes (recall %f, %f "
+    "entries scanned per query).\n", best.buckets, best.prefix_bits,
+    best.recall, best.entries_scanned);
+
+  // Compare with the parameters the index was built with.
+  if (search_index) {
+    uint32_t buckets = search_index->GetNumberOfBuckets();
+    uint32_t prefix_bits = search_index->GetPrefixBits();
+    if ((buckets == best.buckets) && (prefix_bits == best.prefix_bits)) {
+      printf("# The index already uses the recommended parameters.\n");
+    } else {
+      printf("# The index uses %d buckets with %d-bit prefixes", buckets,
+        prefix_bits);
+      for (const BucketConfiguration& candidate : candidates) {
+        if ((candidate.buckets == buckets) &&
+          (candidate.prefix_bits == prefix_bits)) {
+          printf(" (recall %f, %f entries scanned per query)",
+            candidate.recall, candidate.entries_scanned);
+        }
+      }
+      printf("; the parameters of an index cannot be changed, recreate it "
+        "with --write_index.\n");
+    }
+  }
+  if (FLAGS_write_index != "") {
+    SimHashSearchIndex new_index(FLAGS_write_index, true, best.buckets,
+      best.prefix_bits, hasher_version);
+    printf("# Created %s with the recommended parameters and the %s hasher.\n",
+      FLAGS_write_index.c_str(), HasherVersionName(hasher_version));
+  }
+}
@@ -32,4 +32,12 @@ inline uint64_t getLow64(__uint128_t val) {
   return val;
 }
 
+// Returns a mask that keeps the top prefix_bits of a 64-bit value.
+inline uint64_t PrefixMask(uint32_t prefix_bits) {
+  if (prefix_bits >= 64) {
+    return ~0ULL;
+  }
+  return ~(~0ULL >> prefix_bits);
+}
+
 #endif // BITPERMUTATION_HPP
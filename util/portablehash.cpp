@@ -0,0 +1,48 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+
+#include "util/portablehash.hpp"
+
+namespace {
+
+// Assembled byte by byte so that the result does not depend on the byte order
+// of the machine; compilers turn this into a single load on little-endian CPUs.
+inline uint64_t ReadLittleEndian64(const uint8_t* bytes) {
+  uint64_t value = 0;
+  for (int index = 7; index >= 0; --index) {
+    value = (value << 8) | bytes[index];
+  }
+  return value;
+}
+
+} // namespace
+
+uint64_t PortableHashBytes(const void* data, uint64_t length, uint64_t seed) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  seed ^= PortableMix(seed ^ kPortableHashSecret[0], kPortableHashSecret[1]);
+  uint64_t remaining = length;
+  while (remaining > 16) {
+    seed = PortableMix(ReadLittleEndian64(bytes) ^ kPortableHashSecret[1],
+      ReadLittleEndian64(bytes + 8) ^ seed);
+    bytes += 16;
+    remaining -= 16;
+  }
+  uint8_t tail[16] = {};
+  memcpy(tail, bytes, remaining);
+  return PortableMix(kPortableHashSecret[1] ^ length,
+    PortableMix(ReadLittleEndian64(tail) ^ kPortableHashSecret[1],
+      ReadLittleEndian64(tail + 8) ^ seed));
+}
@@ -0,0 +1,61 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PORTABLEHASH_HPP
+#define PORTABLEHASH_HPP
+
+#include <cstdint>
+
+// A small hash family in the style of wyhash, for hash values that are stored
+// on disk or compared between machines. It is fully specified in terms of
+// 64-bit integer arithmetic and little-endian byte order, so the values are
+// the same on every platform and with every compiler and standard library,
+// unlike those of std::hash.
+//
+// The building block is PortableMix: The 128-bit product of two words, folded
+// to 64 bits by XOR of its halves. A 64x64-bit multiplication takes a few
+// cycles and spreads every input bit over the output, and independent mixes
+// can be in flight at the same time.
+//
+// PortableHashBytes(data, length, seed):
+//   seed ^= PortableMix(seed ^ S0, S1)
+//   while more than 16 bytes are left:
+//     seed = PortableMix(Read64(data) ^ S1, Read64(data + 8) ^ seed)
+//     data += 16
+//   a, b = Read64 of the remaining (up to 16) bytes, padded with zeroes
+//   return PortableMix(S1 ^ length, PortableMix(a ^ S1, b ^ seed))
+//
+// Read64 reads 8 bytes in little-endian order; S0 and S1 are the first two
+// secrets below.
+constexpr uint64_t kPortableHashSecret[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+
+inline uint64_t PortableMix(uint64_t a, uint64_t b) {
+  __uint128_t product = static_cast<__uint128_t>(a) * b;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+uint64_t PortableHashBytes(const void* data, uint64_t length, uint64_t seed);
+
+// The same value as PortableHashBytes over the 16 bytes of a and b in little-
+// endian order. With a constant seed, the seed preparation folds away and this
+// is two multiplications.
+inline uint64_t PortableHashWords(uint64_t a, uint64_t b, uint64_t seed) {
+  seed ^= PortableMix(seed ^ kPortableHashSecret[0], kPortableHashSecret[1]);
+  return PortableMix(kPortableHashSecret[1] ^ 16,
+    PortableMix(a ^ kPortableHashSecret[1], b ^ seed));
+}
+
+#endif // PORTABLEHASH_HPP
@@ -0,0 +1,62 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <set>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "util/portablehash.hpp"
+
+uint64_t HashString(const std::string& data, uint64_t seed) {
+  return PortableHashBytes(data.c_str(), data.size(), seed);
+}
+
+// The values are part of the on-disk format of indices and weights files built
+// with the portable hasher, so they must never change. They were computed with
+// an independent implementation of the algorithm described in the header.
+TEST(portablehash, known_answers) {
+  EXPECT_EQ(HashString("", 0), 0x146a6b2ea9984c76ULL);
+  EXPECT_EQ(HashString("mov", 0), 0xecd3c77e594ff2d5ULL);
+  EXPECT_EQ(HashString("mov", 1), 0xfd18030675fab05cULL);
+  EXPECT_EQ(HashString("The quick brown fox jumps over the lazy dog", 0x1234),
+    0x2d81f37836b846e8ULL);
+}
+
+TEST(portablehash, words_match_bytes) {
+  uint64_t a = 0x0123456789abcdefULL;
+  uint64_t b = 0xfedcba9876543210ULL;
+  uint8_t bytes[16];
+  for (int index = 0; index < 8; ++index) {
+    bytes[index] = static_cast<uint8_t>(a >> (8 * index));
+    bytes[index + 8] = static_cast<uint8_t>(b >> (8 * index));
+  }
+  for (uint64_t seed : { 0ULL, 1ULL, 0xdeadbeefULL }) {
+    EXPECT_EQ(PortableHashWords(a, b, seed), PortableHashBytes(bytes, 16, seed));
+  }
+}
+
+TEST(portablehash, no_collisions_among_small_inputs) {
+  std::set<uint64_t> hashes;
+  for (uint64_t a = 0; a < 256; ++a) {
+    for (uint64_t b = 0; b < 256; ++b) {
+      hashes.insert(PortableHashWords(a, b, 7));
+    }
+  }
+  EXPECT_EQ(hashes.size(), 256 * 256);
+  // Zero-padding must not make inputs of different lengths collide.
+  uint8_t zeroes[32] = {};
+  EXPECT_NE(PortableHashBytes(zeroes, 3, 0), PortableHashBytes(zeroes, 4, 0));
+  EXPECT_NE(PortableHashBytes(zeroes, 16, 0), PortableHashBytes(zeroes, 17, 0));
+}
@@ -57,6 +57,55 @@ template <typename T> class SynchronizedQueue {
     std::mutex mutex_;
 };
 
+// Synchronized queue with a maximum size, used to connect the stages of a
+// pipeline. Push() blocks while the queue is full, so a slow consumer throttles
+// its producers instead of letting the queue grow without bounds. After Close()
+// has been called, Push() fails and Pop() fails once the queue has drained.
+template <typename T> class BoundedQueue {
+  public:
+    BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {};
+    bool Push(T value) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this]() {
+        return closed_ || queue_.size() < capacity_; });
+      if (closed_) {
+        return false;
+      }
+      queue_.push(std::move(value));
+      not_empty_.notify_one();
+      return true;
+    }
+    bool Pop(T* value) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return false;
+      }
+      *value = std::move(queue_.front());
+      queue_.pop();
+      not_full_.notify_one();
+      return true;
+    }
+    void Close() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      not_full_.notify_all();
+      not_empty_.notify_all();
+    }
+    size_t Size() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return queue_.size();
+    }
+    size_t GetCapacity() const { return capacity_; }
+  private:
+    const size_t capacity_;
+    bool closed_;
+    std::queue<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
 class ThreadPool {
   public:
     ThreadPool() { Init(); };
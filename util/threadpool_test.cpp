@@ -0,0 +1,102 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "util/threadpool.hpp"
+
+TEST(threadpool, boundedqueue_fifo_and_close) {
+  threadpool::BoundedQueue<uint32_t> queue(4);
+  for (uint32_t index = 0; index < 4; ++index) {
+    EXPECT_TRUE(queue.Push(index));
+  }
+  EXPECT_EQ(queue.Size(), 4);
+  queue.Close();
+  // Closed queues reject new elements but still hand out the remaining ones.
+  EXPECT_FALSE(queue.Push(4));
+  uint32_t value;
+  for (uint32_t index = 0; index < 4; ++index) {
+    ASSERT_TRUE(queue.Pop(&value));
+    EXPECT_EQ(value, index);
+  }
+  EXPECT_FALSE(queue.Pop(&value));
+}
+
+// Spins until 'counter' reaches 'value'; gives up after a few seconds so that
+// a broken queue fails the test instead of hanging it.
+static bool WaitForCount(const std::atomic<uint32_t>& counter, uint32_t value) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (counter.load() < value) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+TEST(threadpool, boundedqueue_blocks_when_full) {
+  const uint32_t capacity = 2;
+  threadpool::BoundedQueue<uint32_t> queue(capacity);
+  std::atomic<uint32_t> pushed(0);
+  std::thread producer([&queue, &pushed]() {
+    for (uint32_t index = 0; index < 10; ++index) {
+      queue.Push(index);
+      ++pushed;
+    }
+  });
+  // The producer fills the queue and then has to wait for the consumer.
+  ASSERT_TRUE(WaitForCount(pushed, capacity));
+  EXPECT_LE(pushed.load(), capacity);
+
+  uint32_t value;
+  uint32_t popped = 0;
+  ASSERT_TRUE(queue.Pop(&value));
+  EXPECT_EQ(value, 0);
+  ++popped;
+  // Each pop frees exactly one slot.
+  ASSERT_TRUE(WaitForCount(pushed, capacity + popped));
+  EXPECT_LE(pushed.load(), capacity + popped);
+
+  for (uint32_t index = 1; index < 10; ++index) {
+    ASSERT_TRUE(queue.Pop(&value));
+    EXPECT_EQ(value, index);
+    ++popped;
+    EXPECT_LE(pushed.load(), capacity + popped);
+  }
+  producer.join();
+  EXPECT_EQ(pushed.load(), 10);
+}
+
+TEST(threadpool, boundedqueue_close_wakes_consumers) {
+  threadpool::BoundedQueue<uint32_t> queue(2);
+  std::atomic<uint32_t> finished(0);
+  std::vector<std::thread> consumers;
+  for (uint32_t index = 0; index < 4; ++index) {
+    consumers.emplace_back([&queue, &finished]() {
+      uint32_t value;
+      while (queue.Pop(&value)) {}
+      ++finished;
+    });
+  }
+  queue.Push(1);
+  queue.Close();
+  for (std::thread& consumer : consumers) {
+    consumer.join();
+  }
+  EXPECT_EQ(finished.load(), 4);
+}
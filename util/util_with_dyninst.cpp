@@ -41,8 +41,8 @@ FeatureHash GetHashForFileAndFunction(FunctionSimHasher& hasher,
     disassembly.GetFlowgraphWithInstructions(index);
   std::unique_ptr<FunctionFeatureGenerator> generator =
     disassembly.GetFeatureGenerator(index);
-  std::vector<uint64_t> hashes;
-  hasher.CalculateFunctionSimHash(generator.get(), 128, &hashes, feature_hashes);
-  return std::make_pair(hashes.at(0), hashes.at(1));
+  FunctionSimHasher::SimHash<128> hashes;
+  hasher.CalculateFunctionSimHash<128>(generator.get(), &hashes, feature_hashes);
+  return std::make_pair(hashes[0], hashes[1]);
 }
 